@@ -18,162 +18,372 @@
     along with this program.  If not, see <https://www.gnu.org/licenses/>.
 */
 
+#include <locale.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/types.h>
-#include "src/dtypes.h"
-#include "src/io_utils.h"
-#include "src/hash_table.h"
-
-#define BUFSIZE 256
-
-typedef struct {
-    double min, max, mean;
-    size_t num_lines;
-} Stats;
-
-void stats_init(Stats** statrow, double min, double max, double mean) {
-    if (statrow==NULL) return;
-    *statrow = (Stats*)malloc(sizeof(Stats));
-    (*statrow)->min = min;
-    (*statrow)->max = max;
-    (*statrow)->mean = mean;
-    (*statrow)->num_lines = 1;
-}
+#include "src/analyzer.h"
+#include "src/catalog.h"
+#include "src/run_stats.h"
+#include "src/perf_counters.h"
+#include "src/follow.h"
+#include "src/args.h"
+#include "src/autotune.h"
+#include "src/output.h"
+#include "src/trace.h"
+#include "src/sample.h"
+#include "src/gzip_input.h"
+#include "src/stream_input.h"
 
-void stats_print(Stats* statrow) {
-    if (statrow==NULL) return;
-    printf("=%.1f/%.1f/%.1f\n", statrow->min, statrow->max, statrow->mean);
-}
+#define OPTION_STATS 1000
+#define OPTION_PERF 1001
+#define OPTION_TABLE_CAPACITY 1002
+#define OPTION_PARTITIONS 1003
+#define OPTION_QUANTILES 1004
+#define OPTION_MAX_MEMORY 1005
+#define OPTION_SPILL_DIR 1006
+#define OPTION_FOLLOW 1007
+#define OPTION_SNAPSHOT_SECONDS 1008
+#define OPTION_SNAPSHOT_ROWS 1009
+#define OPTION_SNAPSHOT 1010
+#define OPTION_TUNE 1011
+#define OPTION_PROFILE 1012
+#define OPTION_BATCH 1013
+#define OPTION_FORMAT 1014
+#define OPTION_SORT 1015
+#define OPTION_TRACE 1016
+#define OPTION_SAMPLE 1017
 
-void* datarow_to_statsnode(DataRow* row) {
-    if (row==NULL) return NULL;
-    
-    Stats* statrow;
-    stats_init(&statrow, row->temperature, row->temperature, row->temperature);
-    return (void*)statrow;
-}
+/// Program options
+static struct argp_option options[] = {
+    {"catalog", 'c', "CATALOG_PATH", 0, "Station catalog (binary or weather_stations.txt) whose station IDs are used for aggregation"},
+    {"threads", 't', "NUM_THREADS", 0, "Number of worker threads (default: one per CPU available to the process, within its cgroup quota)"},
+    {"stats", OPTION_STATS, "json", OPTION_ARG_OPTIONAL, "Print per-phase timings and counters to stderr, as JSON if 'json' is given (needs a build with ONEBRC_STATS)"},
+    {"table", 'm', "private|shared|partitioned", 0, "Aggregate into one table per thread merged at the end (default), into one lock-free table shared by all threads, or scatter rows into hash partitions first and aggregate one partition at a time"},
+    {"table_capacity", OPTION_TABLE_CAPACITY, "SLOTS", 0, "Number of slots of the shared table (default 4194304); at most 90% of them can be used"},
+    {"partitions", OPTION_PARTITIONS, "N", 0, "Number of partitions the partitioned mode starts with, rounded up to a power of two and split further while their tables outgrow half of the L2 cache (default 256, or tuned)"},
+    {"quantiles", OPTION_QUANTILES, "LIST", OPTION_ARG_OPTIONAL, "Also print these comma-separated quantiles of every station, such as 0.5,0.95,0.99 (the default), computed from per-station histograms with 0.1 degree bins"},
+    {"max_memory_mb", OPTION_MAX_MEMORY, "MB", 0, "Memory budget of the private tables; beyond it workers spill sorted partial aggregates to disk, merged back per hash partition at the end (default: unlimited)"},
+    {"spill_dir", OPTION_SPILL_DIR, "DIR", 0, "Directory of the spill files of --max_memory_mb (default: $TMPDIR or /tmp)"},
+    {"follow", OPTION_FOLLOW, 0, 0, "Keep aggregating the lines appended to the file, woken up by inotify, and publish snapshots until the file is removed"},
+    {"snapshot_seconds", OPTION_SNAPSHOT_SECONDS, "SECONDS", 0, "With --follow, publish a snapshot when this many seconds passed since the last one (default 1, 0 disables)"},
+    {"snapshot_rows", OPTION_SNAPSHOT_ROWS, "ROWS", 0, "With --follow, publish a snapshot when this many rows were added since the last one (default 0, disabled)"},
+    {"format", OPTION_FORMAT, "lines|official|csv|json|binary", 0, "Print the results as 'name=min/max/mean' lines after the rows and stations covered (default), as the single '{name=min/max/mean, ...}' line of the challenge, as CSV or JSON with counts, or as exact binary aggregates"},
+    {"sort", OPTION_SORT, "bytes|locale|none", 0, "Order stations by the bytes of their names (default), by the collation of the locale set by LC_COLLATE or LANG, or not at all"},
+    {"snapshot", OPTION_SNAPSHOT, "PATH", 0, "With --follow, atomically replace this file with every snapshot instead of printing it"},
+    {"batch", OPTION_BATCH, "N", 0, "Parse this many rows and prefetch their table slots before looking any of them up (default 16, or tuned; 1 looks up every row as it is parsed)"},
+    {"trace", OPTION_TRACE, "PATH", 0, "Record when every phase, task and chunk ran on which thread and write the timeline to PATH as Chrome trace JSON at exit, for chrome://tracing or Perfetto"},
+    {"sample", OPTION_SAMPLE, "FRACTION", 0, "Read about this fraction of the file as one random line-aligned block from each of many equal strata, and print the mean of every station with its 95% confidence interval, the min and max sampled, and which stations may be missing"},
+    {"perf", OPTION_PERF, 0, 0, "Print IPC and cache, branch and TLB misses per row of every phase and thread to stderr, read from the hardware counters"},
+    {"tune", OPTION_TUNE, 0, 0, "Choose the thread count, chunk size, partitions and batch width by timing runs on a sample of the input first"},
+    {"profile", OPTION_PROFILE, "PATH", 0, "Use the settings tuned for this host saved in PATH, tuning and saving them first if PATH is missing, was tuned on another host or --tune is given"},
+    {0}
+};
 
-size_t myhash(void* key, hash_table_t* table) {
-    if (table==NULL) {
-        fprintf(stderr, "hash table pointer is null.\n");
-        exit(1);
-    }
-    String* row = (String*)key;
-    if (row==NULL) {
-        fprintf(stderr, "key pointer is null.\n");
-        exit(1);
-    }
-    size_t hash = 0;
-    for (size_t i=0; i<row->length; ++i) {
-        hash += hash * 97 + (size_t)row->data[i];
-    }
+// Argp argument parser configuration
+const char* argp_program_version = "v.0.0.1";
+const char* argp_program_bug_address = "the issue tracker at https://github.com/debajyotid2/one-billion-row-challenge.git";
 
-    return hash % ht_capacity(table);
-}
+static char doc[] = "Calculates the min, max and mean temperature of every station in a measurements file, or in measurements piped to stdin when the file is -";
+static char args_doc[] = "MEASUREMENTS_FILE";
 
-size_t djb2(void* key, hash_table_t* table) {
-    if (table==NULL) {
-        fprintf(stderr, "hash table pointer is null.\n");
-        exit(1);
-    }
-    String* row = (String*)key;
-    if (row==NULL) {
-        fprintf(stderr, "key pointer is null.\n");
-        exit(1);
+/// Parse a comma-separated list of quantiles between 0 and 1
+static void _parse_quantiles(struct analyze_arguments* arguments, const char* list, struct argp_state* state) {
+    arguments->num_quantiles = 0;
+    const char* p = list;
+    while (*p != '\0') {
+        char* end;
+        double quantile = strtod(p, &end);
+        if (end == p || quantile < 0.0 || quantile > 1.0 || (*end != ',' && *end != '\0'))
+            argp_error(state, "quantiles must be comma-separated numbers between 0 and 1, not '%s'", list);
+        if (arguments->num_quantiles == ANALYZE_MAX_QUANTILES)
+            argp_error(state, "at most %d quantiles can be reported", ANALYZE_MAX_QUANTILES);
+        arguments->quantiles[arguments->num_quantiles++] = quantile;
+        p = *end == ',' ? end + 1: end;
     }
-    size_t hash = 5381;
-    for (size_t i=0; i<row->length; ++i) {
-        hash = ((hash << 5) + hash) + (size_t)row->data[i];
-    }
-
-    return hash % ht_capacity(table);
 }
 
-void print_stats(hash_table_t* table) {
-    if (table==NULL) return;
-    for (size_t i=0; i<ht_capacity(table); ++i) {
-        KeyValuePair kv = ht_at_index(table, i);
-        String* key = (String*)kv.key;
-        Stats* value = (Stats*)kv.value;
-        if (key==NULL) continue;
-        if (value==NULL) continue;
-        string_print(key);
-        stats_print(value);
-    }
-}
+/// Function to parse arguments option by option
+static error_t parse_opt(int key, char* arg, struct argp_state* state) {
+    struct analyze_arguments *arguments = (struct analyze_arguments*)(state->input);
 
-bool key_equal(void* key1, void* key2) {
-    if (key1==NULL || key2==NULL) {
-        fprintf(stderr, "null pointer given.\n");
-        exit(1);
+    switch (key) {
+        case 'c':
+            strncpy(arguments->catalog_path, arg, sizeof(arguments->catalog_path) - 1);
+            break;
+        case 't':
+            arguments->num_threads = strtoul(arg, NULL, 10);
+            if (arguments->num_threads == 0)
+                argp_error(state, "number of threads must be positive");
+            break;
+        case OPTION_STATS:
+            if (!ONEBRC_STATS)
+                argp_error(state, "--stats needs a build configured with -DONEBRC_STATS=ON");
+            if (arg != NULL && strcmp(arg, "json") != 0)
+                argp_error(state, "unknown --stats format '%s'", arg);
+            arguments->stats = true;
+            arguments->stats_json = arg != NULL;
+            break;
+        case 'm':
+            if (strcmp(arg, "private") == 0)
+                arguments->table_mode = ANALYZE_PRIVATE;
+            else if (strcmp(arg, "shared") == 0)
+                arguments->table_mode = ANALYZE_SHARED;
+            else if (strcmp(arg, "partitioned") == 0)
+                arguments->table_mode = ANALYZE_PARTITIONED;
+            else
+                argp_error(state, "table must be private, shared or partitioned");
+            break;
+        case OPTION_PARTITIONS:
+            arguments->num_partitions = strtoul(arg, NULL, 10);
+            if (arguments->num_partitions < 2)
+                argp_error(state, "number of partitions must be at least 2");
+            break;
+        case OPTION_BATCH:
+            arguments->batch_width = strtoul(arg, NULL, 10);
+            if (arguments->batch_width == 0 || arguments->batch_width > ANALYZER_MAX_BATCH_WIDTH)
+                argp_error(state, "batch width must be between 1 and %d", ANALYZER_MAX_BATCH_WIDTH);
+            break;
+        case OPTION_FORMAT: {
+            OutputFormat format = OUTPUT_LINES;
+            if (!output_parse_format(arg, &format))
+                argp_error(state, "format must be lines, official, csv, json or binary");
+            arguments->output_format = format;
+            break;
+        }
+        case OPTION_SORT: {
+            OutputOrder order = OUTPUT_SORT_BYTES;
+            if (!output_parse_order(arg, &order))
+                argp_error(state, "sort order must be bytes, locale or none");
+            arguments->output_order = order;
+            break;
+        }
+        case OPTION_TABLE_CAPACITY:
+            arguments->table_capacity = strtoul(arg, NULL, 10);
+            if (arguments->table_capacity == 0)
+                argp_error(state, "table capacity must be positive");
+            break;
+        case OPTION_QUANTILES:
+            _parse_quantiles(arguments, arg == NULL ? "0.5,0.95,0.99": arg, state);
+            break;
+        case OPTION_MAX_MEMORY:
+            arguments->max_memory_mb = strtoul(arg, NULL, 10);
+            if (arguments->max_memory_mb == 0)
+                argp_error(state, "memory budget must be positive");
+            break;
+        case OPTION_SPILL_DIR:
+            strncpy(arguments->spill_dir, arg, sizeof(arguments->spill_dir) - 1);
+            break;
+        case OPTION_FOLLOW:
+            arguments->follow = true;
+            break;
+        case OPTION_SNAPSHOT_SECONDS:
+            arguments->snapshot_seconds = strtod(arg, NULL);
+            if (arguments->snapshot_seconds < 0)
+                argp_error(state, "snapshot interval cannot be negative");
+            break;
+        case OPTION_SNAPSHOT_ROWS:
+            arguments->snapshot_rows = strtoul(arg, NULL, 10);
+            break;
+        case OPTION_SNAPSHOT:
+            strncpy(arguments->snapshot_path, arg, sizeof(arguments->snapshot_path) - 1);
+            break;
+        case OPTION_PERF:
+            arguments->perf = true;
+            break;
+        case OPTION_TUNE:
+            arguments->tune = true;
+            break;
+        case OPTION_PROFILE:
+            strncpy(arguments->profile_path, arg, sizeof(arguments->profile_path) - 1);
+            break;
+        case OPTION_SAMPLE:
+            arguments->sample_fraction = strtod(arg, NULL);
+            if (!(arguments->sample_fraction > 0.0 && arguments->sample_fraction <= 1.0))
+                argp_error(state, "sampled fraction must be greater than 0 and at most 1");
+            break;
+        case OPTION_TRACE:
+            strncpy(arguments->trace_path, arg, sizeof(arguments->trace_path) - 1);
+            break;
+        case ARGP_KEY_ARG:
+            if (state->arg_num >= 1)
+                argp_usage(state);
+            strncpy(arguments->input_path, arg, sizeof(arguments->input_path) - 1);
+            break;
+        case ARGP_KEY_END:
+            if (state->arg_num < 1)
+                argp_usage(state);
+            if (arguments->num_quantiles > 0 && arguments->table_mode == ANALYZE_SHARED)
+                argp_error(state, "quantiles are not supported with the shared table");
+            if (arguments->max_memory_mb > 0 && arguments->table_mode != ANALYZE_PRIVATE)
+                argp_error(state, "a memory budget needs private tables");
+            if (arguments->max_memory_mb > 0 && arguments->num_quantiles > 0)
+                argp_error(state, "quantiles are not supported with a memory budget");
+            if (arguments->follow && (arguments->stats || arguments->perf || arguments->max_memory_mb > 0))
+                argp_error(state, "--follow does not support --stats, --perf or a memory budget");
+            if (arguments->sample_fraction > 0.0 && (arguments->follow || arguments->table_mode != ANALYZE_PRIVATE
+                                                     || arguments->max_memory_mb > 0))
+                argp_error(state, "--sample needs private tables and supports neither --follow nor a memory budget");
+            if (!arguments->follow && (arguments->table_mode != ANALYZE_PRIVATE || arguments->max_memory_mb > 0)
+                && stream_input_required(arguments->input_path))
+                argp_error(state, "input read from stdin or a pipe is aggregated into private tables and supports no memory budget");
+            if (!arguments->follow && (arguments->table_mode != ANALYZE_PRIVATE || arguments->max_memory_mb > 0)
+                && gzip_file_is_compressed(arguments->input_path))
+                argp_error(state, "compressed input is aggregated into private tables and supports no memory budget");
+            if (arguments->follow && arguments->snapshot_seconds == 0 && arguments->snapshot_rows == 0)
+                argp_error(state, "--follow needs a snapshot interval in seconds or rows");
+            break;
+        default:
+            return ARGP_ERR_UNKNOWN;
     }
-    return string_equal((String*)key1, (String*)key2);
+    return 0;
 }
 
+// Argument parser
+static struct argp argparser = {options, parse_opt, args_doc, doc};
+
 int main(int argc, char** argv) {
-    if (argc!=2) {
-        fprintf(stderr, "Usage: %s <path to measurements txt file>\n", argv[0]);
-        return EXIT_FAILURE;
+    struct analyze_arguments arg_vals;
+
+    // Parse arguments
+    init_analyze_arguments(&arg_vals);
+    argp_parse(&argparser, argc, argv, 0, 0, &arg_vals);
+    if (arg_vals.trace_path[0] != '\0')
+        trace_start(arg_vals.trace_path, "analyze");
+
+    // Stations in the catalog are aggregated by their dense ID,
+    // everything else goes through the hash table
+    StationCatalog catalog;
+    bool use_catalog = arg_vals.catalog_path[0] != '\0';
+    if (use_catalog)
+        catalog_load(&catalog, arg_vals.catalog_path);
+
+    AnalyzerConfig config;
+    analyzerconfig_init(&config);
+    config.catalog = use_catalog ? &catalog: NULL;
+    config.table_mode = arg_vals.table_mode == ANALYZE_SHARED ? ANALYZER_SHARED_TABLE:
+                        arg_vals.table_mode == ANALYZE_PARTITIONED ? ANALYZER_PARTITIONED: ANALYZER_PRIVATE_TABLES;
+    config.shared_capacity = arg_vals.table_capacity;
+    config.histograms = arg_vals.num_quantiles > 0 || arg_vals.sample_fraction > 0.0;
+    config.max_memory = arg_vals.max_memory_mb << 20;
+    const char* tmpdir = getenv("TMPDIR");
+    config.spill_directory = arg_vals.spill_dir[0] != '\0' ? arg_vals.spill_dir: tmpdir != NULL ? tmpdir: "/tmp";
+
+    // Settings come from the host, a saved profile or a calibration on the
+    // input, and are overridden by those given explicitly
+    HostInfo host;
+    hostinfo_detect(&host);
+    if (host.l2_size > 0)
+        config.partition_table_bytes = host.l2_size / 2;
+    TuneProfile profile;
+    tuneprofile_init(&profile, &host);
+    bool use_profile = arg_vals.profile_path[0] != '\0';
+    if (arg_vals.tune || use_profile) {
+        bool loaded = !arg_vals.tune && use_profile && tuneprofile_load(&profile, arg_vals.profile_path) &&
+                      tuneprofile_matches(&profile, &host);
+        if (!loaded) {
+            tuneprofile_init(&profile, &host);
+            uint64_t trace_tune = trace_begin();
+            bool calibrated = autotune_calibrate_file(arg_vals.input_path, &config, &host, &profile);
+            trace_end("tune", trace_tune);
+            if (!calibrated)
+                fprintf(stderr, "Input cannot be sampled for tuning, using one thread per CPU.\n");
+            if (use_profile)
+                tuneprofile_save(&profile, &host, arg_vals.profile_path);
+        }
+        tuneprofile_print(&profile, stderr);
     }
+    tuneprofile_apply(&profile, &config);
+    if (arg_vals.num_threads > 0)
+        config.num_threads = arg_vals.num_threads;
+    if (arg_vals.num_partitions > 0)
+        config.num_partitions = arg_vals.num_partitions;
+    if (arg_vals.batch_width > 0)
+        config.batch_width = arg_vals.batch_width;
 
-    FILE* infile = fopen(argv[1], "r");
+    OutputConfig output;
+    outputconfig_init(&output);
+    output.format = (OutputFormat)arg_vals.output_format;
+    output.order = (OutputOrder)arg_vals.output_order;
+    output.quantiles = arg_vals.quantiles;
+    output.num_quantiles = arg_vals.num_quantiles;
+    output.num_threads = config.num_threads;
+    if (arg_vals.sample_fraction > 0.0)
+        output.interval_z = SAMPLE_Z95;
+    if (output.order == OUTPUT_SORT_LOCALE)
+        setlocale(LC_COLLATE, "");
 
-    if (!infile) {
-        fprintf(stderr, "Error reading file %s\n", argv[1]);
-        return EXIT_FAILURE;
+    if (arg_vals.follow) {
+        FollowConfig follow;
+        followconfig_init(&follow);
+        follow.interval_seconds = arg_vals.snapshot_seconds;
+        follow.interval_rows = arg_vals.snapshot_rows;
+        follow.snapshot_path = arg_vals.snapshot_path[0] != '\0' ? arg_vals.snapshot_path: NULL;
+        follow.output = output;
+        follow_file(arg_vals.input_path, &config, &follow);
+        if (use_catalog)
+            catalog_destroy(&catalog);
+        return EXIT_SUCCESS;
     }
 
-    char buf[BUFSIZE] = {'\0'};
+    PerfReport perf;
+    if (arg_vals.perf) {
+        perfreport_init(&perf, config.num_threads);
+        config.perf = &perf;
+    }
 
-    hash_table_t* cities;
-    size_t num_collisions = 0;
-    hash_function hashfunc = &myhash; 
-    ht_init(&cities, 50000, hashfunc, key_equal);
-    
-    unsigned long num_lines = 0;
-    bool table_full = false;
-    while (fgets(buf, BUFSIZE * sizeof(char), infile) && !table_full) {
-        num_lines++;
-        DataRow* row = (DataRow*)malloc(sizeof(DataRow));
-        *row = parse_single_row(buf);
-        void* value = datarow_to_statsnode(row);
-
-        if (!ht_insert(cities, row->location, value)) {
-            if (ht_size(cities) >= ht_capacity(cities)) {
-                table_full = true;
-            }
-            KeyValuePair kv = ht_at(cities, row->location);
-            Stats* stats = (Stats*)kv.value;
-            
-            stats->min = stats->min > row->temperature ? row->temperature: stats->min;
-            stats->max = stats->max < row->temperature ? row->temperature: stats->max;                                               
-            stats->mean = (stats->mean * (double)stats->num_lines + row->temperature) / (double)(stats->num_lines + 1.0);
-            stats->num_lines++;
-            
-            string_destroy(*(row->location));
-            free(row->location);
-            free(value);
+    RunStats stats;
+    RunStats* run_stats = NULL;
+    if (arg_vals.stats) {
+        runstats_init(&stats, config.num_threads);
+        run_stats = &stats;
+    }
+
+    Aggregator result;
+    uint64_t trace_phase = trace_begin();
+    if (arg_vals.sample_fraction > 0.0) {
+        SampleSummary summary;
+        if (!sample_file(arg_vals.input_path, arg_vals.sample_fraction, SAMPLE_DEFAULT_SEED, &config, &result, &summary)) {
+            fprintf(stderr, "Error: only an uncompressed regular file can be sampled, not %s\n", arg_vals.input_path);
+            exit(EXIT_FAILURE);
         }
-        free(row);
+        samplesummary_print(&summary, &result, stderr);
+    } else {
+        analyze_file(arg_vals.input_path, &config, &result, run_stats);
     }
-    
-    fclose(infile);
+    trace_end("analyze", trace_phase);
 
-    printf("Lines of input file covered: %zu\n", num_lines);
-    printf("Size: %zu, capacity: %zu, num_collisions: %zu\n", ht_size(cities), ht_capacity(cities), num_collisions);
-    
-    print_stats(cities);
-
-    for (size_t i=0; i<ht_capacity(cities); ++i) {
-        KeyValuePair kv = ht_at_index(cities, i);
-        if (kv.key == NULL) continue;
-        string_destroy(*(String*)(kv.key));
-        free(kv.key);
-        free(kv.value);
+    double output_start = stats_now();
+    PerfCounters counters;
+    bool count = arg_vals.perf && perf_counters_open(&counters, false);
+    if (count)
+        perf_counters_start(&counters);
+
+    trace_phase = trace_begin();
+    if (!output_write(&result, &output, stdout)) {
+        perror("Error: could not write results");
+        exit(EXIT_FAILURE);
+    }
+    trace_end("output", trace_phase);
+
+    if (count) {
+        perf_counters_stop(&counters, perfreport_phase(&perf, "output"));
+        perf_counters_close(&counters);
     }
-    ht_destroy(cities);
-    free(cities);
+    if (arg_vals.perf) {
+        perfreport_print(&perf, stderr);
+        perfreport_destroy(&perf);
+    }
+
+    if (run_stats != NULL) {
+        stats.phase_seconds[PHASE_OUTPUT] = stats_now() - output_start;
+        runstats_print(&stats, stderr, arg_vals.stats_json);
+        runstats_destroy(&stats);
+    }
+
+    aggregator_destroy(&result);
+    if (use_catalog)
+        catalog_destroy(&catalog);
     
     return EXIT_SUCCESS;
 }
@@ -18,72 +18,108 @@
     along with this program.  If not, see <https://www.gnu.org/licenses/>.
 */
 
+#include <argp.h>
 #include <cstdio>
-#include <fstream>
-#include <unordered_map>
-
-#define DELIM ";"
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "src/engine.hpp"
+#include "src/pipeline.hpp"
+
+// Command line arguments
+struct cpp_analyze_arguments {
+    std::vector<std::string> input_paths;
+    std::string engine = onebrc::DEFAULT_ENGINE;
+    size_t num_threads = 16;
+    bool list_engines = false;
+};
 
-struct Stats {
-    double min;
-    double max;
-    double mean;
-    size_t num_lines;
+/// Program options
+static struct argp_option options[] = {
+    {"engine", 'e', "ENGINE", 0, "Aggregation engine, named reader-parser-hash-table-accumulator, or pipeline-parser-hash-table-accumulator for the coroutine pipeline (see --list_engines)", 0},
+    {"list_engines", 'l', 0, 0, "List the prebuilt engines and exit", 0},
+    {"threads", 't', "NUM_THREADS", 0, "Number of worker threads (default 16)", 0},
+    {0, 0, 0, 0, 0, 0}
+};
 
-    Stats() {
-        min = max = mean = 0.0;
-        num_lines = 1;
+// Argp argument parser configuration
+const char* argp_program_version = "v.0.0.1";
+const char* argp_program_bug_address = "the issue tracker at https://github.com/debajyotid2/one-billion-row-challenge.git";
+
+static char doc[] = "Calculates the min, max and mean temperature of every station in a measurements file "
+                    "with a selectable aggregation engine";
+static char args_doc[] = "MEASUREMENTS_FILE...";
+
+/// Function to parse arguments option by option
+static error_t parse_opt(int key, char* arg, struct argp_state* state) {
+    cpp_analyze_arguments* arguments = static_cast<cpp_analyze_arguments*>(state->input);
+
+    switch (key) {
+        case 'e':
+            arguments->engine = arg;
+            break;
+        case 'l':
+            arguments->list_engines = true;
+            break;
+        case 't':
+            arguments->num_threads = strtoul(arg, NULL, 10);
+            if (arguments->num_threads == 0)
+                argp_error(state, "number of threads must be positive");
+            break;
+        case ARGP_KEY_ARG:
+            arguments->input_paths.push_back(arg);
+            break;
+        case ARGP_KEY_END:
+            if (state->arg_num < 1 && !arguments->list_engines)
+                argp_usage(state);
+            break;
+        default:
+            return ARGP_ERR_UNKNOWN;
     }
+    return 0;
+}
 
-    Stats(double a_min, double a_max, double a_mean) {
-        min = a_min;
-        max = a_max;
-        mean = a_mean;
-        num_lines = 1;
+// Argument parser
+static struct argp argparser = {options, parse_opt, args_doc, doc, 0, 0, 0};
+
+/// Look up an engine or pipeline by name, or return nullptr
+static const onebrc::EngineEntry* find_any_engine(const std::string& name) {
+    const onebrc::EngineEntry* engine = onebrc::find_engine(name);
+    if (engine != nullptr)
+        return engine;
+    for (const onebrc::EngineEntry& entry: onebrc::pipeline_registry()) {
+        if (entry.name == name)
+            return &entry;
     }
-};
-
-std::pair<std::string, double> parse_single_row(std::string& row) {
-    std::string city = row.substr(0, row.find(DELIM));
-    double temperature = std::stod(row.substr(row.find(DELIM) + 1, row.length()));
-    return std::make_pair(city, temperature);
+    return nullptr;
 }
 
-
 int main(int argc, char** argv) {
-    std::fstream file;
-    if (argc != 2) {
-        throw std::runtime_error("Usage: " + std::string(argv[0]) + " <PATH TO TEMPERATURE TXT FILE>\n");
-    }
-    file.open(argv[1]);
-    if (!file.is_open()) {
-        throw std::runtime_error("Could not open input file.\n");
+    cpp_analyze_arguments arguments;
+    argp_parse(&argparser, argc, argv, 0, 0, &arguments);
+
+    if (arguments.list_engines) {
+        for (const onebrc::EngineEntry& entry: onebrc::engine_registry())
+            printf("%s\n", entry.name.c_str());
+        for (const onebrc::EngineEntry& entry: onebrc::pipeline_registry())
+            printf("%s\n", entry.name.c_str());
+        return EXIT_SUCCESS;
     }
 
-    std::string line;
-    std::unordered_map<std::string, Stats>* cities = new std::unordered_map<std::string, Stats>();
-
-    while (std::getline(file, line)) {
-        auto res = parse_single_row(line);
-        auto it = cities->find(res.first);
-        if (it != cities->end()) {
-            if (res.second < (it->second).min)
-                it->second.min = res.second;
-            if (res.second > it->second.max)
-                it->second.max = res.second;
-            it->second.mean = (it->second.mean * it->second.num_lines + res.second) / (it->second.num_lines + 1);
-            it->second.num_lines++;
-            continue;
-        }
-        (*cities)[res.first] = Stats(res.second, res.second, res.second);
+    const onebrc::EngineEntry* engine = find_any_engine(arguments.engine);
+    if (engine == nullptr) {
+        fprintf(stderr, "Unknown engine %s, see --list_engines\n", arguments.engine.c_str());
+        return EXIT_FAILURE;
     }
 
-    for (const auto& it: *cities) {
-        printf("%s=%.1f/%.1f/%.1f\n", it.first.data(), it.second.min, it.second.max, it.second.mean);
+    try {
+        size_t rows = engine->analyze(arguments.input_paths, arguments.num_threads, stdout);
+        fprintf(stderr, "Engine %s aggregated %zu rows\n", engine->name.c_str(), rows);
+    } catch (const std::exception& e) {
+        fprintf(stderr, "Error: %s\n", e.what());
+        return EXIT_FAILURE;
     }
-
-    delete cities;
-    
-    file.close();
-    return 0;
+    return EXIT_SUCCESS;
 }
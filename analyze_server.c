@@ -0,0 +1,145 @@
+/* Analyzer server.
+                    GNU AFFERO GENERAL PUBLIC LICENSE
+                       Version 3, 19 November 2007
+
+    Copyright (C) 2024  Debajyoti Debnath
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published
+    by the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <argp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <unistd.h>
+#include "src/analyzer.h"
+#include "src/catalog.h"
+#include "src/server.h"
+#include "src/args.h"
+#include "src/autotune.h"
+
+/// Program options
+static struct argp_option options[] = {
+    {"catalog", 'c', "CATALOG_PATH", 0, "Station catalog (binary or weather_stations.txt) whose station IDs are used for aggregation"},
+    {"threads", 't', "NUM_THREADS", 0, "Number of worker threads analyzing a file or what it gained (default: one per CPU available to the process, within its cgroup quota)"},
+    {0}
+};
+
+// Argp argument parser configuration
+const char* argp_program_version = "v.0.0.1";
+const char* argp_program_bug_address = "the issue tracker at https://github.com/debajyotid2/one-billion-row-challenge.git";
+
+static char doc[] = "Keeps measurements files mapped and aggregated, and answers queries about their stations on a Unix domain socket\n\n"
+                    "Requests are lines of text, answered with a line per station and a status line:\n"
+                    "  REGISTER <path>                    register and analyze a file\n"
+                    "  ALL <path>                         every station of a file\n"
+                    "  STATION <path> <name>              one station\n"
+                    "  STATIONS <path> <name>;<name>;...  several stations\n"
+                    "  FILES                              registered files\n"
+                    "Files are registered on their first query too, and the lines they gained are aggregated before answering.";
+static char args_doc[] = "SOCKET_PATH [MEASUREMENTS_FILE...]";
+
+// Path of the socket, removed on exit
+static const char* socket_path = NULL;
+
+/// Function to parse arguments option by option
+static error_t parse_opt(int key, char* arg, struct argp_state* state) {
+    struct server_arguments *arguments = (struct server_arguments*)(state->input);
+
+    switch (key) {
+        case 'c':
+            strncpy(arguments->catalog_path, arg, sizeof(arguments->catalog_path) - 1);
+            break;
+        case 't':
+            arguments->num_threads = strtoul(arg, NULL, 10);
+            if (arguments->num_threads == 0)
+                argp_error(state, "number of threads must be positive");
+            break;
+        case ARGP_KEY_ARG:
+            if (state->arg_num == 0) {
+                strncpy(arguments->socket_path, arg, sizeof(arguments->socket_path) - 1);
+                break;
+            }
+            if (arguments->num_files == SERVER_MAX_STARTUP_FILES)
+                argp_error(state, "at most %d files can be registered at startup", SERVER_MAX_STARTUP_FILES);
+            arguments->file_paths[arguments->num_files++] = arg;
+            break;
+        case ARGP_KEY_END:
+            if (state->arg_num < 1)
+                argp_usage(state);
+            break;
+        default:
+            return ARGP_ERR_UNKNOWN;
+    }
+    return 0;
+}
+
+// Argument parser
+static struct argp argparser = {options, parse_opt, args_doc, doc};
+
+/// Remove the socket when asked to stop
+static void _stop(int signal) {
+    (void)signal;
+    if (socket_path != NULL)
+        unlink(socket_path);
+    _exit(EXIT_SUCCESS);
+}
+
+int main(int argc, char** argv) {
+    struct server_arguments arg_vals;
+
+    // Parse arguments
+    init_server_arguments(&arg_vals);
+    argp_parse(&argparser, argc, argv, 0, 0, &arg_vals);
+
+    StationCatalog catalog;
+    bool use_catalog = arg_vals.catalog_path[0] != '\0';
+    if (use_catalog)
+        catalog_load(&catalog, arg_vals.catalog_path);
+
+    AnalyzerConfig config;
+    analyzerconfig_init(&config);
+    config.catalog = use_catalog ? &catalog: NULL;
+    if (arg_vals.num_threads > 0) {
+        config.num_threads = arg_vals.num_threads;
+    } else {
+        HostInfo host;
+        hostinfo_detect(&host);
+        config.num_threads = host.cpus;
+    }
+
+    AnalyzerServer server;
+    server_init(&server, &config);
+    for (size_t i = 0; i < arg_vals.num_files; ++i) {
+        ServedFile* file = server_register(&server, arg_vals.file_paths[i]);
+        if (file == NULL) {
+            fprintf(stderr, "Error reading file %s\n", arg_vals.file_paths[i]);
+            exit(EXIT_FAILURE);
+        }
+        printf("Registered %s: %zu lines, %zu stations\n", file->path,
+               (size_t)file->aggregator.rows, aggregator_num_stations(&file->aggregator));
+    }
+
+    socket_path = arg_vals.socket_path;
+    signal(SIGINT, &_stop);
+    signal(SIGTERM, &_stop);
+    printf("Listening on %s\n", socket_path);
+    fflush(stdout);
+    server_run(&server, socket_path);
+
+    server_destroy(&server);
+    if (use_catalog)
+        catalog_destroy(&catalog);
+    return EXIT_FAILURE;
+}
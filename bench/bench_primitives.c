@@ -0,0 +1,259 @@
+/* Micro-benchmarks of the hot-path primitives.
+
+                    GNU AFFERO GENERAL PUBLIC LICENSE
+                       Version 3, 19 November 2007
+
+    Copyright (C) 2024  Debajyoti Debnath
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published
+    by the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include <argp.h>
+#include <yatpool.h>
+#include "harness.h"
+#include "dtypes.h"
+#include "format.h"
+#include "io_utils.h"
+#include "hash_table.h"
+#include "hash_functions.h"
+#include "catalog.h"
+#include "generate_data.h"
+
+#ifndef ONEBRC_DATA_DIR
+#define ONEBRC_DATA_DIR "../data"
+#endif
+
+// Number of empty tasks pushed through the threadpool per repetition
+#define NUM_DISPATCH_TASKS 10000
+
+/// Benchmark options
+struct bench_arguments {
+    BenchConfig config;
+    size_t num_threads;
+    char data_path[1024];
+};
+
+static struct argp_option options[] = {
+    {"raw_data_path", 'D', "RAW_DATA_PATH", 0, "Path to weather_stations.txt used to build the inputs"},
+    {"repetitions", 'r', "N", 0, "Number of timed repetitions per benchmark"},
+    {"warmup", 'w', "N", 0, "Number of untimed warmup runs per benchmark"},
+    {"filter", 'f', "SUBSTRING", 0, "Only run benchmarks whose name contains SUBSTRING"},
+    {"threads", 't', "N", 0, "Number of threadpool workers for the dispatch benchmark"},
+    {0}
+};
+
+static char doc[] = "Micro-benchmarks of the one billion row challenge hot-path primitives";
+
+static error_t parse_opt(int key, char* arg, struct argp_state* state) {
+    struct bench_arguments* arguments = (struct bench_arguments*)(state->input);
+
+    switch (key) {
+        case 'D':
+            strncpy(arguments->data_path, arg, sizeof(arguments->data_path) - 1);
+            break;
+        case 'r':
+            arguments->config.repetitions = atoi(arg);
+            break;
+        case 'w':
+            arguments->config.warmup = atoi(arg);
+            break;
+        case 'f':
+            arguments->config.filter = arg;
+            break;
+        case 't':
+            arguments->num_threads = atoi(arg);
+            break;
+        default:
+            return ARGP_ERR_UNKNOWN;
+    }
+    return 0;
+}
+
+static struct argp argparser = {options, parse_opt, 0, doc};
+
+/// Inputs shared by all benchmarks, built from the station list
+typedef struct {
+    size_t num_stations;
+    char** lines;
+    String* keys;
+    DataRow* rows;
+    hash_table_t* filled;
+    size_t num_threads;
+    volatile size_t sink;
+} BenchData;
+
+static void benchdata_init(BenchData* data, const char* path, size_t num_threads) {
+    StationCatalog catalog;
+    catalog_load(&catalog, path);
+
+    data->num_stations = catalog.num_stations;
+    data->lines = (char**)calloc(catalog.num_stations, sizeof(char*));
+    data->keys = (String*)calloc(catalog.num_stations, sizeof(String));
+    data->rows = (DataRow*)calloc(catalog.num_stations, sizeof(DataRow));
+    data->num_threads = num_threads;
+    data->sink = 0;
+
+    char buf[BUFSIZE];
+    for (uint32_t id = 0; id < catalog.num_stations; ++id) {
+        String name = catalog_name(&catalog, id);
+        data->keys[id] = string_copy(&name);
+        data->rows[id].location = &data->keys[id];
+        data->rows[id].temperature = catalog.mean_temperatures[id];
+        int length = snprintf(buf, sizeof(buf), "%s;%.1f\n", name.data, catalog.mean_temperatures[id]);
+        data->lines[id] = (char*)malloc((size_t)length + 1);
+        memcpy(data->lines[id], buf, (size_t)length + 1);
+    }
+    catalog_destroy(&catalog);
+
+    ht_init(&data->filled, 2 * data->num_stations, myhash, string_key_equal);
+    for (size_t i = 0; i < data->num_stations; ++i)
+        ht_insert(data->filled, &data->keys[i], &data->rows[i]);
+}
+
+static void benchdata_destroy(BenchData* data) {
+    ht_destroy(data->filled);
+    free(data->filled);
+    for (size_t i = 0; i < data->num_stations; ++i) {
+        free(data->lines[i]);
+        string_destroy(data->keys[i]);
+    }
+    free(data->lines);
+    free(data->keys);
+    free(data->rows);
+}
+
+static void bench_parse_single_row(void* ctx) {
+    BenchData* data = (BenchData*)ctx;
+    for (size_t i = 0; i < data->num_stations; ++i) {
+        DataRow row = parse_single_row(data->lines[i]);
+        data->sink += row.location->length;
+        datarow_destroy(row);
+    }
+}
+
+static void bench_myhash(void* ctx) {
+    BenchData* data = (BenchData*)ctx;
+    for (size_t i = 0; i < data->num_stations; ++i)
+        data->sink += myhash(&data->keys[i], data->filled);
+}
+
+static void bench_djb2(void* ctx) {
+    BenchData* data = (BenchData*)ctx;
+    for (size_t i = 0; i < data->num_stations; ++i)
+        data->sink += djb2(&data->keys[i], data->filled);
+}
+
+static void bench_station_hash(void* ctx) {
+    BenchData* data = (BenchData*)ctx;
+    for (size_t i = 0; i < data->num_stations; ++i)
+        data->sink += station_hash(data->keys[i].data, data->keys[i].length);
+}
+
+static void bench_ht_insert(void* ctx) {
+    BenchData* data = (BenchData*)ctx;
+    hash_table_t* table;
+    ht_init(&table, 2 * data->num_stations, myhash, string_key_equal);
+    for (size_t i = 0; i < data->num_stations; ++i)
+        data->sink += ht_insert(table, &data->keys[i], &data->rows[i]);
+    ht_destroy(table);
+    free(table);
+}
+
+static void bench_ht_at(void* ctx) {
+    BenchData* data = (BenchData*)ctx;
+    for (size_t i = 0; i < data->num_stations; ++i)
+        data->sink += (size_t)ht_at(data->filled, &data->keys[i]).value;
+}
+
+static void bench_format_datarow(void* ctx) {
+    BenchData* data = (BenchData*)ctx;
+    for (size_t i = 0; i < data->num_stations; ++i) {
+        String line = format_datarow(&data->rows[i]);
+        data->sink += line.length;
+        string_destroy(line);
+    }
+}
+
+static void bench_sample_temperature(void* ctx) {
+    BenchData* data = (BenchData*)ctx;
+    unsigned int seed = 1;
+    for (size_t i = 0; i < data->num_stations; ++i) {
+        DataRow row = sample_temperature(&data->rows[i], &seed);
+        data->sink += (size_t)row.temperature;
+        datarow_destroy(row);
+    }
+}
+
+static void* _empty_task(void* arg) {
+    return arg;
+}
+
+static void _empty_task_destroy(void* arg) {
+    (void)arg;
+}
+
+static void bench_yatpool_dispatch(void* ctx) {
+    BenchData* data = (BenchData*)ctx;
+    YATPool* pool;
+    yatpool_init(&pool, data->num_threads, NUM_DISPATCH_TASKS);
+    for (size_t i = 0; i < NUM_DISPATCH_TASKS; ++i) {
+        Task* task;
+        task_init(&task, &_empty_task, NULL, &_empty_task_destroy);
+        yatpool_put(pool, task);
+    }
+    yatpool_wait(pool);
+    yatpool_destroy(pool);
+}
+
+int main(int argc, char** argv) {
+    struct bench_arguments arg_vals;
+    benchconfig_init(&arg_vals.config);
+    arg_vals.num_threads = 4;
+    memset(arg_vals.data_path, 0x0, sizeof(arg_vals.data_path));
+    strncpy(arg_vals.data_path, ONEBRC_DATA_DIR "/weather_stations.txt", sizeof(arg_vals.data_path) - 1);
+    argp_parse(&argparser, argc, argv, 0, 0, &arg_vals);
+
+    BenchData data;
+    benchdata_init(&data, arg_vals.data_path, arg_vals.num_threads);
+    printf("%zu stations from %s, %zu warmup runs, %zu repetitions, %.2f cycles/ns\n",
+           data.num_stations, arg_vals.data_path,
+           arg_vals.config.warmup, arg_vals.config.repetitions, bench_cycles_per_ns());
+
+    struct {
+        const char* name;
+        bench_function fn;
+        size_t num_items;
+    } benchmarks[] = {
+        {"parse_single_row", bench_parse_single_row, data.num_stations},
+        {"hash/myhash", bench_myhash, data.num_stations},
+        {"hash/djb2", bench_djb2, data.num_stations},
+        {"hash/station_hash", bench_station_hash, data.num_stations},
+        {"ht_insert", bench_ht_insert, data.num_stations},
+        {"ht_at", bench_ht_at, data.num_stations},
+        {"format_datarow", bench_format_datarow, data.num_stations},
+        {"sample_temperature", bench_sample_temperature, data.num_stations},
+        {"yatpool_dispatch", bench_yatpool_dispatch, NUM_DISPATCH_TASKS},
+    };
+
+    bench_print_header();
+    for (size_t i = 0; i < sizeof(benchmarks) / sizeof(benchmarks[0]); ++i) {
+        BenchResult result;
+        if (bench_run(benchmarks[i].name, benchmarks[i].fn, &data, benchmarks[i].num_items, &arg_vals.config, &result))
+            bench_print_result(&result);
+    }
+
+    benchdata_destroy(&data);
+    return EXIT_SUCCESS;
+}
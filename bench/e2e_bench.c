@@ -0,0 +1,425 @@
+/* End-to-end throughput benchmarks with regression gating.
+
+                    GNU AFFERO GENERAL PUBLIC LICENSE
+                       Version 3, 19 November 2007
+
+    Copyright (C) 2024  Debajyoti Debnath
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published
+    by the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include <argp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+
+#ifndef ONEBRC_DATA_DIR
+#define ONEBRC_DATA_DIR "../data"
+#endif
+
+// Largest number of timed phases recorded per run
+#define MAX_PHASES 16
+// Largest number of results in one run or baseline
+#define MAX_RESULTS 64
+// Size of the buffer holding the output of one child process
+#define OUTPUT_BUFSIZE (1 << 20)
+#define PATH_LEN 1024
+// Exit status when there is no baseline to compare against, which ctest
+// reports as a skipped test
+#define E2E_NO_BASELINE 77
+
+/// Benchmark options
+struct e2e_arguments {
+    char analyze_path[PATH_LEN];
+    char generator_path[PATH_LEN];
+    char stations_path[PATH_LEN];
+    char work_dir[PATH_LEN];
+    char json_path[PATH_LEN];
+    char baseline_path[PATH_LEN];
+    char sizes[PATH_LEN];
+    size_t seed;
+    double threshold;
+    bool write_baseline;
+    bool keep_data;
+};
+
+static struct argp_option options[] = {
+    {"analyze", 'a', "PATH", 0, "Path to the analyze binary"},
+    {"generator", 'g', "PATH", 0, "Path to the create_measurements binary"},
+    {"raw_data_path", 'D', "RAW_DATA_PATH", 0, "Path to weather_stations.txt"},
+    {"work_dir", 'd', "DIR", 0, "Directory the datasets are generated in"},
+    {"sizes", 'n', "N1,N2,...", 0, "Comma-separated dataset sizes in rows"},
+    {"seed", 'S', "SEED", 0, "Seed passed to create_measurements"},
+    {"json", 'j', "PATH", 0, "Write the results as JSON to PATH"},
+    {"baseline", 'b', "PATH", 0, "Compare throughput against the results stored in PATH"},
+    {"threshold", 't', "FRACTION", 0, "Largest tolerated drop in rows/s relative to the baseline"},
+    {"write_baseline", 'w', 0, 0, "Store the results as the new baseline instead of comparing; without it a missing baseline is an error"},
+    {"keep_data", 'k', 0, 0, "Keep the generated datasets"},
+    {0}
+};
+
+static char doc[] = "Runs create_measurements and analyze end to end on datasets of increasing size, "
+                    "in warm- and cold-cache modes, and checks their throughput against a baseline";
+
+static error_t parse_opt(int key, char* arg, struct argp_state* state) {
+    struct e2e_arguments* arguments = (struct e2e_arguments*)(state->input);
+
+    switch (key) {
+        case 'a':
+            strncpy(arguments->analyze_path, arg, PATH_LEN - 1);
+            break;
+        case 'g':
+            strncpy(arguments->generator_path, arg, PATH_LEN - 1);
+            break;
+        case 'D':
+            strncpy(arguments->stations_path, arg, PATH_LEN - 1);
+            break;
+        case 'd':
+            strncpy(arguments->work_dir, arg, PATH_LEN - 1);
+            break;
+        case 'n':
+            strncpy(arguments->sizes, arg, PATH_LEN - 1);
+            break;
+        case 'S':
+            arguments->seed = atol(arg);
+            break;
+        case 'j':
+            strncpy(arguments->json_path, arg, PATH_LEN - 1);
+            break;
+        case 'b':
+            strncpy(arguments->baseline_path, arg, PATH_LEN - 1);
+            break;
+        case 't':
+            arguments->threshold = atof(arg);
+            break;
+        case 'w':
+            arguments->write_baseline = true;
+            break;
+        case 'k':
+            arguments->keep_data = true;
+            break;
+        default:
+            return ARGP_ERR_UNKNOWN;
+    }
+    return 0;
+}
+
+static struct argp argparser = {options, parse_opt, 0, doc};
+
+/// A phase reported by a binary, as "<phase> took <x> milliseconds." by
+/// create_measurements or as a "  <phase> <x> ms" line under "Phase times:"
+/// by analyze --stats
+typedef struct {
+    char name[64];
+    double milliseconds;
+} Phase;
+
+/// Measurements of one run of one binary
+typedef struct {
+    char name[128];
+    size_t rows;
+    size_t bytes;
+    double seconds;
+    double rows_per_s;
+    double gb_per_s;
+    long peak_rss_kb;
+    Phase phases[MAX_PHASES];
+    size_t num_phases;
+} RunResult;
+
+static double _now_s(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+/// Flush a file to disk and drop it from the page cache
+static void _drop_from_cache(const char* path) {
+    int fd = open(path, O_RDONLY);
+    if (fd==-1) return;
+    fdatasync(fd);
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    close(fd);
+}
+
+static size_t _file_size(const char* path) {
+    struct stat st;
+    if (stat(path, &st)==-1) return 0;
+    return (size_t)st.st_size;
+}
+
+/// Record a phase whose name is the first length bytes of name
+static void _add_phase(RunResult* result, const char* name, size_t length, double ms) {
+    if (result->num_phases == MAX_PHASES) return;
+    Phase* phase = &result->phases[result->num_phases++];
+    length = length >= sizeof(phase->name) ? sizeof(phase->name) - 1: length;
+    memcpy(phase->name, name, length);
+    phase->name[length] = '\0';
+    phase->milliseconds = ms;
+}
+
+/// Collect the phase times from a child's output
+static void _parse_phases(char* output, RunResult* result) {
+    result->num_phases = 0;
+    bool in_phase_times = false;
+    for (char* line = strtok(output, "\n"); line != NULL; line = strtok(NULL, "\n")) {
+        double ms;
+        if (in_phase_times && line[0] == ' ') {
+            char name[64];
+            if (sscanf(line, " %63s %lf ms", name, &ms) == 2)
+                _add_phase(result, name, strlen(name), ms);
+            continue;
+        }
+        in_phase_times = strcmp(line, "Phase times:") == 0;
+        char* took = strstr(line, " took ");
+        if (took != NULL && sscanf(took, " took %lf milliseconds", &ms) == 1)
+            _add_phase(result, line, (size_t)(took - line), ms);
+    }
+}
+
+/// Run argv to completion, timing it and recording its peak RSS and the
+/// phase times it prints to stdout or stderr. Exits if the child fails.
+static void _run(char* const argv[], RunResult* result) {
+    int pipefd[2];
+    if (pipe(pipefd)==-1) {
+        perror("Error: could not create pipe.");
+        exit(1);
+    }
+
+    double start = _now_s();
+    pid_t pid = fork();
+    if (pid==-1) {
+        perror("Error: could not fork.");
+        exit(1);
+    }
+    if (pid==0) {
+        dup2(pipefd[1], STDOUT_FILENO);
+        dup2(pipefd[1], STDERR_FILENO);
+        close(pipefd[0]);
+        close(pipefd[1]);
+        execv(argv[0], argv);
+        perror("Error: could not execute benchmarked binary.");
+        _exit(127);
+    }
+    close(pipefd[1]);
+
+    char* output = (char*)malloc(OUTPUT_BUFSIZE);
+    size_t used = 0;
+    ssize_t n;
+    char discard[4096];
+    while ((n = read(pipefd[0], used < OUTPUT_BUFSIZE - 1 ? output + used: discard,
+                     used < OUTPUT_BUFSIZE - 1 ? OUTPUT_BUFSIZE - 1 - used: sizeof(discard))) > 0) {
+        if (used < OUTPUT_BUFSIZE - 1)
+            used += (size_t)n;
+    }
+    output[used] = '\0';
+    close(pipefd[0]);
+
+    int status;
+    struct rusage usage;
+    wait4(pid, &status, 0, &usage);
+    result->seconds = _now_s() - start;
+    result->peak_rss_kb = usage.ru_maxrss;
+
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        fprintf(stderr, "%s failed with status %d.\n", argv[0], status);
+        exit(1);
+    }
+
+    _parse_phases(output, result);
+    free(output);
+
+    result->rows_per_s = (double)result->rows / result->seconds;
+    result->gb_per_s = (double)result->bytes / result->seconds / 1e9;
+}
+
+static void _print_result(FILE* out, const RunResult* result) {
+    fprintf(out, "{\"name\": \"%s\", \"rows\": %zu, \"bytes\": %zu, \"seconds\": %.6f, "
+                 "\"rows_per_s\": %.1f, \"gb_per_s\": %.4f, \"peak_rss_kb\": %ld, \"phases\": {",
+            result->name, result->rows, result->bytes, result->seconds,
+            result->rows_per_s, result->gb_per_s, result->peak_rss_kb);
+    for (size_t i = 0; i < result->num_phases; ++i)
+        fprintf(out, "%s\"%s\": %.3f", i == 0 ? "": ", ", result->phases[i].name, result->phases[i].milliseconds);
+    fprintf(out, "}}");
+}
+
+/// Write results as a JSON array with one result object per line,
+/// which is also the format read back by _read_baseline
+static void _write_json(const char* path, const RunResult* results, size_t num_results) {
+    FILE* out = fopen(path, "w");
+    if (out==NULL) {
+        perror("Error: could not open JSON output.");
+        exit(1);
+    }
+    fprintf(out, "[\n");
+    for (size_t i = 0; i < num_results; ++i) {
+        fprintf(out, "  ");
+        _print_result(out, &results[i]);
+        fprintf(out, "%s\n", i + 1 < num_results ? ",": "");
+    }
+    fprintf(out, "]\n");
+    fclose(out);
+}
+
+/// Read the name and rows/s of every result in a file written by _write_json.
+/// Returns the number of results, or -1 if the file does not exist.
+static int _read_baseline(const char* path, RunResult* baseline) {
+    FILE* in = fopen(path, "r");
+    if (in==NULL) return -1;
+    char line[4096];
+    int n = 0;
+    while (fgets(line, sizeof(line), in) && n < MAX_RESULTS) {
+        char* name = strstr(line, "\"name\": \"");
+        char* rate = strstr(line, "\"rows_per_s\": ");
+        if (name == NULL || rate == NULL) continue;
+        if (sscanf(name, "\"name\": \"%127[^\"]\"", baseline[n].name) != 1) continue;
+        if (sscanf(rate, "\"rows_per_s\": %lf", &baseline[n].rows_per_s) != 1) continue;
+        n++;
+    }
+    fclose(in);
+    return n;
+}
+
+/// Compare results against the baseline and report every result whose
+/// throughput dropped by more than threshold. Returns the number of regressions.
+static size_t _check_regressions(const RunResult* results, size_t num_results, const RunResult* baseline, size_t num_baseline, double threshold) {
+    size_t regressions = 0;
+    for (size_t i = 0; i < num_results; ++i) {
+        for (size_t j = 0; j < num_baseline; ++j) {
+            if (strcmp(results[i].name, baseline[j].name) != 0) continue;
+            double ratio = results[i].rows_per_s / baseline[j].rows_per_s;
+            bool regressed = ratio < 1.0 - threshold;
+            printf("%-40s %14.0f rows/s, baseline %14.0f rows/s (%+.1f%%)%s\n",
+                   results[i].name, results[i].rows_per_s, baseline[j].rows_per_s,
+                   (ratio - 1.0) * 100.0, regressed ? "  REGRESSION": "");
+            regressions += regressed;
+        }
+    }
+    return regressions;
+}
+
+int main(int argc, char** argv) {
+    struct e2e_arguments arg_vals;
+    memset(&arg_vals, 0x0, sizeof(arg_vals));
+    strncpy(arg_vals.analyze_path, "./analyze", PATH_LEN - 1);
+    strncpy(arg_vals.generator_path, "./create_measurements", PATH_LEN - 1);
+    strncpy(arg_vals.stations_path, ONEBRC_DATA_DIR "/weather_stations.txt", PATH_LEN - 1);
+    strncpy(arg_vals.work_dir, ".", PATH_LEN - 1);
+    strncpy(arg_vals.sizes, "1000000,10000000,100000000,1000000000", PATH_LEN - 1);
+    strncpy(arg_vals.json_path, "e2e_results.json", PATH_LEN - 1);
+    arg_vals.seed = 42;
+    arg_vals.threshold = 0.1;
+    argp_parse(&argparser, argc, argv, 0, 0, &arg_vals);
+
+    // Without a baseline there is nothing to gate on, so do not pass silently
+    bool compare = arg_vals.baseline_path[0] != '\0' && !arg_vals.write_baseline;
+    if (compare && _file_size(arg_vals.baseline_path) == 0) {
+        fprintf(stderr, "Baseline %s does not exist, run with --write_baseline to create it.\n", arg_vals.baseline_path);
+        return E2E_NO_BASELINE;
+    }
+
+    RunResult* results = (RunResult*)calloc(MAX_RESULTS, sizeof(RunResult));
+    size_t num_results = 0;
+
+    const char* modes[] = {"warm", "cold"};
+    char seed[32];
+    snprintf(seed, sizeof(seed), "%zu", arg_vals.seed);
+
+    char sizes[PATH_LEN];
+    memcpy(sizes, arg_vals.sizes, PATH_LEN);
+    char* saveptr = NULL;
+    for (char* token = strtok_r(sizes, ",", &saveptr); token != NULL; token = strtok_r(NULL, ",", &saveptr)) {
+        size_t rows = strtoul(token, NULL, 10);
+        char rows_str[32], dataset[PATH_LEN + 64];
+        snprintf(rows_str, sizeof(rows_str), "%zu", rows);
+        snprintf(dataset, sizeof(dataset), "%s/e2e_%zu.txt", arg_vals.work_dir, rows);
+
+        char* generate_argv[] = {arg_vals.generator_path, (char*)"-D", arg_vals.stations_path,
+                                 (char*)"-N", rows_str, (char*)"-S", seed, (char*)"-O", dataset, NULL};
+        char* analyze_argv[] = {arg_vals.analyze_path, (char*)"--stats", dataset, NULL};
+
+        for (size_t m = 0; m < 2 && num_results + 2 <= MAX_RESULTS; ++m) {
+            bool cold = m == 1;
+
+            // The warm run follows an untimed run that pulls the inputs into the cache
+            RunResult* gen = &results[num_results++];
+            snprintf(gen->name, sizeof(gen->name), "create_measurements/%s/%zu", modes[m], rows);
+            gen->rows = rows;
+            if (cold) {
+                _drop_from_cache(arg_vals.stations_path);
+            } else {
+                RunResult discard;
+                discard.rows = rows;
+                discard.bytes = 0;
+                _run(generate_argv, &discard);
+            }
+            _run(generate_argv, gen);
+            gen->bytes = _file_size(dataset);
+            gen->gb_per_s = (double)gen->bytes / gen->seconds / 1e9;
+
+            RunResult* ana = &results[num_results++];
+            snprintf(ana->name, sizeof(ana->name), "analyze/%s/%zu", modes[m], rows);
+            ana->rows = rows;
+            ana->bytes = gen->bytes;
+            if (cold) {
+                _drop_from_cache(dataset);
+            } else {
+                RunResult discard;
+                discard.rows = rows;
+                discard.bytes = 0;
+                _run(analyze_argv, &discard);
+            }
+            _run(analyze_argv, ana);
+
+            printf("%-40s %8.3f s %14.0f rows/s %8.3f GB/s %10ld KB peak RSS\n",
+                   gen->name, gen->seconds, gen->rows_per_s, gen->gb_per_s, gen->peak_rss_kb);
+            printf("%-40s %8.3f s %14.0f rows/s %8.3f GB/s %10ld KB peak RSS\n",
+                   ana->name, ana->seconds, ana->rows_per_s, ana->gb_per_s, ana->peak_rss_kb);
+        }
+
+        if (!arg_vals.keep_data)
+            remove(dataset);
+    }
+
+    _write_json(arg_vals.json_path, results, num_results);
+    printf("Results written to %s.\n", arg_vals.json_path);
+
+    int status = EXIT_SUCCESS;
+    if (arg_vals.baseline_path[0] != '\0') {
+        RunResult* baseline = (RunResult*)calloc(MAX_RESULTS, sizeof(RunResult));
+        int num_baseline = compare ? _read_baseline(arg_vals.baseline_path, baseline): -1;
+        if (!compare) {
+            _write_json(arg_vals.baseline_path, results, num_results);
+            printf("Baseline written to %s.\n", arg_vals.baseline_path);
+        } else if (num_baseline <= 0) {
+            fprintf(stderr, "Baseline %s has no results.\n", arg_vals.baseline_path);
+            status = EXIT_FAILURE;
+        } else if (_check_regressions(results, num_results, baseline, (size_t)num_baseline, arg_vals.threshold) > 0) {
+            fprintf(stderr, "Throughput dropped by more than %.0f%% from the baseline.\n", arg_vals.threshold * 100.0);
+            status = EXIT_FAILURE;
+        }
+        free(baseline);
+    }
+
+    free(results);
+    return status;
+}
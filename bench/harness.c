@@ -0,0 +1,136 @@
+/* Micro-benchmark harness.
+
+                    GNU AFFERO GENERAL PUBLIC LICENSE
+                       Version 3, 19 November 2007
+
+    Copyright (C) 2024  Debajyoti Debnath
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published
+    by the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include "harness.h"
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_RDTSC 1
+#else
+#define HAVE_RDTSC 0
+#endif
+
+/// Initialize a benchmark configuration to defaults
+void benchconfig_init(BenchConfig* config) {
+    if (config==NULL) return;
+    config->warmup = 3;
+    config->repetitions = 21;
+    config->filter = NULL;
+}
+
+static double _now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+static uint64_t _cycles(void) {
+#if HAVE_RDTSC
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+static int _compare_doubles(const void* a, const void* b) {
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+/// Value at quantile q of sorted samples, by nearest rank
+static double _quantile(const double* sorted, size_t n, double q) {
+    size_t rank = (size_t)(q * (double)(n - 1) + 0.5);
+    return sorted[rank];
+}
+
+/// Ratio of time stamp counter ticks to nanoseconds, measured once.
+/// Zero if the platform has no cycle counter.
+double bench_cycles_per_ns(void) {
+    static double ratio = -1.0;
+    if (ratio >= 0.0) return ratio;
+#if HAVE_RDTSC
+    double start_ns = _now_ns();
+    uint64_t start_cycles = _cycles();
+    while (_now_ns() - start_ns < 50e6);
+    ratio = (double)(_cycles() - start_cycles) / (_now_ns() - start_ns);
+#else
+    ratio = 0.0;
+#endif
+    return ratio;
+}
+
+/// Run fn warmup times untimed, then the configured number of timed
+/// repetitions, and summarize them in result. Returns false if the
+/// benchmark was skipped by the filter.
+bool bench_run(const char* name, bench_function fn, void* ctx, size_t num_items, const BenchConfig* config, BenchResult* result) {
+    if (name==NULL || fn==NULL || config==NULL || result==NULL) {
+        perror("Error: Null pointer provided as argument.");
+        abort();
+    }
+    if (config->filter != NULL && strstr(name, config->filter) == NULL)
+        return false;
+    if (config->repetitions == 0 || num_items == 0) {
+        perror("Error: repetitions and num_items must be non-zero.");
+        abort();
+    }
+
+    for (size_t i = 0; i < config->warmup; ++i)
+        fn(ctx);
+
+    double* samples = (double*)calloc(config->repetitions, sizeof(double));
+    for (size_t i = 0; i < config->repetitions; ++i) {
+        double start = _now_ns();
+        fn(ctx);
+        samples[i] = _now_ns() - start;
+    }
+    qsort(samples, config->repetitions, sizeof(double), _compare_doubles);
+
+    // Cycles are derived from the median time and the measured TSC rate
+    result->name = name;
+    result->num_items = num_items;
+    result->min_ns = samples[0];
+    result->median_ns = _quantile(samples, config->repetitions, 0.5);
+    result->p90_ns = _quantile(samples, config->repetitions, 0.9);
+    result->p99_ns = _quantile(samples, config->repetitions, 0.99);
+    result->ns_per_item = result->median_ns / (double)num_items;
+    result->cycles_per_item = result->ns_per_item * bench_cycles_per_ns();
+
+    free(samples);
+    return true;
+}
+
+/// Print the column names of the result table
+void bench_print_header(void) {
+    printf("%-28s %10s %12s %12s %12s %12s %10s %10s\n",
+           "benchmark", "items", "min_us", "median_us", "p90_us", "p99_us", "ns/item", "cyc/item");
+}
+
+/// Print one row of the result table
+void bench_print_result(const BenchResult* result) {
+    if (result==NULL) return;
+    printf("%-28s %10zu %12.1f %12.1f %12.1f %12.1f %10.2f %10.2f\n",
+           result->name, result->num_items,
+           result->min_ns / 1e3, result->median_ns / 1e3,
+           result->p90_ns / 1e3, result->p99_ns / 1e3,
+           result->ns_per_item, result->cycles_per_item);
+}
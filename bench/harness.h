@@ -0,0 +1,60 @@
+/* Micro-benchmark harness.
+
+                    GNU AFFERO GENERAL PUBLIC LICENSE
+                       Version 3, 19 November 2007
+
+    Copyright (C) 2024  Debajyoti Debnath
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published
+    by the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef _HARNESS_H_
+#define _HARNESS_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+// Function under measurement. One call processes num_items items of ctx.
+typedef void (*bench_function)(void* ctx);
+
+// Settings shared by all benchmarks of a run
+typedef struct {
+    size_t warmup;
+    size_t repetitions;
+    const char* filter;
+} BenchConfig;
+
+// Summary of the repetitions of one benchmark
+typedef struct {
+    const char* name;
+    size_t num_items;
+    double min_ns;
+    double median_ns;
+    double p90_ns;
+    double p99_ns;
+    double ns_per_item;
+    double cycles_per_item;
+} BenchResult;
+
+void benchconfig_init(BenchConfig* config);
+bool bench_run(const char* name, bench_function fn, void* ctx, size_t num_items, const BenchConfig* config, BenchResult* result);
+void bench_print_header(void);
+void bench_print_result(const BenchResult* result);
+double bench_cycles_per_ns(void);
+
+#endif // _HARNESS_H_
@@ -0,0 +1,60 @@
+# Build modes of the onebrc binaries
+#
+# ONEBRC_LTO      Link-time optimization (default ON)
+# ONEBRC_PGO      Profile-guided optimization: OFF, GENERATE or USE
+# ONEBRC_PGO_DIR  Directory the profiles are written to and read from
+# ONEBRC_GPROF    gprof instrumentation (-pg)
+# ONEBRC_MARCH    List of -march targets, each built as an extra set of
+#                 binaries suffixed with the target, e.g. analyze-x86-64-v3
+
+if(NOT CMAKE_BUILD_TYPE AND NOT CMAKE_CONFIGURATION_TYPES)
+    set(CMAKE_BUILD_TYPE Release CACHE STRING "Build type" FORCE)
+endif()
+
+option(ONEBRC_LTO "Build with link-time optimization" ON)
+set(ONEBRC_PGO OFF CACHE STRING "Profile-guided optimization stage: OFF, GENERATE or USE")
+set_property(CACHE ONEBRC_PGO PROPERTY STRINGS OFF GENERATE USE)
+set(ONEBRC_PGO_DIR "${CMAKE_BINARY_DIR}/pgo" CACHE PATH "Directory of the profiles used by ONEBRC_PGO")
+option(ONEBRC_GPROF "Instrument the binaries for gprof" OFF)
+set(ONEBRC_MARCH "" CACHE STRING "List of -march targets to build additional binaries for")
+
+if(ONEBRC_LTO)
+    include(CheckIPOSupported)
+    check_ipo_supported(RESULT ONEBRC_LTO_SUPPORTED OUTPUT ONEBRC_LTO_ERROR LANGUAGES C)
+    if(ONEBRC_LTO_SUPPORTED)
+        set(CMAKE_INTERPROCEDURAL_OPTIMIZATION ON)
+    else()
+        message(WARNING "Link-time optimization is not supported: ${ONEBRC_LTO_ERROR}")
+    endif()
+endif()
+
+if(ONEBRC_PGO STREQUAL "GENERATE")
+    message(STATUS "Building with profile generation into ${ONEBRC_PGO_DIR}")
+    # Atomic profile updates keep the counters of the worker threads exact
+    add_compile_options(-fprofile-generate=${ONEBRC_PGO_DIR} -fprofile-update=atomic)
+    add_link_options(-fprofile-generate=${ONEBRC_PGO_DIR})
+elseif(ONEBRC_PGO STREQUAL "USE")
+    message(STATUS "Building with profiles from ${ONEBRC_PGO_DIR}")
+    add_compile_options(-fprofile-use=${ONEBRC_PGO_DIR} -fprofile-correction -Wno-missing-profile)
+    add_link_options(-fprofile-use=${ONEBRC_PGO_DIR})
+elseif(ONEBRC_PGO)
+    message(FATAL_ERROR "ONEBRC_PGO must be OFF, GENERATE or USE, not ${ONEBRC_PGO}")
+endif()
+
+if(ONEBRC_GPROF)
+    message(STATUS "Building with gprof instrumentation")
+    add_compile_options(-pg)
+    add_link_options(-pg)
+endif()
+
+# Build executable NAME from SOURCES once more for every ONEBRC_MARCH target,
+# with the same include directories and libraries as NAME
+function(onebrc_add_march_variants NAME)
+    foreach(MARCH ${ONEBRC_MARCH})
+        set(VARIANT ${NAME}-${MARCH})
+        add_executable(${VARIANT} ${ARGN})
+        target_compile_options(${VARIANT} PRIVATE -march=${MARCH})
+        target_include_directories(${VARIANT} PRIVATE $<TARGET_PROPERTY:${NAME},INCLUDE_DIRECTORIES>)
+        target_link_libraries(${VARIANT} PRIVATE $<TARGET_PROPERTY:${NAME},LINK_LIBRARIES>)
+    endforeach()
+endfunction()
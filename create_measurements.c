@@ -24,15 +24,43 @@
 #include "src/io_utils.h"
 #include "src/args.h"
 #include "src/generate_data.h"
+#include "src/catalog.h"
+#include "src/workload.h"
+#include "src/perf_counters.h"
+#include "src/pipe_writer.h"
+#include "src/autotune.h"
+#include "src/trace.h"
 
 #define DEBUG 0
 #define TIME 1
 
+// Keys of options without a short name
+#define OPTION_STDOUT 1000
+#define OPTION_ROWS_PER_SECOND 1001
+#define OPTION_TRACE 1002
+
 /// Program options
 static struct argp_option options[] = {
-    {"raw_data_path", 'D', "RAW_DATA_PATH", 0, "Path to weather_stations.txt containing locations and mean temperatures"},
+    {"raw_data_path", 'D', "RAW_DATA_PATH", 0, "Path to weather_stations.txt containing locations and mean temperatures, or to a binary station catalog"},
+    {"save_catalog", 'C', "CATALOG_PATH", 0, "Save the parsed stations as a binary catalog that can be passed to -D or to analyze"},
     {"n_rows", 'N', "N_ROWS", 0, "Number of rows to generate"},
     {"seed", 'S', "SEED", 0, "Seed for randomness"},
+    {"output", 'O', "OUTPUT_PATH", 0, "Path to the output file, or the prefix of the shard files"},
+    {"shards", 'K', "N_SHARDS", 0, "Number of shard files to write (0 writes a single file)"},
+    {"shard_balance", 'B', "rows|bytes", 0, "Balance shards by row count (default) or by byte size"},
+    {"writer", 'W', "pwrite|mmap", 0, "Write through bounded pwrite buffers (default) or a shared mmap of the whole file"},
+    {"direct", 'd', 0, 0, "Bypass the page cache with O_DIRECT when writing shards"},
+    {"nontemporal", 'T', 0, 0, "Fill write buffers with non-temporal stores"},
+    {"max_dirty_mb", 'M', "MAX_DIRTY_MB", 0, "Cap on the megabytes of written data left dirty in the page cache"},
+    {"zipf", 'z', "EXPONENT", 0, "Draw stations from a Zipf distribution with this exponent instead of uniformly"},
+    {"stations", 's', "N_STATIONS", 0, "Number of distinct stations, padded with synthetic stations beyond the source data (max 10000000)"},
+    {"name_length", 'L', "MIN-MAX", 0, "Use only synthetic station names with lengths drawn uniformly from MIN-MAX bytes (max 100)"},
+    {"decimals", 'p', "1|2", 0, "Number of decimals of the generated temperatures"},
+    {"threads", 't', "NUM_THREADS", 0, "Number of threads sampling and writing rows (default: one per CPU available to the process)"},
+    {"perf", 'P', 0, 0, "Print IPC and cache, branch and TLB misses per row of every phase, read from the hardware counters"},
+    {"stdout", OPTION_STDOUT, 0, 0, "Stream the rows to stdout, e.g. into a pipe to analyze -, instead of writing a file; messages go to stderr"},
+    {"rows_per_second", OPTION_ROWS_PER_SECOND, "ROWS", 0, "Release at most this many rows per second when streaming to stdout"},
+    {"trace", OPTION_TRACE, "PATH", 0, "Record when every phase and task ran on which thread and write the timeline to PATH as Chrome trace JSON at exit, for chrome://tracing or Perfetto"},
     {0}
 };
 
@@ -57,7 +85,80 @@ static error_t parse_opt(int key, char* arg, struct argp_state* state) {
             break;
         case 'D':
             memset(arguments->raw_data_path, 0x0, sizeof(arguments->raw_data_path));
-            strncpy(arguments->raw_data_path, arg, strlen(arg) * sizeof(char));
+            strncpy(arguments->raw_data_path, arg, sizeof(arguments->raw_data_path) - 1);
+            break;
+        case 'C':
+            memset(arguments->save_catalog_path, 0x0, sizeof(arguments->save_catalog_path));
+            strncpy(arguments->save_catalog_path, arg, sizeof(arguments->save_catalog_path) - 1);
+            break;
+        case 'O':
+            memset(arguments->output_path, 0x0, sizeof(arguments->output_path));
+            strncpy(arguments->output_path, arg, sizeof(arguments->output_path) - 1);
+            break;
+        case 'K':
+            printf("Setting n_shards to %s...\n", arg);
+            arguments->n_shards = atoi(arg);
+            break;
+        case 'B':
+            if (strcmp(arg, "rows") == 0)
+                arguments->shard_by_bytes = false;
+            else if (strcmp(arg, "bytes") == 0)
+                arguments->shard_by_bytes = true;
+            else
+                argp_error(state, "shard_balance must be either rows or bytes.");
+            break;
+        case 'W':
+            if (strcmp(arg, "pwrite") == 0)
+                arguments->use_mmap = false;
+            else if (strcmp(arg, "mmap") == 0)
+                arguments->use_mmap = true;
+            else
+                argp_error(state, "writer must be either pwrite or mmap.");
+            break;
+        case 'd':
+            arguments->direct_io = true;
+            break;
+        case 'T':
+            arguments->nontemporal = true;
+            break;
+        case 'M':
+            printf("Setting max_dirty_mb to %s...\n", arg);
+            arguments->max_dirty_mb = atoi(arg);
+            break;
+        case 'z':
+            printf("Setting zipf_exponent to %s...\n", arg);
+            arguments->zipf_exponent = atof(arg);
+            break;
+        case 's':
+            printf("Setting n_stations to %s...\n", arg);
+            arguments->n_stations = atol(arg);
+            break;
+        case 'L':
+            if (sscanf(arg, "%zu-%zu", &arguments->min_name_length, &arguments->max_name_length) != 2)
+                argp_error(state, "name_length must be given as MIN-MAX.");
+            arguments->synthetic_names = true;
+            break;
+        case 'p':
+            arguments->decimals = atoi(arg);
+            if (arguments->decimals != 1 && arguments->decimals != 2)
+                argp_error(state, "decimals must be either 1 or 2.");
+            break;
+        case 't':
+            arguments->num_threads = strtoul(arg, NULL, 10);
+            if (arguments->num_threads == 0)
+                argp_error(state, "number of threads must be positive");
+            break;
+        case 'P':
+            arguments->perf = true;
+            break;
+        case OPTION_STDOUT:
+            arguments->to_stdout = true;
+            break;
+        case OPTION_ROWS_PER_SECOND:
+            arguments->rows_per_second = atol(arg);
+            break;
+        case OPTION_TRACE:
+            strncpy(arguments->trace_path, arg, sizeof(arguments->trace_path) - 1);
             break;
         default:
             return ARGP_ERR_UNKNOWN;
@@ -74,17 +175,30 @@ int main(int argc, char** argv) {
     // Parse arguments
     init_arguments(&arg_vals);
     argp_parse(&argparser, argc, argv, 0, 0, &arg_vals);
-    print_arguments(&arg_vals);
 
-    FILE* datafile = fopen(arg_vals.raw_data_path, "r");
+    // Rows take over stdout; messages still in its buffer are flushed to
+    // stderr along with everything printed later
+    int out_fd = STDOUT_FILENO;
+    if (arg_vals.to_stdout) {
+        out_fd = dup(STDOUT_FILENO);
+        dup2(STDERR_FILENO, STDOUT_FILENO);
+    }
+    print_arguments(&arg_vals);
+    if (arg_vals.trace_path[0] != '\0')
+        trace_start(arg_vals.trace_path, "create_measurements");
 
-    // Exit if file could not be opened
-    if (datafile == NULL) {
-        fprintf(stderr, "Could not read %s.\n", arg_vals.raw_data_path);
-        return 2;
+    size_t num_threads = arg_vals.num_threads;
+    if (num_threads == 0) {
+        HostInfo host;
+        hostinfo_detect(&host);
+        num_threads = host.cpus;
     }
-    
-    size_t num_threads = 16;
+
+    // Counters are inherited by the threadpools created within each phase
+    PerfReport perf;
+    PerfCounters counters;
+    perfreport_init(&perf, 0);
+    perf.rows = arg_vals.n_rows;
 
 #if TIME
     struct timeval start, end;
@@ -93,10 +207,46 @@ int main(int argc, char** argv) {
     gettimeofday(&start, NULL);
 #endif // TIME
 
+    bool count = arg_vals.perf && perf_counters_open(&counters, true);
+    if (count)
+        perf_counters_start(&counters);
+
     // Parse raw data
+    uint64_t trace_phase = trace_begin();
     printf("Parsing raw data ...\n");
-    DataRowGroup parsed_data = parse_raw_data(datafile);
-    printf("Parsed %zu rows.\n", parsed_data.num_rows);
+    StationCatalog source_catalog;
+    catalog_load(&source_catalog, arg_vals.raw_data_path);
+    printf("Parsed %zu stations.\n", source_catalog.num_stations);
+
+    // Shape the set of stations to sample from
+    WorkloadConfig workload;
+    workloadconfig_init(&workload);
+    workload.zipf_exponent = arg_vals.zipf_exponent;
+    workload.num_stations = arg_vals.n_stations;
+    workload.min_name_length = arg_vals.min_name_length;
+    workload.max_name_length = arg_vals.max_name_length;
+    workload.synthetic_names = arg_vals.synthetic_names;
+    workload.decimals = arg_vals.decimals;
+
+    StationCatalog catalog;
+    if (workload.num_stations == 0 && !workload.synthetic_names) {
+        catalog = source_catalog;
+    } else {
+        workload_build_catalog(&source_catalog, &catalog, &workload, arg_vals.seed);
+        catalog_destroy(&source_catalog);
+        printf("Using %zu stations.\n", catalog.num_stations);
+    }
+
+    if (arg_vals.save_catalog_path[0] != '\0') {
+        catalog_save(&catalog, arg_vals.save_catalog_path);
+        printf("Saved catalog to %s.\n", arg_vals.save_catalog_path);
+    }
+
+    trace_end("parse", trace_phase);
+    if (count) {
+        perf_counters_stop(&counters, perfreport_phase(&perf, "parse"));
+        perf_counters_start(&counters);
+    }
 
 #if TIME
     gettimeofday(&end, NULL);
@@ -106,17 +256,54 @@ int main(int argc, char** argv) {
 
 #if DEBUG
     printf("Parsed data:\n");
-    datarowgroup_print(&parsed_data);
+    for (uint32_t i = 0; i < catalog.num_stations; ++i) {
+        String name = catalog_name(&catalog, i);
+        printf("%s;%g\n", name.data, catalog.mean_temperatures[i]);
+    }
 #endif // DEBUG
     
 #if TIME
     gettimeofday(&start, NULL);
 #endif // TIME
 
+    if (arg_vals.to_stdout) {
+        printf("Streaming %zu rows to stdout ...\n", arg_vals.n_rows);
+        trace_phase = trace_begin();
+        size_t bytes = pipe_measurements(&catalog, arg_vals.n_rows, arg_vals.seed, num_threads, &workload,
+                                         out_fd, arg_vals.rows_per_second);
+        close(out_fd);
+        trace_end("stream", trace_phase);
+        printf("Done.\n");
+
+        if (count) {
+            perf_counters_stop(&counters, perfreport_phase(&perf, "stream"));
+            perf_counters_close(&counters);
+        }
+        if (arg_vals.perf)
+            perfreport_print(&perf, stdout);
+        perfreport_destroy(&perf);
+
+#if TIME
+        gettimeofday(&end, NULL);
+        duration = (end.tv_sec-start.tv_sec)*1000000+(end.tv_usec-start.tv_usec);
+        printf("Streaming %zu bytes took %g milliseconds.\n", bytes, (double)duration / 1000.0);
+#endif // TIME
+
+        catalog_destroy(&catalog);
+        return EXIT_SUCCESS;
+    }
+
     // Random sample with replacement from parsed data
     printf("Sampling %zu rows from parsed data ...\n", arg_vals.n_rows);
-    String* sampled_data = generate_random_temperature_sample_threaded(&parsed_data, arg_vals.n_rows, arg_vals.seed, num_threads);
+    trace_phase = trace_begin();
+    String* sampled_data = generate_random_temperature_sample_threaded(&catalog, arg_vals.n_rows, arg_vals.seed, num_threads, &workload);
+    trace_end("sample", trace_phase);
     printf("Done.\n");
+
+    if (count) {
+        perf_counters_stop(&counters, perfreport_phase(&perf, "sample"));
+        perf_counters_start(&counters);
+    }
     
 #if TIME
     gettimeofday(&end, NULL);
@@ -135,10 +322,34 @@ int main(int argc, char** argv) {
    
     // Write the sampled data to a file
     printf("Writing data ...\n");
-    const char* outfile = "../data/output.txt";
-    write_datarowgroup_threaded(sampled_data, outfile, arg_vals.n_rows, num_threads);
+    trace_phase = trace_begin();
+    const char* outfile = arg_vals.output_path;
+    WriterConfig writer_config;
+    writerconfig_init(&writer_config);
+    writer_config.backend = arg_vals.use_mmap ? WRITER_MMAP: WRITER_PWRITE;
+    writer_config.direct = arg_vals.direct_io;
+    writer_config.nontemporal = arg_vals.nontemporal;
+    writer_config.max_dirty = arg_vals.max_dirty_mb << 20;
+    if (arg_vals.n_shards == 0) {
+        write_datarowgroup_threaded(sampled_data, outfile, arg_vals.n_rows, num_threads, &writer_config);
+    } else {
+        ShardBalance balance = arg_vals.shard_by_bytes ? SHARD_BY_BYTES: SHARD_BY_ROWS;
+        ShardInfo* shards = write_datarowgroup_sharded(sampled_data, outfile, arg_vals.n_rows, arg_vals.n_shards, balance, num_threads, &writer_config);
+        write_shard_manifest(shards, arg_vals.n_shards, outfile);
+        printf("Wrote %zu shards, manifest at %s.manifest\n", arg_vals.n_shards, outfile);
+        free(shards);
+    }
+    trace_end("write", trace_phase);
     printf("Done.\n");
 
+    if (count) {
+        perf_counters_stop(&counters, perfreport_phase(&perf, "write"));
+        perf_counters_close(&counters);
+    }
+    if (arg_vals.perf)
+        perfreport_print(&perf, stdout);
+    perfreport_destroy(&perf);
+
 #if TIME
     gettimeofday(&end, NULL);
     duration = (end.tv_sec-start.tv_sec)*1000000+(end.tv_usec-start.tv_usec);
@@ -146,10 +357,8 @@ int main(int argc, char** argv) {
 #endif // TIME
 
     // Release all buffers
-    datarowgroup_destroy(&parsed_data);
+    catalog_destroy(&catalog);
     for (size_t i = 0; i < arg_vals.n_rows; ++i)
         string_destroy(sampled_data[i]);
     free(sampled_data);
-    
-    fclose(datafile);
 }
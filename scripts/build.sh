@@ -12,15 +12,47 @@ if [ -z "$DEBUG" ]; then
     DEBUG=0
 fi
 
+# Whether to use link-time optimization
+if [ -z "$LTO" ]; then
+    LTO=1
+fi
+
+# Whether to optimize with profiles from a training run
+if [ -z "$PGO" ]; then
+    PGO=0
+fi
+
+# Number of rows generated for the training run
+if [ -z "$PGO_ROWS" ]; then
+    PGO_ROWS=10000000
+fi
+
+# Space-separated -march targets to build additional binaries for,
+# e.g. "x86-64-v2 x86-64-v3 x86-64-v4"
+if [ -z "$MARCH" ]; then
+    MARCH=""
+fi
+
 CMAKE_FLAGS=""
 
 if [ "$PROFILE" = 1 ]; then
     echo "Building with profiling flags ..."
-    CMAKE_FLAGS="${CMAKE_FLAGS} -DCMAKE_CXX_FLAGS=-pg -DCMAKE_EXE_LINKER_FLAGS=-pg -DCMAKE_SHARED_LINKER_FLAGS=-pg"
+    CMAKE_FLAGS="${CMAKE_FLAGS} -DONEBRC_GPROF=ON"
 fi
 if [ "$DEBUG" = 1 ]; then
     echo "Building with debug flags ..."
     CMAKE_FLAGS="${CMAKE_FLAGS} -DCMAKE_BUILD_TYPE=Debug"
+else
+    CMAKE_FLAGS="${CMAKE_FLAGS} -DCMAKE_BUILD_TYPE=Release"
+fi
+if [ "$LTO" = 1 ]; then
+    CMAKE_FLAGS="${CMAKE_FLAGS} -DONEBRC_LTO=ON"
+else
+    CMAKE_FLAGS="${CMAKE_FLAGS} -DONEBRC_LTO=OFF"
+fi
+if [ -n "$MARCH" ]; then
+    echo "Building additional binaries for ${MARCH} ..."
+    CMAKE_FLAGS="${CMAKE_FLAGS} -DONEBRC_MARCH=$(echo "$MARCH" | tr ' ' ';')"
 fi
 
 echo "$CMAKE_FLAGS"
@@ -29,9 +61,22 @@ if [ -d build ]; then
     rm -rf build
 fi
 { mkdir build; cd build; } || { echo "Failed to create build directory."; exit 1; }
-if [ "$CMAKE_FLAGS" = "" ]; then
-    cmake -DCMAKE_BUILD_TYPE=Release ..
+
+if [ "$PGO" = 1 ]; then
+    # Instrumented build, trained on a generated dataset
+    echo "Building instrumented binaries for profile-guided optimization ..."
+    cmake ${CMAKE_FLAGS} -DONEBRC_PGO=GENERATE .. || exit 1
+    make create_measurements analyze || exit 1
+
+    echo "Training on ${PGO_ROWS} rows ..."
+    ./create_measurements -D ../data/weather_stations.txt -N "$PGO_ROWS" -O pgo_training.txt > /dev/null || exit 1
+    ./analyze pgo_training.txt > /dev/null || exit 1
+    rm -f pgo_training.txt
+
+    # The optimized build reuses this directory so that object paths match the profiles
+    echo "Building with profile-guided optimization ..."
+    cmake ${CMAKE_FLAGS} -DONEBRC_PGO=USE .. || exit 1
 else
-    cmake ${CMAKE_FLAGS} ..
+    cmake ${CMAKE_FLAGS} .. || exit 1
 fi
 make
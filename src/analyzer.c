@@ -0,0 +1,684 @@
+/* Parallel aggregation of measurement files.
+
+                    GNU AFFERO GENERAL PUBLIC LICENSE
+                       Version 3, 19 November 2007
+
+    Copyright (C) 2024  Debajyoti Debnath
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published
+    by the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include "analyzer.h"
+#include "format.h"
+#include "gzip_input.h"
+#include "stream_input.h"
+#include "trace.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <yatpool.h>
+
+// State shared by the workers of one analyze_buffer call
+typedef struct {
+    const char* data;
+    size_t* chunk_starts;
+    size_t num_chunks;
+    size_t next_chunk;
+    Aggregator* aggregators;
+    PerfReport* perf;
+} _AnalyzerJob;
+
+typedef struct {
+    _AnalyzerJob* job;
+    size_t worker;
+} _AggregateChunksArg;
+
+void _aggregatechunksarg_init(_AggregateChunksArg** arg, _AnalyzerJob* job, size_t worker) {
+    if (arg==NULL || job==NULL) return;
+    *arg = (_AggregateChunksArg*)malloc(sizeof(_AggregateChunksArg));
+    (*arg)->job = job;
+    (*arg)->worker = worker;
+}
+
+void _aggregatechunksarg_destroy(void* arg) {
+    if (arg==NULL) return;
+    _AggregateChunksArg* _arg = (_AggregateChunksArg*)arg;
+    free(_arg);
+}
+
+/// Initialize an analyzer configuration to defaults
+void analyzerconfig_init(AnalyzerConfig* config) {
+    if (config==NULL) return;
+    config->num_threads = ANALYZER_DEFAULT_THREADS;
+    config->num_chunks = 0;
+    config->chunk_size = 0;
+    config->batch_width = ANALYZER_DEFAULT_BATCH_WIDTH;
+    config->catalog = NULL;
+    config->perf = NULL;
+    config->table_mode = ANALYZER_PRIVATE_TABLES;
+    config->shared_capacity = SHARED_TABLE_DEFAULT_CAPACITY;
+    config->num_partitions = ANALYZER_DEFAULT_PARTITIONS;
+    config->partition_table_bytes = ANALYZER_PARTITION_TABLE_BYTES;
+    config->histograms = false;
+    config->max_memory = 0;
+    config->spill_directory = "/tmp";
+}
+
+/// Parse a temperature such as "-12.3" or "4.56" between p and end into
+/// hundredths of a degree. Digits beyond the second decimal are ignored.
+int32_t parse_temperature(const char* p, const char* end) {
+    bool negative = false;
+    if (p < end && *p == '-') {
+        negative = true;
+        p++;
+    }
+    int32_t value = 0;
+    int decimals = -1;
+    for (; p < end; ++p) {
+        char c = *p;
+        if (c == '.') {
+            decimals = 0;
+            continue;
+        }
+        if (c < '0' || c > '9') break;
+        if (decimals >= 2) continue;
+        value = value * 10 + (c - '0');
+        if (decimals >= 0) decimals++;
+    }
+    for (decimals = decimals < 0 ? 0: decimals; decimals < 2; ++decimals)
+        value *= 10;
+    return negative ? -value: value;
+}
+
+/// Initialize an empty aggregator. With a catalog, its stations are
+/// aggregated by ID.
+void aggregator_init(Aggregator* aggregator, const StationCatalog* catalog) {
+    if (aggregator==NULL) {
+        perror("Error: Null pointer provided as argument.");
+        abort();
+    }
+    memset(aggregator, 0x0, sizeof(Aggregator));
+    stats_table_init(&aggregator->table, STATS_TABLE_DEFAULT_CAPACITY);
+    aggregator->catalog = catalog;
+    aggregator->batch_width = 1;
+    if (catalog != NULL) {
+        aggregator->catalog_stats = (StationStats*)calloc(catalog->num_stations, sizeof(StationStats));
+        for (size_t i = 0; i < catalog->num_stations; ++i) {
+            aggregator->catalog_stats[i].min = INT32_MAX;
+            aggregator->catalog_stats[i].max = INT32_MIN;
+        }
+        aggregator->table.num_allocations++;
+    }
+}
+
+/// Find the statistics of a station, adding it if it is new
+static StationStats* _aggregator_lookup(Aggregator* aggregator, const char* name, size_t length, uint64_t hash) {
+    if (aggregator->catalog != NULL) {
+        uint32_t id = catalog_find(aggregator->catalog, name, length, hash);
+        if (id != CATALOG_NOT_FOUND)
+            return &aggregator->catalog_stats[id];
+    }
+    return stats_table_find_or_insert(&aggregator->table, name, length, hash);
+}
+
+/// Add one measurement of a station, to the shared table if there is one
+static inline void _aggregator_add(Aggregator* aggregator, const char* name, size_t length, uint64_t hash, int32_t value) {
+    if (aggregator->shared == NULL) {
+        StationStats* stats = _aggregator_lookup(aggregator, name, length, hash);
+        station_stats_add(stats, value);
+        if (aggregator->histograms)
+            station_stats_add_histogram(stats, value);
+        if (aggregator->spill != NULL && aggregator->table.size >= aggregator->spill_stations)
+            spillset_spill(aggregator->spill, aggregator->worker, &aggregator->table);
+        return;
+    }
+    if (aggregator->catalog != NULL) {
+        uint32_t id = catalog_find(aggregator->catalog, name, length, hash);
+        if (id != CATALOG_NOT_FOUND) {
+            station_stats_add_atomic(&aggregator->shared_catalog_stats[id], value);
+            return;
+        }
+    }
+    StationStats* stats = shared_table_find_or_insert(aggregator->shared, name, length, hash, aggregator->worker);
+    station_stats_add_atomic(stats, value);
+}
+
+// Row parsed ahead of its table lookup
+typedef struct {
+    const char* name;
+    size_t length;
+    uint64_t hash;
+    int32_t value;
+} _PendingRow;
+
+/// Prefetch the slots the lookup of a station will probe first
+static inline void _aggregator_prefetch(const Aggregator* aggregator, uint64_t hash) {
+    if (aggregator->catalog != NULL)
+        __builtin_prefetch(&aggregator->catalog->index[hash & (aggregator->catalog->index_capacity - 1)]);
+    __builtin_prefetch(&aggregator->table.entries[hash & (aggregator->table.capacity - 1)], 1);
+}
+
+/// Parse the line at p into row. Returns the start of the next line, p
+/// itself if the line is incomplete and final is not set. A line without a
+/// ';' is skipped with row->name set to NULL.
+static inline const char* _parse_row(const char* p, const char* end, bool final, _PendingRow* row) {
+    const char* semi = p;
+    while (semi < end && *semi != ';' && *semi != '\n')
+        semi++;
+    if (semi == end && !final) return p;
+    if (semi == end || *semi == '\n') {
+        row->name = NULL;
+        return semi + 1;
+    }
+    const char* newline = (const char*)memchr(semi + 1, '\n', (size_t)(end - semi - 1));
+    if (newline == NULL) {
+        if (!final) return p;
+        newline = end;
+    }
+    row->name = p;
+    row->length = (size_t)(semi - p);
+    row->value = parse_temperature(semi + 1, newline);
+    row->hash = station_hash(p, row->length);
+    return newline + 1;
+}
+
+/// aggregator_consume for private tables, in batches of batch_width rows:
+/// every row of a batch is parsed and hashed and its table slot prefetched
+/// before the first of them is looked up, so the cache misses of a large
+/// table overlap with parsing instead of stalling every row
+static const char* _aggregator_consume_batched(Aggregator* aggregator, const char* begin, const char* end, bool final) {
+    _PendingRow batch[ANALYZER_MAX_BATCH_WIDTH];
+    size_t width = aggregator->batch_width < ANALYZER_MAX_BATCH_WIDTH ? aggregator->batch_width: ANALYZER_MAX_BATCH_WIDTH;
+    const char* p = begin;
+    uint64_t rows = 0;
+    bool incomplete = false;
+#if ONEBRC_STATS
+    uint64_t batches = 0;
+    uint64_t sample_interval = STATS_SAMPLE_INTERVAL / width > 0 ? STATS_SAMPLE_INTERVAL / width: 1;
+#endif
+    while (p < end && !incomplete) {
+#if ONEBRC_STATS
+        bool sampled = batches++ % sample_interval == 0;
+        uint64_t start_cycles = sampled ? stats_cycles(): 0;
+#endif
+        size_t n = 0;
+        while (n < width && p < end) {
+            const char* next = _parse_row(p, end, final, &batch[n]);
+            if (next == p) {
+                incomplete = true;
+                break;
+            }
+            p = next;
+            if (batch[n].name == NULL) continue;
+            _aggregator_prefetch(aggregator, batch[n].hash);
+            n++;
+        }
+#if ONEBRC_STATS
+        uint64_t parsed_cycles = sampled ? stats_cycles(): 0;
+#endif
+        for (size_t i = 0; i < n; ++i)
+            _aggregator_add(aggregator, batch[i].name, batch[i].length, batch[i].hash, batch[i].value);
+#if ONEBRC_STATS
+        if (sampled && aggregator->stats != NULL) {
+            aggregator->stats->parse_cycles += parsed_cycles - start_cycles;
+            aggregator->stats->aggregate_cycles += stats_cycles() - parsed_cycles;
+        }
+#endif
+        rows += n;
+    }
+    p = p > end ? end: p;
+    aggregator->rows += rows;
+    aggregator->bytes += (uint64_t)(p - begin);
+    return p;
+}
+
+/// Aggregate every complete line between begin and end and return a pointer
+/// to the first byte that was not consumed. A trailing line without a
+/// newline is only consumed if final is set. Lines without a ';' are skipped.
+const char* aggregator_consume(Aggregator* aggregator, const char* begin, const char* end, bool final) {
+    if (aggregator->batch_width > 1 && aggregator->shared == NULL)
+        return _aggregator_consume_batched(aggregator, begin, end, final);
+    const char* p = begin;
+    uint64_t rows = 0;
+    while (p < end) {
+#if ONEBRC_STATS
+        bool sampled = rows % STATS_SAMPLE_INTERVAL == 0;
+        uint64_t start_cycles = sampled ? stats_cycles(): 0;
+#endif
+        const char* semi = p;
+        while (semi < end && *semi != ';' && *semi != '\n')
+            semi++;
+        if (semi == end && !final) break;
+        if (semi == end || *semi == '\n') {
+            p = semi + 1;
+            continue;
+        }
+        const char* newline = (const char*)memchr(semi + 1, '\n', (size_t)(end - semi - 1));
+        if (newline == NULL) {
+            if (!final) break;
+            newline = end;
+        }
+        size_t length = (size_t)(semi - p);
+        int32_t value = parse_temperature(semi + 1, newline);
+        uint64_t hash = station_hash(p, length);
+#if ONEBRC_STATS
+        uint64_t parsed_cycles = sampled ? stats_cycles(): 0;
+#endif
+        _aggregator_add(aggregator, p, length, hash, value);
+#if ONEBRC_STATS
+        if (sampled && aggregator->stats != NULL) {
+            aggregator->stats->parse_cycles += parsed_cycles - start_cycles;
+            aggregator->stats->aggregate_cycles += stats_cycles() - parsed_cycles;
+        }
+#endif
+        rows++;
+        p = newline + 1;
+    }
+    p = p > end ? end: p;
+    aggregator->rows += rows;
+    aggregator->bytes += (uint64_t)(p - begin);
+    return p;
+}
+
+/// Fold every station of src into dest
+void aggregator_merge(Aggregator* dest, const Aggregator* src) {
+    if (dest==NULL || src==NULL) return;
+    if (dest->catalog != src->catalog) {
+        perror("Error: cannot merge aggregators with different catalogs.");
+        abort();
+    }
+    if (src->catalog != NULL) {
+        for (size_t i = 0; i < src->catalog->num_stations; ++i) {
+            if (src->catalog_stats[i].count == 0) continue;
+            station_stats_merge(&dest->catalog_stats[i], &src->catalog_stats[i]);
+        }
+    }
+    stats_table_merge(&dest->table, &src->table);
+    dest->rows += src->rows;
+    dest->bytes += src->bytes;
+}
+
+/// Number of distinct stations seen
+size_t aggregator_num_stations(const Aggregator* aggregator) {
+    size_t n = aggregator->table.size;
+    if (aggregator->catalog != NULL) {
+        for (size_t i = 0; i < aggregator->catalog->num_stations; ++i)
+            n += aggregator->catalog_stats[i].count > 0;
+    }
+    if (aggregator->spill != NULL)
+        n += aggregator->spill->num_stations;
+    return n;
+}
+
+/// Print "name=min/max/mean" for one station, or return false if it was
+/// never seen. Spilled stations are not searched.
+bool aggregator_print_station(const Aggregator* aggregator, const char* name, size_t length, FILE* out) {
+    if (aggregator==NULL || name==NULL) return false;
+    uint64_t hash = station_hash(name, length);
+    const StationStats* stats = NULL;
+    if (aggregator->catalog != NULL) {
+        uint32_t id = catalog_find(aggregator->catalog, name, length, hash);
+        stats = id != CATALOG_NOT_FOUND ? &aggregator->catalog_stats[id]: NULL;
+    }
+    if (stats == NULL || stats->count == 0)
+        stats = stats_table_find(&aggregator->table, name, length, hash);
+    if (stats == NULL || stats->count == 0)
+        return false;
+    char values[3 * (FORMAT_TENTHS_MAX + 1) + 1];
+    char* p = values;
+    *p++ = '=';
+    p = format_tenths(p, round_tenths(stats->min, 1));
+    *p++ = '/';
+    p = format_tenths(p, round_tenths(stats->max, 1));
+    *p++ = '/';
+    p = format_tenths(p, round_tenths(stats->sum, stats->count));
+    *p++ = '\n';
+    fwrite(name, 1, length, out);
+    fwrite(values, 1, (size_t)(p - values), out);
+    return true;
+}
+
+/// Release the memory held by an aggregator
+void aggregator_destroy(Aggregator* aggregator) {
+    if (aggregator==NULL) return;
+    stats_table_destroy(&aggregator->table);
+    for (size_t i = 0; aggregator->catalog_stats != NULL && i < aggregator->catalog->num_stations; ++i)
+        station_stats_destroy(&aggregator->catalog_stats[i]);
+    free(aggregator->catalog_stats);
+    aggregator->catalog_stats = NULL;
+    if (aggregator->spill != NULL) {
+        spillset_destroy(aggregator->spill);
+        free(aggregator->spill);
+        aggregator->spill = NULL;
+    }
+}
+
+/// Function for threadpool to aggregate chunks until none are left
+void* _aggregate_chunks(void* arg) {
+    _AggregateChunksArg* chunkarg = (_AggregateChunksArg*)arg;
+    _AnalyzerJob* job = chunkarg->job;
+    Aggregator* aggregator = &job->aggregators[chunkarg->worker];
+#if ONEBRC_STATS
+    double start = stats_now();
+#endif
+
+    // Counters are opened by the worker itself so that they follow its thread
+    PerfCounters counters;
+    bool count = perfreport_worker_start(job->perf, chunkarg->worker, &counters);
+
+    size_t chunk;
+    while ((chunk = __atomic_fetch_add(&job->next_chunk, 1, __ATOMIC_RELAXED)) < job->num_chunks) {
+        const char* begin = job->data + job->chunk_starts[chunk];
+        const char* end = job->data + job->chunk_starts[chunk + 1];
+        uint64_t trace_start = trace_begin();
+        aggregator_consume(aggregator, begin, end, true);
+        trace_end("parse_chunk", trace_start);
+        STATS(if (aggregator->stats != NULL) aggregator->stats->chunks++);
+    }
+
+    if (count)
+        perfreport_worker_stop(job->perf, chunkarg->worker, &counters, aggregator->rows);
+
+#if ONEBRC_STATS
+    if (aggregator->stats != NULL) {
+        aggregator->stats->seconds = stats_now() - start;
+        aggregator->stats->rows = aggregator->rows;
+        aggregator->stats->bytes = aggregator->bytes;
+    }
+#endif
+    return NULL;
+}
+
+/// Offsets of num_chunks line-aligned chunks of roughly equal size.
+/// The returned array has num_chunks + 1 entries, the last being size.
+size_t* analyzer_split_chunks(const char* data, size_t size, size_t num_chunks) {
+    size_t* starts = (size_t*)calloc(num_chunks + 1, sizeof(size_t));
+    for (size_t i = 1; i < num_chunks; ++i) {
+        size_t start = size / num_chunks * i;
+        start = start < starts[i-1] ? starts[i-1]: start;
+        const char* newline = start == 0 ? NULL: (const char*)memchr(data + start - 1, '\n', size - start + 1);
+        starts[i] = newline == NULL ? size: (size_t)(newline - data) + 1;
+    }
+    starts[num_chunks] = size;
+    return starts;
+}
+
+/// Make the workers of a job aggregate into one shared table and catalog
+/// array instead of their own
+static void _share_aggregators(Aggregator* aggregators, size_t num_threads, const AnalyzerConfig* config,
+                               SharedStatsTable* shared, StationStats** shared_catalog_stats) {
+    shared_table_init(shared, config->shared_capacity, num_threads);
+    *shared_catalog_stats = NULL;
+    if (config->catalog != NULL) {
+        *shared_catalog_stats = (StationStats*)calloc(config->catalog->num_stations, sizeof(StationStats));
+        for (size_t i = 0; i < config->catalog->num_stations; ++i) {
+            (*shared_catalog_stats)[i].min = INT32_MAX;
+            (*shared_catalog_stats)[i].max = INT32_MIN;
+        }
+    }
+    for (size_t i = 0; i < num_threads; ++i) {
+        aggregators[i].catalog = config->catalog;
+        aggregators[i].shared = shared;
+        aggregators[i].shared_catalog_stats = *shared_catalog_stats;
+        aggregators[i].worker = i;
+    }
+}
+
+/// Collect the shared table and catalog array into one aggregator and
+/// release the workers' aggregators
+static void _collect_shared(Aggregator* aggregators, size_t num_threads, const AnalyzerConfig* config,
+                            SharedStatsTable* shared, StationStats* shared_catalog_stats, Aggregator* result) {
+    aggregator_init(result, config->catalog);
+    if (config->catalog != NULL)
+        memcpy(result->catalog_stats, shared_catalog_stats, config->catalog->num_stations * sizeof(StationStats));
+    shared_table_collect(shared, &result->table);
+    for (size_t i = 0; i < num_threads; ++i) {
+        result->rows += aggregators[i].rows;
+        result->bytes += aggregators[i].bytes;
+        aggregator_destroy(&aggregators[i]);
+    }
+    shared_table_destroy(shared);
+    free(shared_catalog_stats);
+}
+
+/// Aggregate a buffer of measurements with config->num_threads workers,
+/// each with its own aggregator merged into result at the end, or all
+/// with one shared table if config->table_mode is ANALYZER_SHARED_TABLE
+void analyze_buffer(const char* data, size_t size, const AnalyzerConfig* config, Aggregator* result, RunStats* stats) {
+    if (config==NULL || result==NULL || (data==NULL && size>0)) {
+        perror("Error: Null pointer provided as argument.");
+        abort();
+    }
+    if (config->num_threads==0) {
+        perror("Error: num_threads cannot be zero.");
+        abort();
+    }
+    if (config->histograms && config->table_mode == ANALYZER_SHARED_TABLE) {
+        fprintf(stderr, "Error: histograms are not supported with the shared table.\n");
+        exit(EXIT_FAILURE);
+    }
+    if (config->table_mode == ANALYZER_PARTITIONED) {
+        analyze_buffer_partitioned(data, size, config, result, stats);
+        return;
+    }
+
+    size_t num_threads = config->num_threads;
+    size_t num_chunks = config->num_chunks;
+    if (num_chunks == 0 && config->chunk_size > 0) {
+        num_chunks = size / config->chunk_size + 1;
+    } else if (num_chunks == 0) {
+        num_chunks = ANALYZER_CHUNKS_PER_THREAD * num_threads;
+        size_t max_chunks = size / ANALYZER_MIN_CHUNK_SIZE + 1;
+        num_chunks = num_chunks > max_chunks ? max_chunks: num_chunks;
+    }
+    num_threads = num_threads > num_chunks ? num_chunks: num_threads;
+
+    _AnalyzerJob job;
+    job.data = data;
+    job.chunk_starts = analyzer_split_chunks(data, size, num_chunks);
+    job.num_chunks = num_chunks;
+    job.next_chunk = 0;
+    job.perf = config->perf;
+    job.aggregators = (Aggregator*)calloc(num_threads, sizeof(Aggregator));
+    // Allocations of the job are counted as they are made: its chunk
+    // offsets and aggregators here, the spill set, the pool and every task
+    // with its argument below. The tables count their own.
+    STATS(if (stats != NULL) stats->allocations += 2);
+    bool shared_mode = config->table_mode == ANALYZER_SHARED_TABLE;
+    for (size_t i = 0; i < num_threads; ++i) {
+        aggregator_init(&job.aggregators[i], shared_mode ? NULL: config->catalog);
+        job.aggregators[i].histograms = config->histograms;
+        job.aggregators[i].batch_width = config->batch_width;
+        STATS(job.aggregators[i].stats = stats != NULL && i < stats->num_workers ? &stats->workers[i]: NULL);
+    }
+    SharedStatsTable shared;
+    StationStats* shared_catalog_stats = NULL;
+    if (shared_mode)
+        _share_aggregators(job.aggregators, num_threads, config, &shared, &shared_catalog_stats);
+    SpillSet* spill = NULL;
+    if (config->max_memory > 0 && config->table_mode == ANALYZER_PRIVATE_TABLES) {
+        spill = (SpillSet*)malloc(sizeof(SpillSet));
+        STATS(if (stats != NULL) stats->allocations++);
+        spillset_init(spill, config->spill_directory, num_threads);
+        for (size_t i = 0; i < num_threads; ++i) {
+            job.aggregators[i].spill = spill;
+            job.aggregators[i].worker = i;
+            job.aggregators[i].spill_stations = spill_table_stations(config->max_memory / num_threads);
+        }
+    }
+
+#if ONEBRC_STATS
+    double start = stats_now();
+#endif
+
+    YATPool* pool;
+    yatpool_init(&pool, num_threads, num_threads);
+    STATS(if (stats != NULL) stats->allocations++);
+
+    for (size_t i = 0; i < num_threads; ++i) {
+        Task* task;
+        _AggregateChunksArg* arg;
+        _aggregatechunksarg_init(&arg, &job, i);
+
+        trace_task_init(&task, "aggregate_chunks", &_aggregate_chunks, arg, &_aggregatechunksarg_destroy);
+        yatpool_put(pool, task);
+        STATS(if (stats != NULL) stats->allocations += 2);
+    }
+
+    yatpool_wait(pool);
+    yatpool_destroy(pool);
+
+#if ONEBRC_STATS
+    double parsed = stats_now();
+    if (stats != NULL)
+        runstats_split_parse_aggregate(stats, parsed - start);
+#endif
+
+    PerfCounters counters;
+    bool count = config->perf != NULL && perf_counters_open(&counters, false);
+    if (count)
+        perf_counters_start(&counters);
+
+    // Merge every worker into the first one
+    uint64_t trace_merge = trace_begin();
+#if ONEBRC_STATS
+    size_t shared_size = shared_mode ? shared.size: 0;
+    size_t shared_capacity = shared_mode ? shared.capacity: 0;
+#endif
+    if (shared_mode) {
+        Aggregator collected;
+        _collect_shared(job.aggregators, num_threads, config, &shared, shared_catalog_stats, &collected);
+        job.aggregators[0] = collected;
+        num_threads = 1;
+    }
+    if (spill != NULL) {
+        // Once anything was spilled, every station goes through the merged
+        // spill files and the emptied tables merge trivially
+        bool spilled = spillset_spilled(spill);
+        for (size_t i = 0; i < num_threads; ++i) {
+            if (spilled)
+                spillset_spill(spill, i, &job.aggregators[i].table);
+            job.aggregators[i].spill = NULL;
+        }
+        if (spilled) {
+            spillset_merge(spill, config->num_threads, config->max_memory);
+            job.aggregators[0].spill = spill;
+        } else {
+            spillset_destroy(spill);
+            free(spill);
+        }
+    }
+#if ONEBRC_STATS
+    for (size_t i = 1; stats != NULL && i < num_threads; ++i) {
+        for (size_t b = 0; b < PROBE_HISTOGRAM_BUCKETS; ++b)
+            stats->probe_histogram[b] += job.aggregators[i].table.probe_histogram[b];
+        stats->allocations += job.aggregators[i].table.num_allocations;
+    }
+#endif
+    aggregator_merge_parallel(job.aggregators, num_threads, num_threads);
+
+    trace_end("merge", trace_merge);
+    if (count) {
+        perf_counters_stop(&counters, perfreport_phase(config->perf, "merge"));
+        perf_counters_close(&counters);
+    }
+    if (config->perf != NULL)
+        config->perf->rows = job.aggregators[0].rows;
+
+#if ONEBRC_STATS
+    if (stats != NULL) {
+        stats->phase_seconds[PHASE_MERGE] = stats_now() - parsed;
+        for (size_t b = 0; b < PROBE_HISTOGRAM_BUCKETS; ++b)
+            stats->probe_histogram[b] += job.aggregators[0].table.probe_histogram[b];
+        stats->allocations += job.aggregators[0].table.num_allocations;
+        stats->table_size = shared_mode ? shared_size: job.aggregators[0].table.size;
+        stats->table_capacity = shared_mode ? shared_capacity: job.aggregators[0].table.capacity;
+    }
+    job.aggregators[0].stats = NULL;
+#endif
+
+    *result = job.aggregators[0];
+    free(job.aggregators);
+    free(job.chunk_starts);
+}
+
+/// Map a measurements file and aggregate it with analyze_buffer. Pipes and
+/// other files that cannot be mapped, including stdin given as "-", are
+/// read as a stream instead.
+void analyze_file(const char* path, const AnalyzerConfig* config, Aggregator* result, RunStats* stats) {
+    if (path==NULL || config==NULL) {
+        perror("Error: Null pointer provided as argument.");
+        abort();
+    }
+#if ONEBRC_STATS
+    double start = stats_now();
+#endif
+    PerfCounters counters;
+    bool count = config->perf != NULL && perf_counters_open(&counters, false);
+    if (count)
+        perf_counters_start(&counters);
+
+    int fd = strcmp(path, "-") == 0 ? STDIN_FILENO: open(path, O_RDONLY);
+    if (fd==-1) {
+        fprintf(stderr, "Error reading file %s\n", path);
+        exit(EXIT_FAILURE);
+    }
+    struct stat st;
+    if (fstat(fd, &st)==-1) {
+        perror("Error: could not stat input file.");
+        exit(EXIT_FAILURE);
+    }
+    if (!S_ISREG(st.st_mode)) {
+        if (count) {
+            perf_counters_stop(&counters, perfreport_phase(config->perf, "map"));
+            perf_counters_close(&counters);
+        }
+        analyze_fd(fd, config, result, stats);
+        if (fd != STDIN_FILENO)
+            close(fd);
+        return;
+    }
+    size_t size = (size_t)st.st_size;
+
+    char* data = NULL;
+    if (size > 0) {
+        data = (char*)mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data==MAP_FAILED) {
+            perror("Error: mmap error.");
+            exit(EXIT_FAILURE);
+        }
+        madvise(data, size, MADV_WILLNEED);
+    }
+    close(fd);
+
+#if ONEBRC_STATS
+    if (stats != NULL)
+        stats->phase_seconds[PHASE_MAP] = stats_now() - start;
+#endif
+    if (count) {
+        perf_counters_stop(&counters, perfreport_phase(config->perf, "map"));
+        perf_counters_close(&counters);
+    }
+
+    // Compressed input is recognized by its magic bytes rather than its name
+    if (gzip_is_compressed(data, size))
+        analyze_gzip_buffer(data, size, config, result, stats);
+    else
+        analyze_buffer(data, size, config, result, stats);
+
+    if (data != NULL)
+        munmap(data, size);
+}
@@ -0,0 +1,145 @@
+/* Parallel aggregation of measurement files.
+
+                    GNU AFFERO GENERAL PUBLIC LICENSE
+                       Version 3, 19 November 2007
+
+    Copyright (C) 2024  Debajyoti Debnath
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published
+    by the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef _ANALYZER_H_
+#define _ANALYZER_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "catalog.h"
+#include "stats_table.h"
+#include "shared_table.h"
+#include "spill.h"
+#include "run_stats.h"
+#include "perf_counters.h"
+
+// Analyzer threads set by analyzerconfig_init. The programs replace it with
+// the CPUs hostinfo_detect finds unless -t is given.
+#define ANALYZER_DEFAULT_THREADS 16
+// Number of chunks per thread the input is split into
+#define ANALYZER_CHUNKS_PER_THREAD 8
+// Smallest chunk the input is split into
+#define ANALYZER_MIN_CHUNK_SIZE (1 << 20)
+
+// Rows parsed ahead of their table lookups by default, and at most
+#define ANALYZER_DEFAULT_BATCH_WIDTH 16
+#define ANALYZER_MAX_BATCH_WIDTH 64
+
+// Default number of partitions of the partitioned mode
+#define ANALYZER_DEFAULT_PARTITIONS 256
+
+// Input scattered per round of the partitioned mode, which bounds the
+// memory held by partition buffers
+#define ANALYZER_PARTITION_ROUND_SIZE (128 << 20)
+// Bytes of table one partition may take by default, half of a 1 MiB L2
+// cache, before the partitions are split, and the most partitions they are
+// split into
+#define ANALYZER_PARTITION_TABLE_BYTES (512 << 10)
+#define ANALYZER_MAX_PARTITIONS 4096
+
+// Stations in all worker tables below which they are merged serially
+#define ANALYZER_MIN_PARALLEL_MERGE (1 << 16)
+// Hash partitions per thread of a parallel merge, and the fewest table
+// slots each partition is given per period of the smallest table
+#define ANALYZER_MERGE_PARTITIONS_PER_THREAD 4
+#define ANALYZER_MERGE_MIN_RUN 64
+// Worker table slots whose key and destination are prefetched ahead of
+// the one being merged
+#define ANALYZER_MERGE_PREFETCH_DISTANCE 8
+
+// Where workers aggregate: each into its own table, merged at the end,
+// all into one concurrent table, or first scattered into hash partitions
+// that are then aggregated one at a time
+typedef enum {
+    ANALYZER_PRIVATE_TABLES,
+    ANALYZER_SHARED_TABLE,
+    ANALYZER_PARTITIONED
+} AnalyzerTableMode;
+
+// Settings of one analyzer run
+typedef struct {
+    size_t num_threads;
+    size_t num_chunks;
+    // Bytes per chunk when num_chunks is 0, or 0 for ANALYZER_CHUNKS_PER_THREAD
+    // chunks per thread
+    size_t chunk_size;
+    // Rows whose table slots are prefetched before any of them is
+    // aggregated, or 1 to aggregate every row as soon as it is parsed
+    size_t batch_width;
+    const StationCatalog* catalog;
+    PerfReport* perf;
+    AnalyzerTableMode table_mode;
+    size_t shared_capacity;
+    size_t num_partitions;
+    // Bytes of table a partition may grow to before partitions are split
+    size_t partition_table_bytes;
+    // Whether every station keeps a histogram for quantiles
+    bool histograms;
+    // Bytes the tables of private workers may take before they are
+    // spilled to files in spill_directory, or 0 for no limit
+    size_t max_memory;
+    const char* spill_directory;
+} AnalyzerConfig;
+
+// Statistics of every station seen by one worker, or of a whole run once
+// the workers have been merged. Stations found in the catalog are kept in
+// an array indexed by their ID, all others in the table.
+typedef struct {
+    StatsTable table;
+    StationStats* catalog_stats;
+    const StationCatalog* catalog;
+    uint64_t rows;
+    uint64_t bytes;
+    bool histograms;
+    size_t batch_width;
+    // Set when aggregating into a table shared with other workers
+    SharedStatsTable* shared;
+    StationStats* shared_catalog_stats;
+    size_t worker;
+    // Set when the table is spilled once it holds spill_stations stations.
+    // The result of a run that spilled owns the spill set of merged stations.
+    SpillSet* spill;
+    size_t spill_stations;
+#if ONEBRC_STATS
+    WorkerStats* stats;
+#endif
+} Aggregator;
+
+void analyzerconfig_init(AnalyzerConfig* config);
+int32_t parse_temperature(const char* p, const char* end);
+void aggregator_init(Aggregator* aggregator, const StationCatalog* catalog);
+const char* aggregator_consume(Aggregator* aggregator, const char* begin, const char* end, bool final);
+void aggregator_merge(Aggregator* dest, const Aggregator* src);
+void aggregator_merge_parallel(Aggregator* aggregators, size_t num_aggregators, size_t num_threads);
+size_t aggregator_num_stations(const Aggregator* aggregator);
+bool aggregator_print_station(const Aggregator* aggregator, const char* name, size_t length, FILE* out);
+void aggregator_destroy(Aggregator* aggregator);
+size_t* analyzer_split_chunks(const char* data, size_t size, size_t num_chunks);
+void analyze_buffer_partitioned(const char* data, size_t size, const AnalyzerConfig* config, Aggregator* result, RunStats* stats);
+void analyze_gzip_buffer(const char* data, size_t size, const AnalyzerConfig* config, Aggregator* result, RunStats* stats);
+void analyze_buffer(const char* data, size_t size, const AnalyzerConfig* config, Aggregator* result, RunStats* stats);
+void analyze_file(const char* path, const AnalyzerConfig* config, Aggregator* result, RunStats* stats);
+
+#endif // _ANALYZER_H_
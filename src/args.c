@@ -21,14 +21,37 @@
 */
 
 #include "args.h"
+#include "output.h"
 
 /// Initialize arguments to defaults
 void init_arguments(struct arguments* arg_vals) {
     arg_vals->n_rows = 1000000000;
     arg_vals->seed = 42;
+    arg_vals->n_shards = 0;
+    arg_vals->shard_by_bytes = false;
+    arg_vals->use_mmap = false;
+    arg_vals->direct_io = false;
+    arg_vals->nontemporal = false;
+    arg_vals->max_dirty_mb = 256;
+    arg_vals->zipf_exponent = 0.0;
+    arg_vals->n_stations = 0;
+    arg_vals->min_name_length = 3;
+    arg_vals->max_name_length = 24;
+    arg_vals->synthetic_names = false;
+    arg_vals->decimals = 2;
+    arg_vals->perf = false;
+    arg_vals->num_threads = 0;
+    arg_vals->to_stdout = false;
+    arg_vals->rows_per_second = 0;
 
     char data_path[] = "../data/weather_stations.txt";
     strncpy(arg_vals->raw_data_path, data_path, sizeof(data_path));
+
+    char output_path[] = "../data/output.txt";
+    strncpy(arg_vals->output_path, output_path, sizeof(output_path));
+
+    memset(arg_vals->save_catalog_path, 0x0, sizeof(arg_vals->save_catalog_path));
+    memset(arg_vals->trace_path, 0x0, sizeof(arg_vals->trace_path));
 }
 
 /// Print arguments
@@ -36,8 +59,58 @@ void print_arguments(struct arguments* arg_vals) {
     printf(
         "Arguments:\n"
         "n_rows = %zu, seed = %zu,\n"
-        "raw_data_path = %s\n",
+        "n_shards = %zu, shard_balance = %s,\n"
+        "writer = %s, direct_io = %d, nontemporal = %d, max_dirty_mb = %zu,\n"
+        "zipf_exponent = %g, n_stations = %zu, name_length = %zu-%zu%s, decimals = %d,\n"
+        "perf = %d, num_threads = %zu, stdout = %d, rows_per_second = %zu,\n"
+        "raw_data_path = %s\n"
+        "output_path = %s\n"
+        "save_catalog_path = %s\n"
+        "trace_path = %s\n",
         arg_vals->n_rows, arg_vals->seed,
-        arg_vals->raw_data_path
+        arg_vals->n_shards, arg_vals->shard_by_bytes ? "bytes": "rows",
+        arg_vals->use_mmap ? "mmap": "pwrite", arg_vals->direct_io, arg_vals->nontemporal, arg_vals->max_dirty_mb,
+        arg_vals->zipf_exponent, arg_vals->n_stations, arg_vals->min_name_length, arg_vals->max_name_length,
+        arg_vals->synthetic_names ? " (synthetic)": "", arg_vals->decimals,
+        arg_vals->perf, arg_vals->num_threads, arg_vals->to_stdout, arg_vals->rows_per_second,
+        arg_vals->raw_data_path,
+        arg_vals->output_path,
+        arg_vals->save_catalog_path,
+        arg_vals->trace_path
    );
 }
+
+/// Initialize analyzer arguments to defaults
+void init_analyze_arguments(struct analyze_arguments* arg_vals) {
+    memset(arg_vals->input_path, 0x0, sizeof(arg_vals->input_path));
+    memset(arg_vals->catalog_path, 0x0, sizeof(arg_vals->catalog_path));
+    arg_vals->num_threads = 0;
+    arg_vals->stats = false;
+    arg_vals->stats_json = false;
+    arg_vals->perf = false;
+    arg_vals->table_mode = ANALYZE_PRIVATE;
+    arg_vals->num_partitions = 0;
+    arg_vals->batch_width = 0;
+    arg_vals->output_format = OUTPUT_LINES;
+    arg_vals->output_order = OUTPUT_SORT_BYTES;
+    arg_vals->table_capacity = 1 << 22;
+    arg_vals->num_quantiles = 0;
+    arg_vals->max_memory_mb = 0;
+    memset(arg_vals->spill_dir, 0x0, sizeof(arg_vals->spill_dir));
+    arg_vals->follow = false;
+    arg_vals->snapshot_seconds = 1.0;
+    arg_vals->snapshot_rows = 0;
+    memset(arg_vals->snapshot_path, 0x0, sizeof(arg_vals->snapshot_path));
+    arg_vals->tune = false;
+    memset(arg_vals->profile_path, 0x0, sizeof(arg_vals->profile_path));
+    memset(arg_vals->trace_path, 0x0, sizeof(arg_vals->trace_path));
+    arg_vals->sample_fraction = 0.0;
+}
+
+/// Initialize analyzer server arguments to defaults
+void init_server_arguments(struct server_arguments* arg_vals) {
+    memset(arg_vals->socket_path, 0x0, sizeof(arg_vals->socket_path));
+    memset(arg_vals->catalog_path, 0x0, sizeof(arg_vals->catalog_path));
+    arg_vals->num_threads = 0;
+    arg_vals->num_files = 0;
+}
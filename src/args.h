@@ -27,15 +27,86 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdbool.h>
+
+// Values of analyze_arguments.table_mode
+#define ANALYZE_PRIVATE 0
+#define ANALYZE_SHARED 1
+#define ANALYZE_PARTITIONED 2
+
+// Most quantiles the analyzer reports per station
+#define ANALYZE_MAX_QUANTILES 16
 
 /// Struct to hold all arguments
 struct arguments {
     size_t n_rows;
     size_t seed;
+    size_t n_shards;
+    bool shard_by_bytes;
+    bool use_mmap;
+    bool direct_io;
+    bool nontemporal;
+    size_t max_dirty_mb;
+    double zipf_exponent;
+    size_t n_stations;
+    size_t min_name_length;
+    size_t max_name_length;
+    bool synthetic_names;
+    int decimals;
+    bool perf;
+    size_t num_threads;
+    bool to_stdout;
+    size_t rows_per_second;
+    char trace_path[1024];
     char raw_data_path[1024];
+    char output_path[1024];
+    char save_catalog_path[1024];
+};
+
+/// Struct to hold all arguments of the analyzer
+struct analyze_arguments {
+    char input_path[1024];
+    char catalog_path[1024];
+    size_t num_threads;
+    bool stats;
+    bool stats_json;
+    bool perf;
+    int table_mode;
+    size_t num_partitions;
+    size_t batch_width;
+    int output_format;
+    int output_order;
+    size_t table_capacity;
+    double quantiles[ANALYZE_MAX_QUANTILES];
+    size_t num_quantiles;
+    size_t max_memory_mb;
+    char spill_dir[1024];
+    bool follow;
+    double snapshot_seconds;
+    size_t snapshot_rows;
+    char snapshot_path[1024];
+    bool tune;
+    char profile_path[1024];
+    char trace_path[1024];
+    // Fraction of the input sampled, or 0 to read all of it
+    double sample_fraction;
+};
+
+// Most files the analyzer server registers at startup
+#define SERVER_MAX_STARTUP_FILES 64
+
+/// Struct to hold all arguments of the analyzer server
+struct server_arguments {
+    char socket_path[1024];
+    char catalog_path[1024];
+    size_t num_threads;
+    const char* file_paths[SERVER_MAX_STARTUP_FILES];
+    size_t num_files;
 };
 
 void init_arguments(struct arguments* arg_vals);
 void print_arguments(struct arguments* arg_vals);
+void init_analyze_arguments(struct analyze_arguments* arg_vals);
+void init_server_arguments(struct server_arguments* arg_vals);
 
 #endif // _ARGS_H_
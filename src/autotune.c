@@ -0,0 +1,377 @@
+/* Detection of host resources and calibration of analyzer settings.
+
+                    GNU AFFERO GENERAL PUBLIC LICENSE
+                       Version 3, 19 November 2007
+
+    Copyright (C) 2024  Debajyoti Debnath
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published
+    by the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include "autotune.h"
+#include "gzip_input.h"
+#include <fcntl.h>
+#include <math.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/// Read the first line of a small file into buffer. Returns false if the
+/// file cannot be read.
+static bool _read_line(const char* path, char* buffer, size_t size) {
+    FILE* file = fopen(path, "r");
+    if (file==NULL) return false;
+    bool ok = fgets(buffer, (int)size, file) != NULL;
+    fclose(file);
+    return ok;
+}
+
+/// CPUs granted by the cgroup of this process, from cpu.max under cgroup
+/// v2 or the CFS quota under cgroup v1. Returns 0 without a quota.
+static double _cgroup_cpu_quota(void) {
+    char line[512], path[1024];
+    double quota = 0.0, period = 0.0;
+
+    // cgroup v2 lists this process as "0::/path"
+    char group[512] = "";
+    FILE* file = fopen("/proc/self/cgroup", "r");
+    while (file != NULL && fgets(line, sizeof(line), file) != NULL) {
+        if (strncmp(line, "0::", 3) == 0) {
+            sscanf(line + 3, "%511s", group);
+            break;
+        }
+    }
+    if (file != NULL)
+        fclose(file);
+    snprintf(path, sizeof(path), "/sys/fs/cgroup%s/cpu.max", strcmp(group, "/") == 0 ? "": group);
+    if (_read_line(path, line, sizeof(line)) || _read_line("/sys/fs/cgroup/cpu.max", line, sizeof(line))) {
+        if (sscanf(line, "%lf %lf", &quota, &period) == 2 && quota > 0.0 && period > 0.0)
+            return quota / period;
+        return 0.0;
+    }
+
+    if (_read_line("/sys/fs/cgroup/cpu/cpu.cfs_quota_us", line, sizeof(line)) ||
+        _read_line("/sys/fs/cgroup/cpu,cpuacct/cpu.cfs_quota_us", line, sizeof(line)))
+        quota = atof(line);
+    if (_read_line("/sys/fs/cgroup/cpu/cpu.cfs_period_us", line, sizeof(line)) ||
+        _read_line("/sys/fs/cgroup/cpu,cpuacct/cpu.cfs_period_us", line, sizeof(line)))
+        period = atof(line);
+    return quota > 0.0 && period > 0.0 ? quota / period: 0.0;
+}
+
+/// Size in bytes of the data or unified cache of the given level, read from
+/// sysfs, or 0 if it is not listed
+static size_t _cache_size(int level) {
+    char path[256], line[64];
+    for (int index = 0; index < 16; ++index) {
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu0/cache/index%d/level", index);
+        if (!_read_line(path, line, sizeof(line))) break;
+        if (atoi(line) != level) continue;
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu0/cache/index%d/type", index);
+        if (!_read_line(path, line, sizeof(line)) || strncmp(line, "Instruction", 11) == 0) continue;
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu0/cache/index%d/size", index);
+        if (!_read_line(path, line, sizeof(line))) continue;
+        char* unit;
+        size_t size = strtoul(line, &unit, 10);
+        return *unit == 'K' ? size << 10: *unit == 'M' ? size << 20: size;
+    }
+    return 0;
+}
+
+/// Detect the CPUs and caches available to this process
+void hostinfo_detect(HostInfo* host) {
+    if (host==NULL) {
+        perror("Error: Null pointer provided as argument.");
+        abort();
+    }
+    memset(host, 0x0, sizeof(HostInfo));
+    if (gethostname(host->name, sizeof(host->name) - 1) != 0)
+        strcpy(host->name, "unknown");
+
+    long online = sysconf(_SC_NPROCESSORS_ONLN);
+    host->online_cpus = online > 0 ? (size_t)online: 1;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    host->affinity_cpus = sched_getaffinity(0, sizeof(set), &set) == 0 ? (size_t)CPU_COUNT(&set): host->online_cpus;
+    host->cpu_quota = _cgroup_cpu_quota();
+
+    // A fractional quota still lets one more thread make progress
+    host->cpus = host->affinity_cpus;
+    size_t quota_cpus = (size_t)ceil(host->cpu_quota);
+    if (quota_cpus > 0 && quota_cpus < host->cpus)
+        host->cpus = quota_cpus;
+    host->cpus = host->cpus == 0 ? 1: host->cpus;
+
+    host->l1d_size = _cache_size(1);
+    host->l2_size = _cache_size(2);
+    host->l3_size = _cache_size(3);
+}
+
+/// Settings used without calibration: one thread per usable CPU and the
+/// default chunks and partitions
+void tuneprofile_init(TuneProfile* profile, const HostInfo* host) {
+    if (profile==NULL || host==NULL) {
+        perror("Error: Null pointer provided as argument.");
+        abort();
+    }
+    memset(profile, 0x0, sizeof(TuneProfile));
+    snprintf(profile->host, sizeof(profile->host), "%s", host->name);
+    profile->cpus = host->cpus;
+    profile->num_threads = host->cpus;
+    profile->chunk_size = 0;
+    profile->num_partitions = ANALYZER_DEFAULT_PARTITIONS;
+    profile->batch_width = ANALYZER_DEFAULT_BATCH_WIDTH;
+}
+
+/// Load a profile written by tuneprofile_save. Returns false if the file
+/// does not exist or does not hold a thread count.
+bool tuneprofile_load(TuneProfile* profile, const char* path) {
+    if (profile==NULL || path==NULL) {
+        perror("Error: Null pointer provided as argument.");
+        abort();
+    }
+    FILE* file = fopen(path, "r");
+    if (file==NULL) return false;
+    memset(profile, 0x0, sizeof(TuneProfile));
+    profile->num_partitions = ANALYZER_DEFAULT_PARTITIONS;
+    profile->batch_width = ANALYZER_DEFAULT_BATCH_WIDTH;
+
+    char line[512], key[64], value[256];
+    while (fgets(line, sizeof(line), file) != NULL) {
+        if (line[0] == '#' || sscanf(line, "%63[^=]=%255s", key, value) != 2) continue;
+        if (strcmp(key, "host") == 0)
+            snprintf(profile->host, sizeof(profile->host), "%s", value);
+        else if (strcmp(key, "cpus") == 0)
+            profile->cpus = strtoul(value, NULL, 10);
+        else if (strcmp(key, "threads") == 0)
+            profile->num_threads = strtoul(value, NULL, 10);
+        else if (strcmp(key, "chunk_size") == 0)
+            profile->chunk_size = strtoul(value, NULL, 10);
+        else if (strcmp(key, "partitions") == 0)
+            profile->num_partitions = strtoul(value, NULL, 10);
+        else if (strcmp(key, "batch_width") == 0)
+            profile->batch_width = strtoul(value, NULL, 10);
+    }
+    fclose(file);
+    return profile->num_threads > 0 && profile->num_partitions > 0 &&
+           profile->batch_width > 0 && profile->batch_width <= ANALYZER_MAX_BATCH_WIDTH;
+}
+
+/// Save a profile as key=value lines, with the host resources it was
+/// measured on as comments
+void tuneprofile_save(const TuneProfile* profile, const HostInfo* host, const char* path) {
+    if (profile==NULL || host==NULL || path==NULL) {
+        perror("Error: Null pointer provided as argument.");
+        abort();
+    }
+    FILE* out = fopen(path, "w");
+    if (out==NULL) {
+        perror("Error: could not open profile file for writing.");
+        exit(EXIT_FAILURE);
+    }
+    fprintf(out, "# online_cpus=%zu affinity_cpus=%zu cpu_quota=%g\n",
+            host->online_cpus, host->affinity_cpus, host->cpu_quota);
+    fprintf(out, "# l1d=%zu l2=%zu l3=%zu\n", host->l1d_size, host->l2_size, host->l3_size);
+    fprintf(out, "host=%s\n", profile->host);
+    fprintf(out, "cpus=%zu\n", profile->cpus);
+    fprintf(out, "threads=%zu\n", profile->num_threads);
+    fprintf(out, "chunk_size=%zu\n", profile->chunk_size);
+    fprintf(out, "partitions=%zu\n", profile->num_partitions);
+    fprintf(out, "batch_width=%zu\n", profile->batch_width);
+    if (fclose(out) != 0) {
+        perror("Error: could not write profile file.");
+        exit(EXIT_FAILURE);
+    }
+}
+
+/// Whether a profile was measured on this host with the CPUs it has now
+bool tuneprofile_matches(const TuneProfile* profile, const HostInfo* host) {
+    return strcmp(profile->host, host->name) == 0 && profile->cpus == host->cpus;
+}
+
+void tuneprofile_apply(const TuneProfile* profile, AnalyzerConfig* config) {
+    config->num_threads = profile->num_threads;
+    config->chunk_size = profile->chunk_size;
+    config->num_partitions = profile->num_partitions;
+    config->batch_width = profile->batch_width;
+}
+
+void tuneprofile_print(const TuneProfile* profile, FILE* out) {
+    fprintf(out, "Settings for %s (%zu CPUs): threads=%zu, chunk_size=%zu, partitions=%zu, batch_width=%zu\n",
+            profile->host, profile->cpus, profile->num_threads, profile->chunk_size, profile->num_partitions,
+            profile->batch_width);
+}
+
+/// Fastest of AUTOTUNE_REPEATS runs over the sample, in seconds. The number
+/// of stations seen is stored in num_stations.
+static double _time_runs(const char* data, size_t size, const AnalyzerConfig* config, size_t* num_stations) {
+    double best = INFINITY;
+    for (int i = 0; i < AUTOTUNE_REPEATS; ++i) {
+        Aggregator result;
+        double start = stats_now();
+        analyze_buffer(data, size, config, &result, NULL);
+        double seconds = stats_now() - start;
+        best = seconds < best ? seconds: best;
+        if (num_stations != NULL)
+            *num_stations = aggregator_num_stations(&result);
+        aggregator_destroy(&result);
+    }
+    return best;
+}
+
+/// Calibrate the profile on a sample of the input: thread counts in powers
+/// of two up to the usable CPUs, keeping fewer threads unless they are
+/// clearly slower, then chunk sizes with the chosen thread count, leaving
+/// the default chunking unless a chunk size is clearly faster. The number of partitions is chosen so that the table of one
+/// partition fits in half of the L2 cache.
+void autotune_calibrate(const char* data, size_t size, const AnalyzerConfig* config, const HostInfo* host, TuneProfile* profile) {
+    if (data==NULL || config==NULL || host==NULL || profile==NULL) {
+        perror("Error: Null pointer provided as argument.");
+        abort();
+    }
+
+    // Spans from across the input keep a sorted or clustered file from
+    // being judged by its first stations only
+    size_t sample_capacity = size < AUTOTUNE_SAMPLE_SIZE ? size: AUTOTUNE_SAMPLE_SIZE;
+    char* sample = (char*)malloc(sample_capacity + 1);
+    size_t sample_size = 0;
+    size_t span = sample_capacity / AUTOTUNE_SAMPLE_SPANS;
+    for (size_t k = 0; k < AUTOTUNE_SAMPLE_SPANS && span > 0; ++k) {
+        const char* begin = data + k * (size / AUTOTUNE_SAMPLE_SPANS);
+        const char* end = begin + span;
+        if (k > 0) {
+            const char* newline = (const char*)memchr(begin, '\n', span);
+            if (newline == NULL) continue;
+            begin = newline + 1;
+        }
+        const char* last = (const char*)memrchr(begin, '\n', (size_t)(end - begin));
+        if (last == NULL) continue;
+        memcpy(sample + sample_size, begin, (size_t)(last + 1 - begin));
+        sample_size += (size_t)(last + 1 - begin);
+    }
+    if (sample_size == 0) {
+        memcpy(sample, data, sample_capacity);
+        sample_size = sample_capacity;
+    }
+
+    AnalyzerConfig trial = *config;
+    trial.perf = NULL;
+    trial.histograms = false;
+    trial.max_memory = 0;
+    trial.num_chunks = 0;
+    trial.chunk_size = 0;
+    trial.batch_width = ANALYZER_DEFAULT_BATCH_WIDTH;
+
+    // Warm up page tables and allocator before timing
+    size_t num_stations = 0;
+    trial.num_threads = host->cpus;
+    _time_runs(sample, sample_size, &trial, &num_stations);
+
+    // Candidates are compared from the most threads down, so that a
+    // smaller count has to be nearly as fast to win
+    size_t counts[64];
+    size_t num_counts = 0;
+    counts[num_counts++] = host->cpus;
+    for (size_t threads = 1; threads < host->cpus && num_counts < 64; threads *= 2)
+        counts[num_counts++] = threads;
+    double best_seconds = INFINITY;
+    size_t best_threads = host->cpus;
+    double* seconds = (double*)malloc(num_counts * sizeof(double));
+    for (size_t i = 0; i < num_counts; ++i) {
+        trial.num_threads = counts[i];
+        seconds[i] = _time_runs(sample, sample_size, &trial, NULL);
+        if (seconds[i] < best_seconds) {
+            best_seconds = seconds[i];
+            best_threads = counts[i];
+        }
+    }
+    for (size_t i = 0; i < num_counts; ++i) {
+        if (counts[i] < best_threads && seconds[i] <= best_seconds * (1.0 + AUTOTUNE_TOLERANCE))
+            best_threads = counts[i];
+    }
+    free(seconds);
+    trial.num_threads = best_threads;
+
+    // Chunk sizes from the largest down; the default chunking competes too
+    best_seconds = _time_runs(sample, sample_size, &trial, NULL);
+    size_t best_chunk_size = 0;
+    for (size_t chunk_size = AUTOTUNE_MAX_CHUNK_SIZE; chunk_size >= AUTOTUNE_MIN_CHUNK_SIZE; chunk_size /= 4) {
+        // Chunks larger than a share of the sample cannot be told apart
+        if (chunk_size * best_threads > sample_size) continue;
+        trial.chunk_size = chunk_size;
+        double t = _time_runs(sample, sample_size, &trial, NULL);
+        if (t < best_seconds * (1.0 - AUTOTUNE_TOLERANCE)) {
+            best_seconds = t;
+            best_chunk_size = chunk_size;
+        }
+    }
+
+    trial.chunk_size = best_chunk_size;
+
+    // Batch widths of the lookups against the default one
+    size_t best_batch_width = ANALYZER_DEFAULT_BATCH_WIDTH;
+    for (size_t batch_width = 1; batch_width <= ANALYZER_MAX_BATCH_WIDTH; batch_width *= 4) {
+        if (batch_width == ANALYZER_DEFAULT_BATCH_WIDTH) continue;
+        trial.batch_width = batch_width;
+        double t = _time_runs(sample, sample_size, &trial, NULL);
+        if (t < best_seconds * (1.0 - AUTOTUNE_TOLERANCE)) {
+            best_seconds = t;
+            best_batch_width = batch_width;
+        }
+    }
+
+    profile->num_threads = best_threads;
+    profile->chunk_size = best_chunk_size;
+    profile->batch_width = best_batch_width;
+
+    // The sample holds at least as many stations as it saw, so this is a
+    // lower bound for the table of every partition
+    size_t l2_size = host->l2_size > 0 ? host->l2_size: 1 << 20;
+    size_t table_bytes = 2 * num_stations * sizeof(StationStats);
+    size_t partitions = AUTOTUNE_MIN_PARTITIONS;
+    while (partitions < AUTOTUNE_MAX_PARTITIONS && table_bytes / partitions > l2_size / 2)
+        partitions *= 2;
+    profile->num_partitions = partitions;
+    free(sample);
+}
+
+/// Calibrate on a sample of a plain measurements file. Returns false,
+/// leaving the profile as it is, for input that cannot be sampled such as
+/// pipes and compressed files.
+bool autotune_calibrate_file(const char* path, const AnalyzerConfig* config, const HostInfo* host, TuneProfile* profile) {
+    int fd = strcmp(path, "-") == 0 ? -1: open(path, O_RDONLY);
+    if (fd == -1) return false;
+    struct stat st;
+    if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode) || st.st_size == 0) {
+        close(fd);
+        return false;
+    }
+    size_t size = (size_t)st.st_size;
+    char* data = (char*)mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) return false;
+
+    bool sampled = !gzip_is_compressed(data, size);
+    if (sampled)
+        autotune_calibrate(data, size, config, host, profile);
+    munmap(data, size);
+    return sampled;
+}
@@ -0,0 +1,85 @@
+/* Detection of host resources and calibration of analyzer settings.
+
+                    GNU AFFERO GENERAL PUBLIC LICENSE
+                       Version 3, 19 November 2007
+
+    Copyright (C) 2024  Debajyoti Debnath
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published
+    by the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+
+#ifndef _AUTOTUNE_H_
+#define _AUTOTUNE_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "analyzer.h"
+
+// Largest sample of the input the calibration runs on
+#define AUTOTUNE_SAMPLE_SIZE (32 << 20)
+// Line-aligned spans the sample is copied from, spread over the input
+#define AUTOTUNE_SAMPLE_SPANS 4
+// Timed runs per candidate, of which the fastest counts
+#define AUTOTUNE_REPEATS 2
+// A candidate with fewer threads or larger chunks is kept if it is at most
+// this much slower than the fastest
+#define AUTOTUNE_TOLERANCE 0.05
+// Chunk sizes tried by the calibration
+#define AUTOTUNE_MIN_CHUNK_SIZE (256 << 10)
+#define AUTOTUNE_MAX_CHUNK_SIZE (16 << 20)
+// Bounds of the number of partitions chosen for the partitioned mode
+#define AUTOTUNE_MIN_PARTITIONS 16
+#define AUTOTUNE_MAX_PARTITIONS 4096
+
+// Resources of the host the analyzer runs on
+typedef struct {
+    char name[256];
+    size_t online_cpus;
+    // CPUs this process may be scheduled on
+    size_t affinity_cpus;
+    // CPUs granted by the cgroup quota, or 0 without a quota
+    double cpu_quota;
+    // CPUs the workers can actually keep busy
+    size_t cpus;
+    size_t l1d_size;
+    size_t l2_size;
+    size_t l3_size;
+} HostInfo;
+
+// Analyzer settings chosen for one host
+typedef struct {
+    char host[256];
+    size_t cpus;
+    size_t num_threads;
+    size_t chunk_size;
+    size_t num_partitions;
+    size_t batch_width;
+} TuneProfile;
+
+void hostinfo_detect(HostInfo* host);
+void tuneprofile_init(TuneProfile* profile, const HostInfo* host);
+bool tuneprofile_load(TuneProfile* profile, const char* path);
+void tuneprofile_save(const TuneProfile* profile, const HostInfo* host, const char* path);
+bool tuneprofile_matches(const TuneProfile* profile, const HostInfo* host);
+void tuneprofile_apply(const TuneProfile* profile, AnalyzerConfig* config);
+void tuneprofile_print(const TuneProfile* profile, FILE* out);
+void autotune_calibrate(const char* data, size_t size, const AnalyzerConfig* config, const HostInfo* host, TuneProfile* profile);
+bool autotune_calibrate_file(const char* path, const AnalyzerConfig* config, const HostInfo* host, TuneProfile* profile);
+
+#endif // _AUTOTUNE_H_
@@ -0,0 +1,350 @@
+/* Interned catalog of weather stations.
+
+                    GNU AFFERO GENERAL PUBLIC LICENSE
+                       Version 3, 19 November 2007
+
+    Copyright (C) 2024  Debajyoti Debnath
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published
+    by the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include "catalog.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Header of a binary catalog file. The arrays follow in the order
+// offsets, hashes, mean temperatures, lengths, index and pool, each
+// starting on an 8 byte boundary.
+typedef struct {
+    char magic[8];
+    uint64_t num_stations;
+    uint64_t pool_size;
+    uint64_t index_capacity;
+} _CatalogHeader;
+
+static size_t _align8(size_t n) {
+    return (n + 7) & ~(size_t)7;
+}
+
+/// 64-bit FNV-1a hash of a station name
+uint64_t station_hash(const char* name, size_t length) {
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < length; ++i) {
+        hash ^= (uint8_t)name[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+/// Initialize an empty catalog
+void catalog_init(StationCatalog* catalog) {
+    if (catalog==NULL) {
+        perror("Error: Null pointer provided as argument.");
+        abort();
+    }
+    memset(catalog, 0x0, sizeof(StationCatalog));
+    catalog->capacity = CATALOG_DEFAULT_CAPACITY;
+    catalog->offsets = (uint64_t*)calloc(catalog->capacity, sizeof(uint64_t));
+    catalog->hashes = (uint64_t*)calloc(catalog->capacity, sizeof(uint64_t));
+    catalog->mean_temperatures = (double*)calloc(catalog->capacity, sizeof(double));
+    catalog->lengths = (uint32_t*)calloc(catalog->capacity, sizeof(uint32_t));
+    catalog->pool_capacity = CATALOG_DEFAULT_CAPACITY * 16;
+    catalog->pool = (char*)malloc(catalog->pool_capacity);
+    catalog->index_capacity = 2 * CATALOG_DEFAULT_CAPACITY;
+    catalog->index = (uint32_t*)malloc(catalog->index_capacity * sizeof(uint32_t));
+    memset(catalog->index, 0xff, catalog->index_capacity * sizeof(uint32_t));
+}
+
+/// Rebuild the index with twice the capacity from the stored hashes
+static void _catalog_grow_index(StationCatalog* catalog) {
+    size_t capacity = 2 * catalog->index_capacity;
+    uint32_t* index = (uint32_t*)malloc(capacity * sizeof(uint32_t));
+    memset(index, 0xff, capacity * sizeof(uint32_t));
+    for (uint32_t id = 0; id < catalog->num_stations; ++id) {
+        size_t slot = catalog->hashes[id] & (capacity - 1);
+        while (index[slot] != CATALOG_NOT_FOUND)
+            slot = (slot + 1) & (capacity - 1);
+        index[slot] = id;
+    }
+    free(catalog->index);
+    catalog->index = index;
+    catalog->index_capacity = capacity;
+}
+
+/// Look up the dense ID of a station given its name and station_hash,
+/// or CATALOG_NOT_FOUND
+uint32_t catalog_find(const StationCatalog* catalog, const char* name, size_t length, uint64_t hash) {
+    size_t mask = catalog->index_capacity - 1;
+    size_t slot = hash & mask;
+    while (catalog->index[slot] != CATALOG_NOT_FOUND) {
+        uint32_t id = catalog->index[slot];
+        if (catalog->hashes[id] == hash && catalog->lengths[id] == length &&
+            memcmp(catalog->pool + catalog->offsets[id], name, length) == 0)
+            return id;
+        slot = (slot + 1) & mask;
+    }
+    return CATALOG_NOT_FOUND;
+}
+
+/// Add a station to the catalog and return its ID. A name that is
+/// already present keeps its existing ID and mean temperature.
+uint32_t catalog_intern(StationCatalog* catalog, const char* name, size_t length, double mean_temperature) {
+    if (catalog==NULL || name==NULL) {
+        perror("Error: Null pointer provided as argument.");
+        abort();
+    }
+    if (catalog->mapping != NULL) {
+        perror("Error: a mapped catalog is read-only.");
+        abort();
+    }
+
+    uint64_t hash = station_hash(name, length);
+    uint32_t id = catalog_find(catalog, name, length, hash);
+    if (id != CATALOG_NOT_FOUND)
+        return id;
+
+    if (catalog->num_stations == CATALOG_NOT_FOUND) {
+        perror("Error: too many stations in catalog.");
+        abort();
+    }
+
+    if (catalog->num_stations == catalog->capacity) {
+        catalog->capacity *= 2;
+        catalog->offsets = (uint64_t*)realloc(catalog->offsets, catalog->capacity * sizeof(uint64_t));
+        catalog->hashes = (uint64_t*)realloc(catalog->hashes, catalog->capacity * sizeof(uint64_t));
+        catalog->mean_temperatures = (double*)realloc(catalog->mean_temperatures, catalog->capacity * sizeof(double));
+        catalog->lengths = (uint32_t*)realloc(catalog->lengths, catalog->capacity * sizeof(uint32_t));
+    }
+    while (catalog->pool_size + length + 1 > catalog->pool_capacity) {
+        catalog->pool_capacity *= 2;
+        catalog->pool = (char*)realloc(catalog->pool, catalog->pool_capacity);
+    }
+
+    id = (uint32_t)catalog->num_stations;
+    catalog->offsets[id] = catalog->pool_size;
+    catalog->hashes[id] = hash;
+    catalog->mean_temperatures[id] = mean_temperature;
+    catalog->lengths[id] = (uint32_t)length;
+    memcpy(catalog->pool + catalog->pool_size, name, length);
+    catalog->pool[catalog->pool_size + length] = '\0';
+    catalog->pool_size += length + 1;
+    catalog->num_stations++;
+
+    // Keep the index at most half full
+    if (2 * catalog->num_stations > catalog->index_capacity) {
+        _catalog_grow_index(catalog);
+    } else {
+        size_t slot = hash & (catalog->index_capacity - 1);
+        while (catalog->index[slot] != CATALOG_NOT_FOUND)
+            slot = (slot + 1) & (catalog->index_capacity - 1);
+        catalog->index[slot] = id;
+    }
+
+    return id;
+}
+
+/// Load stations from a text file in the weather_stations.txt format.
+/// Lines starting with '#' and lines without a ';' are skipped.
+void catalog_load_text(StationCatalog* catalog, const char* path) {
+    if (catalog==NULL || path==NULL) {
+        perror("Error: Null pointer provided as argument.");
+        abort();
+    }
+
+    FILE* file = fopen(path, "rb");
+    if (file==NULL) {
+        perror("Error: could not open station list.");
+        abort();
+    }
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    char* text = (char*)malloc((size_t)size + 1);
+    if (fread(text, 1, (size_t)size, file) != (size_t)size) {
+        perror("Error: could not read station list.");
+        abort();
+    }
+    text[size] = '\n';
+    fclose(file);
+
+    char* line = text;
+    char* end = text + size;
+    while (line < end) {
+        char* newline = (char*)memchr(line, '\n', (size_t)(end - line) + 1);
+        char* delim = (char*)memchr(line, ';', (size_t)(newline - line));
+        if (*line != '#' && delim != NULL && delim > line)
+            catalog_intern(catalog, line, (size_t)(delim - line), strtod(delim + 1, NULL));
+        line = newline + 1;
+    }
+
+    free(text);
+}
+
+/// Save the catalog in binary form so that it can later be mapped
+/// with catalog_map
+void catalog_save(const StationCatalog* catalog, const char* path) {
+    if (catalog==NULL || path==NULL) {
+        perror("Error: Null pointer provided as argument.");
+        abort();
+    }
+
+    FILE* out = fopen(path, "wb");
+    if (out==NULL) {
+        perror("Error: could not open catalog file for writing.");
+        abort();
+    }
+
+    _CatalogHeader header;
+    memset(&header, 0x0, sizeof(header));
+    memcpy(header.magic, CATALOG_MAGIC, sizeof(header.magic));
+    header.num_stations = catalog->num_stations;
+    header.pool_size = catalog->pool_size;
+    header.index_capacity = catalog->index_capacity;
+
+    const char padding[8] = {0};
+    size_t n = catalog->num_stations;
+    size_t lengths_size = n * sizeof(uint32_t);
+    size_t index_size = catalog->index_capacity * sizeof(uint32_t);
+
+    bool ok = fwrite(&header, sizeof(header), 1, out) == 1;
+    ok = ok && fwrite(catalog->offsets, sizeof(uint64_t), n, out) == n;
+    ok = ok && fwrite(catalog->hashes, sizeof(uint64_t), n, out) == n;
+    ok = ok && fwrite(catalog->mean_temperatures, sizeof(double), n, out) == n;
+    ok = ok && fwrite(catalog->lengths, 1, lengths_size, out) == lengths_size;
+    ok = ok && fwrite(padding, 1, _align8(lengths_size) - lengths_size, out) == _align8(lengths_size) - lengths_size;
+    ok = ok && fwrite(catalog->index, 1, index_size, out) == index_size;
+    ok = ok && fwrite(padding, 1, _align8(index_size) - index_size, out) == _align8(index_size) - index_size;
+    ok = ok && fwrite(catalog->pool, 1, catalog->pool_size, out) == catalog->pool_size;
+    if (!ok) {
+        perror("Error: could not write catalog file.");
+        abort();
+    }
+
+    fclose(out);
+}
+
+/// Map a binary catalog file read-only. The catalog arrays point straight
+/// into the mapping, so no parsing or copying happens at load time.
+void catalog_map(StationCatalog* catalog, const char* path) {
+    if (catalog==NULL || path==NULL) {
+        perror("Error: Null pointer provided as argument.");
+        abort();
+    }
+
+    int fd = open(path, O_RDONLY);
+    if (fd==-1) {
+        perror("Error: could not open catalog file.");
+        abort();
+    }
+    struct stat st;
+    if (fstat(fd, &st)==-1 || (size_t)st.st_size < sizeof(_CatalogHeader)) {
+        perror("Error: invalid catalog file.");
+        abort();
+    }
+
+    char* mapped = (char*)mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapped==MAP_FAILED) {
+        perror("Error: mmap error.");
+        abort();
+    }
+
+    _CatalogHeader header;
+    memcpy(&header, mapped, sizeof(header));
+    size_t n = header.num_stations;
+    size_t expected = sizeof(header) + 3 * n * sizeof(uint64_t)
+        + _align8(n * sizeof(uint32_t))
+        + _align8(header.index_capacity * sizeof(uint32_t))
+        + header.pool_size;
+    if (memcmp(header.magic, CATALOG_MAGIC, sizeof(header.magic)) != 0 || expected != (size_t)st.st_size) {
+        fprintf(stderr, "%s is not a valid catalog file.\n", path);
+        exit(1);
+    }
+
+    memset(catalog, 0x0, sizeof(StationCatalog));
+    char* cursor = mapped + sizeof(header);
+    catalog->offsets = (uint64_t*)cursor;
+    cursor += n * sizeof(uint64_t);
+    catalog->hashes = (uint64_t*)cursor;
+    cursor += n * sizeof(uint64_t);
+    catalog->mean_temperatures = (double*)cursor;
+    cursor += n * sizeof(double);
+    catalog->lengths = (uint32_t*)cursor;
+    cursor += _align8(n * sizeof(uint32_t));
+    catalog->index = (uint32_t*)cursor;
+    cursor += _align8(header.index_capacity * sizeof(uint32_t));
+    catalog->pool = cursor;
+
+    catalog->num_stations = n;
+    catalog->capacity = n;
+    catalog->pool_size = header.pool_size;
+    catalog->pool_capacity = header.pool_size;
+    catalog->index_capacity = header.index_capacity;
+    catalog->mapping = mapped;
+    catalog->mapping_size = st.st_size;
+}
+
+/// Load a catalog from either a binary catalog file or a text station list
+void catalog_load(StationCatalog* catalog, const char* path) {
+    if (catalog==NULL || path==NULL) {
+        perror("Error: Null pointer provided as argument.");
+        abort();
+    }
+
+    char magic[8] = {0};
+    FILE* file = fopen(path, "rb");
+    if (file==NULL) {
+        fprintf(stderr, "Could not read %s.\n", path);
+        exit(2);
+    }
+    size_t nread = fread(magic, 1, sizeof(magic), file);
+    fclose(file);
+
+    if (nread == sizeof(magic) && memcmp(magic, CATALOG_MAGIC, sizeof(magic)) == 0) {
+        catalog_map(catalog, path);
+    } else {
+        catalog_init(catalog);
+        catalog_load_text(catalog, path);
+    }
+}
+
+/// Name of the station with the given ID. The returned String points
+/// into the catalog and must not be destroyed.
+String catalog_name(const StationCatalog* catalog, uint32_t id) {
+    assert(catalog!=NULL && id<catalog->num_stations);
+    String name;
+    name.data = catalog->pool + catalog->offsets[id];
+    name.length = catalog->lengths[id];
+    return name;
+}
+
+/// Release the memory or mapping held by a catalog
+void catalog_destroy(StationCatalog* catalog) {
+    if (catalog==NULL) return;
+    if (catalog->mapping != NULL) {
+        munmap(catalog->mapping, catalog->mapping_size);
+    } else {
+        free(catalog->pool);
+        free(catalog->offsets);
+        free(catalog->hashes);
+        free(catalog->mean_temperatures);
+        free(catalog->lengths);
+        free(catalog->index);
+    }
+    memset(catalog, 0x0, sizeof(StationCatalog));
+}
@@ -0,0 +1,69 @@
+/* Interned catalog of weather stations.
+
+                    GNU AFFERO GENERAL PUBLIC LICENSE
+                       Version 3, 19 November 2007
+
+    Copyright (C) 2024  Debajyoti Debnath
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published
+    by the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef _CATALOG_H_
+#define _CATALOG_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "dtypes.h"
+
+// Magic bytes at the start of a binary catalog file
+#define CATALOG_MAGIC "1BRCCAT1"
+// Returned by catalog_find for names that are not in the catalog
+#define CATALOG_NOT_FOUND UINT32_MAX
+// Initial number of stations the catalog has room for
+#define CATALOG_DEFAULT_CAPACITY 1024
+
+// Station names stored once in a contiguous pool, addressed by dense IDs.
+// The arrays either live on the heap or point into a mapped binary file.
+typedef struct {
+    char* pool;
+    uint64_t* offsets;
+    uint64_t* hashes;
+    double* mean_temperatures;
+    uint32_t* lengths;
+    uint32_t* index;
+    size_t num_stations;
+    size_t capacity;
+    size_t pool_size;
+    size_t pool_capacity;
+    size_t index_capacity;
+    void* mapping;
+    size_t mapping_size;
+} StationCatalog;
+
+uint64_t station_hash(const char* name, size_t length);
+void catalog_init(StationCatalog* catalog);
+uint32_t catalog_intern(StationCatalog* catalog, const char* name, size_t length, double mean_temperature);
+uint32_t catalog_find(const StationCatalog* catalog, const char* name, size_t length, uint64_t hash);
+void catalog_load_text(StationCatalog* catalog, const char* path);
+void catalog_save(const StationCatalog* catalog, const char* path);
+void catalog_map(StationCatalog* catalog, const char* path);
+void catalog_load(StationCatalog* catalog, const char* path);
+String catalog_name(const StationCatalog* catalog, uint32_t id);
+void catalog_destroy(StationCatalog* catalog);
+
+#endif // _CATALOG_H_
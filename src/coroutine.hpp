@@ -0,0 +1,417 @@
+/* Coroutine primitives: executor, tasks, channels and asynchronous reads.
+
+                    GNU AFFERO GENERAL PUBLIC LICENSE
+                       Version 3, 19 November 2007
+
+    Copyright (C) 2024  Debajyoti Debnath
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published
+    by the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+
+#ifndef _COROUTINE_HPP_
+#define _COROUTINE_HPP_
+
+#include <algorithm>
+#include <cerrno>
+#include <condition_variable>
+#include <coroutine>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include <unistd.h>
+
+namespace onebrc {
+
+/// Fixed pool of threads resuming coroutines in FIFO order
+class Executor {
+public:
+    explicit Executor(size_t num_threads) {
+        for (size_t i = 0; i < std::max<size_t>(1, num_threads); ++i)
+            threads_.emplace_back([this]() { run(); });
+    }
+
+    ~Executor() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        ready_.notify_all();
+        for (std::thread& thread: threads_)
+            thread.join();
+    }
+
+    Executor(const Executor&) = delete;
+    Executor& operator=(const Executor&) = delete;
+
+    void post(std::coroutine_handle<> handle) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            queue_.push_back(handle);
+        }
+        ready_.notify_one();
+    }
+
+private:
+    void run() {
+        while (true) {
+            std::coroutine_handle<> handle;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                ready_.wait(lock, [this]() { return stop_ || !queue_.empty(); });
+                if (queue_.empty()) return;
+                handle = queue_.front();
+                queue_.pop_front();
+            }
+            handle.resume();
+        }
+    }
+
+    std::mutex mutex_;
+    std::condition_variable ready_;
+    std::deque<std::coroutine_handle<>> queue_;
+    std::vector<std::thread> threads_;
+    bool stop_ = false;
+};
+
+/// Counts running tasks and keeps the first exception thrown by one of them
+class WaitGroup {
+public:
+    // Called once, with the group's lock released, when a task first fails
+    std::function<void()> on_error;
+
+    void add() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        count_++;
+    }
+
+    void done() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (--count_ == 0)
+            finished_.notify_all();
+    }
+
+    void fail(std::exception_ptr error) {
+        bool first;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            first = error_ == nullptr;
+            if (first)
+                error_ = error;
+        }
+        if (first && on_error)
+            on_error();
+    }
+
+    /// Block until every task finished and rethrow the first failure
+    void wait() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        finished_.wait(lock, [this]() { return count_ == 0; });
+        if (error_ != nullptr)
+            std::rethrow_exception(error_);
+    }
+
+private:
+    std::mutex mutex_;
+    std::condition_variable finished_;
+    size_t count_ = 0;
+    std::exception_ptr error_;
+};
+
+/// Coroutine started by spawn and destroyed when it finishes
+class Task {
+public:
+    struct promise_type {
+        WaitGroup* group = nullptr;
+
+        Task get_return_object() { return Task(std::coroutine_handle<promise_type>::from_promise(*this)); }
+        std::suspend_always initial_suspend() noexcept { return {}; }
+
+        auto final_suspend() noexcept {
+            struct FinalAwaiter {
+                bool await_ready() noexcept { return false; }
+                void await_suspend(std::coroutine_handle<promise_type> handle) noexcept {
+                    WaitGroup* group = handle.promise().group;
+                    handle.destroy();
+                    if (group != nullptr)
+                        group->done();
+                }
+                void await_resume() noexcept {}
+            };
+            return FinalAwaiter{};
+        }
+
+        void return_void() {}
+
+        void unhandled_exception() {
+            if (group != nullptr)
+                group->fail(std::current_exception());
+        }
+    };
+
+    explicit Task(std::coroutine_handle<promise_type> handle): handle_(handle) {}
+    Task(Task&& other) noexcept: handle_(std::exchange(other.handle_, nullptr)) {}
+    Task(const Task&) = delete;
+
+    ~Task() {
+        if (handle_)
+            handle_.destroy();
+    }
+
+    /// Start the task on executor, counting it in group
+    void spawn(Executor& executor, WaitGroup& group) {
+        handle_.promise().group = &group;
+        group.add();
+        executor.post(std::exchange(handle_, nullptr));
+    }
+
+private:
+    std::coroutine_handle<promise_type> handle_;
+};
+
+/// Bounded multi-producer multi-consumer channel. Senders suspend while it
+/// is full and receivers while it is empty; both are resumed on the
+/// executor. After close, send fails and receive drains what is left.
+template <class T>
+class Channel {
+public:
+    Channel(Executor& executor, size_t capacity): executor_(executor), capacity_(capacity) {}
+
+    Channel(const Channel&) = delete;
+    Channel& operator=(const Channel&) = delete;
+
+    class SendAwaiter {
+    public:
+        SendAwaiter(Channel& channel, T value): channel_(channel), value_(std::move(value)) {}
+
+        bool await_ready() { return false; }
+
+        bool await_suspend(std::coroutine_handle<> handle) {
+            std::lock_guard<std::mutex> lock(channel_.mutex_);
+            if (channel_.closed_) {
+                ok_ = false;
+                return false;
+            }
+            if (!channel_.receivers_.empty()) {
+                auto* receiver = channel_.receivers_.front();
+                channel_.receivers_.pop_front();
+                receiver->result_ = std::move(value_);
+                channel_.executor_.post(receiver->handle_);
+                return false;
+            }
+            if (channel_.items_.size() < channel_.capacity_) {
+                channel_.items_.push_back(std::move(value_));
+                return false;
+            }
+            handle_ = handle;
+            channel_.senders_.push_back(this);
+            return true;
+        }
+
+        /// Whether the value was delivered, false if the channel was closed
+        bool await_resume() { return ok_; }
+
+    private:
+        friend class Channel;
+        Channel& channel_;
+        T value_;
+        bool ok_ = true;
+        std::coroutine_handle<> handle_;
+    };
+
+    class ReceiveAwaiter {
+    public:
+        explicit ReceiveAwaiter(Channel& channel): channel_(channel) {}
+
+        bool await_ready() { return false; }
+
+        bool await_suspend(std::coroutine_handle<> handle) {
+            std::lock_guard<std::mutex> lock(channel_.mutex_);
+            if (!channel_.items_.empty()) {
+                result_ = std::move(channel_.items_.front());
+                channel_.items_.pop_front();
+                channel_.admit_sender();
+                return false;
+            }
+            if (!channel_.senders_.empty()) {
+                SendAwaiter* sender = channel_.senders_.front();
+                channel_.senders_.pop_front();
+                result_ = std::move(sender->value_);
+                channel_.executor_.post(sender->handle_);
+                return false;
+            }
+            if (channel_.closed_)
+                return false;
+            handle_ = handle;
+            channel_.receivers_.push_back(this);
+            return true;
+        }
+
+        /// The received value, or nothing once the channel is closed and empty
+        std::optional<T> await_resume() { return std::move(result_); }
+
+    private:
+        friend class Channel;
+        Channel& channel_;
+        std::optional<T> result_;
+        std::coroutine_handle<> handle_;
+    };
+
+    SendAwaiter send(T value) { return SendAwaiter(*this, std::move(value)); }
+    ReceiveAwaiter receive() { return ReceiveAwaiter(*this); }
+
+    /// Add a value without suspending, false if the channel is full or closed
+    bool try_send(T value) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (closed_ || !receivers_.empty() || items_.size() >= capacity_)
+            return false;
+        items_.push_back(std::move(value));
+        return true;
+    }
+
+    void close() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        closed_ = true;
+        for (ReceiveAwaiter* receiver: receivers_)
+            executor_.post(receiver->handle_);
+        receivers_.clear();
+        for (SendAwaiter* sender: senders_) {
+            sender->ok_ = false;
+            executor_.post(sender->handle_);
+        }
+        senders_.clear();
+    }
+
+private:
+    // Move the first suspended sender's value into the freed slot
+    void admit_sender() {
+        if (senders_.empty()) return;
+        SendAwaiter* sender = senders_.front();
+        senders_.pop_front();
+        items_.push_back(std::move(sender->value_));
+        executor_.post(sender->handle_);
+    }
+
+    Executor& executor_;
+    size_t capacity_;
+    std::mutex mutex_;
+    std::deque<T> items_;
+    std::deque<SendAwaiter*> senders_;
+    std::deque<ReceiveAwaiter*> receivers_;
+    bool closed_ = false;
+};
+
+/// Performs blocking reads on a dedicated thread so that coroutines waiting
+/// for input suspend instead of holding an executor thread
+class IoService {
+public:
+    explicit IoService(Executor& executor): executor_(executor), thread_([this]() { run(); }) {}
+
+    ~IoService() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        ready_.notify_all();
+        thread_.join();
+    }
+
+    IoService(const IoService&) = delete;
+    IoService& operator=(const IoService&) = delete;
+
+    class ReadAwaiter {
+    public:
+        ReadAwaiter(IoService& io, int fd, char* data, size_t size): io_(io), fd_(fd), data_(data), size_(size) {}
+
+        bool await_ready() { return size_ == 0; }
+
+        void await_suspend(std::coroutine_handle<> handle) {
+            handle_ = handle;
+            io_.submit(this);
+        }
+
+        /// Number of bytes read, less than requested only at the end of input
+        size_t await_resume() {
+            if (error_ != 0)
+                throw std::runtime_error(std::string("Error reading input: ") + strerror(error_));
+            return done_;
+        }
+
+    private:
+        friend class IoService;
+        IoService& io_;
+        int fd_;
+        char* data_;
+        size_t size_;
+        size_t done_ = 0;
+        int error_ = 0;
+        std::coroutine_handle<> handle_;
+    };
+
+    /// Fill data with up to size bytes from fd
+    ReadAwaiter read(int fd, char* data, size_t size) { return ReadAwaiter(*this, fd, data, size); }
+
+private:
+    void submit(ReadAwaiter* request) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            requests_.push_back(request);
+        }
+        ready_.notify_one();
+    }
+
+    void run() {
+        while (true) {
+            ReadAwaiter* request;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                ready_.wait(lock, [this]() { return stop_ || !requests_.empty(); });
+                if (requests_.empty()) return;
+                request = requests_.front();
+                requests_.pop_front();
+            }
+            while (request->done_ < request->size_) {
+                ssize_t n = ::read(request->fd_, request->data_ + request->done_, request->size_ - request->done_);
+                if (n < 0) {
+                    if (errno == EINTR) continue;
+                    request->error_ = errno;
+                    break;
+                }
+                if (n == 0) break;
+                request->done_ += static_cast<size_t>(n);
+            }
+            executor_.post(request->handle_);
+        }
+    }
+
+    Executor& executor_;
+    std::mutex mutex_;
+    std::condition_variable ready_;
+    std::deque<ReadAwaiter*> requests_;
+    bool stop_ = false;
+    std::thread thread_;
+};
+
+} // namespace onebrc
+
+#endif // _COROUTINE_HPP_
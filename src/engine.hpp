@@ -0,0 +1,217 @@
+/* Header-only aggregation engine templated on its policies.
+
+                    GNU AFFERO GENERAL PUBLIC LICENSE
+                       Version 3, 19 November 2007
+
+    Copyright (C) 2024  Debajyoti Debnath
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published
+    by the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+
+#ifndef _ENGINE_HPP_
+#define _ENGINE_HPP_
+
+#include <algorithm>
+#include <cstdio>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <tuple>
+#include <utility>
+#include <vector>
+#include "engine_policies.hpp"
+#include "format.h"
+
+namespace onebrc {
+
+// Chunks per worker handed out by readers that split their input
+constexpr size_t ENGINE_CHUNKS_PER_THREAD = 8;
+
+/// Aggregation engine for one combination of policies. Every policy is a
+/// template argument, so the hot loop in consume is compiled without any
+/// indirect calls.
+template <class Reader, class Parser, class Hash, template <class, class> class Table, class Acc>
+class Engine {
+public:
+    using TableType = Table<Hash, Acc>;
+
+    static std::string name() {
+        return std::string(Reader::name) + "-" + Parser::name + "-" + Hash::name + "-" +
+               TableType::name + "-" + Acc::name;
+    }
+
+    /// Aggregate every row between begin and end into table and return the
+    /// number of rows
+    static inline size_t consume(const char* begin, const char* end, TableType& table) {
+        const char* p = begin;
+        Row row;
+        size_t rows = 0;
+        while (Parser::next(p, end, row)) {
+            table.find_or_insert(row.name, row.length, Hash::hash(row.name, row.length)).add(row.value);
+            rows++;
+        }
+        return rows;
+    }
+
+    /// Aggregate the file at path with num_threads workers, each with its
+    /// own table, and return the merged table along with the number of rows
+    static std::pair<TableType, size_t> run(const std::string& path, size_t num_threads) {
+        num_threads = std::max<size_t>(1, num_threads);
+        Reader reader(path, num_threads * ENGINE_CHUNKS_PER_THREAD);
+        std::vector<TableType> tables(num_threads);
+        std::vector<size_t> rows(num_threads, 0);
+
+        std::vector<std::thread> workers;
+        for (size_t i = 0; i < num_threads; ++i) {
+            workers.emplace_back([&, i]() {
+                std::vector<char> buffer;
+                Block block;
+                while (reader.next(block, buffer))
+                    rows[i] += consume(block.begin, block.end, tables[i]);
+            });
+        }
+        for (std::thread& worker: workers)
+            worker.join();
+
+        for (size_t i = 1; i < num_threads; ++i) {
+            tables[0].merge(tables[i]);
+            rows[0] += rows[i];
+        }
+        return {std::move(tables[0]), rows[0]};
+    }
+
+    /// Run the engine on its single input and print "name=min/max/mean"
+    /// for every station, sorted by name. Returns the number of rows.
+    static size_t analyze(const std::vector<std::string>& paths, size_t num_threads, FILE* out) {
+        if (paths.size() != 1)
+            throw std::runtime_error("Engine " + name() + " reads a single input, use a pipeline engine for several");
+        auto [table, rows] = run(paths[0], num_threads);
+        print_sorted(table, out);
+        return rows;
+    }
+
+    static void print_sorted(const TableType& table, FILE* out) {
+        std::vector<std::pair<std::string_view, const Acc*>> stations;
+        stations.reserve(table.size());
+        table.for_each([&](std::string_view key, const Acc& acc) { stations.emplace_back(key, &acc); });
+        std::sort(stations.begin(), stations.end());
+        // Rounded half up in fixed point, like the C analyzer
+        char values[3 * (FORMAT_TENTHS_MAX + 1) + 1];
+        for (const auto& [key, acc]: stations) {
+            char* p = values;
+            *p++ = '=';
+            p = format_tenths(p, round_tenths(acc->min(), 1));
+            *p++ = '/';
+            p = format_tenths(p, round_tenths(acc->max(), 1));
+            *p++ = '/';
+            p = format_tenths(p, round_tenths(acc->total(), acc->rows()));
+            *p++ = '\n';
+            fwrite(key.data(), 1, key.size(), out);
+            fwrite(values, 1, static_cast<size_t>(p - values), out);
+        }
+    }
+};
+
+// Engine entry points selectable at run time
+using EngineFunction = size_t (*)(const std::vector<std::string>& paths, size_t num_threads, FILE* out);
+
+struct EngineEntry {
+    std::string name;
+    EngineFunction analyze;
+};
+
+// Type lists of the policies the registry is built from
+template <class... Ts> struct TypeList {};
+template <template <class, class> class... Ts> struct TableList {};
+
+// Engines reading with Reader, as a template of the remaining policies
+template <class Reader>
+struct WithReader {
+    template <class Parser, class Hash, template <class, class> class Table, class Acc>
+    using type = Engine<Reader, Parser, Hash, Table, Acc>;
+};
+
+namespace detail {
+
+template <template <class, class, template <class, class> class, class> class E,
+          class Parser, class Hash, template <class, class> class Table, class... Accs>
+void add_accs(std::vector<EngineEntry>& entries, TypeList<Accs...>) {
+    (entries.push_back({E<Parser, Hash, Table, Accs>::name(), &E<Parser, Hash, Table, Accs>::analyze}), ...);
+}
+
+template <template <class, class, template <class, class> class, class> class E,
+          class Parser, class Hash, class Accs, template <class, class> class... Tables>
+void add_tables(std::vector<EngineEntry>& entries, TableList<Tables...>) {
+    (add_accs<E, Parser, Hash, Tables>(entries, Accs{}), ...);
+}
+
+template <template <class, class, template <class, class> class, class> class E,
+          class Parser, class Tables, class Accs, class... Hashes>
+void add_hashes(std::vector<EngineEntry>& entries, TypeList<Hashes...>) {
+    (add_tables<E, Parser, Hashes, Accs>(entries, Tables{}), ...);
+}
+
+template <template <class, class, template <class, class> class, class> class E,
+          class Hashes, class Tables, class Accs, class... Parsers>
+void add_parsers(std::vector<EngineEntry>& entries, TypeList<Parsers...>) {
+    (add_hashes<E, Parsers, Tables, Accs>(entries, Hashes{}), ...);
+}
+
+} // namespace detail
+
+/// Instantiate engine template E for every combination of the given
+/// policies and append them to entries
+template <template <class, class, template <class, class> class, class> class E,
+          class Parsers, class Hashes, class Tables, class Accs>
+void add_engines(std::vector<EngineEntry>& entries) {
+    detail::add_parsers<E, Hashes, Tables, Accs>(entries, Parsers{});
+}
+
+// Policies every registry is built from
+using RegistryParsers = TypeList<SwarParser, ScalarParser>;
+using RegistryHashes = TypeList<WordHash, Fnv1aHash, Djb2Hash>;
+using RegistryTables = TableList<LinearTable, StdTable>;
+using RegistryAccumulators = TypeList<IntAccumulator, DoubleAccumulator>;
+
+/// Every prebuilt engine, named reader-parser-hash-table-accumulator
+inline const std::vector<EngineEntry>& engine_registry() {
+    static const std::vector<EngineEntry> registry = [] {
+        std::vector<EngineEntry> entries;
+        add_engines<WithReader<MmapReader>::template type,
+                    RegistryParsers, RegistryHashes, RegistryTables, RegistryAccumulators>(entries);
+        add_engines<WithReader<ReadReader>::template type,
+                    RegistryParsers, RegistryHashes, RegistryTables, RegistryAccumulators>(entries);
+        return entries;
+    }();
+    return registry;
+}
+
+// Engine used when none is selected
+constexpr const char* DEFAULT_ENGINE = "mmap-swar-word-linear-int";
+
+/// Look up a prebuilt engine by name, or return nullptr
+inline const EngineEntry* find_engine(const std::string& name) {
+    for (const EngineEntry& entry: engine_registry()) {
+        if (entry.name == name)
+            return &entry;
+    }
+    return nullptr;
+}
+
+} // namespace onebrc
+
+#endif // _ENGINE_HPP_
@@ -0,0 +1,534 @@
+/* Policies of the templated aggregation engine.
+
+                    GNU AFFERO GENERAL PUBLIC LICENSE
+                       Version 3, 19 November 2007
+
+    Copyright (C) 2024  Debajyoti Debnath
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published
+    by the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+
+#ifndef _ENGINE_POLICIES_HPP_
+#define _ENGINE_POLICIES_HPP_
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+namespace onebrc {
+
+// Range of whole lines handed from a reader to a worker
+struct Block {
+    const char* begin;
+    const char* end;
+};
+
+// One parsed measurement. The temperature is in hundredths of a degree.
+struct Row {
+    const char* name;
+    size_t length;
+    int32_t value;
+};
+
+// ---------------------------------------------------------------------------
+// Readers hand out line-aligned blocks of the input to the workers through
+// next(block, buffer), which may be called from several threads at once.
+// buffer is owned by the calling worker and may back the returned block.
+// ---------------------------------------------------------------------------
+
+/// Maps the whole file and splits it into line-aligned chunks
+class MmapReader {
+public:
+    static constexpr const char* name = "mmap";
+
+    MmapReader(const std::string& path, size_t num_chunks) {
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd == -1)
+            throw std::runtime_error("Could not open input file " + path);
+        struct stat st;
+        if (fstat(fd, &st) == -1) {
+            close(fd);
+            throw std::runtime_error("Could not stat input file " + path);
+        }
+        size_ = static_cast<size_t>(st.st_size);
+        if (size_ > 0) {
+            void* data = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (data == MAP_FAILED) {
+                close(fd);
+                throw std::runtime_error("Could not map input file " + path);
+            }
+            data_ = static_cast<const char*>(data);
+            madvise(data, size_, MADV_WILLNEED);
+        }
+        close(fd);
+
+        num_chunks = std::max<size_t>(1, std::min(num_chunks, size_ / min_chunk_size + 1));
+        starts_.resize(num_chunks + 1, size_);
+        starts_[0] = 0;
+        for (size_t i = 1; i < num_chunks; ++i) {
+            size_t start = std::max(size_ / num_chunks * i, starts_[i - 1]);
+            const void* newline = start == 0 ? nullptr: memchr(data_ + start - 1, '\n', size_ - start + 1);
+            starts_[i] = newline == nullptr ? size_: static_cast<size_t>(static_cast<const char*>(newline) - data_) + 1;
+        }
+    }
+
+    ~MmapReader() {
+        if (data_ != nullptr)
+            munmap(const_cast<char*>(data_), size_);
+    }
+
+    MmapReader(const MmapReader&) = delete;
+    MmapReader& operator=(const MmapReader&) = delete;
+
+    bool next(Block& block, std::vector<char>&) {
+        size_t chunk = next_chunk_.fetch_add(1, std::memory_order_relaxed);
+        if (chunk + 1 >= starts_.size()) return false;
+        block = {data_ + starts_[chunk], data_ + starts_[chunk + 1]};
+        return true;
+    }
+
+private:
+    static constexpr size_t min_chunk_size = 1 << 20;
+
+    const char* data_ = nullptr;
+    size_t size_ = 0;
+    std::vector<size_t> starts_;
+    std::atomic<size_t> next_chunk_{0};
+};
+
+/// Reads the file, or standard input for "-", in blocks with read(2). The
+/// partial line at the end of a block is carried over to the next one.
+class ReadReader {
+public:
+    static constexpr const char* name = "read";
+
+    ReadReader(const std::string& path, size_t) {
+        fd_ = path == "-" ? STDIN_FILENO: open(path.c_str(), O_RDONLY);
+        if (fd_ == -1)
+            throw std::runtime_error("Could not open input file " + path);
+        if (fd_ != STDIN_FILENO)
+            posix_fadvise(fd_, 0, 0, POSIX_FADV_SEQUENTIAL);
+    }
+
+    ~ReadReader() {
+        if (fd_ != STDIN_FILENO)
+            close(fd_);
+    }
+
+    ReadReader(const ReadReader&) = delete;
+    ReadReader& operator=(const ReadReader&) = delete;
+
+    bool next(Block& block, std::vector<char>& buffer) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (eof_ && carry_.empty()) return false;
+
+        buffer.resize(carry_.size() + block_size);
+        std::copy(carry_.begin(), carry_.end(), buffer.begin());
+        size_t filled = carry_.size();
+        carry_.clear();
+
+        size_t cut = 0;
+        while (!eof_) {
+            if (filled == buffer.size())
+                buffer.resize(buffer.size() * 2);
+            ssize_t n = read(fd_, buffer.data() + filled, buffer.size() - filled);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                throw std::runtime_error("Error reading input file");
+            }
+            if (n == 0) {
+                eof_ = true;
+                break;
+            }
+            filled += static_cast<size_t>(n);
+            // Stop at a full buffer with at least one complete line in it
+            if (filled == buffer.size()) {
+                const char* last = static_cast<const char*>(memrchr(buffer.data(), '\n', filled));
+                if (last != nullptr) {
+                    cut = static_cast<size_t>(last - buffer.data()) + 1;
+                    break;
+                }
+            }
+        }
+        if (eof_)
+            cut = filled;
+
+        carry_.assign(buffer.data() + cut, buffer.data() + filled);
+        block = {buffer.data(), buffer.data() + cut};
+        return true;
+    }
+
+private:
+    static constexpr size_t block_size = 1 << 20;
+
+    int fd_;
+    bool eof_ = false;
+    std::mutex mutex_;
+    std::vector<char> carry_;
+};
+
+// ---------------------------------------------------------------------------
+// Parsers read the next row of a block of whole lines with
+// next(p, end, row), advancing p past it. Lines without a ';' are skipped.
+// ---------------------------------------------------------------------------
+
+/// Temperature such as "-12.3" or "4.56" in hundredths of a degree
+inline int32_t parse_hundredths(const char* p, const char* end) {
+    bool negative = p < end && *p == '-';
+    p += negative;
+    int32_t value = 0;
+    int decimals = -1;
+    for (; p < end; ++p) {
+        char c = *p;
+        if (c == '.') {
+            decimals = 0;
+            continue;
+        }
+        if (c < '0' || c > '9') break;
+        if (decimals >= 2) continue;
+        value = value * 10 + (c - '0');
+        if (decimals >= 0) decimals++;
+    }
+    for (decimals = std::max(decimals, 0); decimals < 2; ++decimals)
+        value *= 10;
+    return negative ? -value: value;
+}
+
+/// Scans the name byte by byte
+struct ScalarParser {
+    static constexpr const char* name = "scalar";
+
+    static inline bool next(const char*& p, const char* end, Row& row) {
+        while (p < end) {
+            const char* semi = p;
+            while (semi < end && *semi != ';' && *semi != '\n')
+                semi++;
+            if (semi == end || *semi == '\n') {
+                p = semi + 1;
+                continue;
+            }
+            const char* newline = static_cast<const char*>(memchr(semi + 1, '\n', static_cast<size_t>(end - semi - 1)));
+            newline = newline == nullptr ? end: newline;
+            row = {p, static_cast<size_t>(semi - p), parse_hundredths(semi + 1, newline)};
+            p = newline + 1;
+            return true;
+        }
+        return false;
+    }
+};
+
+/// Looks for the ';' eight bytes at a time
+struct SwarParser {
+    static constexpr const char* name = "swar";
+
+    static inline uint64_t match(uint64_t word, char c) {
+        uint64_t x = word ^ (0x0101010101010101ULL * static_cast<uint8_t>(c));
+        return (x - 0x0101010101010101ULL) & ~x & 0x8080808080808080ULL;
+    }
+
+    static inline const char* find_delimiter(const char* p, const char* end) {
+        for (; p + 8 <= end; p += 8) {
+            uint64_t word;
+            memcpy(&word, p, 8);
+            uint64_t hits = match(word, ';') | match(word, '\n');
+            if (hits != 0)
+                return p + (__builtin_ctzll(hits) >> 3);
+        }
+        while (p < end && *p != ';' && *p != '\n')
+            p++;
+        return p;
+    }
+
+    static inline bool next(const char*& p, const char* end, Row& row) {
+        while (p < end) {
+            const char* semi = find_delimiter(p, end);
+            if (semi == end || *semi == '\n') {
+                p = semi + 1;
+                continue;
+            }
+            const char* q = semi + 1;
+            bool negative = q < end && *q == '-';
+            q += negative;
+            int32_t value = 0;
+            int decimals = -1;
+            for (; q < end && *q != '\n'; ++q) {
+                if (*q == '.') {
+                    decimals = 0;
+                    continue;
+                }
+                if (decimals >= 2) continue;
+                value = value * 10 + (*q - '0');
+                if (decimals >= 0) decimals++;
+            }
+            value *= decimals < 1 ? 100: decimals == 1 ? 10: 1;
+            row = {p, static_cast<size_t>(semi - p), negative ? -value: value};
+            p = q + 1;
+            return true;
+        }
+        return false;
+    }
+};
+
+// ---------------------------------------------------------------------------
+// Hashes of station names
+// ---------------------------------------------------------------------------
+
+/// 64-bit FNV-1a, the same as station_hash
+struct Fnv1aHash {
+    static constexpr const char* name = "fnv1a";
+
+    static inline uint64_t hash(const char* s, size_t length) {
+        uint64_t h = 14695981039346656037ULL;
+        for (size_t i = 0; i < length; ++i) {
+            h ^= static_cast<uint8_t>(s[i]);
+            h *= 1099511628211ULL;
+        }
+        return h;
+    }
+};
+
+/// Bernstein's djb2, as in hash_functions.c
+struct Djb2Hash {
+    static constexpr const char* name = "djb2";
+
+    static inline uint64_t hash(const char* s, size_t length) {
+        uint64_t h = 5381;
+        for (size_t i = 0; i < length; ++i)
+            h = ((h << 5) + h) + static_cast<uint8_t>(s[i]);
+        return h;
+    }
+};
+
+/// Multiplicative hash of the first and last eight bytes and the length
+struct WordHash {
+    static constexpr const char* name = "word";
+
+    static inline uint64_t hash(const char* s, size_t length) {
+        uint64_t head = 0, tail = 0;
+        if (length >= 8) {
+            memcpy(&head, s, 8);
+            memcpy(&tail, s + length - 8, 8);
+        } else {
+            memcpy(&head, s, length);
+        }
+        uint64_t h = (head ^ length) * 0x9E3779B97F4A7C15ULL;
+        h = (h ^ (h >> 29) ^ tail) * 0xBF58476D1CE4E5B9ULL;
+        return h ^ (h >> 32);
+    }
+};
+
+// ---------------------------------------------------------------------------
+// Accumulators of the temperatures of one station. min, max and total are
+// in hundredths of a degree, and rows is the number of values added.
+// ---------------------------------------------------------------------------
+
+/// Exact integer aggregation in hundredths of a degree
+struct IntAccumulator {
+    static constexpr const char* name = "int";
+
+    int32_t lo = std::numeric_limits<int32_t>::max();
+    int32_t hi = std::numeric_limits<int32_t>::min();
+    int64_t sum = 0;
+    uint64_t count = 0;
+
+    inline void add(int32_t value) {
+        lo = std::min(lo, value);
+        hi = std::max(hi, value);
+        sum += value;
+        count++;
+    }
+
+    inline void merge(const IntAccumulator& other) {
+        lo = std::min(lo, other.lo);
+        hi = std::max(hi, other.hi);
+        sum += other.sum;
+        count += other.count;
+    }
+
+    int64_t min() const { return lo; }
+    int64_t max() const { return hi; }
+    int64_t total() const { return sum; }
+    uint64_t rows() const { return count; }
+};
+
+/// Floating-point aggregation in hundredths of a degree. Every partial sum
+/// is a whole number of hundredths, which a double holds exactly below 2^53,
+/// so the result does not depend on the order rows are added or merged in.
+struct DoubleAccumulator {
+    static constexpr const char* name = "double";
+
+    double lo = std::numeric_limits<double>::infinity();
+    double hi = -std::numeric_limits<double>::infinity();
+    double sum = 0.0;
+    uint64_t count = 0;
+
+    inline void add(int32_t value) {
+        double v = value;
+        lo = std::min(lo, v);
+        hi = std::max(hi, v);
+        sum += v;
+        count++;
+    }
+
+    inline void merge(const DoubleAccumulator& other) {
+        lo = std::min(lo, other.lo);
+        hi = std::max(hi, other.hi);
+        sum += other.sum;
+        count += other.count;
+    }
+
+    int64_t min() const { return static_cast<int64_t>(lo); }
+    int64_t max() const { return static_cast<int64_t>(hi); }
+    int64_t total() const { return static_cast<int64_t>(sum); }
+    uint64_t rows() const { return count; }
+};
+
+// ---------------------------------------------------------------------------
+// Tables from station name to accumulator. find_or_insert takes the hash
+// computed by the engine's hash policy.
+// ---------------------------------------------------------------------------
+
+/// Open addressing with linear probing over a power-of-two array. Names are
+/// copied into one arena and referenced by offset.
+template <class Hash, class Acc>
+class LinearTable {
+public:
+    static constexpr const char* name = "linear";
+
+    LinearTable(): entries_(initial_capacity) {}
+
+    inline Acc& find_or_insert(const char* key, size_t length, uint64_t hash) {
+        size_t mask = entries_.size() - 1;
+        size_t slot = hash & mask;
+        while (true) {
+            Entry& entry = entries_[slot];
+            if (!entry.used) break;
+            if (entry.hash == hash && entry.length == length &&
+                memcmp(keys_.data() + entry.offset, key, length) == 0)
+                return entry.acc;
+            slot = (slot + 1) & mask;
+        }
+        if (2 * (size_ + 1) > entries_.size()) {
+            grow();
+            return find_or_insert(key, length, hash);
+        }
+        Entry& entry = entries_[slot];
+        entry.used = true;
+        entry.hash = hash;
+        entry.length = static_cast<uint32_t>(length);
+        entry.offset = keys_.size();
+        keys_.insert(keys_.end(), key, key + length);
+        size_++;
+        return entry.acc;
+    }
+
+    void merge(const LinearTable& other) {
+        other.for_each([&](std::string_view key, const Acc& acc) {
+            find_or_insert(key.data(), key.size(), Hash::hash(key.data(), key.size())).merge(acc);
+        });
+    }
+
+    template <class F>
+    void for_each(F&& f) const {
+        for (const Entry& entry: entries_) {
+            if (entry.used)
+                f(std::string_view(keys_.data() + entry.offset, entry.length), entry.acc);
+        }
+    }
+
+    size_t size() const { return size_; }
+
+private:
+    static constexpr size_t initial_capacity = 4096;
+
+    struct Entry {
+        uint64_t hash = 0;
+        size_t offset = 0;
+        uint32_t length = 0;
+        bool used = false;
+        Acc acc;
+    };
+
+    void grow() {
+        std::vector<Entry> old(entries_.size() * 2);
+        old.swap(entries_);
+        size_t mask = entries_.size() - 1;
+        for (const Entry& entry: old) {
+            if (!entry.used) continue;
+            size_t slot = entry.hash & mask;
+            while (entries_[slot].used)
+                slot = (slot + 1) & mask;
+            entries_[slot] = entry;
+        }
+    }
+
+    std::vector<Entry> entries_;
+    std::vector<char> keys_;
+    size_t size_ = 0;
+};
+
+/// std::unordered_map keyed by std::string, looked up without allocating
+template <class Hash, class Acc>
+class StdTable {
+public:
+    static constexpr const char* name = "std";
+
+    inline Acc& find_or_insert(const char* key, size_t length, uint64_t) {
+        std::string_view view(key, length);
+        auto it = map_.find(view);
+        if (it == map_.end())
+            it = map_.emplace(std::string(view), Acc()).first;
+        return it->second;
+    }
+
+    void merge(const StdTable& other) {
+        for (const auto& [key, acc]: other.map_)
+            find_or_insert(key.data(), key.size(), 0).merge(acc);
+    }
+
+    template <class F>
+    void for_each(F&& f) const {
+        for (const auto& [key, acc]: map_)
+            f(std::string_view(key), acc);
+    }
+
+    size_t size() const { return map_.size(); }
+
+private:
+    struct KeyHash {
+        using is_transparent = void;
+        size_t operator()(std::string_view key) const { return Hash::hash(key.data(), key.size()); }
+    };
+
+    std::unordered_map<std::string, Acc, KeyHash, std::equal_to<>> map_;
+};
+
+} // namespace onebrc
+
+#endif // _ENGINE_POLICIES_HPP_
@@ -0,0 +1,229 @@
+/* Following a growing measurements file with periodic snapshots.
+
+                    GNU AFFERO GENERAL PUBLIC LICENSE
+                       Version 3, 19 November 2007
+
+    Copyright (C) 2024  Debajyoti Debnath
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published
+    by the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include "follow.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+
+/// Initialize a follow configuration to one snapshot a second on stdout
+void followconfig_init(FollowConfig* follow) {
+    if (follow==NULL) return;
+    follow->interval_seconds = 1.0;
+    follow->interval_rows = 0;
+    follow->snapshot_path = NULL;
+    outputconfig_init(&follow->output);
+}
+
+/// Initialize the state of following fd from its start
+void followstate_init(FollowState* state, int fd, const AnalyzerConfig* config) {
+    if (state==NULL || config==NULL) {
+        perror("Error: Null pointer provided as argument.");
+        abort();
+    }
+    memset(state, 0x0, sizeof(FollowState));
+    state->fd = fd;
+    state->capacity = FOLLOW_READ_SIZE;
+    state->buffer = (char*)malloc(state->capacity);
+    if (state->buffer == NULL) {
+        perror("Error: could not allocate follow buffer.");
+        abort();
+    }
+    aggregator_init(&state->totals, config->catalog);
+    state->totals.histograms = config->histograms;
+    state->totals.batch_width = config->batch_width;
+}
+
+/// Aggregate complete lines into the totals. Small appends are consumed in
+/// place so that a trickle of rows costs no threads and no merge.
+static void _follow_aggregate(FollowState* state, const AnalyzerConfig* config, const char* data, size_t length) {
+    if (length < ANALYZER_MIN_CHUNK_SIZE) {
+        aggregator_consume(&state->totals, data, data + length, true);
+        return;
+    }
+    Aggregator delta;
+    analyze_buffer(data, length, config, &delta, NULL);
+    aggregator_merge(&state->totals, &delta);
+    aggregator_destroy(&delta);
+}
+
+/// Read whatever the file gained and aggregate its complete lines, holding
+/// back a trailing partial line. Returns whether any row was added.
+bool follow_read(FollowState* state, const AnalyzerConfig* config) {
+    uint64_t rows = state->totals.rows;
+
+    // A file that shrank was truncated or rewritten, so start over
+    struct stat st;
+    if (fstat(state->fd, &st) == 0 && (uint64_t)st.st_size < state->offset) {
+        aggregator_destroy(&state->totals);
+        aggregator_init(&state->totals, config->catalog);
+        state->totals.histograms = config->histograms;
+        state->totals.batch_width = config->batch_width;
+        state->offset = 0;
+        state->carried = 0;
+        state->published_rows = 0;
+        rows = UINT64_MAX;
+    }
+
+    while (true) {
+        if (state->carried == state->capacity) {
+            state->capacity *= 2;
+            state->buffer = (char*)realloc(state->buffer, state->capacity);
+            if (state->buffer == NULL) {
+                perror("Error: could not allocate follow buffer.");
+                abort();
+            }
+        }
+        ssize_t n = pread(state->fd, state->buffer + state->carried, state->capacity - state->carried, (off_t)state->offset);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            perror("Error: could not read followed file.");
+            exit(EXIT_FAILURE);
+        }
+        if (n == 0) break;
+        state->offset += (uint64_t)n;
+        size_t filled = state->carried + (size_t)n;
+
+        const char* newline = (const char*)memrchr(state->buffer, '\n', filled);
+        if (newline == NULL) {
+            state->carried = filled;
+            continue;
+        }
+        size_t length = (size_t)(newline + 1 - state->buffer);
+        _follow_aggregate(state, config, state->buffer, length);
+        state->carried = filled - length;
+        memmove(state->buffer, state->buffer + length, state->carried);
+    }
+    return state->totals.rows != rows;
+}
+
+/// Write a snapshot of the totals to stdout, or to a temporary file that
+/// is renamed over the snapshot path so that readers never see it partly
+/// written
+void follow_publish(FollowState* state, const FollowConfig* follow) {
+    FILE* out = stdout;
+    char temporary[1100];
+    if (follow->snapshot_path != NULL) {
+        snprintf(temporary, sizeof(temporary), "%s.tmp", follow->snapshot_path);
+        out = fopen(temporary, "w");
+        if (out == NULL) {
+            fprintf(stderr, "Error: could not write snapshot %s: %s\n", temporary, strerror(errno));
+            return;
+        }
+    }
+
+    bool written = output_write(&state->totals, &follow->output, out);
+
+    if (follow->snapshot_path != NULL) {
+        written = written && fsync(fileno(out)) == 0;
+        fclose(out);
+        if (!written || rename(temporary, follow->snapshot_path) == -1) {
+            fprintf(stderr, "Error: could not publish snapshot %s: %s\n", follow->snapshot_path, strerror(errno));
+            return;
+        }
+    }
+    state->published_rows = state->totals.rows;
+    state->num_snapshots++;
+}
+
+/// Release the buffer and totals of a followed file
+void followstate_destroy(FollowState* state) {
+    if (state==NULL) return;
+    free(state->buffer);
+    aggregator_destroy(&state->totals);
+    memset(state, 0x0, sizeof(FollowState));
+}
+
+/// Aggregate a file and keep aggregating the lines appended to it, waking
+/// up on inotify events rather than polling, and publish snapshots as set
+/// by follow. Returns once the file is removed or renamed.
+void follow_file(const char* path, const AnalyzerConfig* config, const FollowConfig* follow) {
+    if (path==NULL || config==NULL || follow==NULL) {
+        perror("Error: Null pointer provided as argument.");
+        abort();
+    }
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        fprintf(stderr, "Error reading file %s\n", path);
+        exit(EXIT_FAILURE);
+    }
+    int notify = inotify_init1(IN_CLOEXEC);
+    if (notify == -1 || inotify_add_watch(notify, path, IN_MODIFY | IN_ATTRIB | IN_MOVE_SELF | IN_DELETE_SELF) == -1) {
+        perror("Error: could not watch the followed file.");
+        exit(EXIT_FAILURE);
+    }
+
+    FollowState state;
+    followstate_init(&state, fd, config);
+    follow_read(&state, config);
+    follow_publish(&state, follow);
+    double published = stats_now();
+
+    // Room for at least one event with the longest name
+    char events[sizeof(struct inotify_event) + 4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    bool removed = false;
+    while (!removed) {
+        int timeout = -1;
+        if (follow->interval_seconds > 0) {
+            double wait = published + follow->interval_seconds - stats_now();
+            timeout = wait <= 0 ? 0: (int)(wait * 1000) + 1;
+        }
+        struct pollfd waiting = {notify, POLLIN, 0};
+        int ready = poll(&waiting, 1, timeout);
+        if (ready < 0) {
+            if (errno == EINTR) continue;
+            perror("Error: could not wait for the followed file.");
+            exit(EXIT_FAILURE);
+        }
+        if (ready > 0) {
+            ssize_t n = read(notify, events, sizeof(events));
+            for (char* p = events; n > 0 && p < events + n;) {
+                const struct inotify_event* event = (const struct inotify_event*)p;
+                removed = removed || (event->mask & (IN_MOVE_SELF | IN_DELETE_SELF | IN_IGNORED)) != 0;
+                p += sizeof(struct inotify_event) + event->len;
+            }
+        }
+
+        follow_read(&state, config);
+        double now = stats_now();
+        bool changed = state.totals.rows != state.published_rows;
+        bool rows_due = follow->interval_rows > 0 && state.totals.rows - state.published_rows >= follow->interval_rows;
+        bool time_due = follow->interval_seconds > 0 && now - published >= follow->interval_seconds;
+        if (changed && (rows_due || time_due || removed))
+            follow_publish(&state, follow);
+        if (time_due || rows_due)
+            published = now;
+    }
+    fprintf(stderr, "Stopped following %s: the file was removed or renamed.\n", path);
+
+    followstate_destroy(&state);
+    close(notify);
+    close(fd);
+}
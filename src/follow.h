@@ -0,0 +1,70 @@
+/* Following a growing measurements file with periodic snapshots.
+
+                    GNU AFFERO GENERAL PUBLIC LICENSE
+                       Version 3, 19 November 2007
+
+    Copyright (C) 2024  Debajyoti Debnath
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published
+    by the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+
+
+#ifndef _FOLLOW_H_
+#define _FOLLOW_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "analyzer.h"
+#include "output.h"
+
+// Bytes read from the followed file at a time
+#define FOLLOW_READ_SIZE (16 << 20)
+
+// When and where snapshots of a followed file are published
+typedef struct {
+    // Publish once this many seconds or rows passed since the last
+    // snapshot, if anything changed; 0 disables either trigger
+    double interval_seconds;
+    uint64_t interval_rows;
+    // Replaced atomically by every snapshot, or NULL for stdout
+    const char* snapshot_path;
+    OutputConfig output;
+} FollowConfig;
+
+// State of a followed file: the aggregates of its complete lines and the
+// partial line after them
+typedef struct {
+    int fd;
+    uint64_t offset;
+    char* buffer;
+    size_t capacity;
+    size_t carried;
+    Aggregator totals;
+    uint64_t published_rows;
+    size_t num_snapshots;
+} FollowState;
+
+void followconfig_init(FollowConfig* follow);
+void followstate_init(FollowState* state, int fd, const AnalyzerConfig* config);
+bool follow_read(FollowState* state, const AnalyzerConfig* config);
+void follow_publish(FollowState* state, const FollowConfig* follow);
+void followstate_destroy(FollowState* state);
+void follow_file(const char* path, const AnalyzerConfig* config, const FollowConfig* follow);
+
+#endif // _FOLLOW_H_
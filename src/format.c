@@ -24,9 +24,14 @@
 
 /// Format a DataRow in the form of "foo;123.44"
 String format_datarow(const DataRow* row) {
+    return format_datarow_decimals(row, 2);
+}
+
+/// Format a DataRow with the given number of decimals, e.g. "foo;123.4"
+String format_datarow_decimals(const DataRow* row, int decimals) {
     // Format the data into the desired format
     char formatted[BUFSIZE];
-    if (snprintf(formatted, sizeof(formatted), "%s;%.2f\n", row->location->data, row->temperature) < 0) {
+    if (snprintf(formatted, sizeof(formatted), "%s;%.*f\n", row->location->data, decimals, row->temperature) < 0) {
         perror("Error formatting data row.");
         abort();
     }
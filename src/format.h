@@ -23,12 +23,51 @@
 #ifndef FORMAT_H
 #define FORMAT_H
 
+#include <stdint.h>
 #include "dtypes.h"
 
 // Size of data buffer
 #define BUFSIZE 256
+// Longest text format_tenths writes
+#define FORMAT_TENTHS_MAX 22
 
 String format_datarow(const DataRow* row);
+String format_datarow_decimals(const DataRow* row, int decimals);
+
+/// Mean of count values given as their sum in hundredths, rounded to tenths
+/// half up like the reference implementation of the challenge (Java's
+/// Math.round), so 1.25 becomes 1.3 and -1.25 becomes -1.2
+static inline int64_t round_tenths(int64_t hundredths, uint64_t count) {
+    if (count == 0) return 0;
+    int64_t numerator = hundredths + 5 * (int64_t)count;
+    int64_t denominator = 10 * (int64_t)count;
+    int64_t quotient = numerator / denominator;
+    if (numerator % denominator != 0 && numerator < 0)
+        quotient--;
+    return quotient;
+}
+
+/// Write tenths of a degree as "-12.3" at p without a terminating NUL and
+/// return the end of the text. At most FORMAT_TENTHS_MAX bytes are written.
+static inline char* format_tenths(char* p, int64_t tenths) {
+    uint64_t magnitude = (uint64_t)tenths;
+    if (tenths < 0) {
+        *p++ = '-';
+        magnitude = 0 - magnitude;
+    }
+    char digits[20];
+    size_t n = 0;
+    uint64_t whole = magnitude / 10;
+    do {
+        digits[n++] = (char)('0' + whole % 10);
+        whole /= 10;
+    } while (whole > 0);
+    while (n > 0)
+        *p++ = digits[--n];
+    *p++ = '.';
+    *p++ = (char)('0' + magnitude % 10);
+    return p;
+}
 
 #endif // FORMAT_H
 
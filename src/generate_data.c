@@ -22,11 +22,14 @@
 
 #include "generate_data.h"
 #include "format.h"
+#include "trace.h"
 
 typedef struct {
     size_t low, high;
     size_t seed;
-    DataRowGroup* source;
+    const StationCatalog* source;
+    const double* cdf;
+    int decimals;
     String* destination;
 } _SampleRowsArg;
 
@@ -34,7 +37,9 @@ void _samplerowsarg_init(_SampleRowsArg** arg,
                          size_t low, 
                          size_t high, 
                          size_t seed, 
-                         DataRowGroup* source, 
+                         const StationCatalog* source, 
+                         const double* cdf,
+                         int decimals,
                          String* destination) {
     if (arg==NULL) {
         perror("Error: _SampleRowsArg ptr is null.\n");
@@ -53,6 +58,8 @@ void _samplerowsarg_init(_SampleRowsArg** arg,
     (*arg)->high = high;
     (*arg)->seed = seed;
     (*arg)->source = source;
+    (*arg)->cdf = cdf;
+    (*arg)->decimals = decimals;
     (*arg)->destination = destination;
 }
 
@@ -64,8 +71,9 @@ void _samplerowsarg_destroy(void* arg) {
 
 /// From the data from a datarow, generate a new datarow with temperature
 /// sampled from a Gaussian distribution with mean as the temperature of the 
-/// argument data and standard deviation STDDEV
-DataRow sample_temperature(DataRow* data) {
+/// argument data and standard deviation STDDEV. seed is the rand_r state of
+/// the calling thread.
+DataRow sample_temperature(DataRow* data, unsigned int* seed) {
     if (data==NULL) {
         perror("Error: null datarow pointer provided.");
         abort();
@@ -74,16 +82,34 @@ DataRow sample_temperature(DataRow* data) {
     res.location = (String*)malloc(sizeof(String));
     *(res.location) = string_copy(data->location);
     res.temperature = data->temperature;
-    double _x = (double)rand()/(double)(RAND_MAX);
+    double _x = (double)rand_r(seed)/(double)(RAND_MAX);
     res.temperature = data->temperature + STDDEV * exp(-0.5*(_x * _x) / sqrt(2*M_PI));
     return res;
 };
 
-/// Sample n_sample rows with replacement from the provided DataRowGroup group,
+/// Sample the temperature of the station with the given catalog ID and
+/// format it as an output line
+static String _sample_station(const StationCatalog* catalog, uint32_t id, int decimals, unsigned int* seed) {
+    String name = catalog_name(catalog, id);
+    DataRow station;
+    station.location = &name;
+    station.temperature = catalog->mean_temperatures[id];
+
+    DataRow row = sample_temperature(&station, seed);
+    String line = format_datarow_decimals(&row, decimals);
+    datarow_destroy(row);
+    return line;
+}
+
+/// Sample n_sample rows with replacement from the stations in the catalog,
 /// sample temperatures for each row.
-String* generate_random_temperature_sample_serial(DataRowGroup *group, size_t n_samples, size_t seed) {
-    if (group==NULL) {
-        perror("Error: null datarowgroup pointer provided.");
+String* generate_random_temperature_sample_serial(const StationCatalog* catalog, size_t n_samples, size_t seed, const WorkloadConfig* workload) {
+    if (catalog==NULL || catalog->num_stations==0) {
+        perror("Error: null or empty catalog provided.");
+        abort();
+    }
+    if (workload==NULL) {
+        perror("Error: null workload config provided.");
         abort();
     }
     if (n_samples == 0 || n_samples > ONE_BILLION) {
@@ -91,21 +117,28 @@ String* generate_random_temperature_sample_serial(DataRowGroup *group, size_t n_
         abort();
     }
 
-    srand(seed);
+    unsigned int state = (unsigned int)seed;
 
     String* res = (String*)calloc(n_samples, sizeof(String));
-    DataRow row;
+
+    if (workload->zipf_exponent > 0.0) {
+        double* cdf = workload_zipf_cdf(catalog->num_stations, workload->zipf_exponent);
+        for (size_t i = 0; i < n_samples; ++i) {
+            double u = (double)rand_r(&state) / (double)RAND_MAX;
+            uint32_t idx = workload_sample_station(cdf, catalog->num_stations, u);
+            res[i] = _sample_station(catalog, idx, workload->decimals, &state);
+        }
+        free(cdf);
+        return res;
+    }
 
     // Generate indices to sample
     IntMatrix idxs = intmat_create(n_samples, 1);
-    intmat_fill_random(&idxs, 0, group->num_rows, true, seed);
+    intmat_fill_random(&idxs, 0, catalog->num_stations, true, seed);
 
     // Generate data
-    for (size_t i = 0; i < n_samples; ++i) {
-        row = sample_temperature(&group->data[idxs.data[i]]);
-        res[i] = format_datarow(&row);
-        datarow_destroy(row);
-    }
+    for (size_t i = 0; i < n_samples; ++i)
+        res[i] = _sample_station(catalog, (uint32_t)idxs.data[i], workload->decimals, &state);
 
     // Destroy idx matrix
     intmat_destroy(&idxs);
@@ -113,32 +146,51 @@ String* generate_random_temperature_sample_serial(DataRowGroup *group, size_t n_
     return res;
 }
 
+/// Seed of the rand_r state of sampling task task_index. Every task draws
+/// from its own stream, so a seed gives the same rows whatever the number
+/// of threads or the order the tasks run in.
+static size_t _task_seed(size_t seed, size_t task_index) {
+    // splitmix64 finalizer of the seed and task index
+    uint64_t z = (uint64_t)seed + 0x9E3779B97F4A7C15ULL * (uint64_t)(task_index + 1);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return (size_t)(z ^ (z >> 31));
+}
+
 void* _sample_rows(void* arg) {
     _SampleRowsArg* _arg = (_SampleRowsArg*)arg;
 
     if (_arg->low>=_arg->high)
         return NULL;
 
-    unsigned int seed = _arg->seed;
-    DataRow row;
+    unsigned int seed = (unsigned int)_arg->seed;
 
     // Generate data
     for (size_t i = _arg->low; i < _arg->high; ++i) {
-        size_t idx = rand_r(&seed) % _arg->source->num_rows;
-        row = sample_temperature(&(_arg->source->data[idx]));
-        _arg->destination[i] = format_datarow(&row);
-        datarow_destroy(row);
-        seed *= i;
+        size_t idx;
+        if (_arg->cdf != NULL) {
+            double u = (double)rand_r(&seed) / (double)RAND_MAX;
+            idx = workload_sample_station(_arg->cdf, _arg->source->num_stations, u);
+        } else {
+            idx = rand_r(&seed) % _arg->source->num_stations;
+        }
+        _arg->destination[i] = _sample_station(_arg->source, (uint32_t)idx, _arg->decimals, &seed);
     }
 
     return NULL;
 }
 
-/// Sample n_sample rows with replacement from the provided DataRowGroup group,
-/// sample temperatures for each row. This is done using multithreading.
-String* generate_random_temperature_sample_threaded(DataRowGroup *group, size_t n_samples, size_t seed, size_t num_threads) {
-    if (group==NULL) {
-        perror("Error: null datarowgroup pointer provided.");
+/// Sample rows first_row to first_row + n_samples of the measurements
+/// generated from seed, so that a long run can be generated a range at a
+/// time with the same rows as in one go. first_row must be a multiple of
+/// GENERATE_TASK_ROWS. This is done using multithreading.
+String* generate_random_temperature_sample_range(const StationCatalog* catalog, size_t first_row, size_t n_samples, size_t seed, size_t num_threads, const WorkloadConfig* workload) {
+    if (catalog==NULL || catalog->num_stations==0) {
+        perror("Error: null or empty catalog provided.");
+        abort();
+    }
+    if (workload==NULL) {
+        perror("Error: null workload config provided.");
         abort();
     }
     if (n_samples == 0 || n_samples > ONE_BILLION) {
@@ -148,37 +200,47 @@ String* generate_random_temperature_sample_threaded(DataRowGroup *group, size_t
     if (num_threads==0) {
         perror("Error: num_threads must be at least 1.");
     }
-
-    srand(seed);
+    if (first_row % GENERATE_TASK_ROWS != 0) {
+        perror("Error: first_row must be a multiple of GENERATE_TASK_ROWS.");
+        abort();
+    }
 
     String* res = (String*)calloc(n_samples, sizeof(String));
+
+    // Skewed popularity is sampled by inverting a shared Zipf distribution
+    double* cdf = NULL;
+    if (workload->zipf_exponent > 0.0)
+        cdf = workload_zipf_cdf(catalog->num_stations, workload->zipf_exponent);
     
     YATPool* pool;
 
-    size_t fac = 16 * (size_t)log2(n_samples);
-    fac = n_samples == 1 ? 1: fac;
-    size_t num_tasks = n_samples / (fac * num_threads);
-    num_tasks = (n_samples % (fac * num_threads) == 0)? num_tasks: num_tasks+1;
+    size_t num_tasks = n_samples / GENERATE_TASK_ROWS;
+    num_tasks = (n_samples % GENERATE_TASK_ROWS == 0)? num_tasks: num_tasks+1;
 
     yatpool_init(&pool, num_threads, num_tasks);
 
     for (size_t i=0; i<num_tasks; ++i) {
         Task* task;
         _SampleRowsArg* arg;
-        size_t low = i * fac * num_threads;
-        size_t high = (i + 1) * fac * num_threads;
+        size_t low = i * GENERATE_TASK_ROWS;
+        size_t high = (i + 1) * GENERATE_TASK_ROWS;
         if (high > n_samples)
             high = n_samples;
-        if (low > high) 
-            low = high;
-        _samplerowsarg_init(&arg, low, high, seed, group, res);
-        task_init(&task, &_sample_rows, arg, &_samplerowsarg_destroy);
+        _samplerowsarg_init(&arg, low, high, _task_seed(seed, first_row / GENERATE_TASK_ROWS + i), catalog, cdf, workload->decimals, res);
+        trace_task_init(&task, "sample_rows", &_sample_rows, arg, &_samplerowsarg_destroy);
 
         yatpool_put(pool, task);
     }
     yatpool_wait(pool);
 
     yatpool_destroy(pool);
+    free(cdf);
 
     return res;
 }
+
+/// Sample n_sample rows with replacement from the stations in the catalog,
+/// sample temperatures for each row. This is done using multithreading.
+String* generate_random_temperature_sample_threaded(const StationCatalog* catalog, size_t n_samples, size_t seed, size_t num_threads, const WorkloadConfig* workload) {
+    return generate_random_temperature_sample_range(catalog, 0, n_samples, seed, num_threads, workload);
+}
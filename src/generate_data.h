@@ -28,14 +28,21 @@
 
 #define ONE_BILLION 1000000000
 
+// Rows sampled by one threadpool task. Task boundaries do not depend on the
+// thread count, and per-task overhead no longer shows from about 4K rows.
+#define GENERATE_TASK_ROWS (1 << 16)
+
 #include <math.h>
 #include <matrix.h>
 #include <yatpool.h>
 #include "format.h"
 #include "dtypes.h"
+#include "catalog.h"
+#include "workload.h"
 
-DataRow sample_temperature(DataRow* data);
-String* generate_random_temperature_sample_serial(DataRowGroup* group, size_t n_samples, size_t seed);
-String* generate_random_temperature_sample_threaded(DataRowGroup* group, size_t n_samples, size_t seed, size_t num_threads);
+DataRow sample_temperature(DataRow* data, unsigned int* seed);
+String* generate_random_temperature_sample_serial(const StationCatalog* catalog, size_t n_samples, size_t seed, const WorkloadConfig* workload);
+String* generate_random_temperature_sample_range(const StationCatalog* catalog, size_t first_row, size_t n_samples, size_t seed, size_t num_threads, const WorkloadConfig* workload);
+String* generate_random_temperature_sample_threaded(const StationCatalog* catalog, size_t n_samples, size_t seed, size_t num_threads, const WorkloadConfig* workload);
 
 #endif // _GENERATE_DATA_H_
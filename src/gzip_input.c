@@ -0,0 +1,390 @@
+/* Analysis of gzip-compressed measurements.
+
+                    GNU AFFERO GENERAL PUBLIC LICENSE
+                       Version 3, 19 November 2007
+
+    Copyright (C) 2024  Debajyoti Debnath
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published
+    by the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include "gzip_input.h"
+#include "stream_input.h"
+#include "trace.h"
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+#include <yatpool.h>
+
+// Decompresses consecutive gzip members from a mapped file
+typedef struct {
+    const char* data;
+    size_t size;
+    z_stream stream;
+    // No member is started at or after this offset
+    size_t stop;
+    // Offset just past the last member that was fully decompressed
+    size_t member_end;
+    bool done;
+    bool failed;
+} _GzipReader;
+
+// Compressed range of a multi-member file decompressed and aggregated by
+// one worker, with the partial lines at both of its ends
+typedef struct {
+    const char* data;
+    size_t size;
+    size_t start;
+    size_t end;
+    Aggregator aggregator;
+    char* head;
+    size_t head_length;
+    char* tail;
+    size_t tail_length;
+    size_t decoded_end;
+    bool failed;
+    PerfReport* perf;
+    size_t worker;
+} _GzipSegment;
+
+/// Whether data starts like a gzip member: magic bytes, deflate, and no
+/// reserved flags
+static inline bool _gzip_header_at(const char* data, size_t size, size_t offset) {
+    return offset + 10 <= size && (unsigned char)data[offset] == 0x1f && (unsigned char)data[offset + 1] == 0x8b &&
+           data[offset + 2] == 8 && ((unsigned char)data[offset + 3] & 0xe0) == 0;
+}
+
+/// Whether a buffer holds gzip-compressed data
+bool gzip_is_compressed(const char* data, size_t size) {
+    return data != NULL && _gzip_header_at(data, size, 0);
+}
+
+/// Whether the regular file at path holds gzip-compressed data; stdin given
+/// as "-", pipes and unreadable paths are reported as uncompressed
+bool gzip_file_is_compressed(const char* path) {
+    int fd = strcmp(path, "-") == 0 ? -1: open(path, O_RDONLY);
+    if (fd == -1) return false;
+    struct stat st;
+    char header[10];
+    bool compressed = fstat(fd, &st) == 0 && S_ISREG(st.st_mode) &&
+                      pread(fd, header, sizeof(header), 0) == (ssize_t)sizeof(header) &&
+                      _gzip_header_at(header, sizeof(header), 0);
+    close(fd);
+    return compressed;
+}
+
+static void _gzip_reader_init(_GzipReader* reader, const char* data, size_t size, size_t start, size_t stop) {
+    memset(reader, 0x0, sizeof(_GzipReader));
+    reader->data = data;
+    reader->size = size;
+    reader->stop = stop;
+    reader->member_end = start;
+    reader->stream.next_in = (Bytef*)(data + start);
+    reader->stream.avail_in = 0;
+    if (inflateInit2(&reader->stream, 16 + MAX_WBITS) != Z_OK) {
+        perror("Error: could not initialize zlib.");
+        abort();
+    }
+}
+
+/// Decompress up to capacity bytes into out, continuing into the next
+/// member after each one ends. Returns the number of bytes written.
+static size_t _gzip_reader_read(_GzipReader* reader, char* out, size_t capacity) {
+    z_stream* stream = &reader->stream;
+    stream->next_out = (Bytef*)out;
+    stream->avail_out = (uInt)capacity;
+    while (stream->avail_out > 0 && !reader->done) {
+        size_t offset = (size_t)((const char*)stream->next_in - reader->data);
+        if (stream->avail_in == 0 && offset < reader->size) {
+            size_t remaining = reader->size - offset;
+            stream->avail_in = (uInt)(remaining < (size_t)INT_MAX ? remaining: (size_t)INT_MAX);
+        }
+        int ret = inflate(stream, Z_NO_FLUSH);
+        if (ret == Z_STREAM_END) {
+            reader->member_end = (size_t)((const char*)stream->next_in - reader->data);
+            // Padding or a stop offset ends the stream like the end of the file
+            if (reader->member_end >= reader->stop || !_gzip_header_at(reader->data, reader->size, reader->member_end))
+                reader->done = true;
+            else
+                inflateReset(stream);
+        } else if (ret == Z_BUF_ERROR && stream->avail_in == 0) {
+            // The file ends inside a member
+            reader->failed = true;
+            reader->done = true;
+        } else if (ret != Z_OK && ret != Z_BUF_ERROR) {
+            reader->failed = true;
+            reader->done = true;
+        }
+    }
+    return capacity - stream->avail_out;
+}
+
+static void _gzip_reader_destroy(_GzipReader* reader) {
+    inflateEnd(&reader->stream);
+}
+
+/// Read a single stream of members for analyze_stream
+static size_t _gzip_stream_read(void* source, char* out, size_t capacity, bool* done, bool* failed) {
+    _GzipReader* reader = (_GzipReader*)source;
+    size_t n = _gzip_reader_read(reader, out, capacity);
+    *done = reader->done;
+    *failed = reader->failed;
+    return n;
+}
+
+/// Whether a member that decompresses cleanly starts at offset
+static bool _gzip_probe(const char* data, size_t size, size_t offset) {
+    if (!_gzip_header_at(data, size, offset)) return false;
+    char out[4096];
+    _GzipReader reader;
+    size_t end = offset + 65536 < size ? offset + 65536: size;
+    _gzip_reader_init(&reader, data, end, offset, end);
+    size_t n = _gzip_reader_read(&reader, out, sizeof(out));
+    bool valid = n > 0 && (!reader.failed || end < size);
+    _gzip_reader_destroy(&reader);
+    return valid;
+}
+
+/// Find up to max_starts offsets at which members start, spread evenly over
+/// the file and at least GZIP_MIN_SEGMENT_SIZE apart, the first being 0.
+/// Headers are recognized by their bytes and by decompressing a little, so
+/// an offset can still be inside a member; segments are checked once they
+/// have been decompressed.
+size_t gzip_find_members(const char* data, size_t size, size_t* starts, size_t max_starts) {
+    if (data==NULL || starts==NULL || max_starts==0) return 0;
+    size_t count = 0;
+    starts[count++] = 0;
+    for (size_t k = 1; k < max_starts; ++k) {
+        size_t offset = k * (size / max_starts);
+        size_t earliest = starts[count - 1] + GZIP_MIN_SEGMENT_SIZE;
+        offset = offset < earliest ? earliest: offset;
+        while (offset + 10 <= size) {
+            const char* magic = (const char*)memmem(data + offset, size - offset, "\x1f\x8b\x08", 3);
+            if (magic == NULL) {
+                offset = size;
+                break;
+            }
+            offset = (size_t)(magic - data);
+            if (_gzip_probe(data, size, offset))
+                break;
+            offset++;
+        }
+        if (offset + 10 > size) break;
+        starts[count++] = offset;
+    }
+    return count;
+}
+
+/// Function for threadpool to decompress and aggregate one segment of a
+/// multi-member file. The text before its first newline is kept aside for
+/// the previous segment, except in the first segment.
+void* _decompress_segment(void* arg) {
+    _GzipSegment* segment = (_GzipSegment*)arg;
+#if ONEBRC_STATS
+    double start = stats_now();
+#endif
+    PerfCounters counters;
+    bool count = perfreport_worker_start(segment->perf, segment->worker, &counters);
+    _GzipReader reader;
+    _gzip_reader_init(&reader, segment->data, segment->size, segment->start, segment->end);
+
+    size_t capacity = STREAM_BLOCK_SIZE;
+    char* buffer = (char*)malloc(capacity);
+    size_t carried = 0;
+    bool seen_newline = segment->start == 0;
+    while (!reader.done) {
+        size_t filled = carried + _gzip_reader_read(&reader, buffer + carried, capacity - carried);
+        char* begin = buffer;
+        if (!seen_newline) {
+            char* newline = (char*)memchr(buffer, '\n', filled);
+            if (newline == NULL && filled == capacity) {
+                capacity *= 2;
+                buffer = (char*)realloc(buffer, capacity);
+                carried = filled;
+                continue;
+            }
+            if (newline == NULL) {
+                carried = filled;
+                continue;
+            }
+            segment->head_length = (size_t)(newline - buffer);
+            segment->head = (char*)malloc(segment->head_length + 1);
+            memcpy(segment->head, buffer, segment->head_length);
+            begin = newline + 1;
+            seen_newline = true;
+        }
+        char* last = (char*)memrchr(begin, '\n', (size_t)(buffer + filled - begin));
+        if (last != NULL) {
+            aggregator_consume(&segment->aggregator, begin, last + 1, true);
+            STATS(if (segment->aggregator.stats != NULL) segment->aggregator.stats->chunks++);
+            begin = last + 1;
+        }
+        carried = (size_t)(buffer + filled - begin);
+        memmove(buffer, begin, carried);
+        if (carried == capacity) {
+            capacity *= 2;
+            buffer = (char*)realloc(buffer, capacity);
+        }
+    }
+
+    // A segment without a newline cannot be stitched to its neighbours
+    segment->failed = reader.failed || !seen_newline;
+    segment->decoded_end = reader.member_end;
+    segment->tail = buffer;
+    segment->tail_length = carried;
+    _gzip_reader_destroy(&reader);
+    if (count)
+        perfreport_worker_stop(segment->perf, segment->worker, &counters, segment->aggregator.rows);
+#if ONEBRC_STATS
+    WorkerStats* worker_stats = segment->aggregator.stats;
+    if (worker_stats != NULL) {
+        worker_stats->seconds = stats_now() - start;
+        worker_stats->rows = segment->aggregator.rows;
+        worker_stats->bytes = segment->aggregator.bytes;
+    }
+#endif
+    return NULL;
+}
+
+/// Decompress the segments of a multi-member file in parallel. Returns
+/// false, with nothing aggregated, if a segment did not start on a member
+/// boundary or failed to decompress.
+static bool _analyze_members(const char* data, size_t size, const size_t* starts, size_t num_segments,
+                             const AnalyzerConfig* config, Aggregator* result, RunStats* stats) {
+#if !ONEBRC_STATS
+    (void)stats;
+#endif
+    _GzipSegment* segments = (_GzipSegment*)calloc(num_segments, sizeof(_GzipSegment));
+    YATPool* pool;
+    yatpool_init(&pool, num_segments, num_segments);
+    for (size_t k = 0; k < num_segments; ++k) {
+        _GzipSegment* segment = &segments[k];
+        segment->data = data;
+        segment->size = size;
+        segment->start = starts[k];
+        segment->end = k + 1 < num_segments ? starts[k + 1]: size;
+        segment->perf = config->perf;
+        segment->worker = k;
+        aggregator_init(&segment->aggregator, config->catalog);
+        segment->aggregator.histograms = config->histograms;
+        segment->aggregator.batch_width = config->batch_width;
+        STATS(segment->aggregator.stats = stats != NULL && k < stats->num_workers ? &stats->workers[k]: NULL);
+
+        Task* task;
+        trace_task_init(&task, "decompress_segment", &_decompress_segment, segment, NULL);
+        yatpool_put(pool, task);
+    }
+    yatpool_wait(pool);
+    yatpool_destroy(pool);
+
+    // Every segment must end where the next one starts
+    bool valid = true;
+    for (size_t k = 0; k < num_segments; ++k) {
+        valid = valid && !segments[k].failed;
+        if (k + 1 < num_segments)
+            valid = valid && segments[k].decoded_end == segments[k + 1].start;
+    }
+
+    if (valid) {
+        // Lines split between segments are joined and aggregated last
+        for (size_t k = 1; k < num_segments; ++k) {
+            size_t length = segments[k - 1].tail_length + segments[k].head_length;
+            char* line = (char*)malloc(length + 1);
+            memcpy(line, segments[k - 1].tail, segments[k - 1].tail_length);
+            memcpy(line + segments[k - 1].tail_length, segments[k].head, segments[k].head_length);
+            aggregator_consume(&segments[k].aggregator, line, line + length, true);
+            free(line);
+        }
+        _GzipSegment* last = &segments[num_segments - 1];
+        aggregator_consume(&last->aggregator, last->tail, last->tail + last->tail_length, true);
+
+        Aggregator* aggregators = (Aggregator*)malloc(num_segments * sizeof(Aggregator));
+        for (size_t k = 0; k < num_segments; ++k)
+            aggregators[k] = segments[k].aggregator;
+        PerfCounters counters;
+        bool count = config->perf != NULL && perf_counters_open(&counters, false);
+        if (count)
+            perf_counters_start(&counters);
+        aggregator_merge_parallel(aggregators, num_segments, config->num_threads);
+        if (count) {
+            perf_counters_stop(&counters, perfreport_phase(config->perf, "merge"));
+            perf_counters_close(&counters);
+        }
+        *result = aggregators[0];
+        free(aggregators);
+    } else {
+        for (size_t k = 0; k < num_segments; ++k)
+            aggregator_destroy(&segments[k].aggregator);
+    }
+    for (size_t k = 0; k < num_segments; ++k) {
+        free(segments[k].head);
+        free(segments[k].tail);
+    }
+    free(segments);
+    return valid;
+}
+
+/// Aggregate a gzip-compressed buffer. A file of several members, such as
+/// one written by pigz or by concatenating gzip files, is decompressed by
+/// all workers at once, each from a member boundary; otherwise one thread
+/// decompresses while the others aggregate.
+void analyze_gzip_buffer(const char* data, size_t size, const AnalyzerConfig* config, Aggregator* result, RunStats* stats) {
+    if (config==NULL || result==NULL || data==NULL) {
+        perror("Error: Null pointer provided as argument.");
+        abort();
+    }
+    if (config->num_threads==0) {
+        perror("Error: num_threads cannot be zero.");
+        abort();
+    }
+#if ONEBRC_STATS
+    double start = stats_now();
+#endif
+
+    size_t* starts = (size_t*)malloc(config->num_threads * sizeof(size_t));
+    size_t num_segments = config->num_threads > 1 ? gzip_find_members(data, size, starts, config->num_threads): 0;
+    bool parallel = num_segments > 1 && _analyze_members(data, size, starts, num_segments, config, result, stats);
+    free(starts);
+    if (!parallel) {
+        // One thread decompresses while the others aggregate
+        _GzipReader reader;
+        _gzip_reader_init(&reader, data, size, 0, size);
+        bool complete = analyze_stream(&_gzip_stream_read, &reader, config, result, stats);
+        _gzip_reader_destroy(&reader);
+        if (!complete) {
+            fprintf(stderr, "Error: corrupt or truncated gzip input.\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    result->histograms = config->histograms;
+    STATS(result->stats = NULL);
+    if (config->perf != NULL)
+        config->perf->rows = result->rows;
+#if ONEBRC_STATS
+    if (stats != NULL) {
+        runstats_split_parse_aggregate(stats, stats_now() - start);
+        stats->table_size = result->table.size;
+        stats->table_capacity = result->table.capacity;
+    }
+#endif
+}
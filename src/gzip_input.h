@@ -0,0 +1,41 @@
+/* Analysis of gzip-compressed measurements.
+
+                    GNU AFFERO GENERAL PUBLIC LICENSE
+                       Version 3, 19 November 2007
+
+    Copyright (C) 2024  Debajyoti Debnath
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published
+    by the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+
+
+#ifndef _GZIP_INPUT_H_
+#define _GZIP_INPUT_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+// Smallest compressed range decompressed by one worker of a multi-member file
+#define GZIP_MIN_SEGMENT_SIZE (1 << 20)
+
+bool gzip_is_compressed(const char* data, size_t size);
+bool gzip_file_is_compressed(const char* path);
+size_t gzip_find_members(const char* data, size_t size, size_t* starts, size_t max_starts);
+
+#endif // _GZIP_INPUT_H_
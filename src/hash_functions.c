@@ -0,0 +1,70 @@
+/* Hash functions and key comparers for String keys.
+
+                    GNU AFFERO GENERAL PUBLIC LICENSE
+                       Version 3, 19 November 2007
+
+    Copyright (C) 2024  Debajyoti Debnath
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published
+    by the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include "hash_functions.h"
+
+/// Polynomial hash of a String key with base 97
+size_t myhash(void* key, hash_table_t* table) {
+    if (table==NULL) {
+        fprintf(stderr, "hash table pointer is null.\n");
+        exit(1);
+    }
+    String* row = (String*)key;
+    if (row==NULL) {
+        fprintf(stderr, "key pointer is null.\n");
+        exit(1);
+    }
+    size_t hash = 0;
+    for (size_t i=0; i<row->length; ++i) {
+        hash += hash * 97 + (size_t)row->data[i];
+    }
+
+    return hash % ht_capacity(table);
+}
+
+/// djb2 hash of a String key
+size_t djb2(void* key, hash_table_t* table) {
+    if (table==NULL) {
+        fprintf(stderr, "hash table pointer is null.\n");
+        exit(1);
+    }
+    String* row = (String*)key;
+    if (row==NULL) {
+        fprintf(stderr, "key pointer is null.\n");
+        exit(1);
+    }
+    size_t hash = 5381;
+    for (size_t i=0; i<row->length; ++i) {
+        hash = ((hash << 5) + hash) + (size_t)row->data[i];
+    }
+
+    return hash % ht_capacity(table);
+}
+
+/// Compare two String keys
+bool string_key_equal(void* key1, void* key2) {
+    if (key1==NULL || key2==NULL) {
+        fprintf(stderr, "null pointer given.\n");
+        exit(1);
+    }
+    return string_equal((String*)key1, (String*)key2);
+}
@@ -0,0 +1,36 @@
+/* Hash functions and key comparers for String keys.
+
+                    GNU AFFERO GENERAL PUBLIC LICENSE
+                       Version 3, 19 November 2007
+
+    Copyright (C) 2024  Debajyoti Debnath
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published
+    by the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef _HASH_FUNCTIONS_H_
+#define _HASH_FUNCTIONS_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include "dtypes.h"
+#include "hash_table.h"
+
+size_t myhash(void* key, hash_table_t* table);
+size_t djb2(void* key, hash_table_t* table);
+bool string_key_equal(void* key1, void* key2);
+
+#endif // _HASH_FUNCTIONS_H_
@@ -0,0 +1,194 @@
+/* Mergeable fixed-bin temperature histograms for per-station quantiles.
+
+                    GNU AFFERO GENERAL PUBLIC LICENSE
+                       Version 3, 19 November 2007
+
+    Copyright (C) 2024  Debajyoti Debnath
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published
+    by the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+
+#include "histogram.h"
+
+/// Bin of a temperature in hundredths of a degree, clamped to the range
+static inline uint32_t _histogram_bin(int32_t value) {
+    int32_t tenths = value >= 0 ? value / 10: -((9 - value) / 10);
+    tenths = tenths < HISTOGRAM_MIN_TENTHS ? HISTOGRAM_MIN_TENTHS: tenths;
+    tenths = tenths > -HISTOGRAM_MIN_TENTHS ? -HISTOGRAM_MIN_TENTHS: tenths;
+    return (uint32_t)(tenths - HISTOGRAM_MIN_TENTHS);
+}
+
+static inline uint32_t _sparse_bin(uint32_t entry) {
+    return entry >> HISTOGRAM_SPARSE_COUNT_BITS;
+}
+
+static inline uint32_t _sparse_count(uint32_t entry) {
+    return entry & ((1u << HISTOGRAM_SPARSE_COUNT_BITS) - 1);
+}
+
+/// Initialize an empty, sparse histogram
+void histogram_init(TemperatureHistogram* histogram) {
+    if (histogram==NULL) {
+        perror("Error: Null pointer provided as argument.");
+        abort();
+    }
+    memset(histogram, 0x0, sizeof(TemperatureHistogram));
+}
+
+/// Move the sparse bins of a histogram into dense ones
+static void _histogram_make_dense(TemperatureHistogram* histogram) {
+    histogram->dense = (uint64_t*)calloc(HISTOGRAM_NUM_BINS, sizeof(uint64_t));
+    if (histogram->dense == NULL) {
+        perror("Error: could not allocate histogram.");
+        abort();
+    }
+    for (uint32_t i = 0; i < histogram->num_sparse; ++i)
+        histogram->dense[_sparse_bin(histogram->sparse[i])] = _sparse_count(histogram->sparse[i]);
+    free(histogram->sparse);
+    histogram->sparse = NULL;
+    histogram->num_sparse = 0;
+    histogram->sparse_capacity = 0;
+}
+
+/// Add count measurements to a bin
+static void _histogram_add_bin(TemperatureHistogram* histogram, uint32_t bin, uint64_t count) {
+    histogram->count += count;
+    if (histogram->dense == NULL && histogram->count > HISTOGRAM_MAX_SPARSE_COUNT)
+        _histogram_make_dense(histogram);
+    if (histogram->dense != NULL) {
+        histogram->dense[bin] += count;
+        return;
+    }
+
+    // Binary search for the bin among the sorted sparse bins
+    uint32_t lo = 0, hi = histogram->num_sparse;
+    while (lo < hi) {
+        uint32_t mid = (lo + hi) / 2;
+        if (_sparse_bin(histogram->sparse[mid]) < bin)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    // Sparse counts stay below HISTOGRAM_MAX_SPARSE_COUNT, so never carry
+    // into the bin
+    if (lo < histogram->num_sparse && _sparse_bin(histogram->sparse[lo]) == bin) {
+        histogram->sparse[lo] += (uint32_t)count;
+        return;
+    }
+
+    if (histogram->num_sparse == HISTOGRAM_MAX_SPARSE_BINS) {
+        _histogram_make_dense(histogram);
+        histogram->dense[bin] += count;
+        return;
+    }
+    if (histogram->num_sparse == histogram->sparse_capacity) {
+        histogram->sparse_capacity = histogram->sparse_capacity == 0 ? 8: 2 * histogram->sparse_capacity;
+        histogram->sparse = (uint32_t*)realloc(histogram->sparse, histogram->sparse_capacity * sizeof(uint32_t));
+        if (histogram->sparse == NULL) {
+            perror("Error: could not allocate histogram.");
+            abort();
+        }
+    }
+    memmove(histogram->sparse + lo + 1, histogram->sparse + lo, (histogram->num_sparse - lo) * sizeof(uint32_t));
+    histogram->sparse[lo] = bin << HISTOGRAM_SPARSE_COUNT_BITS | (uint32_t)count;
+    histogram->num_sparse++;
+}
+
+/// Add one measurement in hundredths of a degree
+void histogram_add(TemperatureHistogram* histogram, int32_t value) {
+    uint32_t bin = _histogram_bin(value);
+    if (histogram->dense != NULL) {
+        histogram->dense[bin]++;
+        histogram->count++;
+        return;
+    }
+    _histogram_add_bin(histogram, bin, 1);
+}
+
+/// Fold the measurements of src into dest, bin by bin
+void histogram_merge(TemperatureHistogram* dest, const TemperatureHistogram* src) {
+    if (dest==NULL || src==NULL || src->count == 0) return;
+    if (src->dense != NULL) {
+        if (dest->dense == NULL)
+            _histogram_make_dense(dest);
+        for (uint32_t bin = 0; bin < HISTOGRAM_NUM_BINS; ++bin)
+            dest->dense[bin] += src->dense[bin];
+        dest->count += src->count;
+        return;
+    }
+    for (uint32_t i = 0; i < src->num_sparse; ++i)
+        _histogram_add_bin(dest, _sparse_bin(src->sparse[i]), _sparse_count(src->sparse[i]));
+}
+
+/// Nearest-rank quantile in hundredths of a degree, rounded down to the
+/// tenth of a degree of its bin. 0 for an empty histogram.
+int32_t histogram_quantile(const TemperatureHistogram* histogram, double quantile) {
+    if (histogram==NULL || histogram->count == 0) return 0;
+    quantile = quantile < 0.0 ? 0.0: quantile > 1.0 ? 1.0: quantile;
+    double target = quantile * (double)histogram->count;
+    uint64_t rank = (uint64_t)target;
+    rank = (double)rank < target || rank == 0 ? rank + 1: rank;
+
+    uint64_t seen = 0;
+    if (histogram->dense != NULL) {
+        for (uint32_t bin = 0; bin < HISTOGRAM_NUM_BINS; ++bin) {
+            seen += histogram->dense[bin];
+            if (seen >= rank)
+                return ((int32_t)bin + HISTOGRAM_MIN_TENTHS) * 10;
+        }
+    }
+    for (uint32_t i = 0; i < histogram->num_sparse; ++i) {
+        seen += _sparse_count(histogram->sparse[i]);
+        if (seen >= rank)
+            return ((int32_t)_sparse_bin(histogram->sparse[i]) + HISTOGRAM_MIN_TENTHS) * 10;
+    }
+    return -HISTOGRAM_MIN_TENTHS * 10;
+}
+
+/// Temperature in hundredths of a degree and count of the i-th non-empty
+/// or dense bin
+static inline uint64_t _histogram_bin_at(const TemperatureHistogram* histogram, uint32_t i, double* value) {
+    uint32_t bin = histogram->dense != NULL ? i: _sparse_bin(histogram->sparse[i]);
+    *value = ((double)bin + HISTOGRAM_MIN_TENTHS) * 10.0;
+    return histogram->dense != NULL ? histogram->dense[i]: _sparse_count(histogram->sparse[i]);
+}
+
+/// Sample variance in squared hundredths of a degree, taking every
+/// measurement to be at the start of its bin. 0 for fewer than two.
+double histogram_variance(const TemperatureHistogram* histogram) {
+    if (histogram==NULL || histogram->count < 2) return 0.0;
+    uint32_t num_bins = histogram->dense != NULL ? HISTOGRAM_NUM_BINS: histogram->num_sparse;
+    double value, sum = 0.0;
+    for (uint32_t i = 0; i < num_bins; ++i) {
+        uint64_t count = _histogram_bin_at(histogram, i, &value);
+        sum += value * (double)count;
+    }
+    double mean = sum / (double)histogram->count;
+    double squares = 0.0;
+    for (uint32_t i = 0; i < num_bins; ++i) {
+        uint64_t count = _histogram_bin_at(histogram, i, &value);
+        squares += (value - mean) * (value - mean) * (double)count;
+    }
+    return squares / (double)(histogram->count - 1);
+}
+
+/// Release the bins of a histogram
+void histogram_destroy(TemperatureHistogram* histogram) {
+    if (histogram==NULL) return;
+    free(histogram->dense);
+    free(histogram->sparse);
+    memset(histogram, 0x0, sizeof(TemperatureHistogram));
+}
@@ -0,0 +1,61 @@
+/* Mergeable fixed-bin temperature histograms for per-station quantiles.
+
+                    GNU AFFERO GENERAL PUBLIC LICENSE
+                       Version 3, 19 November 2007
+
+    Copyright (C) 2024  Debajyoti Debnath
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published
+    by the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+
+
+#ifndef _HISTOGRAM_H_
+#define _HISTOGRAM_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+// Temperatures are binned by tenth of a degree over -99.9..99.9
+#define HISTOGRAM_MIN_TENTHS (-999)
+#define HISTOGRAM_NUM_BINS 1999
+// A histogram switches from sparse to dense bins once it holds more
+// distinct bins or measurements than these
+#define HISTOGRAM_MAX_SPARSE_BINS 128
+#define HISTOGRAM_MAX_SPARSE_COUNT 4096
+// A sparse bin packs its index above a count of this many bits
+#define HISTOGRAM_SPARSE_COUNT_BITS 20
+
+// Counts of measurements per bin. Rare stations keep a sorted array of
+// their non-empty bins, hot ones one counter for every bin.
+typedef struct {
+    uint64_t count;
+    uint64_t* dense;
+    uint32_t* sparse;
+    uint32_t num_sparse;
+    uint32_t sparse_capacity;
+} TemperatureHistogram;
+
+void histogram_init(TemperatureHistogram* histogram);
+void histogram_add(TemperatureHistogram* histogram, int32_t value);
+void histogram_merge(TemperatureHistogram* dest, const TemperatureHistogram* src);
+int32_t histogram_quantile(const TemperatureHistogram* histogram, double quantile);
+double histogram_variance(const TemperatureHistogram* histogram);
+void histogram_destroy(TemperatureHistogram* histogram);
+
+#endif // _HISTOGRAM_H_
@@ -21,6 +21,7 @@
 */
 
 #include "io_utils.h"
+#include "trace.h"
 #include <yatpool.h>
 
 typedef struct {
@@ -38,6 +39,23 @@ typedef struct {
     size_t offset;
 } _WriteToFileArg;
 
+typedef struct {
+    const String* lines;
+    ShardInfo* shard;
+    const WriterConfig* config;
+    size_t max_dirty;
+} _WriteShardArg;
+
+typedef struct {
+    int fd;
+    const String* lines;
+    size_t start_lineno;
+    size_t end_lineno;
+    off_t offset;
+    const WriterConfig* config;
+    size_t max_dirty;
+} _PwriteToFileArg;
+
 void _getoffsetarg_init(_GetOffsetArg** arg, 
                        const String* lines, 
                        size_t start_lineno,
@@ -79,6 +97,88 @@ void _writetofilearg_destroy(void* arg) {
     free(_arg);
 }
 
+void _writeshardarg_init(_WriteShardArg** arg,
+                         const String* lines,
+                         ShardInfo* shard,
+                         const WriterConfig* config,
+                         size_t max_dirty) {
+    if (arg==NULL || lines==NULL || shard==NULL || config==NULL) return;
+    *arg = (_WriteShardArg*)malloc(sizeof(_WriteShardArg));
+    (*arg)->lines = lines;
+    (*arg)->shard = shard;
+    (*arg)->config = config;
+    (*arg)->max_dirty = max_dirty;
+}
+
+void _writeshardarg_destroy(void* arg) {
+    if (arg==NULL) return;
+    _WriteShardArg* _arg = (_WriteShardArg*)arg;
+    free(_arg);
+}
+
+void _pwritetofilearg_init(_PwriteToFileArg** arg,
+                          int fd,
+                          const String* lines,
+                          size_t start_lineno,
+                          size_t end_lineno,
+                          off_t offset,
+                          const WriterConfig* config,
+                          size_t max_dirty) {
+    if (arg==NULL || lines==NULL || config==NULL) return;
+    *arg = (_PwriteToFileArg*)malloc(sizeof(_PwriteToFileArg));
+    (*arg)->fd = fd;
+    (*arg)->lines = lines;
+    (*arg)->start_lineno = start_lineno;
+    (*arg)->end_lineno = end_lineno;
+    (*arg)->offset = offset;
+    (*arg)->config = config;
+    (*arg)->max_dirty = max_dirty;
+}
+
+void _pwritetofilearg_destroy(void* arg) {
+    if (arg==NULL) return;
+    _PwriteToFileArg* _arg = (_PwriteToFileArg*)arg;
+    free(_arg);
+}
+
+/// Function for threadpool to write one shard into its own file.
+/// Each shard only needs the sizes of its own lines, so shards do not
+/// depend on one another.
+void* _write_shard(void* arg) {
+    _WriteShardArg* shardarg = (_WriteShardArg*)arg;
+    ShardInfo* shard = shardarg->shard;
+
+    int fd = writer_open(shard->path, shardarg->config->direct);
+    if (fd==-1) {
+        perror("Error: could not open shard file for writing.");
+        abort();
+    }
+
+    BufferedWriter writer;
+    writer_init(&writer, fd, 0, shardarg->config, shardarg->max_dirty);
+    for (size_t i = shard->start_lineno; i < shard->end_lineno; ++i)
+        writer_append(&writer, shardarg->lines[i].data, shardarg->lines[i].length);
+    writer_finish(&writer);
+    shard->num_bytes = writer.total_bytes;
+
+    close(fd);
+    return NULL;
+}
+
+/// Function for threadpool to write a chunk of lines into a shared file
+/// at a precomputed offset through a bounded buffer
+void* _pwrite_to_file(void* arg) {
+    _PwriteToFileArg* currarg = (_PwriteToFileArg*)arg;
+
+    BufferedWriter writer;
+    writer_init(&writer, currarg->fd, currarg->offset, currarg->config, currarg->max_dirty);
+    for (size_t i = currarg->start_lineno; i < currarg->end_lineno; ++i)
+        writer_append(&writer, currarg->lines[i].data, currarg->lines[i].length);
+    writer_finish(&writer);
+
+    return NULL;
+}
+
 /// Function for threadpool to calculate the offset required for a group of lines
 void* _get_offset(void* arg) {
     _GetOffsetArg* offsetarg = (_GetOffsetArg*)arg;
@@ -205,8 +305,62 @@ void write_datarowgroup_serial(const String* data, size_t num_rows, const char*
     fclose(out);
 }
 
+/// Write lines to a file with a bounded number of coarse pwrite tasks, each
+/// covering a run of consecutive offset blocks
+static void _write_offsets_pwrite(const String* data, const char* outfile, size_t num_lines, const size_t* offsets, size_t num_blocks, size_t fac, size_t num_threads, const WriterConfig* config) {
+    // O_DIRECT needs aligned offsets, which the line offsets are not
+    if (config->direct)
+        fprintf(stderr, "O_DIRECT is only used for sharded output, using buffered I/O.\n");
+
+    int fd = open(outfile, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+    if (fd==-1) {
+        perror("Error: could not open file for writing.");
+        abort();
+    }
+
+    // Set file size without touching any pages
+    size_t file_size = offsets[num_blocks-1];
+    if (ftruncate(fd, file_size)==-1) {
+        perror("Error: could not truncate file to specific length.");
+        close(fd);
+        return;
+    }
+
+    size_t num_tasks = WRITER_TASKS_PER_THREAD * num_threads;
+    size_t blocks_per_task = num_blocks / num_tasks;
+    blocks_per_task = num_blocks % num_tasks == 0 ? blocks_per_task: blocks_per_task + 1;
+    num_tasks = num_blocks / blocks_per_task;
+    num_tasks = num_blocks % blocks_per_task == 0 ? num_tasks: num_tasks + 1;
+
+    // Split the dirty page budget between the writers running at once
+    size_t max_dirty = config->max_dirty / (num_threads < num_tasks ? num_threads: num_tasks);
+
+    YATPool* pool;
+    yatpool_init(&pool, num_threads, num_tasks);
+
+    for (size_t i=0; i<num_tasks; ++i) {
+        Task* task;
+        _PwriteToFileArg* arg;
+        size_t first_block = i * blocks_per_task;
+        size_t start_lineno = fac * first_block;
+        size_t end_lineno = fac * (first_block + blocks_per_task);
+        end_lineno = end_lineno > num_lines ? num_lines: end_lineno;
+        off_t offset = (first_block == 0) ? 0: (off_t)offsets[first_block-1];
+
+        _pwritetofilearg_init(&arg, fd, data, start_lineno, end_lineno, offset, config, max_dirty);
+
+        trace_task_init(&task, "pwrite_to_file", &_pwrite_to_file, arg, &_pwritetofilearg_destroy);
+        yatpool_put(pool, task);
+    }
+
+    yatpool_wait(pool);
+    yatpool_destroy(pool);
+
+    close(fd);
+}
+
 /// Write a DataRowGroup to a txt file using multithreading
-void write_datarowgroup_threaded(const String* data, const char* outfile, size_t num_lines, size_t num_threads) {
+void write_datarowgroup_threaded(const String* data, const char* outfile, size_t num_lines, size_t num_threads, const WriterConfig* config) {
     if (data == NULL) {
         perror("Error: Data pointer provided is null.");
         abort();
@@ -224,6 +378,10 @@ void write_datarowgroup_threaded(const String* data, const char* outfile, size_t
         perror("Error: num_lines cannot be zero.");
         abort();
     }
+    if (config==NULL) {
+        perror("Error: writer config provided is null.");
+        abort();
+    }
 
     YATPool* pool;
 
@@ -244,7 +402,7 @@ void write_datarowgroup_threaded(const String* data, const char* outfile, size_t
         end_lineno = end_lineno > num_lines ? num_lines: end_lineno;
         _getoffsetarg_init(&arg, data, start_lineno, end_lineno, &offsets[i]);
 
-        task_init(&task, &_get_offset, arg, &_getoffsetarg_destroy);
+        trace_task_init(&task, "get_offset", &_get_offset, arg, &_getoffsetarg_destroy);
         yatpool_put(pool, task);
     }
 
@@ -253,6 +411,12 @@ void write_datarowgroup_threaded(const String* data, const char* outfile, size_t
 
     for (size_t i=1; i<num_tasks; ++i)
         offsets[i] += offsets[i-1];
+
+    if (config->backend == WRITER_PWRITE) {
+        _write_offsets_pwrite(data, outfile, num_lines, offsets, num_tasks, fac, num_threads, config);
+        free(offsets);
+        return;
+    }
  
     // Open outfile for writing
     int fd = open(outfile, O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
@@ -288,7 +452,7 @@ void write_datarowgroup_threaded(const String* data, const char* outfile, size_t
 
         _writetofilearg_init(&arg, file_buf, data, start_lineno, end_lineno, offset);
 
-        task_init(&task, &_write_to_file, arg, &_writetofilearg_destroy);
+        trace_task_init(&task, "write_to_file", &_write_to_file, arg, &_writetofilearg_destroy);
         yatpool_put(pool, task);
     }
 
@@ -300,3 +464,242 @@ void write_datarowgroup_threaded(const String* data, const char* outfile, size_t
 
     free(offsets);
 }
+
+/// Split lines into num_shards contiguous ranges of roughly equal byte size.
+/// Line lengths are summed per block in parallel and shard boundaries are
+/// placed on block boundaries, so the balance is accurate to one block.
+static void _balance_shards_by_bytes(const String* data, size_t num_lines, ShardInfo* shards, size_t num_shards, size_t num_threads) {
+    size_t fac = 8 * num_threads;
+    size_t num_blocks = num_lines / fac;
+    num_blocks = num_lines % fac == 0 ? num_blocks: num_blocks + 1;
+
+    size_t* block_bytes = (size_t*)calloc(num_blocks, sizeof(size_t));
+
+    YATPool* pool;
+    yatpool_init(&pool, num_threads, num_blocks);
+
+    for (size_t i=0; i<num_blocks; ++i) {
+        Task* task;
+        _GetOffsetArg* arg;
+        size_t start_lineno = fac * i;
+        size_t end_lineno = fac * (i + 1);
+        end_lineno = end_lineno > num_lines ? num_lines: end_lineno;
+        _getoffsetarg_init(&arg, data, start_lineno, end_lineno, &block_bytes[i]);
+
+        trace_task_init(&task, "get_offset", &_get_offset, arg, &_getoffsetarg_destroy);
+        yatpool_put(pool, task);
+    }
+
+    yatpool_wait(pool);
+    yatpool_destroy(pool);
+
+    size_t total_bytes = 0;
+    for (size_t i=0; i<num_blocks; ++i)
+        total_bytes += block_bytes[i];
+
+    // Close shard s as soon as the running total reaches its share
+    size_t running_bytes = 0;
+    size_t shard = 0;
+    shards[0].start_lineno = 0;
+    for (size_t i=0; i<num_blocks && shard+1<num_shards; ++i) {
+        running_bytes += block_bytes[i];
+        if (running_bytes * num_shards >= total_bytes * (shard + 1)) {
+            size_t boundary = fac * (i + 1);
+            boundary = boundary > num_lines ? num_lines: boundary;
+            shards[shard].end_lineno = boundary;
+            shards[shard+1].start_lineno = boundary;
+            shard++;
+        }
+    }
+    for (; shard+1<num_shards; ++shard) {
+        shards[shard].end_lineno = num_lines;
+        shards[shard+1].start_lineno = num_lines;
+    }
+    shards[num_shards-1].end_lineno = num_lines;
+
+    free(block_bytes);
+}
+
+/// Write every shard in pieces_per_shard line ranges, each by its own pwrite
+/// task at the byte offset of its first line, so that fewer shards than
+/// threads still keep every thread busy
+static void _write_shards_in_pieces(const String* data, ShardInfo* shards, size_t num_shards, size_t pieces_per_shard, size_t num_threads, const WriterConfig* config) {
+    size_t num_pieces = num_shards * pieces_per_shard;
+    size_t* starts = (size_t*)malloc(num_pieces * sizeof(size_t));
+    size_t* offsets = (size_t*)calloc(num_pieces, sizeof(size_t));
+    for (size_t s=0; s<num_shards; ++s) {
+        size_t rows = shards[s].end_lineno - shards[s].start_lineno;
+        for (size_t j=0; j<pieces_per_shard; ++j)
+            starts[s * pieces_per_shard + j] = shards[s].start_lineno + rows * j / pieces_per_shard;
+    }
+
+    // Bytes of every piece, turned into offsets within its shard below
+    YATPool* pool;
+    yatpool_init(&pool, num_threads, num_pieces);
+    for (size_t i=0; i<num_pieces; ++i) {
+        Task* task;
+        _GetOffsetArg* arg;
+        size_t end_lineno = (i + 1) % pieces_per_shard == 0 ? shards[i / pieces_per_shard].end_lineno: starts[i + 1];
+        _getoffsetarg_init(&arg, data, starts[i], end_lineno, &offsets[i]);
+
+        trace_task_init(&task, "get_offset", &_get_offset, arg, &_getoffsetarg_destroy);
+        yatpool_put(pool, task);
+    }
+    yatpool_wait(pool);
+    yatpool_destroy(pool);
+
+    int* fds = (int*)malloc(num_shards * sizeof(int));
+    for (size_t s=0; s<num_shards; ++s) {
+        size_t shard_bytes = 0;
+        for (size_t j=0; j<pieces_per_shard; ++j) {
+            size_t bytes = offsets[s * pieces_per_shard + j];
+            offsets[s * pieces_per_shard + j] = shard_bytes;
+            shard_bytes += bytes;
+        }
+        shards[s].num_bytes = shard_bytes;
+
+        fds[s] = writer_open(shards[s].path, false);
+        if (fds[s]==-1) {
+            perror("Error: could not open shard file for writing.");
+            abort();
+        }
+        if (ftruncate(fds[s], (off_t)shard_bytes)==-1) {
+            perror("Error: could not truncate file to specific length.");
+            abort();
+        }
+    }
+
+    // Split the dirty page budget between the pieces written at once
+    size_t max_dirty = config->max_dirty / (num_threads < num_pieces ? num_threads: num_pieces);
+
+    yatpool_init(&pool, num_threads, num_pieces);
+    for (size_t i=0; i<num_pieces; ++i) {
+        Task* task;
+        _PwriteToFileArg* arg;
+        size_t shard = i / pieces_per_shard;
+        size_t end_lineno = (i + 1) % pieces_per_shard == 0 ? shards[shard].end_lineno: starts[i + 1];
+        _pwritetofilearg_init(&arg, fds[shard], data, starts[i], end_lineno, (off_t)offsets[i], config, max_dirty);
+
+        trace_task_init(&task, "pwrite_to_file", &_pwrite_to_file, arg, &_pwritetofilearg_destroy);
+        yatpool_put(pool, task);
+    }
+    yatpool_wait(pool);
+    yatpool_destroy(pool);
+
+    for (size_t s=0; s<num_shards; ++s)
+        close(fds[s]);
+    free(fds);
+    free(offsets);
+    free(starts);
+}
+
+/// Write lines into num_shards files named <outfile>.<shard index>. Shards
+/// are written one threadpool task each if there are at least
+/// WRITER_TASKS_PER_THREAD per thread, and otherwise split into line
+/// ranges written in parallel at their own offsets. Shards are always
+/// written through the buffered writer, whatever the configured backend,
+/// and O_DIRECT shards are never split. Returns the description of every
+/// shard, which the caller must free.
+ShardInfo* write_datarowgroup_sharded(const String* data, const char* outfile, size_t num_lines, size_t num_shards, ShardBalance balance, size_t num_threads, const WriterConfig* config) {
+    if (data == NULL) {
+        perror("Error: Data pointer provided is null.");
+        abort();
+    }
+    if (outfile == NULL) {
+        perror("Error: Outfile name provided is null.");
+        abort();
+    }
+    if (num_threads==0) {
+        perror("Error: num_threads cannot be zero.");
+        abort();
+    }
+    if (num_lines==0) {
+        perror("Error: num_lines cannot be zero.");
+        abort();
+    }
+    if (num_shards==0 || num_shards>num_lines) {
+        perror("Error: num_shards must be between one and num_lines.");
+        abort();
+    }
+    if (config==NULL) {
+        perror("Error: writer config provided is null.");
+        abort();
+    }
+
+    ShardInfo* shards = (ShardInfo*)calloc(num_shards, sizeof(ShardInfo));
+    for (size_t i=0; i<num_shards; ++i) {
+        if (snprintf(shards[i].path, MAX_PATH_LEN, "%s.%04zu", outfile, i) >= MAX_PATH_LEN) {
+            perror("Error: shard path is too long.");
+            abort();
+        }
+    }
+
+    if (balance == SHARD_BY_BYTES) {
+        _balance_shards_by_bytes(data, num_lines, shards, num_shards, num_threads);
+    } else {
+        for (size_t i=0; i<num_shards; ++i) {
+            shards[i].start_lineno = num_lines * i / num_shards;
+            shards[i].end_lineno = num_lines * (i + 1) / num_shards;
+        }
+    }
+
+    size_t num_tasks = WRITER_TASKS_PER_THREAD * num_threads;
+    size_t pieces_per_shard = (num_tasks + num_shards - 1) / num_shards;
+    if (pieces_per_shard > 1 && !config->direct) {
+        _write_shards_in_pieces(data, shards, num_shards, pieces_per_shard, num_threads, config);
+        return shards;
+    }
+
+    // Split the dirty page budget between the shards written at once
+    size_t max_dirty = config->max_dirty / (num_threads < num_shards ? num_threads: num_shards);
+
+    YATPool* pool;
+    yatpool_init(&pool, num_threads, num_shards);
+
+    for (size_t i=0; i<num_shards; ++i) {
+        Task* task;
+        _WriteShardArg* arg;
+        _writeshardarg_init(&arg, data, &shards[i], config, max_dirty);
+
+        trace_task_init(&task, "write_shard", &_write_shard, arg, &_writeshardarg_destroy);
+        yatpool_put(pool, task);
+    }
+
+    yatpool_wait(pool);
+    yatpool_destroy(pool);
+
+    return shards;
+}
+
+/// Write a manifest listing the rows and bytes of every shard
+/// to <outfile>.manifest
+void write_shard_manifest(const ShardInfo* shards, size_t num_shards, const char* outfile) {
+    if (shards == NULL || outfile == NULL) {
+        perror("Error: Null pointer provided as argument.");
+        abort();
+    }
+
+    char manifest_path[MAX_PATH_LEN];
+    if (snprintf(manifest_path, MAX_PATH_LEN, "%s.manifest", outfile) >= MAX_PATH_LEN) {
+        perror("Error: manifest path is too long.");
+        abort();
+    }
+
+    FILE* out = fopen(manifest_path, "w");
+    if (out == NULL) {
+        perror("Error: Could not open manifest file to write.");
+        abort();
+    }
+
+    size_t total_rows = 0, total_bytes = 0;
+    fprintf(out, "# shard\trows\tbytes\tpath\n");
+    for (size_t i = 0; i < num_shards; ++i) {
+        size_t rows = shards[i].end_lineno - shards[i].start_lineno;
+        fprintf(out, "%zu\t%zu\t%zu\t%s\n", i, rows, shards[i].num_bytes, shards[i].path);
+        total_rows += rows;
+        total_bytes += shards[i].num_bytes;
+    }
+    fprintf(out, "# total\t%zu\t%zu\n", total_rows, total_bytes);
+
+    fclose(out);
+}
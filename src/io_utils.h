@@ -27,21 +27,44 @@
 #include <stdlib.h>
 #include <assert.h>
 #include <string.h>
+#include <errno.h>
+#include <stdbool.h>
 #include <sys/types.h>
 #include <fcntl.h>
 #include <sys/mman.h>
 #include <unistd.h>
 #include "dtypes.h"
 #include "format.h"
+#include "writer.h"
 
 // Size of data buffer
 #define BUFSIZE 256
 // Default size of the initial DataRow buffer
 #define DEFAULT_SIZE 10
+// Number of pwrite tasks per thread when writing a single file
+#define WRITER_TASKS_PER_THREAD 4
+// Maximum length of an output path
+#define MAX_PATH_LEN 1024
+
+// How rows are split across output shards
+typedef enum {
+    SHARD_BY_ROWS,
+    SHARD_BY_BYTES
+} ShardBalance;
+
+// Description of one output shard, filled in by the writer
+typedef struct {
+    char path[MAX_PATH_LEN];
+    size_t start_lineno;
+    size_t end_lineno;
+    size_t num_bytes;
+} ShardInfo;
 
 DataRow parse_single_row(const char* row);
 DataRowGroup parse_raw_data(FILE* datafile);
 void write_datarowgroup_serial(const String* data, size_t num_rows, const char* outfile);
-void write_datarowgroup_threaded(const String* data, const char* outfile, size_t num_rows, size_t num_threads);
+void write_datarowgroup_threaded(const String* data, const char* outfile, size_t num_rows, size_t num_threads, const WriterConfig* config);
+ShardInfo* write_datarowgroup_sharded(const String* data, const char* outfile, size_t num_lines, size_t num_shards, ShardBalance balance, size_t num_threads, const WriterConfig* config);
+void write_shard_manifest(const ShardInfo* shards, size_t num_shards, const char* outfile);
 
 #endif // _IOUTILS_H_
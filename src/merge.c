@@ -0,0 +1,298 @@
+/* Parallel merge of the tables of several workers.
+
+                    GNU AFFERO GENERAL PUBLIC LICENSE
+                       Version 3, 19 November 2007
+
+    Copyright (C) 2024  Debajyoti Debnath
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published
+    by the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+
+#include "analyzer.h"
+#include "trace.h"
+#include <yatpool.h>
+
+// Stations of one partition, merged from every worker, and those that
+// could not be placed in the partition's runs of the result table
+typedef struct {
+    StatsTable table;
+    StationStats* deferred;
+    size_t num_deferred;
+} _MergePartition;
+
+// State shared by the tasks of one aggregator_merge_parallel call
+typedef struct {
+    Aggregator* aggregators;
+    size_t num_aggregators;
+    size_t num_partitions;
+    // Every table is a run of run_length slots per partition, repeated
+    // every period slots, where period is the smallest capacity of all
+    size_t run_length;
+    size_t period;
+    unsigned int run_bits;
+    unsigned int partition_bits;
+    unsigned int period_bits;
+    size_t next_partition;
+    _MergePartition* partitions;
+    StationStats* entries;
+    size_t capacity;
+} _MergeJob;
+
+typedef struct {
+    _MergeJob* job;
+} _MergeArg;
+
+void _mergearg_init(_MergeArg** arg, _MergeJob* job) {
+    if (arg==NULL || job==NULL) return;
+    *arg = (_MergeArg*)malloc(sizeof(_MergeArg));
+    (*arg)->job = job;
+}
+
+void _mergearg_destroy(void* arg) {
+    if (arg==NULL) return;
+    _MergeArg* _arg = (_MergeArg*)arg;
+    free(_arg);
+}
+
+/// Every station of a partition has the same partition bits, which would
+/// crowd them into a few home slots of the partition's own table. That table
+/// is keyed by the hash with the partition bits moved to the top, so that
+/// its slots also follow the order of the worker and result tables.
+static inline uint64_t _partition_hash(uint64_t hash, const _MergeJob* job) {
+    uint64_t offset = hash & (job->run_length - 1);
+    uint64_t partition = (hash >> job->run_bits) & (job->num_partitions - 1);
+    return offset | (hash >> job->period_bits << job->run_bits) | (partition << (64 - job->partition_bits));
+}
+
+/// Inverse of _partition_hash
+static inline uint64_t _unpartition_hash(uint64_t hash, const _MergeJob* job) {
+    uint64_t offset = hash & (job->run_length - 1);
+    uint64_t partition = hash >> (64 - job->partition_bits);
+    return offset | (partition << job->run_bits) | (hash << job->partition_bits >> job->partition_bits >> job->run_bits << job->period_bits);
+}
+
+/// Fold into dest the stations of table whose home slot lies in one of the
+/// runs of partition. Stations displaced past the end of a run by linear
+/// probing are found by scanning on to the next empty slot, and those
+/// displaced into the run from before it are left to their own partition.
+static void _merge_table_partition(StatsTable* dest, const StatsTable* table, const _MergeJob* job, size_t partition) {
+    size_t mask = table->capacity - 1;
+    for (size_t base = 0; base < table->capacity; base += job->period) {
+        size_t start = base + partition * job->run_length;
+        size_t end = start + job->run_length;
+        for (size_t i = start; i < end || table->entries[i & mask].key != NULL; ++i) {
+            const StationStats* ahead = &table->entries[(i + ANALYZER_MERGE_PREFETCH_DISTANCE) & mask];
+            if (ahead->key != NULL) {
+                __builtin_prefetch(ahead->key);
+                __builtin_prefetch(&dest->entries[_partition_hash(ahead->hash, job) & (dest->capacity - 1)]);
+            }
+            const StationStats* entry = &table->entries[i & mask];
+            if (entry->key == NULL) continue;
+            size_t home = entry->hash & mask;
+            if (home < start || home >= end) continue;
+            uint64_t hash = _partition_hash(entry->hash, job);
+            StationStats* merged = stats_table_find_or_insert(dest, entry->key, entry->length, hash);
+            station_stats_merge(merged, entry);
+        }
+    }
+}
+
+/// Function for threadpool to gather whole partitions of every worker table,
+/// and the matching range of catalog stations, until none are left
+void* _gather_partitions(void* arg) {
+    _MergeJob* job = ((_MergeArg*)arg)->job;
+    Aggregator* dest = &job->aggregators[0];
+    size_t num_catalog = dest->catalog != NULL ? dest->catalog->num_stations: 0;
+
+    size_t partition;
+    while ((partition = __atomic_fetch_add(&job->next_partition, 1, __ATOMIC_RELAXED)) < job->num_partitions) {
+        StatsTable* table = &job->partitions[partition].table;
+        size_t largest = 0;
+        for (size_t i = 0; i < job->num_aggregators; ++i)
+            largest = job->aggregators[i].table.size > largest ? job->aggregators[i].table.size: largest;
+        stats_table_init(table, 2 * largest / job->num_partitions + 16);
+        for (size_t i = 0; i < job->num_aggregators; ++i)
+            _merge_table_partition(table, &job->aggregators[i].table, job, partition);
+
+        size_t first = partition * num_catalog / job->num_partitions;
+        size_t last = (partition + 1) * num_catalog / job->num_partitions;
+        for (size_t i = 1; i < job->num_aggregators; ++i) {
+            const StationStats* catalog_stats = job->aggregators[i].catalog_stats;
+            for (size_t id = first; id < last; ++id) {
+                if (catalog_stats[id].count == 0) continue;
+                station_stats_merge(&dest->catalog_stats[id], &catalog_stats[id]);
+            }
+        }
+    }
+    return NULL;
+}
+
+/// Function for threadpool to move the stations of whole partitions into
+/// their runs of the result table. Every home slot of a partition lies in
+/// its own runs, so tasks never write the same slot. A station whose probe
+/// would leave its run is deferred to the serial pass that follows.
+void* _place_partitions(void* arg) {
+    _MergeJob* job = ((_MergeArg*)arg)->job;
+    size_t mask = job->capacity - 1;
+
+    size_t partition;
+    while ((partition = __atomic_fetch_add(&job->next_partition, 1, __ATOMIC_RELAXED)) < job->num_partitions) {
+        _MergePartition* merged = &job->partitions[partition];
+        for (size_t i = 0; i < merged->table.capacity; ++i) {
+            StationStats* entry = &merged->table.entries[i];
+            if (entry->key == NULL) continue;
+            entry->hash = _unpartition_hash(entry->hash, job);
+            size_t slot = entry->hash & mask;
+            size_t end = (slot & ~(job->run_length - 1)) + job->run_length;
+            while (slot < end && job->entries[slot].key != NULL)
+                slot++;
+            if (slot < end) {
+                job->entries[slot] = *entry;
+                continue;
+            }
+            if (merged->deferred == NULL)
+                merged->deferred = (StationStats*)malloc(merged->table.size * sizeof(StationStats));
+            merged->deferred[merged->num_deferred++] = *entry;
+        }
+    }
+    return NULL;
+}
+
+/// Run one task per thread of job on a fresh threadpool and wait for them
+static void _run_tasks(_MergeJob* job, size_t num_threads, const char* name, void* (*function)(void*)) {
+    job->next_partition = 0;
+    YATPool* pool;
+    yatpool_init(&pool, num_threads, num_threads);
+    for (size_t i = 0; i < num_threads; ++i) {
+        Task* task;
+        _MergeArg* arg;
+        _mergearg_init(&arg, job);
+
+        trace_task_init(&task, name, function, arg, &_mergearg_destroy);
+        yatpool_put(pool, task);
+    }
+    yatpool_wait(pool);
+    yatpool_destroy(pool);
+}
+
+/// Fold aggregators 1 to num_aggregators - 1 into the first one and destroy
+/// them. Tables with many stations in total are merged by num_threads tasks
+/// that each own a set of hash partitions: a task pulls the stations of its
+/// partitions out of every worker table into a small table of its own, then
+/// moves them into the result table, so that no pass is serial in the
+/// number of workers or stations.
+void aggregator_merge_parallel(Aggregator* aggregators, size_t num_aggregators, size_t num_threads) {
+    if (aggregators==NULL) {
+        perror("Error: Null pointer provided as argument.");
+        abort();
+    }
+    size_t total = 0, period = SIZE_MAX;
+    for (size_t i = 0; i < num_aggregators; ++i) {
+        total += aggregators[i].table.size;
+        period = aggregators[i].table.capacity < period ? aggregators[i].table.capacity: period;
+    }
+
+    // Partitions are a power of two that divides the smallest capacity into
+    // runs of at least ANALYZER_MERGE_MIN_RUN slots
+    size_t num_partitions = 1;
+    while (num_partitions < ANALYZER_MERGE_PARTITIONS_PER_THREAD * num_threads
+           && period / (2 * num_partitions) >= ANALYZER_MERGE_MIN_RUN)
+        num_partitions *= 2;
+    if (num_aggregators < 2 || num_threads < 2 || num_partitions < 2 || total < ANALYZER_MIN_PARALLEL_MERGE) {
+        for (size_t i = 1; i < num_aggregators; ++i) {
+            aggregator_merge(&aggregators[0], &aggregators[i]);
+            aggregator_destroy(&aggregators[i]);
+        }
+        return;
+    }
+    for (size_t i = 1; i < num_aggregators; ++i) {
+        if (aggregators[i].catalog != aggregators[0].catalog) {
+            perror("Error: cannot merge aggregators with different catalogs.");
+            abort();
+        }
+    }
+
+    _MergeJob job;
+    memset(&job, 0x0, sizeof(_MergeJob));
+    job.aggregators = aggregators;
+    job.num_aggregators = num_aggregators;
+    job.num_partitions = num_partitions;
+    job.period = period;
+    job.run_length = period / num_partitions;
+    while (((size_t)1 << job.run_bits) < job.run_length)
+        job.run_bits++;
+    while (((size_t)1 << job.partition_bits) < num_partitions)
+        job.partition_bits++;
+    job.period_bits = job.run_bits + job.partition_bits;
+    job.partitions = (_MergePartition*)calloc(num_partitions, sizeof(_MergePartition));
+    _run_tasks(&job, num_threads, "gather_partitions", &_gather_partitions);
+
+    // Partitions hold disjoint stations, so the result is sized exactly
+    size_t num_stations = 0;
+    for (size_t p = 0; p < num_partitions; ++p)
+        num_stations += job.partitions[p].table.size;
+    StatsTable result;
+    stats_table_init(&result, 2 * num_stations + 1);
+    if (result.capacity < period) {
+        free(result.entries);
+        stats_table_init(&result, period);
+    }
+    job.entries = result.entries;
+    job.capacity = result.capacity;
+    _run_tasks(&job, num_threads, "place_partitions", &_place_partitions);
+
+    // The result takes over the keys and histograms of every partition
+    size_t mask = result.capacity - 1;
+    for (size_t p = 0; p < num_partitions; ++p) {
+        _MergePartition* merged = &job.partitions[p];
+        for (size_t i = 0; i < merged->num_deferred; ++i) {
+            size_t slot = merged->deferred[i].hash & mask;
+            while (result.entries[slot].key != NULL)
+                slot = (slot + 1) & mask;
+            result.entries[slot] = merged->deferred[i];
+        }
+        if (merged->table.keys != NULL) {
+            KeyBlock* last = merged->table.keys;
+            while (last->next != NULL)
+                last = last->next;
+            last->next = result.keys;
+            result.keys = merged->table.keys;
+        }
+        result.size += merged->table.size;
+        result.num_allocations += merged->table.num_allocations;
+#if ONEBRC_STATS
+        for (size_t b = 0; b < PROBE_HISTOGRAM_BUCKETS; ++b)
+            result.probe_histogram[b] += merged->table.probe_histogram[b];
+#endif
+        free(merged->table.entries);
+        free(merged->deferred);
+    }
+    free(job.partitions);
+
+    // Probes and allocations of the first worker are still reported
+#if ONEBRC_STATS
+    for (size_t b = 0; b < PROBE_HISTOGRAM_BUCKETS; ++b)
+        result.probe_histogram[b] += aggregators[0].table.probe_histogram[b];
+#endif
+    result.num_allocations += aggregators[0].table.num_allocations;
+    stats_table_destroy(&aggregators[0].table);
+    aggregators[0].table = result;
+    for (size_t i = 1; i < num_aggregators; ++i) {
+        aggregators[0].rows += aggregators[i].rows;
+        aggregators[0].bytes += aggregators[i].bytes;
+        aggregator_destroy(&aggregators[i]);
+    }
+}
@@ -0,0 +1,1095 @@
+/* Sorted export of analyzer results.
+
+                    GNU AFFERO GENERAL PUBLIC LICENSE
+                       Version 3, 19 November 2007
+
+    Copyright (C) 2024  Debajyoti Debnath
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published
+    by the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+
+#include "output.h"
+#include "format.h"
+#include "trace.h"
+#include <errno.h>
+#include <math.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <yatpool.h>
+
+// Longest label of a quantile, such as "p99.9"
+#define OUTPUT_LABEL_SIZE 32
+// Entries sorted by insertion before merge passes take over
+#define OUTPUT_INSERTION_RUN 16
+// Entries ahead of the one being formatted whose station is prefetched
+#define OUTPUT_PREFETCH_DISTANCE 8
+
+// Station to be written, with the key it is sorted by: its name, or its
+// collation key under OUTPUT_SORT_LOCALE
+typedef struct {
+    // First bytes of the key in big-endian order, compared before the rest
+    uint64_t prefix;
+    const char* key;
+    const char* name;
+    const StationStats* stats;
+    uint32_t key_length;
+    uint32_t length;
+} _OutputEntry;
+
+// State shared by the tasks of one output_write call
+typedef struct {
+    const OutputConfig* config;
+    _OutputEntry* entries;
+    _OutputEntry* scratch;
+    size_t num_entries;
+    // Index in the output of the first entry, as stations of a spilled
+    // result are written a batch at a time
+    size_t first_index;
+    // Entries per sorted run, doubled by every merge round
+    size_t run_length;
+    // Collation keys and formatted output of every task
+    char** keys;
+    char** buffers;
+    size_t* sizes;
+    size_t num_tasks;
+    // Most tasks of any batch, which keys, buffers and sizes have room for
+    size_t max_tasks;
+    char (*labels)[OUTPUT_LABEL_SIZE];
+} _OutputJob;
+
+typedef struct {
+    _OutputJob* job;
+    size_t task;
+} _OutputArg;
+
+// Stations copied out of a spilled result, sorted or written together
+typedef struct {
+    StationStats* stats;
+    // Offset of the name of every station in text
+    size_t* offsets;
+    size_t num_stations;
+    size_t capacity;
+    char* text;
+    size_t text_used;
+    size_t text_capacity;
+    // Estimate of the bytes the stations take once sorted and formatted
+    size_t bytes;
+} _OutputBatch;
+
+// Header of a station of a sorted run, followed by its collation key
+// under OUTPUT_SORT_LOCALE and by its name
+typedef struct {
+    int64_t sum;
+    uint64_t count;
+    int32_t min;
+    int32_t max;
+    uint32_t key_length;
+    uint32_t length;
+} _OutputRecord;
+
+// Buffered reader of the stations of one sorted run
+typedef struct {
+    SpillReader reader;
+    _OutputRecord record;
+    // Sort key of the current station, followed by its name unless the
+    // name is the key
+    char* text;
+    size_t capacity;
+    uint32_t key_length;
+    const char* name;
+} _OutputRunReader;
+
+// External sort of the stations of a spilled result within the budget of
+// its spill. Stations are read in batches, which are either written out
+// as they come or sorted and appended to a spill file as runs that are
+// merged once all of them are written.
+typedef struct {
+    _OutputJob* job;
+    FILE* out;
+    SpillFile* file;
+    _OutputBatch batch;
+    // Estimated bytes of a batch, and runs merged at once
+    size_t batch_limit;
+    size_t fan_in;
+    // Whether full batches become runs rather than output
+    bool to_runs;
+    SpillSegment* runs;
+    size_t num_runs;
+    size_t runs_capacity;
+    // Cleared once writing to out failed
+    bool written;
+} _OutputSpill;
+
+void _outputarg_init(_OutputArg** arg, _OutputJob* job, size_t task) {
+    if (arg==NULL || job==NULL) return;
+    *arg = (_OutputArg*)malloc(sizeof(_OutputArg));
+    (*arg)->job = job;
+    (*arg)->task = task;
+}
+
+void _outputarg_destroy(void* arg) {
+    if (arg==NULL) return;
+    _OutputArg* _arg = (_OutputArg*)arg;
+    free(_arg);
+}
+
+void outputconfig_init(OutputConfig* config) {
+    if (config==NULL) {
+        perror("Error: Null pointer provided as argument.");
+        abort();
+    }
+    config->format = OUTPUT_LINES;
+    config->order = OUTPUT_SORT_BYTES;
+    config->quantiles = NULL;
+    config->num_quantiles = 0;
+    config->interval_z = 0.0;
+    config->summary = true;
+    config->num_threads = 1;
+}
+
+/// Parse "lines", "official", "csv", "json" or "binary"
+bool output_parse_format(const char* name, OutputFormat* format) {
+    const char* names[] = {"lines", "official", "csv", "json", "binary"};
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); ++i) {
+        if (strcmp(name, names[i]) == 0) {
+            *format = (OutputFormat)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+/// Parse "bytes", "locale" or "none"
+bool output_parse_order(const char* name, OutputOrder* order) {
+    const char* names[] = {"bytes", "locale", "none"};
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); ++i) {
+        if (strcmp(name, names[i]) == 0) {
+            *order = (OutputOrder)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+/// Run num_tasks tasks of function on a fresh threadpool and wait for them,
+/// or run a single one on the calling thread
+static void _run_tasks(_OutputJob* job, size_t num_tasks, const char* name, void* (*function)(void*)) {
+    if (num_tasks == 1) {
+        _OutputArg arg = {job, 0};
+        uint64_t start = trace_begin();
+        function(&arg);
+        trace_end(name, start);
+        return;
+    }
+    YATPool* pool;
+    size_t num_threads = num_tasks < job->config->num_threads ? num_tasks: job->config->num_threads;
+    yatpool_init(&pool, num_threads, num_tasks);
+    for (size_t i = 0; i < num_tasks; ++i) {
+        Task* task;
+        _OutputArg* arg;
+        _outputarg_init(&arg, job, i);
+
+        trace_task_init(&task, name, function, arg, &_outputarg_destroy);
+        yatpool_put(pool, task);
+    }
+    yatpool_wait(pool);
+    yatpool_destroy(pool);
+}
+
+static inline uint64_t _key_prefix(const char* key, size_t length) {
+    uint64_t prefix = 0;
+    for (size_t i = 0; i < 8; ++i)
+        prefix = prefix << 8 | (i < length ? (unsigned char)key[i]: 0);
+    return prefix;
+}
+
+/// Byte order of the keys of two entries. Keys hold no NUL bytes, so equal
+/// prefixes of keys of at most eight bytes leave only their lengths to
+/// compare.
+static inline int _compare_entries(const _OutputEntry* a, const _OutputEntry* b) {
+    if (a->prefix != b->prefix)
+        return a->prefix < b->prefix ? -1: 1;
+    size_t n = a->key_length < b->key_length ? a->key_length: b->key_length;
+    if (n > 8) {
+        int c = memcmp(a->key + 8, b->key + 8, n - 8);
+        if (c != 0) return c;
+    }
+    return (a->key_length > b->key_length) - (a->key_length < b->key_length);
+}
+
+/// Merge the sorted ranges [begin, middle) and [middle, end) of src into
+/// the same positions of dest. Ties are taken from the first range.
+static void _merge(const _OutputEntry* src, _OutputEntry* dest, size_t begin, size_t middle, size_t end) {
+    size_t i = begin, j = middle, k = begin;
+    while (i < middle && j < end)
+        dest[k++] = _compare_entries(&src[j], &src[i]) < 0 ? src[j++]: src[i++];
+    memcpy(dest + k, src + i, (middle - i) * sizeof(_OutputEntry));
+    k += middle - i;
+    memcpy(dest + k, src + j, (end - j) * sizeof(_OutputEntry));
+}
+
+/// Stable merge sort of n entries, using scratch of the same size. The
+/// comparison is inlined, which qsort cannot do.
+static void _sort_range(_OutputEntry* entries, _OutputEntry* scratch, size_t n) {
+    for (size_t begin = 0; begin < n; begin += OUTPUT_INSERTION_RUN) {
+        size_t end = begin + OUTPUT_INSERTION_RUN < n ? begin + OUTPUT_INSERTION_RUN: n;
+        for (size_t i = begin + 1; i < end; ++i) {
+            _OutputEntry entry = entries[i];
+            size_t j = i;
+            while (j > begin && _compare_entries(&entry, &entries[j - 1]) < 0) {
+                entries[j] = entries[j - 1];
+                j--;
+            }
+            entries[j] = entry;
+        }
+    }
+    _OutputEntry* src = entries;
+    _OutputEntry* dest = scratch;
+    for (size_t width = OUTPUT_INSERTION_RUN; width < n; width *= 2) {
+        for (size_t begin = 0; begin < n; begin += 2 * width) {
+            size_t middle = begin + width < n ? begin + width: n;
+            size_t end = begin + 2 * width < n ? begin + 2 * width: n;
+            _merge(src, dest, begin, middle, end);
+        }
+        _OutputEntry* sorted = dest;
+        dest = src;
+        src = sorted;
+    }
+    if (src != entries)
+        memcpy(entries, src, n * sizeof(_OutputEntry));
+}
+
+/// Replace the keys of entries [begin, end) with their strxfrm collation
+/// keys, stored in one buffer owned by the task
+static void _collation_keys(_OutputJob* job, size_t task, size_t begin, size_t end) {
+    size_t capacity = 64;
+    for (size_t i = begin; i < end; ++i)
+        capacity += 2 * (job->entries[i].length + 1);
+    char* keys = (char*)malloc(capacity);
+    size_t* offsets = (size_t*)malloc((end - begin + 1) * sizeof(size_t));
+    char name[256];
+    size_t used = 0;
+    for (size_t i = begin; i < end; ++i) {
+        _OutputEntry* entry = &job->entries[i];
+        char* source = entry->length < sizeof(name) ? name: (char*)malloc(entry->length + 1);
+        memcpy(source, entry->name, entry->length);
+        source[entry->length] = '\0';
+        size_t length = strxfrm(keys + used, source, capacity - used);
+        if (length >= capacity - used) {
+            capacity = 2 * capacity + length + 1;
+            keys = (char*)realloc(keys, capacity);
+            if (keys == NULL) {
+                perror("Error: could not allocate collation keys.");
+                abort();
+            }
+            strxfrm(keys + used, source, capacity - used);
+        }
+        if (source != name)
+            free(source);
+        offsets[i - begin] = used;
+        entry->key_length = (uint32_t)length;
+        used += length + 1;
+    }
+    // Keys are only addressed once the buffer stopped moving
+    for (size_t i = begin; i < end; ++i)
+        job->entries[i].key = keys + offsets[i - begin];
+    free(offsets);
+    job->keys[task] = keys;
+}
+
+/// Function for threadpool to sort one run of run_length entries
+static void* _sort_run(void* arg) {
+    _OutputArg* _arg = (_OutputArg*)arg;
+    _OutputJob* job = _arg->job;
+    size_t begin = _arg->task * job->run_length;
+    size_t end = begin + job->run_length < job->num_entries ? begin + job->run_length: job->num_entries;
+    if (job->config->order == OUTPUT_SORT_LOCALE)
+        _collation_keys(job, _arg->task, begin, end);
+    for (size_t i = begin; i < end; ++i) {
+        _OutputEntry* entry = &job->entries[i];
+        entry->prefix = _key_prefix(entry->key, entry->key_length);
+    }
+    _sort_range(job->entries + begin, job->scratch + begin, end - begin);
+    return NULL;
+}
+
+/// Function for threadpool to merge one pair of sorted runs into scratch
+static void* _merge_runs(void* arg) {
+    _OutputArg* _arg = (_OutputArg*)arg;
+    _OutputJob* job = _arg->job;
+    size_t n = job->num_entries;
+    size_t begin = 2 * _arg->task * job->run_length;
+    size_t middle = begin + job->run_length < n ? begin + job->run_length: n;
+    size_t end = middle + job->run_length < n ? middle + job->run_length: n;
+    _merge(job->entries, job->scratch, begin, middle, end);
+    return NULL;
+}
+
+/// Sort the entries in runs, one task each, then merge pairs of runs in
+/// parallel until one run is left
+static void _sort_entries(_OutputJob* job, size_t num_tasks) {
+    size_t n = job->num_entries;
+    job->run_length = (n + num_tasks - 1) / num_tasks;
+    _run_tasks(job, num_tasks, "sort_run", &_sort_run);
+    while (job->run_length < n) {
+        size_t num_merges = (n + 2 * job->run_length - 1) / (2 * job->run_length);
+        _run_tasks(job, num_merges, "merge_runs", &_merge_runs);
+        _OutputEntry* sorted = job->scratch;
+        job->scratch = job->entries;
+        job->entries = sorted;
+        job->run_length *= 2;
+    }
+}
+
+static inline char* _put_u32(char* p, uint32_t value) {
+    for (size_t i = 0; i < 4; ++i)
+        *p++ = (char)(value >> (8 * i));
+    return p;
+}
+
+static inline char* _put_u64(char* p, uint64_t value) {
+    for (size_t i = 0; i < 8; ++i)
+        *p++ = (char)(value >> (8 * i));
+    return p;
+}
+
+static inline char* _put_text(char* p, const char* text) {
+    size_t length = strlen(text);
+    memcpy(p, text, length);
+    return p + length;
+}
+
+static char* _format_uint(char* p, uint64_t value) {
+    char digits[20];
+    size_t n = 0;
+    do {
+        digits[n++] = (char)('0' + value % 10);
+        value /= 10;
+    } while (value > 0);
+    while (n > 0)
+        *p++ = digits[--n];
+    return p;
+}
+
+static char* _format_csv_name(char* p, const char* name, size_t length) {
+    bool quote = false;
+    for (size_t i = 0; i < length && !quote; ++i)
+        quote = name[i] == ',' || name[i] == '"' || name[i] == '\n' || name[i] == '\r';
+    if (!quote) {
+        memcpy(p, name, length);
+        return p + length;
+    }
+    *p++ = '"';
+    for (size_t i = 0; i < length; ++i) {
+        if (name[i] == '"')
+            *p++ = '"';
+        *p++ = name[i];
+    }
+    *p++ = '"';
+    return p;
+}
+
+static char* _format_json_string(char* p, const char* text, size_t length) {
+    static const char hex[] = "0123456789abcdef";
+    *p++ = '"';
+    for (size_t i = 0; i < length; ++i) {
+        unsigned char c = (unsigned char)text[i];
+        if (c == '"' || c == '\\') {
+            *p++ = '\\';
+            *p++ = (char)c;
+        } else if (c < 0x20) {
+            p = _put_text(p, "\\u00");
+            *p++ = hex[c >> 4];
+            *p++ = hex[c & 0xf];
+        } else {
+            *p++ = (char)c;
+        }
+    }
+    *p++ = '"';
+    return p;
+}
+
+/// Quantile of Student's t distribution with df degrees of freedom at the
+/// probability of the standard normal quantile z: exact for one and two
+/// degrees of freedom, from the Cornish-Fisher expansion beyond
+static double _student_t(double z, uint64_t df) {
+    double p = 0.5 * erfc(-z / sqrt(2.0));
+    if (df == 1)
+        return tan(M_PI * (p - 0.5));
+    if (df == 2)
+        return (2.0 * p - 1.0) / sqrt(2.0 * p * (1.0 - p));
+    double v = (double)df, z2 = z * z;
+    return z + z * (z2 + 1.0) / (4.0 * v)
+             + z * ((5.0 * z2 + 16.0) * z2 + 3.0) / (96.0 * v * v)
+             + z * (((3.0 * z2 + 19.0) * z2 + 17.0) * z2 - 15.0) / (384.0 * v * v * v)
+             + z * ((((79.0 * z2 + 776.0) * z2 + 1482.0) * z2 - 1920.0) * z2 - 945.0) / (92160.0 * v * v * v * v);
+}
+
+/// Half-width of the confidence interval of the mean of stats in tenths
+/// of a degree, rounded up, or -1 for a station measured fewer than twice.
+/// Few measurements widen z to the t quantile of the same confidence.
+static int64_t _interval_tenths(const StationStats* stats, double z) {
+    if (stats->count < 2 || stats->histogram == NULL) return -1;
+    double critical = _student_t(z, stats->count - 1);
+    double hundredths = critical * sqrt(histogram_variance(stats->histogram) / (double)stats->count);
+    return (int64_t)ceil(hundredths / 10.0);
+}
+
+/// Write the interval of stats after its mean as "±h", or "±?" without one
+static char* _format_interval(char* p, const StationStats* stats, double z) {
+    int64_t interval = _interval_tenths(stats, z);
+    p = _put_text(p, "\xc2\xb1");
+    if (interval < 0) {
+        *p++ = '?';
+        return p;
+    }
+    return format_tenths(p, interval);
+}
+
+/// Upper bound of the bytes _format_entry writes for a station whose name
+/// has length bytes
+static inline size_t _entry_size(size_t length, size_t num_quantiles) {
+    return 6 * length + 128 + FORMAT_TENTHS_MAX + num_quantiles * (OUTPUT_LABEL_SIZE + FORMAT_TENTHS_MAX + 8);
+}
+
+/// Write the station at index of the output
+static char* _format_entry(char* p, const _OutputJob* job, const _OutputEntry* entry, size_t index) {
+    const OutputConfig* config = job->config;
+    const StationStats* stats = entry->stats;
+    int64_t min = round_tenths(stats->min, 1);
+    int64_t max = round_tenths(stats->max, 1);
+    int64_t mean = round_tenths(stats->sum, stats->count);
+    switch (config->format) {
+        case OUTPUT_LINES:
+        case OUTPUT_OFFICIAL:
+            if (config->format == OUTPUT_OFFICIAL && index > 0)
+                p = _put_text(p, ", ");
+            memcpy(p, entry->name, entry->length);
+            p += entry->length;
+            *p++ = '=';
+            p = format_tenths(p, min);
+            *p++ = '/';
+            p = format_tenths(p, max);
+            *p++ = '/';
+            p = format_tenths(p, mean);
+            if (config->interval_z > 0.0)
+                p = _format_interval(p, stats, config->interval_z);
+            for (size_t i = 0; i < config->num_quantiles; ++i) {
+                *p++ = '/';
+                p = format_tenths(p, round_tenths(histogram_quantile(stats->histogram, config->quantiles[i]), 1));
+            }
+            if (config->format == OUTPUT_LINES)
+                *p++ = '\n';
+            break;
+        case OUTPUT_CSV:
+            p = _format_csv_name(p, entry->name, entry->length);
+            *p++ = ',';
+            p = format_tenths(p, min);
+            *p++ = ',';
+            p = format_tenths(p, max);
+            *p++ = ',';
+            p = format_tenths(p, mean);
+            if (config->interval_z > 0.0) {
+                *p++ = ',';
+                int64_t interval = _interval_tenths(stats, config->interval_z);
+                if (interval >= 0)
+                    p = format_tenths(p, interval);
+            }
+            *p++ = ',';
+            p = _format_uint(p, stats->count);
+            for (size_t i = 0; i < config->num_quantiles; ++i) {
+                *p++ = ',';
+                p = format_tenths(p, round_tenths(histogram_quantile(stats->histogram, config->quantiles[i]), 1));
+            }
+            *p++ = '\n';
+            break;
+        case OUTPUT_JSON:
+            p = _put_text(p, index > 0 ? ",\n{\"name\":": "\n{\"name\":");
+            p = _format_json_string(p, entry->name, entry->length);
+            p = _put_text(p, ",\"min\":");
+            p = format_tenths(p, min);
+            p = _put_text(p, ",\"max\":");
+            p = format_tenths(p, max);
+            p = _put_text(p, ",\"mean\":");
+            p = format_tenths(p, mean);
+            if (config->interval_z > 0.0) {
+                p = _put_text(p, ",\"mean_error\":");
+                int64_t interval = _interval_tenths(stats, config->interval_z);
+                p = interval >= 0 ? format_tenths(p, interval): _put_text(p, "null");
+            }
+            p = _put_text(p, ",\"count\":");
+            p = _format_uint(p, stats->count);
+            for (size_t i = 0; i < config->num_quantiles; ++i) {
+                p = _put_text(p, ",\"");
+                p = _put_text(p, job->labels[i]);
+                p = _put_text(p, "\":");
+                p = format_tenths(p, round_tenths(histogram_quantile(stats->histogram, config->quantiles[i]), 1));
+            }
+            *p++ = '}';
+            break;
+        case OUTPUT_BINARY:
+            p = _put_u32(p, (uint32_t)entry->length);
+            memcpy(p, entry->name, entry->length);
+            p += entry->length;
+            p = _put_u32(p, (uint32_t)stats->min);
+            p = _put_u32(p, (uint32_t)stats->max);
+            p = _put_u64(p, (uint64_t)stats->sum);
+            p = _put_u64(p, stats->count);
+            for (size_t i = 0; i < config->num_quantiles; ++i)
+                p = _put_u32(p, (uint32_t)histogram_quantile(stats->histogram, config->quantiles[i]));
+            break;
+    }
+    return p;
+}
+
+/// Function for threadpool to format a contiguous share of the entries
+/// into a buffer of the task
+static void* _format_entries(void* arg) {
+    _OutputArg* _arg = (_OutputArg*)arg;
+    _OutputJob* job = _arg->job;
+    size_t begin = job->num_entries * _arg->task / job->num_tasks;
+    size_t end = job->num_entries * (_arg->task + 1) / job->num_tasks;
+    size_t capacity = 1;
+    for (size_t i = begin; i < end; ++i)
+        capacity += _entry_size(job->entries[i].length, job->config->num_quantiles);
+    char* buffer = (char*)malloc(capacity);
+    if (buffer == NULL) {
+        perror("Error: could not allocate output buffer.");
+        abort();
+    }
+    char* p = buffer;
+    for (size_t i = begin; i < end; ++i) {
+        // Sorted entries point all over the tables
+        if (i + OUTPUT_PREFETCH_DISTANCE < end) {
+            __builtin_prefetch(job->entries[i + OUTPUT_PREFETCH_DISTANCE].stats);
+            __builtin_prefetch(job->entries[i + OUTPUT_PREFETCH_DISTANCE].name);
+        }
+        p = _format_entry(p, job, &job->entries[i], job->first_index + i);
+    }
+    job->buffers[_arg->task] = buffer;
+    job->sizes[_arg->task] = (size_t)(p - buffer);
+    return NULL;
+}
+
+/// Write the text before the first of num_stations stations into p, which
+/// has room for 256 + 64 bytes per quantile
+static char* _format_header(char* p, const _OutputJob* job, const Aggregator* aggregator, size_t num_stations) {
+    const OutputConfig* config = job->config;
+    switch (config->format) {
+        case OUTPUT_LINES:
+            if (!config->summary) break;
+            p = _put_text(p, "Lines of input file covered: ");
+            p = _format_uint(p, aggregator->rows);
+            p = _put_text(p, "\nStations: ");
+            p = _format_uint(p, num_stations);
+            *p++ = '\n';
+            break;
+        case OUTPUT_OFFICIAL:
+            *p++ = '{';
+            break;
+        case OUTPUT_CSV:
+            p = _put_text(p, config->interval_z > 0.0 ? "station,min,max,mean,mean_error,count": "station,min,max,mean,count");
+            for (size_t i = 0; i < config->num_quantiles; ++i) {
+                *p++ = ',';
+                p = _put_text(p, job->labels[i]);
+            }
+            *p++ = '\n';
+            break;
+        case OUTPUT_JSON:
+            p = _put_text(p, "{\"rows\":");
+            p = _format_uint(p, aggregator->rows);
+            p = _put_text(p, ",\"stations\":[");
+            break;
+        case OUTPUT_BINARY:
+            p = _put_text(p, OUTPUT_BINARY_MAGIC);
+            p = _put_u32(p, OUTPUT_BINARY_VERSION);
+            p = _put_u32(p, (uint32_t)config->num_quantiles);
+            p = _put_u64(p, num_stations);
+            for (size_t i = 0; i < config->num_quantiles; ++i) {
+                uint64_t bits;
+                memcpy(&bits, &config->quantiles[i], sizeof(bits));
+                p = _put_u64(p, bits);
+            }
+            break;
+    }
+    return p;
+}
+
+static const char* _footer(OutputFormat format, size_t num_entries) {
+    switch (format) {
+        case OUTPUT_OFFICIAL:
+            return "}\n";
+        case OUTPUT_JSON:
+            return num_entries > 0 ? "\n]}\n": "]}\n";
+        default:
+            return "";
+    }
+}
+
+/// Write all of iov to out, with as few writev calls as the kernel allows
+/// when out has a file descriptor
+static bool _write_all(FILE* out, struct iovec* iov, size_t count) {
+    if (fflush(out) != 0) return false;
+    int fd = fileno(out);
+    if (fd < 0) {
+        for (size_t i = 0; i < count; ++i) {
+            if (fwrite(iov[i].iov_base, 1, iov[i].iov_len, out) != iov[i].iov_len)
+                return false;
+        }
+        return fflush(out) == 0;
+    }
+    while (count > 0) {
+        ssize_t written = writev(fd, iov, count < UIO_MAXIOV ? (int)count: UIO_MAXIOV);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        while (count > 0 && (size_t)written >= iov->iov_len) {
+            written -= (ssize_t)iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count > 0) {
+            iov->iov_base = (char*)iov->iov_base + written;
+            iov->iov_len -= (size_t)written;
+        }
+    }
+    return true;
+}
+
+
+/// Number of tasks the current entries are sorted and formatted by
+static size_t _num_tasks(const _OutputJob* job) {
+    size_t num_tasks = job->num_entries / OUTPUT_MIN_STATIONS_PER_TASK;
+    num_tasks = num_tasks < job->max_tasks ? num_tasks: job->max_tasks;
+    return num_tasks > 0 ? num_tasks: 1;
+}
+
+/// Sort the current entries in the configured order, if any
+static void _sort_job(_OutputJob* job) {
+    job->num_tasks = _num_tasks(job);
+    if (job->config->order == OUTPUT_SORT_NONE || job->num_entries < 2) return;
+    job->scratch = (_OutputEntry*)malloc(job->num_entries * sizeof(_OutputEntry));
+    if (job->scratch == NULL) {
+        perror("Error: could not allocate output entries.");
+        abort();
+    }
+    _sort_entries(job, job->num_tasks);
+}
+
+/// Format the current entries into one buffer per task
+static void _format_job(_OutputJob* job) {
+    job->num_tasks = _num_tasks(job);
+    _run_tasks(job, job->num_tasks, "format_entries", &_format_entries);
+}
+
+/// Release the current entries with their collation keys and formatted
+/// buffers
+static void _release_entries(_OutputJob* job) {
+    for (size_t i = 0; i < job->max_tasks; ++i) {
+        free(job->keys[i]);
+        free(job->buffers[i]);
+        job->keys[i] = NULL;
+        job->buffers[i] = NULL;
+    }
+    free(job->entries);
+    free(job->scratch);
+    job->entries = NULL;
+    job->scratch = NULL;
+    job->num_entries = 0;
+}
+
+/// Make the stations kept in memory by an aggregator, from its catalog
+/// first, the current entries
+static void _collect_entries(_OutputJob* job, const Aggregator* aggregator) {
+    size_t capacity = aggregator->table.size;
+    if (aggregator->catalog != NULL)
+        capacity += aggregator->catalog->num_stations;
+    job->entries = (_OutputEntry*)malloc((capacity + 1) * sizeof(_OutputEntry));
+    if (job->entries == NULL) {
+        perror("Error: could not allocate output entries.");
+        abort();
+    }
+    size_t n = 0;
+    if (aggregator->catalog != NULL) {
+        for (uint32_t id = 0; id < aggregator->catalog->num_stations; ++id) {
+            if (aggregator->catalog_stats[id].count == 0) continue;
+            String name = catalog_name(aggregator->catalog, id);
+            job->entries[n].name = name.data;
+            job->entries[n].length = (uint32_t)name.length;
+            job->entries[n++].stats = &aggregator->catalog_stats[id];
+        }
+    }
+    for (size_t i = 0; i < aggregator->table.capacity; ++i) {
+        const StationStats* entry = &aggregator->table.entries[i];
+        if (entry->key == NULL) continue;
+        job->entries[n].name = entry->key;
+        job->entries[n].length = entry->length;
+        job->entries[n++].stats = entry;
+    }
+    for (size_t i = 0; i < n; ++i) {
+        job->entries[i].key = job->entries[i].name;
+        job->entries[i].key_length = job->entries[i].length;
+    }
+    job->num_entries = n;
+}
+
+/// Format the current entries and write them to out
+static bool _write_entries(_OutputJob* job, FILE* out) {
+    _format_job(job);
+    struct iovec* iov = (struct iovec*)malloc(job->num_tasks * sizeof(struct iovec));
+    for (size_t i = 0; i < job->num_tasks; ++i) {
+        iov[i].iov_base = job->buffers[i];
+        iov[i].iov_len = job->sizes[i];
+    }
+    bool written = _write_all(out, iov, job->num_tasks);
+    free(iov);
+    return written;
+}
+
+/// Copy a station and its name into the batch
+static void _batch_add(_OutputBatch* batch, const _OutputJob* job, const char* name, uint32_t length,
+                       const StationStats* stats) {
+    if (batch->num_stations == batch->capacity) {
+        batch->capacity = batch->capacity == 0 ? 1024: 2 * batch->capacity;
+        batch->stats = (StationStats*)realloc(batch->stats, batch->capacity * sizeof(StationStats));
+        batch->offsets = (size_t*)realloc(batch->offsets, batch->capacity * sizeof(size_t));
+    }
+    if (batch->text_used + length > batch->text_capacity) {
+        batch->text_capacity = 2 * batch->text_capacity + length;
+        batch->text = (char*)realloc(batch->text, batch->text_capacity);
+    }
+    if (batch->stats == NULL || batch->offsets == NULL || batch->text == NULL) {
+        perror("Error: could not allocate output batch.");
+        abort();
+    }
+    // Catalog stations are named by the catalog rather than their stats
+    batch->stats[batch->num_stations] = *stats;
+    batch->stats[batch->num_stations].length = length;
+    batch->offsets[batch->num_stations++] = batch->text_used;
+    memcpy(batch->text + batch->text_used, name, length);
+    batch->text_used += length;
+
+    // The station, its entry and scratch copy, formatted text and
+    // collation key
+    batch->bytes += sizeof(StationStats) + sizeof(size_t) + length + 2 * sizeof(_OutputEntry) +
+                    _entry_size(length, job->config->num_quantiles);
+    if (job->config->order == OUTPUT_SORT_LOCALE)
+        batch->bytes += 2 * ((size_t)length + 1);
+}
+
+/// Make the stations of the batch the current entries, in batch order
+static void _batch_entries(_OutputBatch* batch, _OutputJob* job) {
+    job->entries = (_OutputEntry*)malloc((batch->num_stations + 1) * sizeof(_OutputEntry));
+    if (job->entries == NULL) {
+        perror("Error: could not allocate output entries.");
+        abort();
+    }
+    for (size_t i = 0; i < batch->num_stations; ++i) {
+        _OutputEntry* entry = &job->entries[i];
+        entry->name = batch->text + batch->offsets[i];
+        entry->length = batch->stats[i].length;
+        entry->stats = &batch->stats[i];
+        entry->key = entry->name;
+        entry->key_length = entry->length;
+    }
+    job->num_entries = batch->num_stations;
+    batch->num_stations = 0;
+    batch->text_used = 0;
+    batch->bytes = 0;
+}
+
+static void _batch_destroy(_OutputBatch* batch) {
+    free(batch->stats);
+    free(batch->offsets);
+    free(batch->text);
+}
+
+/// Write the stations of the batch to the output in batch order
+static void _spill_write_batch(_OutputSpill* sort) {
+    _OutputJob* job = sort->job;
+    size_t n = sort->batch.num_stations;
+    _batch_entries(&sort->batch, job);
+    sort->written = sort->written && _write_entries(job, sort->out);
+    job->first_index += n;
+    _release_entries(job);
+}
+
+/// Sort the stations of the batch and append them to the spill file as a
+/// run
+static void _spill_write_run(_OutputSpill* sort) {
+    _OutputJob* job = sort->job;
+    _batch_entries(&sort->batch, job);
+    _sort_job(job);
+    bool separate_keys = job->config->order == OUTPUT_SORT_LOCALE;
+    SpillSegment run = {0, sort->file->size, 0};
+    for (size_t i = 0; i < job->num_entries; ++i) {
+        const _OutputEntry* entry = &job->entries[i];
+        _OutputRecord record;
+        memset(&record, 0x0, sizeof(_OutputRecord));
+        record.sum = entry->stats->sum;
+        record.count = entry->stats->count;
+        record.min = entry->stats->min;
+        record.max = entry->stats->max;
+        record.key_length = separate_keys ? entry->key_length: 0;
+        record.length = entry->length;
+        spillfile_write(sort->file, &record, sizeof(_OutputRecord));
+        if (separate_keys)
+            spillfile_write(sort->file, entry->key, entry->key_length);
+        spillfile_write(sort->file, entry->name, entry->length);
+    }
+    run.size = sort->file->size - run.offset;
+    _release_entries(job);
+
+    if (sort->num_runs == sort->runs_capacity) {
+        sort->runs_capacity = sort->runs_capacity == 0 ? 8: 2 * sort->runs_capacity;
+        sort->runs = (SpillSegment*)realloc(sort->runs, sort->runs_capacity * sizeof(SpillSegment));
+    }
+    sort->runs[sort->num_runs++] = run;
+}
+
+/// Add a station to the batch, which is written out or as a run once it
+/// reaches the batch limit
+static void _spill_add(_OutputSpill* sort, const char* name, uint32_t length, const StationStats* stats) {
+    _batch_add(&sort->batch, sort->job, name, length, stats);
+    if (sort->batch.bytes < sort->batch_limit) return;
+    if (sort->to_runs)
+        _spill_write_run(sort);
+    else
+        _spill_write_batch(sort);
+}
+
+/// Read the next station of a run, or return false at its end
+static bool _run_reader_next(_OutputRunReader* reader) {
+    if (spillreader_done(&reader->reader))
+        return false;
+    spillreader_read(&reader->reader, &reader->record, sizeof(_OutputRecord));
+    size_t length = (size_t)reader->record.key_length + reader->record.length;
+    if (length > reader->capacity) {
+        reader->capacity = 2 * length;
+        reader->text = (char*)realloc(reader->text, reader->capacity);
+    }
+    spillreader_read(&reader->reader, reader->text, length);
+    reader->key_length = reader->record.key_length > 0 ? reader->record.key_length: reader->record.length;
+    reader->name = reader->text + reader->record.key_length;
+    return true;
+}
+
+static bool _run_reader_less(const _OutputRunReader* a, const _OutputRunReader* b) {
+    size_t n = a->key_length < b->key_length ? a->key_length: b->key_length;
+    int c = memcmp(a->text, b->text, n);
+    return c < 0 || (c == 0 && a->key_length < b->key_length);
+}
+
+/// Restore the heap order below index i of a min-heap of run readers
+static void _run_heap_sift_down(_OutputRunReader** heap, size_t size, size_t i) {
+    while (true) {
+        size_t smallest = i;
+        size_t left = 2 * i + 1, right = 2 * i + 2;
+        if (left < size && _run_reader_less(heap[left], heap[smallest])) smallest = left;
+        if (right < size && _run_reader_less(heap[right], heap[smallest])) smallest = right;
+        if (smallest == i) return;
+        _OutputRunReader* tmp = heap[i];
+        heap[i] = heap[smallest];
+        heap[smallest] = tmp;
+        i = smallest;
+    }
+}
+
+/// Merge sorted runs into one run appended to the spill file and return
+/// it, or into the output if final is set. Every station is in one run
+/// only, so stations are passed on as they are.
+static SpillSegment _spill_merge_runs(_OutputSpill* sort, const SpillSegment* runs, size_t num_runs, bool final) {
+    _OutputRunReader* readers = (_OutputRunReader*)calloc(num_runs + 1, sizeof(_OutputRunReader));
+    _OutputRunReader** heap = (_OutputRunReader**)calloc(num_runs + 1, sizeof(_OutputRunReader*));
+    size_t size = 0;
+    for (size_t r = 0; r < num_runs; ++r) {
+        spillreader_init(&readers[r].reader, sort->file, runs[r].offset, runs[r].size);
+        if (_run_reader_next(&readers[r]))
+            heap[size++] = &readers[r];
+    }
+    for (size_t i = size / 2; i-- > 0;)
+        _run_heap_sift_down(heap, size, i);
+
+    SpillSegment merged = {0, sort->file->size, 0};
+    while (size > 0) {
+        _OutputRunReader* top = heap[0];
+        if (final) {
+            StationStats stats;
+            memset(&stats, 0x0, sizeof(StationStats));
+            stats.length = top->record.length;
+            stats.min = top->record.min;
+            stats.max = top->record.max;
+            stats.sum = top->record.sum;
+            stats.count = top->record.count;
+            _spill_add(sort, top->name, top->record.length, &stats);
+        } else {
+            spillfile_write(sort->file, &top->record, sizeof(_OutputRecord));
+            spillfile_write(sort->file, top->text, (size_t)top->record.key_length + top->record.length);
+        }
+        if (!_run_reader_next(top))
+            heap[0] = heap[--size];
+        _run_heap_sift_down(heap, size, 0);
+    }
+    if (!final)
+        spillfile_flush(sort->file);
+    merged.size = sort->file->size - merged.offset;
+
+    for (size_t i = 0; i < num_runs; ++i) {
+        spillreader_destroy(&readers[i].reader);
+        free(readers[i].text);
+    }
+    free(readers);
+    free(heap);
+    return merged;
+}
+
+/// Write the stations of a result that spilled, from its catalog first,
+/// between header and footer. Only a batch of stations and the readers of
+/// the runs merged at once are held in memory, within the budget of the
+/// spill.
+static bool _write_spilled(_OutputJob* job, const Aggregator* aggregator, FILE* out) {
+    SpillSet* spill = aggregator->spill;
+    _OutputSpill sort;
+    memset(&sort, 0x0, sizeof(_OutputSpill));
+    sort.job = job;
+    sort.out = out;
+    sort.file = &spill->files[0];
+    sort.written = true;
+    // Half of the budget for the batch, the rest for run readers
+    size_t readers = spill->budget / 2 / SPILL_BUFFER_SIZE;
+    sort.batch_limit = spill->budget == 0 ? SIZE_MAX: spill->budget / 2;
+    sort.fan_in = spill->budget == 0 ? SIZE_MAX: readers > SPILL_MIN_FAN_IN + 1 ? readers - 1: SPILL_MIN_FAN_IN;
+    sort.to_runs = job->config->order != OUTPUT_SORT_NONE;
+
+    size_t num_stations = aggregator->table.size + spill->num_stations;
+    for (uint32_t id = 0; aggregator->catalog != NULL && id < aggregator->catalog->num_stations; ++id)
+        num_stations += aggregator->catalog_stats[id].count > 0;
+    char* header = (char*)malloc(256 + 64 * job->config->num_quantiles);
+    struct iovec iov = {header, (size_t)(_format_header(header, job, aggregator, num_stations) - header)};
+    sort.written = _write_all(out, &iov, 1);
+    free(header);
+
+    if (aggregator->catalog != NULL) {
+        for (uint32_t id = 0; id < aggregator->catalog->num_stations; ++id) {
+            if (aggregator->catalog_stats[id].count == 0) continue;
+            String name = catalog_name(aggregator->catalog, id);
+            _spill_add(&sort, name.data, (uint32_t)name.length, &aggregator->catalog_stats[id]);
+        }
+    }
+    for (size_t i = 0; i < aggregator->table.capacity; ++i) {
+        const StationStats* entry = &aggregator->table.entries[i];
+        if (entry->key != NULL)
+            _spill_add(&sort, entry->key, entry->length, entry);
+    }
+    SpillCursor cursor;
+    StationStats stats;
+    spillcursor_init(&cursor, spill);
+    while (spillcursor_next(&cursor, &stats))
+        _spill_add(&sort, stats.key, stats.length, &stats);
+    spillcursor_destroy(&cursor);
+
+    if (sort.to_runs && sort.num_runs == 0) {
+        // Everything fit in one batch, which is sorted in memory
+        _batch_entries(&sort.batch, job);
+        _sort_job(job);
+        sort.written = sort.written && _write_entries(job, out);
+        _release_entries(job);
+    } else if (sort.to_runs) {
+        if (sort.batch.num_stations > 0)
+            _spill_write_run(&sort);
+        spillfile_flush(sort.file);
+        while (sort.num_runs > sort.fan_in) {
+            // Groups are merged into the front of the array they are read from
+            size_t n = 0;
+            for (size_t i = 0; i < sort.num_runs; i += sort.fan_in) {
+                size_t group = sort.num_runs - i < sort.fan_in ? sort.num_runs - i: sort.fan_in;
+                sort.runs[n++] = group == 1 ? sort.runs[i]: _spill_merge_runs(&sort, sort.runs + i, group, false);
+            }
+            sort.num_runs = n;
+        }
+        sort.to_runs = false;
+        _spill_merge_runs(&sort, sort.runs, sort.num_runs, true);
+    }
+    if (sort.batch.num_stations > 0)
+        _spill_write_batch(&sort);
+
+    const char* footer = _footer(job->config->format, num_stations);
+    struct iovec tail = {(void*)footer, strlen(footer)};
+    sort.written = sort.written && _write_all(out, &tail, 1);
+    _batch_destroy(&sort.batch);
+    free(sort.runs);
+    return sort.written;
+}
+
+/// Write every station of an aggregator to out in the configured format
+/// and order. Stations are sorted and formatted by up to num_threads tasks
+/// into buffers that are handed to a single writev, or a batch at a time
+/// within the memory budget of a result that spilled. Quantiles need an
+/// aggregator that kept histograms. Returns false with errno set if the
+/// output could not be written.
+bool output_write(const Aggregator* aggregator, const OutputConfig* config, FILE* out) {
+    if (aggregator==NULL || config==NULL || out==NULL) {
+        perror("Error: Null pointer provided as argument.");
+        abort();
+    }
+
+    _OutputJob job;
+    memset(&job, 0x0, sizeof(_OutputJob));
+    job.config = config;
+    job.max_tasks = config->num_threads > 0 ? config->num_threads: 1;
+    job.keys = (char**)calloc(job.max_tasks, sizeof(char*));
+    job.buffers = (char**)calloc(job.max_tasks, sizeof(char*));
+    job.sizes = (size_t*)calloc(job.max_tasks, sizeof(size_t));
+    job.labels = (char (*)[OUTPUT_LABEL_SIZE])calloc(config->num_quantiles + 1, OUTPUT_LABEL_SIZE);
+    for (size_t i = 0; i < config->num_quantiles; ++i)
+        snprintf(job.labels[i], OUTPUT_LABEL_SIZE, "p%g", config->quantiles[i] * 100.0);
+
+    bool written;
+    if (aggregator->spill != NULL) {
+        written = _write_spilled(&job, aggregator, out);
+    } else {
+        _collect_entries(&job, aggregator);
+        size_t n = job.num_entries;
+        _sort_job(&job);
+        _format_job(&job);
+
+        char* header = (char*)malloc(256 + 64 * config->num_quantiles);
+        const char* footer = _footer(config->format, n);
+        struct iovec* iov = (struct iovec*)malloc((job.num_tasks + 2) * sizeof(struct iovec));
+        size_t count = 0;
+        iov[count].iov_base = header;
+        iov[count++].iov_len = (size_t)(_format_header(header, &job, aggregator, n) - header);
+        for (size_t i = 0; i < job.num_tasks; ++i) {
+            iov[count].iov_base = job.buffers[i];
+            iov[count++].iov_len = job.sizes[i];
+        }
+        iov[count].iov_base = (void*)footer;
+        iov[count++].iov_len = strlen(footer);
+        written = _write_all(out, iov, count);
+        free(iov);
+        free(header);
+    }
+
+    int error = errno;
+    _release_entries(&job);
+    free(job.keys);
+    free(job.buffers);
+    free(job.sizes);
+    free(job.labels);
+    errno = error;
+    return written;
+}
@@ -0,0 +1,85 @@
+/* Sorted export of analyzer results.
+
+                    GNU AFFERO GENERAL PUBLIC LICENSE
+                       Version 3, 19 November 2007
+
+    Copyright (C) 2024  Debajyoti Debnath
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published
+    by the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+
+#ifndef _OUTPUT_H_
+#define _OUTPUT_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "analyzer.h"
+
+// Fewest stations worth a sort or formatting task of their own
+#define OUTPUT_MIN_STATIONS_PER_TASK 16384
+// Magic and version at the start of the binary format
+#define OUTPUT_BINARY_MAGIC "1BRC"
+#define OUTPUT_BINARY_VERSION 1
+
+// How stations are written
+typedef enum {
+    // "name=min/max/mean" lines after a two-line summary
+    OUTPUT_LINES,
+    // "{A=min/max/mean, B=min/max/mean}" on one line, as in the challenge
+    OUTPUT_OFFICIAL,
+    OUTPUT_CSV,
+    OUTPUT_JSON,
+    // Little-endian header of OUTPUT_BINARY_MAGIC, the u32 version, the u32
+    // number of quantiles, the u64 number of stations and the f64 quantiles,
+    // then per station its u32 name length, the name, the i32 min and max,
+    // i64 sum and u64 count, and one i32 per quantile, all in hundredths
+    OUTPUT_BINARY
+} OutputFormat;
+
+// Order stations are written in
+typedef enum {
+    // By the bytes of their names, which is code point order for UTF-8
+    OUTPUT_SORT_BYTES,
+    // By the LC_COLLATE collation of the current locale
+    OUTPUT_SORT_LOCALE,
+    // In table order, catalog stations first
+    OUTPUT_SORT_NONE
+} OutputOrder;
+
+// How the results of an analysis are exported
+typedef struct {
+    OutputFormat format;
+    OutputOrder order;
+    const double* quantiles;
+    size_t num_quantiles;
+    // z-score of the confidence interval written after every mean, from
+    // the variance of the station's histogram, or 0 for none. Binary
+    // output carries no intervals.
+    double interval_z;
+    // Whether OUTPUT_LINES starts with the rows and stations covered
+    bool summary;
+    size_t num_threads;
+} OutputConfig;
+
+void outputconfig_init(OutputConfig* config);
+bool output_parse_format(const char* name, OutputFormat* format);
+bool output_parse_order(const char* name, OutputOrder* order);
+bool output_write(const Aggregator* aggregator, const OutputConfig* config, FILE* out);
+
+#endif // _OUTPUT_H_
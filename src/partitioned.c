@@ -0,0 +1,454 @@
+/* Radix-partitioned aggregation for inputs with many stations.
+
+                    GNU AFFERO GENERAL PUBLIC LICENSE
+                       Version 3, 19 November 2007
+
+    Copyright (C) 2024  Debajyoti Debnath
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published
+    by the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+
+#include "analyzer.h"
+#include "trace.h"
+#include <yatpool.h>
+
+// One row scattered to a partition. name points into the input.
+typedef struct {
+    uint64_t hash;
+    const char* name;
+    uint32_t length;
+    int32_t value;
+} _PartitionTuple;
+
+// Growable array of the rows one worker scattered to one partition
+typedef struct {
+    _PartitionTuple* tuples;
+    size_t size;
+    size_t capacity;
+} _TupleBuffer;
+
+// State shared by the workers of one analyze_buffer_partitioned call
+typedef struct {
+    const char* data;
+    size_t* chunk_starts;
+    size_t next_chunk;
+    size_t round_end;
+    size_t num_workers;
+    size_t num_partitions;
+    unsigned int shift;
+    size_t next_partition;
+    _TupleBuffer* buffers;
+    StatsTable* tables;
+    // Partitions each table is split into, the tables split into, and the
+    // keys of split tables, which their stations still point to
+    size_t split;
+    StatsTable* split_tables;
+    KeyBlock* split_keys;
+    const StationCatalog* catalog;
+    StationStats* catalog_stats;
+    bool histograms;
+    uint64_t* rows;
+    uint64_t* bytes;
+    RunStats* stats;
+    PerfReport* perf;
+} _PartitionJob;
+
+typedef struct {
+    _PartitionJob* job;
+    size_t worker;
+} _PartitionArg;
+
+void _partitionarg_init(_PartitionArg** arg, _PartitionJob* job, size_t worker) {
+    if (arg==NULL || job==NULL) return;
+    *arg = (_PartitionArg*)malloc(sizeof(_PartitionArg));
+    (*arg)->job = job;
+    (*arg)->worker = worker;
+}
+
+void _partitionarg_destroy(void* arg) {
+    if (arg==NULL) return;
+    _PartitionArg* _arg = (_PartitionArg*)arg;
+    free(_arg);
+}
+
+/// Append a tuple to a buffer, doubling it when full
+static inline void _tuple_buffer_push(_TupleBuffer* buffer, uint64_t hash, const char* name, size_t length, int32_t value) {
+    if (buffer->size == buffer->capacity) {
+        buffer->capacity = buffer->capacity == 0 ? 256: 2 * buffer->capacity;
+        buffer->tuples = (_PartitionTuple*)realloc(buffer->tuples, buffer->capacity * sizeof(_PartitionTuple));
+        if (buffer->tuples == NULL) {
+            perror("Error: could not allocate partition buffer.");
+            abort();
+        }
+    }
+    _PartitionTuple* tuple = &buffer->tuples[buffer->size++];
+    tuple->hash = hash;
+    tuple->name = name;
+    tuple->length = (uint32_t)length;
+    tuple->value = value;
+}
+
+/// Function for threadpool to scatter the rows of the current round's
+/// chunks into the worker's partition buffers by the high bits of their hash
+void* _scatter_chunks(void* arg) {
+    _PartitionArg* partitionarg = (_PartitionArg*)arg;
+    _PartitionJob* job = partitionarg->job;
+    size_t worker = partitionarg->worker;
+    _TupleBuffer* buffers = job->buffers + worker * job->num_partitions;
+#if ONEBRC_STATS
+    double start = stats_now();
+    WorkerStats* worker_stats = job->stats != NULL && worker < job->stats->num_workers ? &job->stats->workers[worker]: NULL;
+#endif
+    PerfCounters counters;
+    bool count = perfreport_worker_start(job->perf, worker, &counters);
+    uint64_t rows_before = job->rows[worker];
+
+    size_t chunk;
+    while ((chunk = __atomic_fetch_add(&job->next_chunk, 1, __ATOMIC_RELAXED)) < job->round_end) {
+        const char* p = job->data + job->chunk_starts[chunk];
+        const char* end = job->data + job->chunk_starts[chunk + 1];
+        uint64_t rows = 0;
+        while (p < end) {
+            const char* semi = p;
+            while (semi < end && *semi != ';' && *semi != '\n')
+                semi++;
+            if (semi == end || *semi == '\n') {
+                p = semi + 1;
+                continue;
+            }
+            const char* newline = (const char*)memchr(semi + 1, '\n', (size_t)(end - semi - 1));
+            newline = newline == NULL ? end: newline;
+            size_t length = (size_t)(semi - p);
+            uint64_t hash = station_hash(p, length);
+            _tuple_buffer_push(&buffers[hash >> job->shift], hash, p, length, parse_temperature(semi + 1, newline));
+            rows++;
+            p = newline + 1;
+        }
+        job->rows[worker] += rows;
+        job->bytes[worker] += job->chunk_starts[chunk + 1] - job->chunk_starts[chunk];
+        STATS(if (worker_stats != NULL) worker_stats->chunks++);
+    }
+    if (count)
+        perfreport_worker_stop(job->perf, worker, &counters, job->rows[worker] - rows_before);
+
+#if ONEBRC_STATS
+    if (worker_stats != NULL) {
+        worker_stats->seconds += stats_now() - start;
+        worker_stats->rows = job->rows[worker];
+        worker_stats->bytes = job->bytes[worker];
+    }
+#endif
+    return NULL;
+}
+
+/// Function for threadpool to aggregate whole partitions, each into its
+/// own table, until none are left. No two tasks touch the same station.
+void* _aggregate_partitions(void* arg) {
+    _PartitionArg* partitionarg = (_PartitionArg*)arg;
+    _PartitionJob* job = partitionarg->job;
+    PerfCounters counters;
+    bool count = perfreport_worker_start(job->perf, partitionarg->worker, &counters);
+
+    size_t partition;
+    while ((partition = __atomic_fetch_add(&job->next_partition, 1, __ATOMIC_RELAXED)) < job->num_partitions) {
+        StatsTable* table = &job->tables[partition];
+        for (size_t worker = 0; worker < job->num_workers; ++worker) {
+            _TupleBuffer* buffer = &job->buffers[worker * job->num_partitions + partition];
+            for (size_t i = 0; i < buffer->size; ++i) {
+                const _PartitionTuple* tuple = &buffer->tuples[i];
+                StationStats* stats = NULL;
+                if (job->catalog != NULL) {
+                    uint32_t id = catalog_find(job->catalog, tuple->name, tuple->length, tuple->hash);
+                    stats = id != CATALOG_NOT_FOUND ? &job->catalog_stats[id]: NULL;
+                }
+                if (stats == NULL)
+                    stats = stats_table_find_or_insert(table, tuple->name, tuple->length, tuple->hash);
+                station_stats_add(stats, tuple->value);
+                if (job->histograms)
+                    station_stats_add_histogram(stats, tuple->value);
+            }
+            buffer->size = 0;
+        }
+    }
+    if (count)
+        perfreport_worker_stop(job->perf, partitionarg->worker, &counters, 0);
+    return NULL;
+}
+
+/// Function for threadpool to split whole partition tables into job->split
+/// tables each, by the hash bits below the old partition. Stations are
+/// moved as they are, and the keys they point to go to job->split_keys.
+void* _split_partitions(void* arg) {
+    _PartitionArg* partitionarg = (_PartitionArg*)arg;
+    _PartitionJob* job = partitionarg->job;
+    size_t* counts = (size_t*)malloc(job->split * sizeof(size_t));
+    PerfCounters counters;
+    bool count = perfreport_worker_start(job->perf, partitionarg->worker, &counters);
+
+    size_t partition;
+    while ((partition = __atomic_fetch_add(&job->next_partition, 1, __ATOMIC_RELAXED)) < job->num_partitions) {
+        StatsTable* table = &job->tables[partition];
+        StatsTable* split = &job->split_tables[partition * job->split];
+        size_t first = partition * job->split;
+        memset(counts, 0x0, job->split * sizeof(size_t));
+        for (size_t i = 0; i < table->capacity; ++i) {
+            if (table->entries[i].key != NULL)
+                counts[(table->entries[i].hash >> job->shift) - first]++;
+        }
+        for (size_t i = 0; i < job->split; ++i)
+            stats_table_init(&split[i], 2 * counts[i] + 16);
+
+        for (size_t i = 0; i < table->capacity; ++i) {
+            const StationStats* entry = &table->entries[i];
+            if (entry->key == NULL) continue;
+            StatsTable* dest = &job->split_tables[entry->hash >> job->shift];
+            size_t mask = dest->capacity - 1;
+            size_t slot = entry->hash & mask;
+            while (dest->entries[slot].key != NULL)
+                slot = (slot + 1) & mask;
+            dest->entries[slot] = *entry;
+            dest->size++;
+        }
+#if ONEBRC_STATS
+        for (size_t b = 0; b < PROBE_HISTOGRAM_BUCKETS; ++b)
+            split[0].probe_histogram[b] += table->probe_histogram[b];
+#endif
+        split[0].num_allocations += table->num_allocations;
+
+        if (table->keys != NULL) {
+            KeyBlock* last = table->keys;
+            while (last->next != NULL)
+                last = last->next;
+            last->next = __atomic_load_n(&job->split_keys, __ATOMIC_RELAXED);
+            while (!__atomic_compare_exchange_n(&job->split_keys, &last->next, table->keys, true,
+                                                __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+                ;
+        }
+        free(table->entries);
+    }
+    free(counts);
+    if (count)
+        perfreport_worker_stop(job->perf, partitionarg->worker, &counters, 0);
+    return NULL;
+}
+
+/// Run one task per worker of job on a fresh threadpool and wait for them
+static void _run_tasks(_PartitionJob* job, const char* name, void* (*function)(void*)) {
+    YATPool* pool;
+    yatpool_init(&pool, job->num_workers, job->num_workers);
+    for (size_t i = 0; i < job->num_workers; ++i) {
+        Task* task;
+        _PartitionArg* arg;
+        _partitionarg_init(&arg, job, i);
+
+        trace_task_init(&task, name, function, arg, &_partitionarg_destroy);
+        yatpool_put(pool, task);
+    }
+    yatpool_wait(pool);
+    yatpool_destroy(pool);
+}
+
+/// Split the partitions of job into enough partitions that no table is
+/// larger than max_bytes, up to ANALYZER_MAX_PARTITIONS. The partition
+/// buffers must be empty.
+static void _fit_partitions(_PartitionJob* job, size_t max_bytes) {
+    size_t largest = 0;
+    for (size_t i = 0; i < job->num_partitions; ++i)
+        largest = job->tables[i].capacity > largest ? job->tables[i].capacity: largest;
+    size_t split = 1;
+    while (largest * sizeof(StationStats) / split > max_bytes
+           && job->num_partitions * split < ANALYZER_MAX_PARTITIONS) {
+        split *= 2;
+        job->shift--;
+    }
+    if (split == 1) return;
+
+    job->split = split;
+    job->split_tables = (StatsTable*)calloc(job->num_partitions * split, sizeof(StatsTable));
+    job->next_partition = 0;
+    _run_tasks(job, "split_partitions", &_split_partitions);
+    free(job->tables);
+    job->tables = job->split_tables;
+    job->split_tables = NULL;
+
+    for (size_t i = 0; i < job->num_workers * job->num_partitions; ++i)
+        free(job->buffers[i].tuples);
+    free(job->buffers);
+    job->num_partitions *= split;
+    job->buffers = (_TupleBuffer*)calloc(job->num_workers * job->num_partitions, sizeof(_TupleBuffer));
+}
+
+/// Aggregate a buffer of measurements in rounds of two passes. The workers
+/// first scatter (hash, name, temperature) tuples into per-partition
+/// buffers by the high bits of the hash, then aggregate one partition at a
+/// time, so that each table probed stays small enough to be cache resident
+/// however many stations there are. Partitions whose tables outgrow the
+/// cache are split between rounds, so their number follows the stations
+/// seen rather than the configured starting point.
+void analyze_buffer_partitioned(const char* data, size_t size, const AnalyzerConfig* config, Aggregator* result, RunStats* stats) {
+    if (config==NULL || result==NULL || (data==NULL && size>0)) {
+        perror("Error: Null pointer provided as argument.");
+        abort();
+    }
+    if (config->num_threads==0) {
+        perror("Error: num_threads cannot be zero.");
+        abort();
+    }
+
+    // Partitions are a power of two so that the partition is a shift away
+    size_t num_partitions = 2;
+    unsigned int shift = 63;
+    while (num_partitions < config->num_partitions) {
+        num_partitions *= 2;
+        shift--;
+    }
+
+    // Chunks are grouped into rounds of at most ANALYZER_PARTITION_ROUND_SIZE
+    size_t num_threads = config->num_threads;
+    size_t num_rounds = size / ANALYZER_PARTITION_ROUND_SIZE + 1;
+    size_t chunks_per_round = config->num_chunks;
+    if (chunks_per_round == 0 && config->chunk_size > 0) {
+        chunks_per_round = size / num_rounds / config->chunk_size + 1;
+    } else if (chunks_per_round == 0) {
+        chunks_per_round = ANALYZER_CHUNKS_PER_THREAD * num_threads;
+        size_t max_chunks = size / num_rounds / ANALYZER_MIN_CHUNK_SIZE + 1;
+        chunks_per_round = chunks_per_round > max_chunks ? max_chunks: chunks_per_round;
+    }
+
+    _PartitionJob job;
+    memset(&job, 0x0, sizeof(_PartitionJob));
+    job.data = data;
+    job.chunk_starts = analyzer_split_chunks(data, size, num_rounds * chunks_per_round);
+    job.num_workers = num_threads;
+    job.num_partitions = num_partitions;
+    job.shift = shift;
+    job.buffers = (_TupleBuffer*)calloc(num_threads * num_partitions, sizeof(_TupleBuffer));
+    job.tables = (StatsTable*)calloc(num_partitions, sizeof(StatsTable));
+    for (size_t i = 0; i < num_partitions; ++i)
+        stats_table_init(&job.tables[i], 16);
+    job.rows = (uint64_t*)calloc(num_threads, sizeof(uint64_t));
+    job.bytes = (uint64_t*)calloc(num_threads, sizeof(uint64_t));
+    job.stats = stats;
+    job.perf = config->perf;
+
+    // Catalog stations are aggregated straight into the result
+    aggregator_init(result, config->catalog);
+    job.catalog = config->catalog;
+    job.catalog_stats = result->catalog_stats;
+    job.histograms = config->histograms;
+    result->histograms = config->histograms;
+
+#if ONEBRC_STATS
+    double scatter_seconds = 0.0, aggregate_seconds = 0.0;
+#endif
+    for (size_t round = 0; round < num_rounds; ++round) {
+#if ONEBRC_STATS
+        double start = stats_now();
+#endif
+        job.next_chunk = round * chunks_per_round;
+        job.round_end = (round + 1) * chunks_per_round;
+        _run_tasks(&job, "scatter_chunks", &_scatter_chunks);
+#if ONEBRC_STATS
+        double scattered = stats_now();
+        scatter_seconds += scattered - start;
+#endif
+        job.next_partition = 0;
+        _run_tasks(&job, "aggregate_partitions", &_aggregate_partitions);
+        if (round + 1 < num_rounds)
+            _fit_partitions(&job, config->partition_table_bytes);
+#if ONEBRC_STATS
+        aggregate_seconds += stats_now() - scattered;
+#endif
+    }
+
+#if ONEBRC_STATS
+    double merge_start = stats_now();
+#endif
+    PerfCounters counters;
+    bool count = config->perf != NULL && perf_counters_open(&counters, false);
+    if (count)
+        perf_counters_start(&counters);
+
+#if ONEBRC_STATS
+    if (stats != NULL) {
+        for (size_t i = 0; i < job.num_partitions; ++i) {
+            for (size_t b = 0; b < PROBE_HISTOGRAM_BUCKETS; ++b)
+                stats->probe_histogram[b] += job.tables[i].probe_histogram[b];
+            stats->allocations += job.tables[i].num_allocations;
+        }
+    }
+#endif
+    stats_table_destroy(&result->table);
+    if (num_threads > 1) {
+        // Every partition table becomes an aggregator without a catalog, and
+        // the parallel merge collects them into the first one
+        Aggregator* partitions = (Aggregator*)calloc(job.num_partitions, sizeof(Aggregator));
+        for (size_t i = 0; i < job.num_partitions; ++i) {
+            partitions[i].table = job.tables[i];
+            partitions[i].table.num_allocations = 0;
+            partitions[i].batch_width = 1;
+        }
+        aggregator_merge_parallel(partitions, job.num_partitions, num_threads);
+        result->table = partitions[0].table;
+        free(partitions);
+    } else {
+        // Partitions hold disjoint stations, so collecting them never merges
+        size_t num_stations = 0;
+        for (size_t i = 0; i < job.num_partitions; ++i)
+            num_stations += job.tables[i].size;
+        stats_table_init(&result->table, 2 * num_stations + 1);
+        for (size_t i = 0; i < job.num_partitions; ++i) {
+            stats_table_merge(&result->table, &job.tables[i]);
+            stats_table_destroy(&job.tables[i]);
+        }
+    }
+    // Keys moved by splits may still be referenced by the result
+    while (job.split_keys != NULL) {
+        KeyBlock* next = job.split_keys->next;
+        job.split_keys->next = result->table.keys;
+        result->table.keys = job.split_keys;
+        job.split_keys = next;
+    }
+    for (size_t i = 0; i < num_threads; ++i) {
+        result->rows += job.rows[i];
+        result->bytes += job.bytes[i];
+    }
+    if (count) {
+        perf_counters_stop(&counters, perfreport_phase(config->perf, "merge"));
+        perf_counters_close(&counters);
+    }
+    if (config->perf != NULL)
+        config->perf->rows = result->rows;
+
+#if ONEBRC_STATS
+    if (stats != NULL) {
+        stats->phase_seconds[PHASE_PARSE] = scatter_seconds;
+        stats->phase_seconds[PHASE_AGGREGATE] = aggregate_seconds;
+        stats->phase_seconds[PHASE_MERGE] = stats_now() - merge_start;
+        stats->table_size = result->table.size;
+        stats->table_capacity = result->table.capacity;
+        stats->allocations += result->table.num_allocations;
+    }
+#endif
+
+    for (size_t i = 0; i < num_threads * job.num_partitions; ++i)
+        free(job.buffers[i].tuples);
+    free(job.buffers);
+    free(job.tables);
+    free(job.rows);
+    free(job.bytes);
+    free(job.chunk_starts);
+}
@@ -0,0 +1,224 @@
+/* Hardware performance counters read through perf_event_open.
+
+                    GNU AFFERO GENERAL PUBLIC LICENSE
+                       Version 3, 19 November 2007
+
+    Copyright (C) 2024  Debajyoti Debnath
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published
+    by the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include "perf_counters.h"
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+static const char* EVENT_NAMES[NUM_PERF_EVENTS] = {
+    "cycles", "instructions", "L1d misses", "LLC misses", "branch misses", "dTLB misses"
+};
+
+#define CACHE_READ_MISS(cache) \
+    ((cache) | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16))
+
+static const uint32_t EVENT_TYPES[NUM_PERF_EVENTS] = {
+    PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HW_CACHE,
+    PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HW_CACHE
+};
+
+static const uint64_t EVENT_CONFIGS[NUM_PERF_EVENTS] = {
+    PERF_COUNT_HW_CPU_CYCLES,
+    PERF_COUNT_HW_INSTRUCTIONS,
+    CACHE_READ_MISS(PERF_COUNT_HW_CACHE_L1D),
+    PERF_COUNT_HW_CACHE_MISSES,
+    PERF_COUNT_HW_BRANCH_MISSES,
+    CACHE_READ_MISS(PERF_COUNT_HW_CACHE_DTLB)
+};
+
+/// Open a counter for every event on the calling thread, counting user
+/// space only so that the default perf_event_paranoid setting suffices.
+/// With inherit set, threads created afterwards are counted as well; their
+/// counts are added once they exit. Returns false if no event could be opened.
+bool perf_counters_open(PerfCounters* counters, bool inherit) {
+    if (counters==NULL) return false;
+    bool any = false;
+    for (size_t i = 0; i < NUM_PERF_EVENTS; ++i) {
+        struct perf_event_attr attr;
+        memset(&attr, 0x0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = EVENT_TYPES[i];
+        attr.config = EVENT_CONFIGS[i];
+        attr.disabled = 1;
+        attr.inherit = inherit ? 1: 0;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+        counters->fds[i] = (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+        any = any || counters->fds[i] != -1;
+    }
+    return any;
+}
+
+/// Reset and enable every open counter
+void perf_counters_start(PerfCounters* counters) {
+    if (counters==NULL) return;
+    for (size_t i = 0; i < NUM_PERF_EVENTS; ++i) {
+        if (counters->fds[i] == -1) continue;
+        ioctl(counters->fds[i], PERF_EVENT_IOC_RESET, 0);
+        ioctl(counters->fds[i], PERF_EVENT_IOC_ENABLE, 0);
+    }
+}
+
+/// Disable every open counter and add its value to sample
+void perf_counters_stop(PerfCounters* counters, PerfSample* sample) {
+    if (counters==NULL || sample==NULL) return;
+    for (size_t i = 0; i < NUM_PERF_EVENTS; ++i) {
+        if (counters->fds[i] == -1) continue;
+        ioctl(counters->fds[i], PERF_EVENT_IOC_DISABLE, 0);
+
+        // value, time enabled, time running
+        uint64_t buf[3];
+        if (read(counters->fds[i], buf, sizeof(buf)) != (ssize_t)sizeof(buf)) continue;
+        if (buf[2] == 0) continue;
+        double scale = buf[2] < buf[1] ? (double)buf[1] / (double)buf[2]: 1.0;
+        sample->values[i] += (uint64_t)((double)buf[0] * scale);
+        sample->valid[i] = true;
+    }
+}
+
+/// Close every open counter
+void perf_counters_close(PerfCounters* counters) {
+    if (counters==NULL) return;
+    for (size_t i = 0; i < NUM_PERF_EVENTS; ++i) {
+        if (counters->fds[i] != -1)
+            close(counters->fds[i]);
+        counters->fds[i] = -1;
+    }
+}
+
+/// Add the counts of src to dest
+void perf_sample_add(PerfSample* dest, const PerfSample* src) {
+    if (dest==NULL || src==NULL) return;
+    for (size_t i = 0; i < NUM_PERF_EVENTS; ++i) {
+        dest->values[i] += src->values[i];
+        dest->valid[i] = dest->valid[i] || src->valid[i];
+    }
+}
+
+/// Initialize an empty report with room for num_threads worker threads
+void perfreport_init(PerfReport* report, size_t num_threads) {
+    if (report==NULL) return;
+    memset(report, 0x0, sizeof(PerfReport));
+    report->num_threads = num_threads;
+    if (num_threads > 0) {
+        report->threads = (PerfSample*)calloc(num_threads, sizeof(PerfSample));
+        report->thread_rows = (uint64_t*)calloc(num_threads, sizeof(uint64_t));
+    }
+}
+
+/// Sample of the phase called name, added to the report if it is new
+PerfSample* perfreport_phase(PerfReport* report, const char* name) {
+    for (size_t i = 0; i < report->num_phases; ++i) {
+        if (strcmp(report->phase_names[i], name) == 0)
+            return &report->phases[i];
+    }
+    if (report->num_phases == PERF_MAX_PHASES) {
+        perror("Error: too many phases in performance counter report.");
+        abort();
+    }
+    report->phase_names[report->num_phases] = name;
+    return &report->phases[report->num_phases++];
+}
+
+/// Open and start counters on the calling thread for worker, if report
+/// has a slot for it. Returns false if the worker is not counted.
+bool perfreport_worker_start(PerfReport* report, size_t worker, PerfCounters* counters) {
+    if (report==NULL || worker >= report->num_threads || !perf_counters_open(counters, false))
+        return false;
+    perf_counters_start(counters);
+    return true;
+}
+
+/// Stop and close the counters of a worker started with
+/// perfreport_worker_start, adding its counts and rows to report
+void perfreport_worker_stop(PerfReport* report, size_t worker, PerfCounters* counters, uint64_t rows) {
+    perf_counters_stop(counters, &report->threads[worker]);
+    perf_counters_close(counters);
+    report->thread_rows[worker] += rows;
+}
+
+/// Whether any counter of the report was read
+static bool _perfreport_available(const PerfReport* report) {
+    for (size_t i = 0; i < NUM_PERF_EVENTS; ++i) {
+        for (size_t k = 0; k < report->num_phases; ++k) {
+            if (report->phases[k].valid[i]) return true;
+        }
+        for (size_t k = 0; k < report->num_threads; ++k) {
+            if (report->threads[k].valid[i]) return true;
+        }
+    }
+    return false;
+}
+
+static void _print_sample(const char* label, const PerfSample* sample, uint64_t rows, FILE* out) {
+    fprintf(out, "  %-18s", label);
+    if (sample->valid[PERF_CYCLES] && sample->valid[PERF_INSTRUCTIONS] && sample->values[PERF_CYCLES] > 0)
+        fprintf(out, " IPC %5.2f", (double)sample->values[PERF_INSTRUCTIONS] / (double)sample->values[PERF_CYCLES]);
+    else
+        fprintf(out, " IPC   n/a");
+    for (size_t i = 0; i < NUM_PERF_EVENTS; ++i) {
+        if (!sample->valid[i])
+            fprintf(out, "  %s n/a", EVENT_NAMES[i]);
+        else if (rows > 0)
+            fprintf(out, "  %s/row %.3f", EVENT_NAMES[i], (double)sample->values[i] / (double)rows);
+        else
+            fprintf(out, "  %s %llu", EVENT_NAMES[i], (unsigned long long)sample->values[i]);
+    }
+    fprintf(out, "\n");
+}
+
+/// Print IPC and events per row of every phase and worker thread. The
+/// workers, whichever phases they ran, are also reported as one phase.
+void perfreport_print(const PerfReport* report, FILE* out) {
+    if (report==NULL) return;
+    if (!_perfreport_available(report)) {
+        fprintf(out, "Hardware counters unavailable (perf_event_open failed, see /proc/sys/kernel/perf_event_paranoid)\n");
+        return;
+    }
+    fprintf(out, "Hardware counters per phase:\n");
+    for (size_t i = 0; i < report->num_phases; ++i)
+        _print_sample(report->phase_names[i], &report->phases[i], report->rows, out);
+    if (report->num_threads == 0) return;
+    PerfSample workers;
+    memset(&workers, 0x0, sizeof(PerfSample));
+    for (size_t i = 0; i < report->num_threads; ++i)
+        perf_sample_add(&workers, &report->threads[i]);
+    _print_sample("workers", &workers, report->rows, out);
+    fprintf(out, "Hardware counters per thread:\n");
+    char label[32];
+    for (size_t i = 0; i < report->num_threads; ++i) {
+        snprintf(label, sizeof(label), "thread %zu", i);
+        _print_sample(label, &report->threads[i], report->thread_rows[i], out);
+    }
+}
+
+/// Release the memory held by a report
+void perfreport_destroy(PerfReport* report) {
+    if (report==NULL) return;
+    free(report->threads);
+    free(report->thread_rows);
+    report->threads = NULL;
+    report->thread_rows = NULL;
+}
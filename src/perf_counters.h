@@ -0,0 +1,82 @@
+/* Hardware performance counters read through perf_event_open.
+
+                    GNU AFFERO GENERAL PUBLIC LICENSE
+                       Version 3, 19 November 2007
+
+    Copyright (C) 2024  Debajyoti Debnath
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published
+    by the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef _PERF_COUNTERS_H_
+#define _PERF_COUNTERS_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+// Largest number of phases a report can hold
+#define PERF_MAX_PHASES 8
+
+// Hardware events counted by a PerfCounters group
+typedef enum {
+    PERF_CYCLES,
+    PERF_INSTRUCTIONS,
+    PERF_L1D_MISSES,
+    PERF_LLC_MISSES,
+    PERF_BRANCH_MISSES,
+    PERF_DTLB_MISSES,
+    NUM_PERF_EVENTS
+} PerfEvent;
+
+// Counter values, scaled up when the kernel had to multiplex the counters.
+// Events the CPU or kernel does not provide are marked invalid.
+typedef struct {
+    uint64_t values[NUM_PERF_EVENTS];
+    bool valid[NUM_PERF_EVENTS];
+} PerfSample;
+
+// One file descriptor per event, -1 where the event could not be opened
+typedef struct {
+    int fds[NUM_PERF_EVENTS];
+} PerfCounters;
+
+// Counters of a whole run, per phase and per worker thread
+typedef struct {
+    const char* phase_names[PERF_MAX_PHASES];
+    PerfSample phases[PERF_MAX_PHASES];
+    size_t num_phases;
+    PerfSample* threads;
+    uint64_t* thread_rows;
+    size_t num_threads;
+    uint64_t rows;
+} PerfReport;
+
+bool perf_counters_open(PerfCounters* counters, bool inherit);
+void perf_counters_start(PerfCounters* counters);
+void perf_counters_stop(PerfCounters* counters, PerfSample* sample);
+void perf_counters_close(PerfCounters* counters);
+void perf_sample_add(PerfSample* dest, const PerfSample* src);
+
+void perfreport_init(PerfReport* report, size_t num_threads);
+PerfSample* perfreport_phase(PerfReport* report, const char* name);
+bool perfreport_worker_start(PerfReport* report, size_t worker, PerfCounters* counters);
+void perfreport_worker_stop(PerfReport* report, size_t worker, PerfCounters* counters, uint64_t rows);
+void perfreport_print(const PerfReport* report, FILE* out);
+void perfreport_destroy(PerfReport* report);
+
+#endif // _PERF_COUNTERS_H_
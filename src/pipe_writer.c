@@ -0,0 +1,172 @@
+/* Streaming generated measurements into a pipe.
+
+                    GNU AFFERO GENERAL PUBLIC LICENSE
+                       Version 3, 19 November 2007
+
+    Copyright (C) 2024  Debajyoti Debnath
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published
+    by the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include "pipe_writer.h"
+#include "generate_data.h"
+#include "run_stats.h"
+#include "trace.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+/// Set up a writer for fd. Buffers are handed to a pipe with vmsplice, so
+/// that the reader copies them straight out of this process, and written
+/// with write() to anything else. With rows_per_second set, rows are
+/// released in small steps no faster than that rate.
+void pipe_writer_init(PipeWriter* writer, int fd, size_t rows_per_second) {
+    if (writer==NULL) {
+        perror("Error: Null pointer provided as argument.");
+        abort();
+    }
+    memset(writer, 0x0, sizeof(PipeWriter));
+    writer->fd = fd;
+    struct stat st;
+    writer->splice = fstat(fd, &st) == 0 && S_ISFIFO(st.st_mode);
+    // A larger pipe needs fewer wake-ups of the reader; the default is
+    // kept where the limit of unprivileged pipes is lower
+    if (writer->splice)
+        fcntl(fd, F_SETPIPE_SZ, PIPE_WRITER_PIPE_SIZE);
+    for (size_t i = 0; i < PIPE_WRITER_BUFFERS; ++i)
+        writer->buffers[i] = (char*)aligned_alloc(4096, PIPE_WRITER_BUFSIZE);
+    writer->rows_per_second = rows_per_second;
+    writer->pacing_rows = rows_per_second / PIPE_WRITER_PACING_HZ;
+    writer->pacing_rows = writer->pacing_rows == 0 ? 1: writer->pacing_rows;
+    writer->start = stats_now();
+}
+
+/// Wait until the reader has consumed the stream up to offset
+static void _pipe_writer_wait_consumed(const PipeWriter* writer, size_t offset) {
+    while (true) {
+        int unread = 0;
+        if (ioctl(writer->fd, FIONREAD, &unread) == -1 || writer->total_bytes - (size_t)unread >= offset)
+            return;
+        struct timespec pause = {0, 20000};
+        nanosleep(&pause, NULL);
+    }
+}
+
+/// Sleep until the rows written so far are due at the configured rate
+static void _pipe_writer_pace(const PipeWriter* writer, size_t rows) {
+    double due = writer->start + (double)rows / (double)writer->rows_per_second;
+    double wait = due - stats_now();
+    if (wait <= 0.0) return;
+    struct timespec pause;
+    pause.tv_sec = (time_t)wait;
+    pause.tv_nsec = (long)((wait - (double)pause.tv_sec) * 1e9);
+    while (nanosleep(&pause, &pause) == -1 && errno == EINTR);
+}
+
+/// Hand the current buffer to the pipe and move on to the next one
+static void _pipe_writer_flush(PipeWriter* writer) {
+    if (writer->used == 0) return;
+    if (writer->rows_per_second > 0)
+        _pipe_writer_pace(writer, writer->rows + writer->buffered_rows);
+
+    const char* data = writer->buffers[writer->current];
+    size_t remaining = writer->used;
+    while (remaining > 0) {
+        ssize_t n;
+        if (writer->splice) {
+            struct iovec iov = {(void*)data, remaining};
+            n = vmsplice(writer->fd, &iov, 1, 0);
+            // Not every pipe-like file accepts vmsplice
+            if (n == -1 && (errno == EINVAL || errno == ENOSYS)) {
+                writer->splice = false;
+                continue;
+            }
+        } else {
+            n = write(writer->fd, data, remaining);
+        }
+        if (n == -1 && errno == EINTR) continue;
+        if (n == -1) {
+            perror("Error: could not write to the output stream.");
+            exit(EXIT_FAILURE);
+        }
+        data += n;
+        remaining -= (size_t)n;
+    }
+    writer->total_bytes += writer->used;
+    writer->ends[writer->current] = writer->total_bytes;
+    writer->rows += writer->buffered_rows;
+    writer->used = 0;
+    writer->buffered_rows = 0;
+
+    // Pages given away by vmsplice still belong to the pipe until read
+    writer->current = (writer->current + 1) % PIPE_WRITER_BUFFERS;
+    if (writer->splice)
+        _pipe_writer_wait_consumed(writer, writer->ends[writer->current]);
+}
+
+/// Append one line, which must be shorter than a buffer
+void pipe_writer_append(PipeWriter* writer, const char* line, size_t length) {
+    if (writer->used + length > PIPE_WRITER_BUFSIZE)
+        _pipe_writer_flush(writer);
+    memcpy(writer->buffers[writer->current] + writer->used, line, length);
+    writer->used += length;
+    writer->buffered_rows++;
+    if (writer->rows_per_second > 0 && writer->buffered_rows >= writer->pacing_rows)
+        _pipe_writer_flush(writer);
+}
+
+/// Write out what is left and release the buffers. The file descriptor
+/// stays open.
+void pipe_writer_finish(PipeWriter* writer) {
+    _pipe_writer_flush(writer);
+    // The last buffers may still be read from the pipe
+    if (writer->splice)
+        _pipe_writer_wait_consumed(writer, writer->total_bytes);
+    for (size_t i = 0; i < PIPE_WRITER_BUFFERS; ++i)
+        free(writer->buffers[i]);
+}
+
+/// Sample n_rows measurements in batches and stream them to fd as they are
+/// formatted, so no more than one batch is held in memory. The rows are the
+/// same as those written to a file with the same seed. Returns the
+/// number of bytes written.
+size_t pipe_measurements(const StationCatalog* catalog, size_t n_rows, size_t seed, size_t num_threads,
+                         const WorkloadConfig* workload, int fd, size_t rows_per_second) {
+    PipeWriter writer;
+    pipe_writer_init(&writer, fd, rows_per_second);
+    for (size_t batch = 0; batch * PIPE_WRITER_BATCH_ROWS < n_rows; ++batch) {
+        size_t low = batch * PIPE_WRITER_BATCH_ROWS;
+        size_t rows = n_rows - low < PIPE_WRITER_BATCH_ROWS ? n_rows - low: PIPE_WRITER_BATCH_ROWS;
+        String* lines = generate_random_temperature_sample_range(catalog, low, rows, seed, num_threads, workload);
+        uint64_t trace_start = trace_begin();
+        for (size_t i = 0; i < rows; ++i) {
+            pipe_writer_append(&writer, lines[i].data, lines[i].length);
+            string_destroy(lines[i]);
+        }
+        free(lines);
+        trace_end("write_batch", trace_start);
+    }
+    pipe_writer_finish(&writer);
+    return writer.total_bytes;
+}
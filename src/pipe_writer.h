@@ -0,0 +1,72 @@
+/* Streaming generated measurements into a pipe.
+
+                    GNU AFFERO GENERAL PUBLIC LICENSE
+                       Version 3, 19 November 2007
+
+    Copyright (C) 2024  Debajyoti Debnath
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published
+    by the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+
+#ifndef _PIPE_WRITER_H_
+#define _PIPE_WRITER_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include "catalog.h"
+#include "workload.h"
+
+// Buffers of a pipe writer; a buffer given to the pipe with vmsplice is
+// only refilled once the reader has consumed it
+#define PIPE_WRITER_BUFFERS 4
+// Size of each buffer
+#define PIPE_WRITER_BUFSIZE (1 << 20)
+// Pipe capacity requested with F_SETPIPE_SZ
+#define PIPE_WRITER_PIPE_SIZE (1 << 20)
+// Times per second a rate-limited writer releases rows
+#define PIPE_WRITER_PACING_HZ 100
+// Rows sampled at a time when streaming measurements, a multiple of
+// GENERATE_TASK_ROWS
+#define PIPE_WRITER_BATCH_ROWS (1 << 20)
+
+// Hands lines to a pipe, or any other file descriptor, in whole buffers
+typedef struct {
+    int fd;
+    bool splice;
+    char* buffers[PIPE_WRITER_BUFFERS];
+    // Stream offset just past each buffer once it was handed to the pipe
+    size_t ends[PIPE_WRITER_BUFFERS];
+    size_t current;
+    size_t used;
+    size_t total_bytes;
+    size_t rows;
+    size_t buffered_rows;
+    // Optional cap on the rows released per second, with the number of rows
+    // released at a time
+    size_t rows_per_second;
+    size_t pacing_rows;
+    double start;
+} PipeWriter;
+
+void pipe_writer_init(PipeWriter* writer, int fd, size_t rows_per_second);
+void pipe_writer_append(PipeWriter* writer, const char* line, size_t length);
+void pipe_writer_finish(PipeWriter* writer);
+size_t pipe_measurements(const StationCatalog* catalog, size_t n_rows, size_t seed, size_t num_threads,
+                         const WorkloadConfig* workload, int fd, size_t rows_per_second);
+
+#endif // _PIPE_WRITER_H_
@@ -0,0 +1,215 @@
+/* Coroutine pipeline of reader, splitter and aggregator stages.
+
+                    GNU AFFERO GENERAL PUBLIC LICENSE
+                       Version 3, 19 November 2007
+
+    Copyright (C) 2024  Debajyoti Debnath
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published
+    by the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+
+#ifndef _PIPELINE_HPP_
+#define _PIPELINE_HPP_
+
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include "coroutine.hpp"
+#include "engine.hpp"
+
+namespace onebrc {
+
+// Bytes read into each pipeline buffer
+constexpr size_t PIPELINE_BLOCK_SIZE = 1 << 20;
+// Room in front of each buffer for the partial line carried over from the
+// previous one, which bounds the length of a line
+constexpr size_t PIPELINE_HEADROOM = 64 * 1024;
+// Buffers in flight per aggregator
+constexpr size_t PIPELINE_BUFFERS_PER_THREAD = 2;
+
+// Block of input moving through the pipeline. The reader fills
+// [PIPELINE_HEADROOM, size), the splitter prepends the carried-over line
+// at begin and cuts the block after its last newline at end.
+struct PipelineBuffer {
+    std::vector<char> storage = std::vector<char>(PIPELINE_HEADROOM + PIPELINE_BLOCK_SIZE);
+    size_t begin = PIPELINE_HEADROOM;
+    size_t end = PIPELINE_HEADROOM;
+    size_t size = PIPELINE_HEADROOM;
+    // Last buffer of an input, whose trailing line is complete
+    bool last = false;
+};
+
+/// Read, split and aggregate the inputs at paths ("-" for standard input)
+/// with coroutines on an executor of num_threads threads. Buffers are
+/// recycled through a bounded free list, so a slow stage makes the ones
+/// before it suspend instead of buffering more input.
+template <class Parser, class Hash, template <class, class> class Table, class Acc>
+class Pipeline {
+public:
+    using EngineType = Engine<MmapReader, Parser, Hash, Table, Acc>;
+    using TableType = typename EngineType::TableType;
+
+    static std::string name() {
+        return std::string("pipeline-") + Parser::name + "-" + Hash::name + "-" + TableType::name + "-" + Acc::name;
+    }
+
+    Pipeline(const std::vector<std::string>& paths, size_t num_threads):
+        paths_(paths),
+        num_aggregators_(std::max<size_t>(1, num_threads)),
+        executor_(num_aggregators_),
+        io_(executor_),
+        free_(executor_, PIPELINE_BUFFERS_PER_THREAD * num_aggregators_ + 2),
+        filled_(executor_, num_aggregators_),
+        blocks_(executor_, num_aggregators_),
+        tables_(num_aggregators_),
+        rows_(num_aggregators_, 0) {
+        buffers_.resize(PIPELINE_BUFFERS_PER_THREAD * num_aggregators_ + 2);
+        for (auto& buffer: buffers_) {
+            buffer = std::make_unique<PipelineBuffer>();
+            free_.try_send(buffer.get());
+        }
+    }
+
+    /// Run every stage to completion and return the merged table and the
+    /// number of rows
+    std::pair<TableType, size_t> run() {
+        WaitGroup group;
+        group.on_error = [this]() {
+            free_.close();
+            filled_.close();
+            blocks_.close();
+        };
+        read_inputs().spawn(executor_, group);
+        split().spawn(executor_, group);
+        for (size_t i = 0; i < num_aggregators_; ++i)
+            aggregate(i).spawn(executor_, group);
+        group.wait();
+
+        for (size_t i = 1; i < num_aggregators_; ++i) {
+            tables_[0].merge(tables_[i]);
+            rows_[0] += rows_[i];
+        }
+        return {std::move(tables_[0]), rows_[0]};
+    }
+
+    static size_t analyze(const std::vector<std::string>& paths, size_t num_threads, FILE* out) {
+        Pipeline pipeline(paths, num_threads);
+        auto [table, rows] = pipeline.run();
+        EngineType::print_sorted(table, out);
+        return rows;
+    }
+
+private:
+    /// Reader stage: fill free buffers from every input in turn
+    Task read_inputs() {
+        for (const std::string& path: paths_) {
+            int fd = path == "-" ? STDIN_FILENO: open(path.c_str(), O_RDONLY);
+            if (fd == -1)
+                throw std::runtime_error("Could not open input file " + path);
+            if (fd != STDIN_FILENO)
+                posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+            bool last = false;
+            while (!last) {
+                std::optional<PipelineBuffer*> buffer = co_await free_.receive();
+                if (!buffer) break;
+                PipelineBuffer* b = *buffer;
+                size_t n = co_await io_.read(fd, b->storage.data() + PIPELINE_HEADROOM, PIPELINE_BLOCK_SIZE);
+                last = n < PIPELINE_BLOCK_SIZE;
+                b->begin = b->end = PIPELINE_HEADROOM;
+                b->size = PIPELINE_HEADROOM + n;
+                b->last = last;
+                if (!co_await filled_.send(b)) break;
+            }
+            if (fd != STDIN_FILENO)
+                close(fd);
+        }
+        filled_.close();
+    }
+
+    /// Splitter stage: carry the partial line at the end of each buffer
+    /// over to the next one of the same input, then pass the buffer on
+    Task split() {
+        PipelineBuffer* pending = nullptr;
+        while (true) {
+            std::optional<PipelineBuffer*> buffer = co_await filled_.receive();
+            if (!buffer) break;
+            PipelineBuffer* b = *buffer;
+
+            if (pending != nullptr) {
+                const char* data = pending->storage.data();
+                const void* newline = memrchr(data + pending->begin, '\n', pending->size - pending->begin);
+                pending->end = newline == nullptr ? pending->begin: static_cast<size_t>(static_cast<const char*>(newline) - data) + 1;
+                size_t carry = pending->size - pending->end;
+                if (carry > PIPELINE_HEADROOM)
+                    throw std::runtime_error("Line longer than the pipeline headroom");
+                b->begin = PIPELINE_HEADROOM - carry;
+                memcpy(b->storage.data() + b->begin, data + pending->end, carry);
+                if (!co_await blocks_.send(pending)) break;
+                pending = nullptr;
+            }
+
+            if (b->last) {
+                b->end = b->size;
+                if (!co_await blocks_.send(b)) break;
+            } else {
+                pending = b;
+            }
+        }
+        blocks_.close();
+    }
+
+    /// Aggregator stage: aggregate whole lines and recycle the buffer
+    Task aggregate(size_t worker) {
+        while (true) {
+            std::optional<PipelineBuffer*> buffer = co_await blocks_.receive();
+            if (!buffer) break;
+            PipelineBuffer* b = *buffer;
+            const char* data = b->storage.data();
+            rows_[worker] += EngineType::consume(data + b->begin, data + b->end, tables_[worker]);
+            if (!co_await free_.send(b)) break;
+        }
+    }
+
+    std::vector<std::string> paths_;
+    size_t num_aggregators_;
+    Executor executor_;
+    IoService io_;
+    Channel<PipelineBuffer*> free_;
+    Channel<PipelineBuffer*> filled_;
+    Channel<PipelineBuffer*> blocks_;
+    std::vector<std::unique_ptr<PipelineBuffer>> buffers_;
+    std::vector<TableType> tables_;
+    std::vector<size_t> rows_;
+};
+
+/// Every prebuilt pipeline, named pipeline-parser-hash-table-accumulator
+inline const std::vector<EngineEntry>& pipeline_registry() {
+    static const std::vector<EngineEntry> registry = [] {
+        std::vector<EngineEntry> entries;
+        add_engines<Pipeline, RegistryParsers, RegistryHashes, RegistryTables, RegistryAccumulators>(entries);
+        return entries;
+    }();
+    return registry;
+}
+
+} // namespace onebrc
+
+#endif // _PIPELINE_HPP_
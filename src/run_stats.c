@@ -0,0 +1,142 @@
+/* Optional run-time instrumentation of the analyzer.
+
+                    GNU AFFERO GENERAL PUBLIC LICENSE
+                       Version 3, 19 November 2007
+
+    Copyright (C) 2024  Debajyoti Debnath
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published
+    by the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include "run_stats.h"
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+static const char* PHASE_NAMES[NUM_PHASES] = {"map", "parse", "aggregate", "merge", "output"};
+static const char* BUCKET_NAMES[PROBE_HISTOGRAM_BUCKETS] = {"1", "2", "3", "4", "5-8", "9-16", "17-32", "33+"};
+
+/// Seconds on the monotonic clock
+double stats_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+/// Time stamp counter, or zero where there is none
+uint64_t stats_cycles(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+/// Histogram bucket of a lookup that took the given number of probes
+size_t probe_bucket(size_t probes) {
+    if (probes <= 4) return probes - 1;
+    if (probes <= 8) return 4;
+    if (probes <= 16) return 5;
+    if (probes <= 32) return 6;
+    return 7;
+}
+
+/// Initialize counters for a run with num_workers workers
+void runstats_init(RunStats* stats, size_t num_workers) {
+    if (stats==NULL) return;
+    memset(stats, 0x0, sizeof(RunStats));
+    stats->num_workers = num_workers;
+    stats->workers = (WorkerStats*)calloc(num_workers, sizeof(WorkerStats));
+}
+
+/// Split the wall time of the parse and aggregate phase between the two
+/// in proportion to the sampled worker cycles
+void runstats_split_parse_aggregate(RunStats* stats, double seconds) {
+    uint64_t parse = 0, aggregate = 0;
+    for (size_t i = 0; i < stats->num_workers; ++i) {
+        parse += stats->workers[i].parse_cycles;
+        aggregate += stats->workers[i].aggregate_cycles;
+    }
+    double share = parse + aggregate == 0 ? 0.5: (double)parse / (double)(parse + aggregate);
+    stats->phase_seconds[PHASE_PARSE] = seconds * share;
+    stats->phase_seconds[PHASE_AGGREGATE] = seconds * (1.0 - share);
+}
+
+/// Ratio of the busiest worker's rows to the mean rows per worker
+static double _imbalance(const RunStats* stats) {
+    uint64_t total = 0, busiest = 0;
+    for (size_t i = 0; i < stats->num_workers; ++i) {
+        total += stats->workers[i].rows;
+        busiest = stats->workers[i].rows > busiest ? stats->workers[i].rows: busiest;
+    }
+    if (total == 0) return 1.0;
+    return (double)busiest * (double)stats->num_workers / (double)total;
+}
+
+/// Print the counters as text or as JSON
+void runstats_print(const RunStats* stats, FILE* out, bool json) {
+    if (stats==NULL || out==NULL) return;
+    double load_factor = stats->table_capacity == 0 ? 0.0: (double)stats->table_size / (double)stats->table_capacity;
+
+    if (json) {
+        fprintf(out, "{\"phases_ms\": {");
+        for (size_t i = 0; i < NUM_PHASES; ++i)
+            fprintf(out, "%s\"%s\": %.3f", i == 0 ? "": ", ", PHASE_NAMES[i], stats->phase_seconds[i] * 1e3);
+        fprintf(out, "}, \"workers\": [");
+        for (size_t i = 0; i < stats->num_workers; ++i) {
+            const WorkerStats* w = &stats->workers[i];
+            double secs = w->seconds > 0.0 ? w->seconds: 1e-9;
+            fprintf(out, "%s{\"rows\": %lu, \"bytes\": %lu, \"chunks\": %lu, \"seconds\": %.6f, "
+                         "\"rows_per_s\": %.1f, \"bytes_per_s\": %.1f}",
+                    i == 0 ? "": ", ", (unsigned long)w->rows, (unsigned long)w->bytes, (unsigned long)w->chunks,
+                    w->seconds, (double)w->rows / secs, (double)w->bytes / secs);
+        }
+        fprintf(out, "], \"probe_histogram\": {");
+        for (size_t i = 0; i < PROBE_HISTOGRAM_BUCKETS; ++i)
+            fprintf(out, "%s\"%s\": %lu", i == 0 ? "": ", ", BUCKET_NAMES[i], (unsigned long)stats->probe_histogram[i]);
+        fprintf(out, "}, \"table_size\": %zu, \"table_capacity\": %zu, \"load_factor\": %.4f, "
+                     "\"allocations\": %zu, \"chunk_imbalance\": %.4f}\n",
+                stats->table_size, stats->table_capacity, load_factor, stats->allocations, _imbalance(stats));
+        return;
+    }
+
+    fprintf(out, "Phase times:\n");
+    for (size_t i = 0; i < NUM_PHASES; ++i)
+        fprintf(out, "  %-10s %12.3f ms\n", PHASE_NAMES[i], stats->phase_seconds[i] * 1e3);
+    fprintf(out, "Workers:\n");
+    for (size_t i = 0; i < stats->num_workers; ++i) {
+        const WorkerStats* w = &stats->workers[i];
+        double secs = w->seconds > 0.0 ? w->seconds: 1e-9;
+        fprintf(out, "  %3zu: %12lu rows %14lu bytes %6lu chunks %10.3f ms %12.0f rows/s %8.3f GB/s\n",
+                i, (unsigned long)w->rows, (unsigned long)w->bytes, (unsigned long)w->chunks, w->seconds * 1e3,
+                (double)w->rows / secs, (double)w->bytes / secs / 1e9);
+    }
+    fprintf(out, "Chunk imbalance (busiest / mean rows): %.3f\n", _imbalance(stats));
+    fprintf(out, "Probe lengths:\n");
+    for (size_t i = 0; i < PROBE_HISTOGRAM_BUCKETS; ++i)
+        fprintf(out, "  %-6s %14lu\n", BUCKET_NAMES[i], (unsigned long)stats->probe_histogram[i]);
+    fprintf(out, "Table: %zu stations, capacity %zu, load factor %.3f\n",
+            stats->table_size, stats->table_capacity, load_factor);
+    fprintf(out, "Allocations: %zu\n", stats->allocations);
+}
+
+/// Release the per-worker counters
+void runstats_destroy(RunStats* stats) {
+    if (stats==NULL) return;
+    free(stats->workers);
+    stats->workers = NULL;
+}
@@ -0,0 +1,86 @@
+/* Optional run-time instrumentation of the analyzer.
+
+                    GNU AFFERO GENERAL PUBLIC LICENSE
+                       Version 3, 19 November 2007
+
+    Copyright (C) 2024  Debajyoti Debnath
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published
+    by the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef _RUN_STATS_H_
+#define _RUN_STATS_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+// Counters are compiled in only when ONEBRC_STATS is set to 1
+#ifndef ONEBRC_STATS
+#define ONEBRC_STATS 0
+#endif
+
+#if ONEBRC_STATS
+#define STATS(x) do { x; } while (0)
+#else
+#define STATS(x) do {} while (0)
+#endif
+
+// Buckets of the probe length histogram: 1, 2, 3, 4, 5-8, 9-16, 17-32, 33+
+#define PROBE_HISTOGRAM_BUCKETS 8
+// Every n-th row is timed to split worker time between parsing and aggregation
+#define STATS_SAMPLE_INTERVAL 64
+
+typedef enum {
+    PHASE_MAP,
+    PHASE_PARSE,
+    PHASE_AGGREGATE,
+    PHASE_MERGE,
+    PHASE_OUTPUT,
+    NUM_PHASES
+} RunPhase;
+
+// Counters of one worker thread
+typedef struct {
+    uint64_t rows;
+    uint64_t bytes;
+    uint64_t chunks;
+    double seconds;
+    uint64_t parse_cycles;
+    uint64_t aggregate_cycles;
+} WorkerStats;
+
+// Counters of one analyzer run
+typedef struct {
+    double phase_seconds[NUM_PHASES];
+    WorkerStats* workers;
+    size_t num_workers;
+    uint64_t probe_histogram[PROBE_HISTOGRAM_BUCKETS];
+    size_t table_size;
+    size_t table_capacity;
+    size_t allocations;
+} RunStats;
+
+void runstats_init(RunStats* stats, size_t num_workers);
+void runstats_split_parse_aggregate(RunStats* stats, double seconds);
+void runstats_print(const RunStats* stats, FILE* out, bool json);
+void runstats_destroy(RunStats* stats);
+double stats_now(void);
+uint64_t stats_cycles(void);
+size_t probe_bucket(size_t probes);
+
+#endif // _RUN_STATS_H_
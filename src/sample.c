@@ -0,0 +1,307 @@
+/* Approximate analysis of a stratified sample of line-aligned blocks.
+
+                    GNU AFFERO GENERAL PUBLIC LICENSE
+                       Version 3, 19 November 2007
+
+    Copyright (C) 2024  Debajyoti Debnath
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published
+    by the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+
+#include "sample.h"
+#include "gzip_input.h"
+#include "trace.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <yatpool.h>
+
+// Line-aligned byte range of the input read by the sample
+typedef struct {
+    size_t begin;
+    size_t end;
+} _SampleBlock;
+
+// State shared by the workers of one sample_buffer call
+typedef struct {
+    const char* data;
+    _SampleBlock* blocks;
+    size_t num_blocks;
+    size_t next_block;
+    Aggregator* aggregators;
+    PerfReport* perf;
+} _SampleJob;
+
+typedef struct {
+    _SampleJob* job;
+    size_t worker;
+} _SampleArg;
+
+void _samplearg_init(_SampleArg** arg, _SampleJob* job, size_t worker) {
+    if (arg==NULL || job==NULL) return;
+    *arg = (_SampleArg*)malloc(sizeof(_SampleArg));
+    (*arg)->job = job;
+    (*arg)->worker = worker;
+}
+
+void _samplearg_destroy(void* arg) {
+    if (arg==NULL) return;
+    _SampleArg* _arg = (_SampleArg*)arg;
+    free(_arg);
+}
+
+/// Start of the first line at or after offset
+static size_t _align_line(const char* data, size_t size, size_t offset) {
+    if (offset == 0 || offset >= size || data[offset - 1] == '\n')
+        return offset < size ? offset: size;
+    const char* newline = (const char*)memchr(data + offset, '\n', size - offset);
+    return newline == NULL ? size: (size_t)(newline + 1 - data);
+}
+
+/// Uniform offset below range, which may exceed RAND_MAX
+static size_t _random_offset(unsigned int* seed, size_t range) {
+    uint64_t bits = (uint64_t)rand_r(seed) << 31 ^ (uint64_t)rand_r(seed);
+    return (size_t)(bits % range);
+}
+
+/// Split the input into num_blocks strata of equal size and pick a block
+/// of block_size bytes, at most the stratum, at a random offset in each,
+/// widened to whole lines.
+/// A block never reaches past its stratum by more than the line it ends
+/// in, so blocks never overlap. Returns the number of non-empty blocks.
+static size_t _plan_blocks(const char* data, size_t size, size_t num_blocks, size_t block_size,
+                           unsigned int seed, _SampleBlock* blocks) {
+    size_t stratum = size / num_blocks;
+    size_t n = 0;
+    for (size_t k = 0; k < num_blocks; ++k) {
+        size_t first = k * stratum;
+        size_t span = k + 1 == num_blocks ? size - first: stratum;
+        // The last stratum also holds the remainder of the division
+        size_t length = span == stratum ? block_size: (size_t)((double)span * (double)block_size / (double)stratum);
+        length = length < span ? length: span;
+        size_t start = first + (span > length ? _random_offset(&seed, span - length + 1): 0);
+        size_t begin = _align_line(data, size, start);
+        size_t end = _align_line(data, size, start + length);
+        if (begin >= end) continue;
+        blocks[n].begin = begin;
+        blocks[n++].end = end;
+    }
+    return n;
+}
+
+/// Function for threadpool to aggregate sampled blocks into the worker's
+/// aggregator until none are left
+void* _aggregate_samples(void* arg) {
+    _SampleArg* samplearg = (_SampleArg*)arg;
+    _SampleJob* job = samplearg->job;
+    Aggregator* aggregator = &job->aggregators[samplearg->worker];
+    PerfCounters counters;
+    bool count = perfreport_worker_start(job->perf, samplearg->worker, &counters);
+
+    size_t block;
+    while ((block = __atomic_fetch_add(&job->next_block, 1, __ATOMIC_RELAXED)) < job->num_blocks) {
+        const char* begin = job->data + job->blocks[block].begin;
+        const char* end = job->data + job->blocks[block].end;
+        aggregator_consume(aggregator, begin, end, true);
+    }
+    if (count)
+        perfreport_worker_stop(job->perf, samplearg->worker, &counters, aggregator->rows);
+    return NULL;
+}
+
+/// Aggregate about fraction of a buffer of measurements, read as one
+/// line-aligned block from each of at least SAMPLE_MIN_BLOCKS strata of
+/// the input, and summarize what the sample stands for. Every station
+/// keeps a histogram, from which the confidence intervals of the means
+/// are computed.
+void sample_buffer(const char* data, size_t size, double fraction, unsigned int seed,
+                   const AnalyzerConfig* config, Aggregator* result, SampleSummary* summary) {
+    if (config==NULL || result==NULL || summary==NULL || (data==NULL && size>0)) {
+        perror("Error: Null pointer provided as argument.");
+        abort();
+    }
+    if (!(fraction > 0.0 && fraction <= 1.0)) {
+        perror("Error: sampled fraction must be greater than 0 and at most 1.");
+        abort();
+    }
+    if (config->num_threads==0) {
+        perror("Error: num_threads cannot be zero.");
+        abort();
+    }
+
+    // Blocks of SAMPLE_BLOCK_SIZE, made smaller to have SAMPLE_MIN_BLOCKS
+    // strata as long as they stay above SAMPLE_MIN_BLOCK_SIZE
+    size_t target = (size_t)(fraction * (double)size);
+    target = target > 0 ? target: 1;
+    size_t num_blocks = target / SAMPLE_BLOCK_SIZE;
+    num_blocks = num_blocks > SAMPLE_MIN_BLOCKS ? num_blocks: SAMPLE_MIN_BLOCKS;
+    size_t block_size = target / num_blocks;
+    if (block_size < SAMPLE_MIN_BLOCK_SIZE) {
+        block_size = SAMPLE_MIN_BLOCK_SIZE;
+        num_blocks = target / block_size;
+    }
+    if (num_blocks == 0) {
+        block_size = target;
+        num_blocks = 1;
+    }
+
+    _SampleJob job;
+    memset(&job, 0x0, sizeof(_SampleJob));
+    job.data = data;
+    job.perf = config->perf;
+    job.blocks = (_SampleBlock*)malloc(num_blocks * sizeof(_SampleBlock));
+    job.num_blocks = size > 0 ? _plan_blocks(data, size, num_blocks, block_size, seed, job.blocks): 0;
+
+    // Blocks are read ahead all at once, and nothing around them
+    long page_size = sysconf(_SC_PAGESIZE);
+    for (size_t i = 0; i < job.num_blocks && page_size > 0; ++i) {
+        size_t begin = job.blocks[i].begin / (size_t)page_size * (size_t)page_size;
+        madvise((void*)(data + begin), job.blocks[i].end - begin, MADV_WILLNEED);
+    }
+
+    size_t num_threads = config->num_threads < job.num_blocks ? config->num_threads: job.num_blocks;
+    num_threads = num_threads > 0 ? num_threads: 1;
+    job.aggregators = (Aggregator*)calloc(num_threads, sizeof(Aggregator));
+    for (size_t i = 0; i < num_threads; ++i) {
+        aggregator_init(&job.aggregators[i], config->catalog);
+        job.aggregators[i].histograms = true;
+        job.aggregators[i].batch_width = config->batch_width;
+    }
+
+    YATPool* pool;
+    yatpool_init(&pool, num_threads, num_threads);
+    for (size_t i = 0; i < num_threads; ++i) {
+        Task* task;
+        _SampleArg* arg;
+        _samplearg_init(&arg, &job, i);
+
+        trace_task_init(&task, "aggregate_samples", &_aggregate_samples, arg, &_samplearg_destroy);
+        yatpool_put(pool, task);
+    }
+    yatpool_wait(pool);
+    yatpool_destroy(pool);
+
+    PerfCounters counters;
+    bool count = config->perf != NULL && perf_counters_open(&counters, false);
+    if (count)
+        perf_counters_start(&counters);
+    uint64_t trace_merge = trace_begin();
+    aggregator_merge_parallel(job.aggregators, num_threads, num_threads);
+    trace_end("merge", trace_merge);
+    if (count) {
+        perf_counters_stop(&counters, perfreport_phase(config->perf, "merge"));
+        perf_counters_close(&counters);
+    }
+    *result = job.aggregators[0];
+    if (config->perf != NULL)
+        config->perf->rows = result->rows;
+
+    memset(summary, 0x0, sizeof(SampleSummary));
+    summary->input_size = size;
+    summary->num_blocks = job.num_blocks;
+    summary->rows = result->rows;
+    summary->bytes = result->bytes;
+    if (result->bytes > 0)
+        summary->estimated_rows = (uint64_t)((double)result->rows * (double)size / (double)result->bytes + 0.5);
+    summary->num_stations = aggregator_num_stations(result);
+    for (size_t i = 0; result->catalog != NULL && i < result->catalog->num_stations; ++i) {
+        summary->singletons += result->catalog_stats[i].count == 1;
+        summary->doubletons += result->catalog_stats[i].count == 2;
+    }
+    for (size_t i = 0; i < result->table.capacity; ++i) {
+        if (result->table.entries[i].key == NULL) continue;
+        summary->singletons += result->table.entries[i].count == 1;
+        summary->doubletons += result->table.entries[i].count == 2;
+    }
+    // Bias-corrected Chao1 estimate of the stations of the whole input
+    double f1 = (double)summary->singletons, f2 = (double)summary->doubletons;
+    summary->estimated_stations = (double)summary->num_stations + f1 * (f1 - 1.0) / (2.0 * (f2 + 1.0));
+
+    free(job.aggregators);
+    free(job.blocks);
+}
+
+/// Sample a plain measurements file with sample_buffer. Returns false,
+/// leaving result untouched, for input that cannot be sampled such as
+/// pipes and compressed files.
+bool sample_file(const char* path, double fraction, unsigned int seed,
+                 const AnalyzerConfig* config, Aggregator* result, SampleSummary* summary) {
+    if (path==NULL) {
+        perror("Error: Null pointer provided as argument.");
+        abort();
+    }
+    int fd = strcmp(path, "-") == 0 ? -1: open(path, O_RDONLY);
+    if (fd == -1) return false;
+    struct stat st;
+    if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode)) {
+        close(fd);
+        return false;
+    }
+    size_t size = (size_t)st.st_size;
+    if (size == 0) {
+        close(fd);
+        sample_buffer(NULL, 0, fraction, seed, config, result, summary);
+        return true;
+    }
+    char* data = (char*)mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) return false;
+
+    // Only the sampled blocks are read, so readahead would be wasted
+    bool sampled = !gzip_is_compressed(data, size);
+    if (sampled) {
+        madvise(data, size, MADV_RANDOM);
+        sample_buffer(data, size, fraction, seed, config, result, summary);
+    }
+    munmap(data, size);
+    return sampled;
+}
+
+static double _mib(uint64_t bytes) {
+    return (double)bytes / (double)(1 << 20);
+}
+
+/// Print what a sample covered, how many stations the input is estimated
+/// to hold and, with a catalog, the catalog stations it did not see
+void samplesummary_print(const SampleSummary* summary, const Aggregator* aggregator, FILE* out) {
+    if (summary==NULL || aggregator==NULL || out==NULL) return;
+    double percent = summary->input_size > 0 ? 100.0 * (double)summary->bytes / (double)summary->input_size: 0.0;
+    fprintf(out, "Sampled %.1f MiB of %.1f MiB (%.2f%%) in %zu blocks: %lu rows of about %lu\n",
+            _mib(summary->bytes), _mib(summary->input_size), percent, summary->num_blocks,
+            (unsigned long)summary->rows, (unsigned long)summary->estimated_rows);
+    fprintf(out, "Stations: %zu sampled, %zu of them only once, of an estimated %.0f or more\n",
+            summary->num_stations, summary->singletons, summary->estimated_stations);
+
+    if (aggregator->catalog != NULL) {
+        size_t missing = 0;
+        for (uint32_t id = 0; id < aggregator->catalog->num_stations; ++id) {
+            if (aggregator->catalog_stats[id].count > 0) continue;
+            if (missing < SAMPLE_MAX_LISTED) {
+                String name = catalog_name(aggregator->catalog, id);
+                fprintf(out, "%s%.*s", missing == 0 ? "Catalog stations not sampled: ": ", ", (int)name.length, name.data);
+            }
+            missing++;
+        }
+        if (missing > SAMPLE_MAX_LISTED)
+            fprintf(out, " and %zu more", missing - SAMPLE_MAX_LISTED);
+        if (missing > 0)
+            fputc('\n', out);
+    } else if (summary->singletons > 0) {
+        fprintf(out, "Stations sampled only once suggest that others were not sampled at all\n");
+    }
+    fprintf(out, "Means are followed by their 95%% confidence interval; min and max are those sampled\n");
+}
@@ -0,0 +1,70 @@
+/* Approximate analysis of a stratified sample of line-aligned blocks.
+
+                    GNU AFFERO GENERAL PUBLIC LICENSE
+                       Version 3, 19 November 2007
+
+    Copyright (C) 2024  Debajyoti Debnath
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published
+    by the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+
+#ifndef _SAMPLE_H_
+#define _SAMPLE_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "analyzer.h"
+
+// Bytes read per sampled block, unless the sample is too small for
+// SAMPLE_MIN_BLOCKS of them
+#define SAMPLE_BLOCK_SIZE (1 << 20)
+// Fewest strata the input is divided into, each contributing one block,
+// and the smallest block they may be given
+#define SAMPLE_MIN_BLOCKS 64
+#define SAMPLE_MIN_BLOCK_SIZE (4 << 10)
+// Seed of the block offsets, so that repeated runs read the same blocks
+#define SAMPLE_DEFAULT_SEED 1
+// z-score of the two-sided 95% confidence interval of a mean
+#define SAMPLE_Z95 1.959964
+// Most unsampled catalog stations listed by name
+#define SAMPLE_MAX_LISTED 32
+
+// What a sample covered and how much of the input it stands for
+typedef struct {
+    size_t input_size;
+    size_t num_blocks;
+    uint64_t rows;
+    uint64_t bytes;
+    // Rows of the whole input, extrapolated from the bytes per sampled row
+    uint64_t estimated_rows;
+    size_t num_stations;
+    // Stations sampled exactly once and exactly twice, from which the
+    // number of stations not sampled at all is estimated
+    size_t singletons;
+    size_t doubletons;
+    double estimated_stations;
+} SampleSummary;
+
+void sample_buffer(const char* data, size_t size, double fraction, unsigned int seed,
+                   const AnalyzerConfig* config, Aggregator* result, SampleSummary* summary);
+bool sample_file(const char* path, double fraction, unsigned int seed,
+                 const AnalyzerConfig* config, Aggregator* result, SampleSummary* summary);
+void samplesummary_print(const SampleSummary* summary, const Aggregator* aggregator, FILE* out);
+
+#endif // _SAMPLE_H_
@@ -0,0 +1,347 @@
+/* Resident analyzer serving aggregates over a Unix domain socket.
+
+                    GNU AFFERO GENERAL PUBLIC LICENSE
+                       Version 3, 19 November 2007
+
+    Copyright (C) 2024  Debajyoti Debnath
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published
+    by the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include "server.h"
+#include "output.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+typedef struct {
+    AnalyzerServer* server;
+    int fd;
+} _ClientArg;
+
+void _clientarg_init(_ClientArg** arg, AnalyzerServer* server, int fd) {
+    if (arg==NULL || server==NULL) return;
+    *arg = (_ClientArg*)malloc(sizeof(_ClientArg));
+    (*arg)->server = server;
+    (*arg)->fd = fd;
+}
+
+void _clientarg_destroy(void* arg) {
+    if (arg==NULL) return;
+    _ClientArg* _arg = (_ClientArg*)arg;
+    free(_arg);
+}
+
+/// Initialize a server without files. Files are analyzed with config.
+void server_init(AnalyzerServer* server, const AnalyzerConfig* config) {
+    if (server==NULL || config==NULL) {
+        perror("Error: Null pointer provided as argument.");
+        abort();
+    }
+    memset(server, 0x0, sizeof(AnalyzerServer));
+    server->config = *config;
+    pthread_mutex_init(&server->lock, NULL);
+}
+
+/// Aggregate the complete lines a file gained since the last refresh. The
+/// caller holds the file's lock exclusively.
+static bool _server_refresh_locked(AnalyzerServer* server, ServedFile* file) {
+    struct stat st;
+    if (fstat(file->fd, &st) == -1)
+        return false;
+    size_t size = (size_t)st.st_size;
+
+    // A file that shrank was rewritten, so it is analyzed from scratch
+    if (size < file->consumed) {
+        aggregator_destroy(&file->aggregator);
+        aggregator_init(&file->aggregator, server->config.catalog);
+        file->consumed = 0;
+    }
+    if (size <= file->consumed)
+        return true;
+
+    if (size > file->mapped_size) {
+        if (file->data != NULL)
+            munmap(file->data, file->mapped_size);
+        file->data = (char*)mmap(NULL, size, PROT_READ, MAP_SHARED, file->fd, 0);
+        if (file->data == MAP_FAILED) {
+            file->data = NULL;
+            file->mapped_size = 0;
+            return false;
+        }
+        file->mapped_size = size;
+    }
+
+    // A trailing line still being written is left for the next refresh
+    const char* begin = file->data + file->consumed;
+    const char* newline = (const char*)memrchr(begin, '\n', size - file->consumed);
+    if (newline == NULL)
+        return true;
+    size_t length = (size_t)(newline + 1 - begin);
+
+    Aggregator delta;
+    analyze_buffer(begin, length, &server->config, &delta, NULL);
+    if (file->consumed == 0) {
+        aggregator_destroy(&file->aggregator);
+        file->aggregator = delta;
+    } else {
+        aggregator_merge(&file->aggregator, &delta);
+        aggregator_destroy(&delta);
+    }
+    file->consumed += length;
+    return true;
+}
+
+/// Aggregate whatever a registered file gained since it was last analyzed
+bool server_refresh(AnalyzerServer* server, ServedFile* file) {
+    if (server==NULL || file==NULL) return false;
+    pthread_rwlock_wrlock(&file->lock);
+    bool refreshed = _server_refresh_locked(server, file);
+    pthread_rwlock_unlock(&file->lock);
+    return refreshed;
+}
+
+/// Look up a registered file, registering and analyzing it if it is new.
+/// Returns NULL if the file cannot be opened.
+ServedFile* server_register(AnalyzerServer* server, const char* path) {
+    if (server==NULL || path==NULL) return NULL;
+    pthread_mutex_lock(&server->lock);
+    for (size_t i = 0; i < server->num_files; ++i) {
+        if (strcmp(server->files[i]->path, path) == 0) {
+            ServedFile* file = server->files[i];
+            pthread_mutex_unlock(&server->lock);
+            return file;
+        }
+    }
+
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        pthread_mutex_unlock(&server->lock);
+        return NULL;
+    }
+    ServedFile* file = (ServedFile*)calloc(1, sizeof(ServedFile));
+    strncpy(file->path, path, sizeof(file->path) - 1);
+    file->fd = fd;
+    aggregator_init(&file->aggregator, server->config.catalog);
+    pthread_rwlock_init(&file->lock, NULL);
+
+    // Held until the first analysis is done, so no query sees it empty
+    pthread_rwlock_wrlock(&file->lock);
+    if (server->num_files == server->capacity) {
+        server->capacity = server->capacity == 0 ? 8: 2 * server->capacity;
+        server->files = (ServedFile**)realloc(server->files, server->capacity * sizeof(ServedFile*));
+    }
+    server->files[server->num_files++] = file;
+    pthread_mutex_unlock(&server->lock);
+
+    _server_refresh_locked(server, file);
+    pthread_rwlock_unlock(&file->lock);
+    return file;
+}
+
+/// Split the first space-separated word off a request
+static char* _next_word(char** rest) {
+    char* word = *rest;
+    while (*word == ' ')
+        word++;
+    char* end = word;
+    while (*end != '\0' && *end != ' ')
+        end++;
+    *rest = *end == '\0' ? end: end + 1;
+    *end = '\0';
+    return word;
+}
+
+/// Answer one request line. Every answer is a line per station followed by
+/// a status line, "OK <rows> <stations>" or "ERROR <message>":
+///   REGISTER <path>                    register and analyze a file
+///   ALL <path>                         every station of a file
+///   STATION <path> <name>              one station
+///   STATIONS <path> <name>;<name>;...  several stations, unknown ones left out
+///   FILES                              "<path> <rows> <stations>" per file
+void server_handle_request(AnalyzerServer* server, char* request, FILE* out) {
+    if (server==NULL || request==NULL || out==NULL) return;
+    char* rest = request;
+    char* command = _next_word(&rest);
+
+    if (strcmp(command, "FILES") == 0) {
+        pthread_mutex_lock(&server->lock);
+        size_t num_files = server->num_files;
+        for (size_t i = 0; i < num_files; ++i) {
+            ServedFile* file = server->files[i];
+            pthread_rwlock_rdlock(&file->lock);
+            fprintf(out, "%s %zu %zu\n", file->path, (size_t)file->aggregator.rows,
+                    aggregator_num_stations(&file->aggregator));
+            pthread_rwlock_unlock(&file->lock);
+        }
+        pthread_mutex_unlock(&server->lock);
+        fprintf(out, "OK %zu %zu\n", num_files, num_files);
+        return;
+    }
+
+    bool all = strcmp(command, "ALL") == 0;
+    bool one = strcmp(command, "STATION") == 0;
+    bool several = strcmp(command, "STATIONS") == 0;
+    if (!all && !one && !several && strcmp(command, "REGISTER") != 0) {
+        fprintf(out, "ERROR unknown command '%s'\n", command);
+        return;
+    }
+    char* path = one || several ? _next_word(&rest): rest;
+    if (*path == '\0') {
+        fprintf(out, "ERROR missing path\n");
+        return;
+    }
+    ServedFile* file = server_register(server, path);
+    if (file == NULL) {
+        fprintf(out, "ERROR cannot open %s: %s\n", path, strerror(errno));
+        return;
+    }
+    if (!server_refresh(server, file)) {
+        fprintf(out, "ERROR cannot refresh %s\n", path);
+        return;
+    }
+
+    pthread_rwlock_rdlock(&file->lock);
+    const Aggregator* aggregator = &file->aggregator;
+    size_t printed = 0;
+    if (all) {
+        OutputConfig output;
+        outputconfig_init(&output);
+        output.summary = false;
+        output.num_threads = server->config.num_threads;
+        output_write(aggregator, &output, out);
+        printed = aggregator_num_stations(aggregator);
+    } else if (one) {
+        printed = aggregator_print_station(aggregator, rest, strlen(rest), out);
+    } else if (several) {
+        char* name = rest;
+        while (*name != '\0') {
+            char* end = strchr(name, ';');
+            size_t length = end == NULL ? strlen(name): (size_t)(end - name);
+            printed += aggregator_print_station(aggregator, name, length, out);
+            name = end == NULL ? name + length: end + 1;
+        }
+    } else {
+        printed = aggregator_num_stations(aggregator);
+    }
+    size_t rows = (size_t)aggregator->rows;
+    pthread_rwlock_unlock(&file->lock);
+
+    if (one && printed == 0)
+        fprintf(out, "ERROR unknown station '%s'\n", rest);
+    else
+        fprintf(out, "OK %zu %zu\n", rows, printed);
+}
+
+/// Thread serving one client until it disconnects
+void* _serve_client(void* arg) {
+    _ClientArg* clientarg = (_ClientArg*)arg;
+    int out_fd = dup(clientarg->fd);
+    FILE* in = fdopen(clientarg->fd, "r");
+    FILE* out = out_fd == -1 ? NULL: fdopen(out_fd, "w");
+    char* request = (char*)malloc(SERVER_MAX_REQUEST);
+
+    while (in != NULL && out != NULL && fgets(request, SERVER_MAX_REQUEST, in) != NULL) {
+        size_t length = strlen(request);
+        while (length > 0 && (request[length - 1] == '\n' || request[length - 1] == '\r'))
+            request[--length] = '\0';
+        if (length == 0) continue;
+        server_handle_request(clientarg->server, request, out);
+        if (fflush(out) != 0) break;
+    }
+
+    free(request);
+    if (in != NULL) fclose(in); else close(clientarg->fd);
+    if (out != NULL) fclose(out); else if (out_fd != -1) close(out_fd);
+    _clientarg_destroy(clientarg);
+    return NULL;
+}
+
+/// Listen on socket_path and serve every client on its own thread. Only
+/// returns if the socket cannot be set up.
+void server_run(AnalyzerServer* server, const char* socket_path) {
+    if (server==NULL || socket_path==NULL) {
+        perror("Error: Null pointer provided as argument.");
+        abort();
+    }
+    struct sockaddr_un address;
+    memset(&address, 0x0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (strlen(socket_path) >= sizeof(address.sun_path)) {
+        fprintf(stderr, "Error: socket path %s is too long.\n", socket_path);
+        return;
+    }
+    strncpy(address.sun_path, socket_path, sizeof(address.sun_path) - 1);
+
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener == -1) {
+        perror("Error: could not create socket.");
+        return;
+    }
+    unlink(socket_path);
+    if (bind(listener, (struct sockaddr*)&address, sizeof(address)) == -1 || listen(listener, SERVER_BACKLOG) == -1) {
+        fprintf(stderr, "Error: could not listen on %s: %s\n", socket_path, strerror(errno));
+        close(listener);
+        return;
+    }
+
+    // Clients hanging up mid-answer must not kill the server
+    signal(SIGPIPE, SIG_IGN);
+    while (true) {
+        int fd = accept(listener, NULL, NULL);
+        if (fd == -1) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            perror("Error: accept failed.");
+            break;
+        }
+        _ClientArg* arg;
+        _clientarg_init(&arg, server, fd);
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, &_serve_client, arg) != 0) {
+            close(fd);
+            _clientarg_destroy(arg);
+            continue;
+        }
+        pthread_detach(thread);
+    }
+    close(listener);
+    unlink(socket_path);
+}
+
+/// Unmap every registered file and release its aggregates
+void server_destroy(AnalyzerServer* server) {
+    if (server==NULL) return;
+    for (size_t i = 0; i < server->num_files; ++i) {
+        ServedFile* file = server->files[i];
+        if (file->data != NULL)
+            munmap(file->data, file->mapped_size);
+        close(file->fd);
+        aggregator_destroy(&file->aggregator);
+        pthread_rwlock_destroy(&file->lock);
+        free(file);
+    }
+    free(server->files);
+    pthread_mutex_destroy(&server->lock);
+    memset(server, 0x0, sizeof(AnalyzerServer));
+}
@@ -0,0 +1,69 @@
+/* Resident analyzer serving aggregates over a Unix domain socket.
+
+                    GNU AFFERO GENERAL PUBLIC LICENSE
+                       Version 3, 19 November 2007
+
+    Copyright (C) 2024  Debajyoti Debnath
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published
+    by the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+
+
+#ifndef _SERVER_H_
+#define _SERVER_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <pthread.h>
+#include "analyzer.h"
+
+// Longest request line accepted from a client
+#define SERVER_MAX_REQUEST (64 * 1024)
+// Connections waiting to be accepted
+#define SERVER_BACKLOG 64
+
+// A measurements file kept mapped with the aggregates of its complete
+// lines. Queries hold the lock shared; refreshing holds it exclusively.
+typedef struct {
+    char path[1024];
+    int fd;
+    char* data;
+    size_t mapped_size;
+    size_t consumed;
+    Aggregator aggregator;
+    pthread_rwlock_t lock;
+} ServedFile;
+
+// Registered files and the configuration they are analyzed with
+typedef struct {
+    AnalyzerConfig config;
+    ServedFile** files;
+    size_t num_files;
+    size_t capacity;
+    pthread_mutex_t lock;
+} AnalyzerServer;
+
+void server_init(AnalyzerServer* server, const AnalyzerConfig* config);
+ServedFile* server_register(AnalyzerServer* server, const char* path);
+bool server_refresh(AnalyzerServer* server, ServedFile* file);
+void server_handle_request(AnalyzerServer* server, char* request, FILE* out);
+void server_run(AnalyzerServer* server, const char* socket_path);
+void server_destroy(AnalyzerServer* server);
+
+#endif // _SERVER_H_
@@ -0,0 +1,154 @@
+/* Concurrent open addressing table shared by all analyzer workers.
+
+                    GNU AFFERO GENERAL PUBLIC LICENSE
+                       Version 3, 19 November 2007
+
+    Copyright (C) 2024  Debajyoti Debnath
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published
+    by the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+
+#include "shared_table.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CPU_RELAX() _mm_pause()
+#else
+#define CPU_RELAX() do {} while (0)
+#endif
+
+// Key of a slot that has been claimed but not yet published
+static const char SHARED_CLAIMED[1] = {'\0'};
+
+/// Initialize an empty table with capacity slots, rounded up to a power of
+/// two, for num_workers workers
+void shared_table_init(SharedStatsTable* table, size_t capacity, size_t num_workers) {
+    if (table==NULL) {
+        perror("Error: Null pointer provided as argument.");
+        abort();
+    }
+    size_t rounded = 16;
+    while (rounded < capacity)
+        rounded *= 2;
+
+    memset(table, 0x0, sizeof(SharedStatsTable));
+    table->capacity = rounded;
+    table->num_workers = num_workers;
+    table->entries = (StationStats*)calloc(rounded, sizeof(StationStats));
+    table->keys = (KeyBlock**)calloc(num_workers, sizeof(KeyBlock*));
+    if (table->entries == NULL || table->keys == NULL) {
+        perror("Error: could not allocate shared stats table.");
+        abort();
+    }
+}
+
+/// Copy a key into the arena of one worker
+static const char* _shared_table_copy_key(SharedStatsTable* table, size_t worker, const char* key, size_t length) {
+    KeyBlock* block = table->keys[worker];
+    if (block == NULL || block->used + length + 1 > block->capacity) {
+        size_t capacity = length + 1 > KEY_ARENA_BLOCKSIZE ? length + 1: KEY_ARENA_BLOCKSIZE;
+        block = (KeyBlock*)malloc(sizeof(KeyBlock) + capacity);
+        block->next = table->keys[worker];
+        block->used = 0;
+        block->capacity = capacity;
+        table->keys[worker] = block;
+    }
+    char* copy = block->data + block->used;
+    memcpy(copy, key, length);
+    copy[length] = '\0';
+    block->used += length + 1;
+    return copy;
+}
+
+/// Look up a station, inserting it with no measurements if it is new.
+/// Safe to call from every worker at once; worker selects the key arena.
+StationStats* shared_table_find_or_insert(SharedStatsTable* table, const char* key, size_t length, uint64_t hash, size_t worker) {
+    size_t mask = table->capacity - 1;
+    size_t slot = hash & mask;
+    while (true) {
+        StationStats* entry = &table->entries[slot];
+        const char* entry_key = __atomic_load_n(&entry->key, __ATOMIC_ACQUIRE);
+
+        if (entry_key == NULL) {
+            const char* expected = NULL;
+            if (__atomic_compare_exchange_n(&entry->key, &expected, SHARED_CLAIMED, false,
+                                            __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+                size_t size = __atomic_add_fetch(&table->size, 1, __ATOMIC_RELAXED);
+                if (100 * size > SHARED_TABLE_MAX_LOAD * table->capacity) {
+                    fprintf(stderr, "Error: shared stats table with %zu slots is full, raise its capacity.\n", table->capacity);
+                    exit(EXIT_FAILURE);
+                }
+                entry->hash = hash;
+                entry->length = (uint32_t)length;
+                entry->min = INT32_MAX;
+                entry->max = INT32_MIN;
+                entry->sum = 0;
+                entry->count = 0;
+                __atomic_store_n(&entry->key, _shared_table_copy_key(table, worker, key, length), __ATOMIC_RELEASE);
+                return entry;
+            }
+            entry_key = expected;
+        }
+
+        // Wait for a concurrent insertion into this slot to be published
+        while (entry_key == SHARED_CLAIMED) {
+            CPU_RELAX();
+            entry_key = __atomic_load_n(&entry->key, __ATOMIC_ACQUIRE);
+        }
+
+        if (entry->hash == hash && entry->length == length && memcmp(entry_key, key, length) == 0)
+            return entry;
+        slot = (slot + 1) & mask;
+    }
+}
+
+/// Add one measurement in hundredths of a degree with atomic updates.
+/// min and max are only written when the value extends them.
+void station_stats_add_atomic(StationStats* stats, int32_t value) {
+    int32_t current = __atomic_load_n(&stats->min, __ATOMIC_RELAXED);
+    while (value < current &&
+           !__atomic_compare_exchange_n(&stats->min, &current, value, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+    current = __atomic_load_n(&stats->max, __ATOMIC_RELAXED);
+    while (value > current &&
+           !__atomic_compare_exchange_n(&stats->max, &current, value, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+    __atomic_fetch_add(&stats->sum, (int64_t)value, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&stats->count, 1, __ATOMIC_RELAXED);
+}
+
+/// Fold every station of a table no longer being updated into dest
+void shared_table_collect(const SharedStatsTable* table, StatsTable* dest) {
+    if (table==NULL || dest==NULL) return;
+    for (size_t i = 0; i < table->capacity; ++i) {
+        const StationStats* entry = &table->entries[i];
+        if (entry->key == NULL || entry->count == 0) continue;
+        station_stats_merge(stats_table_find_or_insert(dest, entry->key, entry->length, entry->hash), entry);
+    }
+}
+
+/// Release the entries and keys of a table
+void shared_table_destroy(SharedStatsTable* table) {
+    if (table==NULL) return;
+    free(table->entries);
+    for (size_t i = 0; i < table->num_workers; ++i) {
+        while (table->keys[i] != NULL) {
+            KeyBlock* next = table->keys[i]->next;
+            free(table->keys[i]);
+            table->keys[i] = next;
+        }
+    }
+    free(table->keys);
+    memset(table, 0x0, sizeof(SharedStatsTable));
+}
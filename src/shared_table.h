@@ -0,0 +1,59 @@
+/* Concurrent open addressing table shared by all analyzer workers.
+
+                    GNU AFFERO GENERAL PUBLIC LICENSE
+                       Version 3, 19 November 2007
+
+    Copyright (C) 2024  Debajyoti Debnath
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published
+    by the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+
+#ifndef _SHARED_TABLE_H_
+#define _SHARED_TABLE_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "stats_table.h"
+
+// Default number of slots of a shared table
+#define SHARED_TABLE_DEFAULT_CAPACITY (1 << 22)
+
+// Largest fraction of the slots that may be in use, in percent
+#define SHARED_TABLE_MAX_LOAD 90
+
+// One fixed-capacity table of StationStats updated by every worker without
+// locks. A slot is claimed by swapping its key from NULL to a placeholder;
+// the claiming worker then fills the slot and publishes the copied key.
+// Measurements are added with atomic instructions. Each worker copies the
+// keys it inserts into its own arena.
+typedef struct {
+    StationStats* entries;
+    size_t capacity;
+    size_t size;
+    KeyBlock** keys;
+    size_t num_workers;
+} SharedStatsTable;
+
+void shared_table_init(SharedStatsTable* table, size_t capacity, size_t num_workers);
+StationStats* shared_table_find_or_insert(SharedStatsTable* table, const char* key, size_t length, uint64_t hash, size_t worker);
+void station_stats_add_atomic(StationStats* stats, int32_t value);
+void shared_table_collect(const SharedStatsTable* table, StatsTable* dest);
+void shared_table_destroy(SharedStatsTable* table);
+
+#endif // _SHARED_TABLE_H_
@@ -0,0 +1,488 @@
+/* Spilling of partial aggregates to disk under a memory budget.
+
+                    GNU AFFERO GENERAL PUBLIC LICENSE
+                       Version 3, 19 November 2007
+
+    Copyright (C) 2024  Debajyoti Debnath
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published
+    by the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+
+#include "spill.h"
+#include "trace.h"
+#include <errno.h>
+#include <unistd.h>
+#include <yatpool.h>
+
+// Partition of a hash, from its high bits like the partitioned mode
+#define SPILL_PARTITION(hash) ((size_t)((hash) >> 58))
+
+// Header of a spilled station, followed by its name
+typedef struct {
+    uint64_t hash;
+    int64_t sum;
+    uint64_t count;
+    int32_t min;
+    int32_t max;
+    uint32_t length;
+    uint32_t padding;
+} _SpillRecord;
+
+// Buffered reader of the records of one segment
+typedef struct {
+    SpillReader reader;
+    _SpillRecord record;
+    char* name;
+    size_t name_capacity;
+} _SegmentReader;
+
+typedef struct {
+    SpillSet* spill;
+    size_t* next_partition;
+    size_t worker;
+} _SpillMergeArg;
+
+void _spillmergearg_init(_SpillMergeArg** arg, SpillSet* spill, size_t* next_partition, size_t worker) {
+    if (arg==NULL || spill==NULL) return;
+    *arg = (_SpillMergeArg*)malloc(sizeof(_SpillMergeArg));
+    (*arg)->spill = spill;
+    (*arg)->next_partition = next_partition;
+    (*arg)->worker = worker;
+}
+
+void _spillmergearg_destroy(void* arg) {
+    if (arg==NULL) return;
+    _SpillMergeArg* _arg = (_SpillMergeArg*)arg;
+    free(_arg);
+}
+
+/// Number of stations a worker table may hold before it is spilled so that
+/// the table, its growth and the sort of a spill stay within budget bytes
+size_t spill_table_stations(size_t budget) {
+    size_t capacity = 16;
+    while (3 * capacity * sizeof(StationStats) + capacity * (SPILL_KEY_ESTIMATE + sizeof(void*)) <= budget)
+        capacity *= 2;
+    return capacity / 2;
+}
+
+/// Open an unlinked temporary file in directory
+static void _spill_file_open(SpillFile* file, const char* directory) {
+    char path[1100];
+    snprintf(path, sizeof(path), "%s/onebrc-spill-XXXXXX", directory);
+    file->fd = mkstemp(path);
+    if (file->fd == -1) {
+        fprintf(stderr, "Error: could not create a spill file in %s: %s\n", directory, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    unlink(path);
+    file->size = 0;
+    file->used = 0;
+    file->buffer = (char*)malloc(SPILL_BUFFER_SIZE);
+}
+
+/// Write out the buffer of a spill file
+void spillfile_flush(SpillFile* file) {
+    size_t written = 0;
+    while (written < file->used) {
+        ssize_t n = write(file->fd, file->buffer + written, file->used - written);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            perror("Error: could not write spill file.");
+            exit(EXIT_FAILURE);
+        }
+        written += (size_t)n;
+    }
+    file->used = 0;
+}
+
+/// Append length bytes of data to a spill file through its buffer
+void spillfile_write(SpillFile* file, const void* data, size_t length) {
+    const char* p = (const char*)data;
+    file->size += length;
+    while (length > 0) {
+        if (file->used == SPILL_BUFFER_SIZE)
+            spillfile_flush(file);
+        size_t n = SPILL_BUFFER_SIZE - file->used;
+        n = n < length ? n: length;
+        memcpy(file->buffer + file->used, p, n);
+        file->used += n;
+        p += n;
+        length -= n;
+    }
+}
+
+static void _spill_write_station(SpillFile* file, const StationStats* stats) {
+    _SpillRecord record;
+    memset(&record, 0x0, sizeof(_SpillRecord));
+    record.hash = stats->hash;
+    record.sum = stats->sum;
+    record.count = stats->count;
+    record.min = stats->min;
+    record.max = stats->max;
+    record.length = stats->length;
+    spillfile_write(file, &record, sizeof(_SpillRecord));
+    spillfile_write(file, stats->key, stats->length);
+}
+
+/// Spill order: by hash, and so by partition, then by name
+static int _compare_keys(uint64_t hash_a, const char* key_a, uint32_t length_a,
+                         uint64_t hash_b, const char* key_b, uint32_t length_b) {
+    if (hash_a != hash_b)
+        return hash_a < hash_b ? -1: 1;
+    if (length_a != length_b)
+        return length_a < length_b ? -1: 1;
+    return memcmp(key_a, key_b, length_a);
+}
+
+static int _compare_stations(const void* a, const void* b) {
+    const StationStats* x = *(const StationStats* const*)a;
+    const StationStats* y = *(const StationStats* const*)b;
+    return _compare_keys(x->hash, x->key, x->length, y->hash, y->key, y->length);
+}
+
+static void _segment_list_push(SpillSegmentList* list, SpillSegment segment) {
+    if (list->size == list->capacity) {
+        list->capacity = list->capacity == 0 ? 8: 2 * list->capacity;
+        list->segments = (SpillSegment*)realloc(list->segments, list->capacity * sizeof(SpillSegment));
+    }
+    list->segments[list->size++] = segment;
+}
+
+/// Initialize an empty spill set with one file per worker in directory
+void spillset_init(SpillSet* spill, const char* directory, size_t num_workers) {
+    if (spill==NULL || directory==NULL) {
+        perror("Error: Null pointer provided as argument.");
+        abort();
+    }
+    memset(spill, 0x0, sizeof(SpillSet));
+    spill->num_workers = num_workers;
+    spill->files = (SpillFile*)calloc(num_workers, sizeof(SpillFile));
+    for (size_t i = 0; i < num_workers; ++i)
+        _spill_file_open(&spill->files[i], directory);
+    spill->runs = (SpillSegmentList*)calloc(num_workers * SPILL_NUM_PARTITIONS, sizeof(SpillSegmentList));
+}
+
+/// Write every station of a worker's table to its file as one sorted run,
+/// split into a segment per partition, and empty the table
+void spillset_spill(SpillSet* spill, size_t worker, StatsTable* table) {
+    if (table->size == 0) return;
+    StationStats** sorted = (StationStats**)malloc(table->size * sizeof(StationStats*));
+    size_t n = 0;
+    for (size_t i = 0; i < table->capacity; ++i) {
+        if (table->entries[i].key != NULL)
+            sorted[n++] = &table->entries[i];
+    }
+    qsort(sorted, n, sizeof(StationStats*), &_compare_stations);
+
+    SpillFile* file = &spill->files[worker];
+    SpillSegmentList* runs = spill->runs + worker * SPILL_NUM_PARTITIONS;
+    size_t i = 0;
+    while (i < n) {
+        size_t partition = SPILL_PARTITION(sorted[i]->hash);
+        SpillSegment segment = {worker, file->size, 0};
+        for (; i < n && SPILL_PARTITION(sorted[i]->hash) == partition; ++i)
+            _spill_write_station(file, sorted[i]);
+        segment.size = file->size - segment.offset;
+        _segment_list_push(&runs[partition], segment);
+    }
+    free(sorted);
+    stats_table_clear(table);
+    __atomic_fetch_add(&spill->num_spills, 1, __ATOMIC_RELAXED);
+}
+
+/// Whether any worker has spilled
+bool spillset_spilled(const SpillSet* spill) {
+    return spill != NULL && __atomic_load_n(&spill->num_spills, __ATOMIC_RELAXED) > 0;
+}
+
+/// Start reading size bytes of a spill file from offset
+void spillreader_init(SpillReader* reader, const SpillFile* file, uint64_t offset, uint64_t size) {
+    reader->fd = file->fd;
+    reader->position = offset;
+    reader->end = offset + size;
+    reader->buffer = (char*)malloc(SPILL_BUFFER_SIZE);
+    reader->begin = 0;
+    reader->filled = 0;
+}
+
+/// Whether every byte of the range was read
+bool spillreader_done(const SpillReader* reader) {
+    return reader->begin == reader->filled && reader->position == reader->end;
+}
+
+/// Read the next length bytes of the range into data
+void spillreader_read(SpillReader* reader, void* data, size_t length) {
+    char* p = (char*)data;
+    while (length > 0) {
+        if (reader->begin == reader->filled) {
+            uint64_t want = reader->end - reader->position;
+            want = want < SPILL_BUFFER_SIZE ? want: SPILL_BUFFER_SIZE;
+            ssize_t n = pread(reader->fd, reader->buffer, (size_t)want, (off_t)reader->position);
+            if (n <= 0) {
+                if (n < 0 && errno == EINTR) continue;
+                perror("Error: could not read spill file.");
+                exit(EXIT_FAILURE);
+            }
+            reader->position += (uint64_t)n;
+            reader->begin = 0;
+            reader->filled = (size_t)n;
+        }
+        size_t n = reader->filled - reader->begin;
+        n = n < length ? n: length;
+        memcpy(p, reader->buffer + reader->begin, n);
+        reader->begin += n;
+        p += n;
+        length -= n;
+    }
+}
+
+void spillreader_destroy(SpillReader* reader) {
+    free(reader->buffer);
+}
+
+static void _segment_reader_init(_SegmentReader* reader, const SpillSet* spill, const SpillSegment* segment) {
+    spillreader_init(&reader->reader, &spill->files[segment->file], segment->offset, segment->size);
+    reader->name = NULL;
+    reader->name_capacity = 0;
+}
+
+/// Read the next record of a segment, or return false at its end
+static bool _segment_reader_next(_SegmentReader* reader) {
+    if (spillreader_done(&reader->reader))
+        return false;
+    spillreader_read(&reader->reader, &reader->record, sizeof(_SpillRecord));
+    if (reader->record.length > reader->name_capacity) {
+        reader->name_capacity = 2 * reader->record.length;
+        reader->name = (char*)realloc(reader->name, reader->name_capacity);
+    }
+    spillreader_read(&reader->reader, reader->name, reader->record.length);
+    return true;
+}
+
+static void _segment_reader_destroy(_SegmentReader* reader) {
+    spillreader_destroy(&reader->reader);
+    free(reader->name);
+}
+
+static bool _reader_less(const _SegmentReader* a, const _SegmentReader* b) {
+    return _compare_keys(a->record.hash, a->name, a->record.length,
+                         b->record.hash, b->name, b->record.length) < 0;
+}
+
+/// Restore the heap order below index i of a min-heap of readers
+static void _heap_sift_down(_SegmentReader** heap, size_t size, size_t i) {
+    while (true) {
+        size_t smallest = i;
+        size_t left = 2 * i + 1, right = 2 * i + 2;
+        if (left < size && _reader_less(heap[left], heap[smallest])) smallest = left;
+        if (right < size && _reader_less(heap[right], heap[smallest])) smallest = right;
+        if (smallest == i) return;
+        _SegmentReader* tmp = heap[i];
+        heap[i] = heap[smallest];
+        heap[smallest] = tmp;
+        i = smallest;
+    }
+}
+
+/// Merge sorted segments into one segment of the worker's file, with one
+/// record per station, and return it. The file is flushed, so the merged
+/// segment can be read back at once.
+static SpillSegment _merge_segments(SpillSet* spill, const SpillSegment* segments, size_t num_segments,
+                                    size_t worker, size_t* num_stations) {
+    _SegmentReader* readers = (_SegmentReader*)calloc(num_segments + 1, sizeof(_SegmentReader));
+    _SegmentReader** heap = (_SegmentReader**)calloc(num_segments + 1, sizeof(_SegmentReader*));
+    size_t size = 0;
+    for (size_t r = 0; r < num_segments; ++r) {
+        _segment_reader_init(&readers[r], spill, &segments[r]);
+        if (_segment_reader_next(&readers[r]))
+            heap[size++] = &readers[r];
+    }
+    for (size_t i = size / 2; i-- > 0;)
+        _heap_sift_down(heap, size, i);
+
+    SpillFile* file = &spill->files[worker];
+    SpillSegment merged = {worker, file->size, 0};
+    *num_stations = 0;
+    StationStats current;
+    char* name = NULL;
+    size_t name_capacity = 0;
+    while (size > 0) {
+        // The smallest record starts a station, folded with every equal one
+        _SegmentReader* top = heap[0];
+        if (top->record.length > name_capacity) {
+            name_capacity = 2 * top->record.length;
+            name = (char*)realloc(name, name_capacity);
+        }
+        memcpy(name, top->name, top->record.length);
+        memset(&current, 0x0, sizeof(StationStats));
+        current.hash = top->record.hash;
+        current.key = name;
+        current.length = top->record.length;
+        current.min = INT32_MAX;
+        current.max = INT32_MIN;
+        while (size > 0 && _compare_keys(heap[0]->record.hash, heap[0]->name, heap[0]->record.length,
+                                         current.hash, current.key, current.length) == 0) {
+            top = heap[0];
+            current.min = top->record.min < current.min ? top->record.min: current.min;
+            current.max = top->record.max > current.max ? top->record.max: current.max;
+            current.sum += top->record.sum;
+            current.count += top->record.count;
+            if (!_segment_reader_next(top))
+                heap[0] = heap[--size];
+            _heap_sift_down(heap, size, 0);
+        }
+        _spill_write_station(file, &current);
+        (*num_stations)++;
+    }
+    spillfile_flush(file);
+    merged.size = file->size - merged.offset;
+
+    for (size_t i = 0; i < num_segments; ++i)
+        _segment_reader_destroy(&readers[i]);
+    free(readers);
+    free(heap);
+    free(name);
+    return merged;
+}
+
+/// Merge every run of a partition into one segment of the worker's file.
+/// More runs than spill->max_fan_in are merged in passes, max_fan_in at a
+/// time, so that the readers of one merge stay within the budget.
+static void _merge_partition(SpillSet* spill, size_t partition, size_t worker) {
+    size_t num_segments = 0;
+    for (size_t w = 0; w < spill->num_workers; ++w)
+        num_segments += spill->runs[w * SPILL_NUM_PARTITIONS + partition].size;
+    SpillSegment* segments = (SpillSegment*)malloc((num_segments + 1) * sizeof(SpillSegment));
+    size_t r = 0;
+    for (size_t w = 0; w < spill->num_workers; ++w) {
+        const SpillSegmentList* runs = &spill->runs[w * SPILL_NUM_PARTITIONS + partition];
+        for (size_t i = 0; i < runs->size; ++i)
+            segments[r++] = runs->segments[i];
+    }
+
+    size_t num_stations;
+    while (num_segments > spill->max_fan_in) {
+        // Groups are merged into the front of the array they are read from
+        size_t n = 0;
+        for (size_t i = 0; i < num_segments; i += spill->max_fan_in) {
+            size_t group = num_segments - i < spill->max_fan_in ? num_segments - i: spill->max_fan_in;
+            segments[n++] = group == 1 ? segments[i]: _merge_segments(spill, segments + i, group, worker, &num_stations);
+        }
+        num_segments = n;
+    }
+    spill->merged[partition] = _merge_segments(spill, segments, num_segments, worker, &num_stations);
+    __atomic_fetch_add(&spill->num_stations, num_stations, __ATOMIC_RELAXED);
+    free(segments);
+}
+
+/// Function for threadpool to merge partitions until none are left
+void* _merge_partitions(void* arg) {
+    _SpillMergeArg* mergearg = (_SpillMergeArg*)arg;
+    size_t partition;
+    while ((partition = __atomic_fetch_add(mergearg->next_partition, 1, __ATOMIC_RELAXED)) < SPILL_NUM_PARTITIONS)
+        _merge_partition(mergearg->spill, partition, mergearg->worker);
+    return NULL;
+}
+
+/// Merge the runs of every partition with up to num_threads threads, each
+/// writing the partitions it merges to its own file. Every run is sorted,
+/// so merging holds one buffer per run rather than a table of stations,
+/// and the runs merged at once are capped so that the buffers of all
+/// threads fit in budget bytes, or not capped if budget is 0.
+void spillset_merge(SpillSet* spill, size_t num_threads, size_t budget) {
+    if (spill==NULL) return;
+    for (size_t i = 0; i < spill->num_workers; ++i)
+        spillfile_flush(&spill->files[i]);
+    num_threads = num_threads > spill->num_workers ? spill->num_workers: num_threads;
+    num_threads = num_threads == 0 ? 1: num_threads;
+
+    // Every merge also writes through its file's buffer
+    spill->budget = budget;
+    size_t buffers = budget / num_threads / SPILL_BUFFER_SIZE;
+    spill->max_fan_in = budget == 0 ? SIZE_MAX: buffers > SPILL_MIN_FAN_IN + 1 ? buffers - 1: SPILL_MIN_FAN_IN;
+
+    size_t next_partition = 0;
+    YATPool* pool;
+    yatpool_init(&pool, num_threads, num_threads);
+    for (size_t i = 0; i < num_threads; ++i) {
+        Task* task;
+        _SpillMergeArg* arg;
+        _spillmergearg_init(&arg, spill, &next_partition, i);
+
+        trace_task_init(&task, "merge_partitions", &_merge_partitions, arg, &_spillmergearg_destroy);
+        yatpool_put(pool, task);
+    }
+    yatpool_wait(pool);
+    yatpool_destroy(pool);
+}
+
+/// Close the files of a spill set and release its memory
+void spillset_destroy(SpillSet* spill) {
+    if (spill==NULL) return;
+    for (size_t i = 0; i < spill->num_workers; ++i) {
+        close(spill->files[i].fd);
+        free(spill->files[i].buffer);
+    }
+    for (size_t i = 0; i < spill->num_workers * SPILL_NUM_PARTITIONS; ++i)
+        free(spill->runs[i].segments);
+    free(spill->files);
+    free(spill->runs);
+    memset(spill, 0x0, sizeof(SpillSet));
+}
+
+/// Start reading the merged stations of a spill set
+void spillcursor_init(SpillCursor* cursor, const SpillSet* spill) {
+    cursor->spill = spill;
+    cursor->partition = 0;
+    cursor->reader = NULL;
+}
+
+/// Read the next merged station into stats, whose key stays valid until
+/// the next call. Returns false once every partition has been read.
+bool spillcursor_next(SpillCursor* cursor, StationStats* stats) {
+    while (cursor->partition < SPILL_NUM_PARTITIONS) {
+        _SegmentReader* reader = (_SegmentReader*)cursor->reader;
+        if (reader == NULL) {
+            reader = (_SegmentReader*)malloc(sizeof(_SegmentReader));
+            _segment_reader_init(reader, cursor->spill, &cursor->spill->merged[cursor->partition]);
+            cursor->reader = reader;
+        }
+        if (_segment_reader_next(reader)) {
+            memset(stats, 0x0, sizeof(StationStats));
+            stats->hash = reader->record.hash;
+            stats->key = reader->name;
+            stats->length = reader->record.length;
+            stats->min = reader->record.min;
+            stats->max = reader->record.max;
+            stats->sum = reader->record.sum;
+            stats->count = reader->record.count;
+            return true;
+        }
+        _segment_reader_destroy(reader);
+        free(reader);
+        cursor->reader = NULL;
+        cursor->partition++;
+    }
+    return false;
+}
+
+void spillcursor_destroy(SpillCursor* cursor) {
+    if (cursor==NULL || cursor->reader==NULL) return;
+    _SegmentReader* reader = (_SegmentReader*)cursor->reader;
+    _segment_reader_destroy(reader);
+    free(reader);
+    cursor->reader = NULL;
+}
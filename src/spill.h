@@ -0,0 +1,116 @@
+/* Spilling of partial aggregates to disk under a memory budget.
+
+                    GNU AFFERO GENERAL PUBLIC LICENSE
+                       Version 3, 19 November 2007
+
+    Copyright (C) 2024  Debajyoti Debnath
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published
+    by the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+
+
+#ifndef _SPILL_H_
+#define _SPILL_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "stats_table.h"
+
+// Number of hash partitions of every spill, merged back independently
+#define SPILL_NUM_PARTITIONS 64
+// Size of the write buffer of every spill file and of every run reader
+#define SPILL_BUFFER_SIZE (64 * 1024)
+// Fewest runs merged at once, however small the budget
+#define SPILL_MIN_FAN_IN 2
+// Bytes assumed per station name when sizing tables to a budget
+#define SPILL_KEY_ESTIMATE 32
+
+// Byte range of a spill file holding the sorted records of one partition
+typedef struct {
+    size_t file;
+    uint64_t offset;
+    uint64_t size;
+} SpillSegment;
+
+// Growable list of the segments one worker spilled to one partition
+typedef struct {
+    SpillSegment* segments;
+    size_t size;
+    size_t capacity;
+} SpillSegmentList;
+
+// Unlinked temporary file, appended to through a buffer
+typedef struct {
+    int fd;
+    uint64_t size;
+    char* buffer;
+    size_t used;
+} SpillFile;
+
+// Buffered sequential reader of a byte range of a spill file
+typedef struct {
+    int fd;
+    uint64_t position;
+    uint64_t end;
+    char* buffer;
+    size_t begin;
+    size_t filled;
+} SpillReader;
+
+// Run files of a memory-bounded aggregation. Every worker appends its
+// spills to its own file, each spill as one segment per partition sorted
+// by hash. spillset_merge combines the segments of each partition into a
+// single merged segment with one record per station, in several passes if
+// there are more segments than max_fan_in.
+typedef struct {
+    size_t num_workers;
+    SpillFile* files;
+    SpillSegmentList* runs;
+    SpillSegment merged[SPILL_NUM_PARTITIONS];
+    size_t num_stations;
+    size_t num_spills;
+    size_t max_fan_in;
+    // Memory budget the merge was given, in bytes, or 0 for none
+    size_t budget;
+} SpillSet;
+
+// Sequential reader of the merged stations of a spill set
+typedef struct {
+    const SpillSet* spill;
+    size_t partition;
+    void* reader;
+} SpillCursor;
+
+size_t spill_table_stations(size_t budget);
+void spillfile_write(SpillFile* file, const void* data, size_t length);
+void spillfile_flush(SpillFile* file);
+void spillreader_init(SpillReader* reader, const SpillFile* file, uint64_t offset, uint64_t size);
+bool spillreader_done(const SpillReader* reader);
+void spillreader_read(SpillReader* reader, void* data, size_t length);
+void spillreader_destroy(SpillReader* reader);
+void spillset_init(SpillSet* spill, const char* directory, size_t num_workers);
+void spillset_spill(SpillSet* spill, size_t worker, StatsTable* table);
+bool spillset_spilled(const SpillSet* spill);
+void spillset_merge(SpillSet* spill, size_t num_threads, size_t budget);
+void spillset_destroy(SpillSet* spill);
+void spillcursor_init(SpillCursor* cursor, const SpillSet* spill);
+bool spillcursor_next(SpillCursor* cursor, StationStats* stats);
+void spillcursor_destroy(SpillCursor* cursor);
+
+#endif // _SPILL_H_
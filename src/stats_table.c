@@ -0,0 +1,209 @@
+/* Open addressing table of per-station temperature statistics.
+
+                    GNU AFFERO GENERAL PUBLIC LICENSE
+                       Version 3, 19 November 2007
+
+    Copyright (C) 2024  Debajyoti Debnath
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published
+    by the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include "stats_table.h"
+
+/// Initialize an empty table with room for at least capacity stations
+void stats_table_init(StatsTable* table, size_t capacity) {
+    if (table==NULL) {
+        perror("Error: Null pointer provided as argument.");
+        abort();
+    }
+    size_t rounded = 16;
+    while (rounded < capacity)
+        rounded *= 2;
+
+    memset(table, 0x0, sizeof(StatsTable));
+    table->capacity = rounded;
+    table->entries = (StationStats*)calloc(rounded, sizeof(StationStats));
+    table->num_allocations = 1;
+    if (table->entries == NULL) {
+        perror("Error: could not allocate stats table.");
+        abort();
+    }
+}
+
+/// Copy a key into the table's arena
+static const char* _stats_table_copy_key(StatsTable* table, const char* key, size_t length) {
+    KeyBlock* block = table->keys;
+    if (block == NULL || block->used + length + 1 > block->capacity) {
+        size_t capacity = length + 1 > KEY_ARENA_BLOCKSIZE ? length + 1: KEY_ARENA_BLOCKSIZE;
+        block = (KeyBlock*)malloc(sizeof(KeyBlock) + capacity);
+        block->next = table->keys;
+        block->used = 0;
+        block->capacity = capacity;
+        table->keys = block;
+        table->num_allocations++;
+    }
+    char* copy = block->data + block->used;
+    memcpy(copy, key, length);
+    copy[length] = '\0';
+    block->used += length + 1;
+    return copy;
+}
+
+/// Double the capacity of the table and reinsert every entry
+static void _stats_table_grow(StatsTable* table) {
+    size_t capacity = 2 * table->capacity;
+    StationStats* entries = (StationStats*)calloc(capacity, sizeof(StationStats));
+    if (entries == NULL) {
+        perror("Error: could not allocate stats table.");
+        abort();
+    }
+    for (size_t i = 0; i < table->capacity; ++i) {
+        if (table->entries[i].key == NULL) continue;
+        size_t slot = table->entries[i].hash & (capacity - 1);
+        while (entries[slot].key != NULL)
+            slot = (slot + 1) & (capacity - 1);
+        entries[slot] = table->entries[i];
+    }
+    free(table->entries);
+    table->entries = entries;
+    table->capacity = capacity;
+    table->num_allocations++;
+}
+
+/// Look up a station, or NULL if it is not in the table
+StationStats* stats_table_find(const StatsTable* table, const char* key, size_t length, uint64_t hash) {
+    size_t mask = table->capacity - 1;
+    size_t slot = hash & mask;
+    while (table->entries[slot].key != NULL) {
+        StationStats* entry = &table->entries[slot];
+        if (entry->hash == hash && entry->length == length && memcmp(entry->key, key, length) == 0)
+            return entry;
+        slot = (slot + 1) & mask;
+    }
+    return NULL;
+}
+
+/// Look up a station, inserting it with no measurements if it is new.
+/// The table is kept at most half full.
+StationStats* stats_table_find_or_insert(StatsTable* table, const char* key, size_t length, uint64_t hash) {
+    size_t mask = table->capacity - 1;
+    size_t slot = hash & mask;
+    size_t probes = 1;
+    while (table->entries[slot].key != NULL) {
+        StationStats* entry = &table->entries[slot];
+        if (entry->hash == hash && entry->length == length && memcmp(entry->key, key, length) == 0) {
+            STATS(table->probe_histogram[probe_bucket(probes)]++);
+            return entry;
+        }
+        slot = (slot + 1) & mask;
+        probes++;
+    }
+    STATS(table->probe_histogram[probe_bucket(probes)]++);
+
+    if (2 * (table->size + 1) > table->capacity) {
+        _stats_table_grow(table);
+        return stats_table_find_or_insert(table, key, length, hash);
+    }
+
+    StationStats* entry = &table->entries[slot];
+    entry->hash = hash;
+    entry->key = _stats_table_copy_key(table, key, length);
+    entry->length = (uint32_t)length;
+    entry->min = INT32_MAX;
+    entry->max = INT32_MIN;
+    entry->sum = 0;
+    entry->count = 0;
+    entry->histogram = NULL;
+    table->size++;
+    return entry;
+}
+
+/// Add one measurement in hundredths of a degree
+void station_stats_add(StationStats* stats, int32_t value) {
+    stats->min = value < stats->min ? value: stats->min;
+    stats->max = value > stats->max ? value: stats->max;
+    stats->sum += value;
+    stats->count++;
+}
+
+/// Add one measurement to the histogram of a station, creating it first
+void station_stats_add_histogram(StationStats* stats, int32_t value) {
+    if (stats->histogram == NULL) {
+        stats->histogram = (TemperatureHistogram*)malloc(sizeof(TemperatureHistogram));
+        histogram_init(stats->histogram);
+    }
+    histogram_add(stats->histogram, value);
+}
+
+/// Fold the measurements of src into dest
+void station_stats_merge(StationStats* dest, const StationStats* src) {
+    dest->min = src->min < dest->min ? src->min: dest->min;
+    dest->max = src->max > dest->max ? src->max: dest->max;
+    dest->sum += src->sum;
+    dest->count += src->count;
+    if (src->histogram != NULL) {
+        if (dest->histogram == NULL) {
+            dest->histogram = (TemperatureHistogram*)malloc(sizeof(TemperatureHistogram));
+            histogram_init(dest->histogram);
+        }
+        histogram_merge(dest->histogram, src->histogram);
+    }
+}
+
+/// Release the histogram of a station, if it has one
+void station_stats_destroy(StationStats* stats) {
+    if (stats==NULL || stats->histogram==NULL) return;
+    histogram_destroy(stats->histogram);
+    free(stats->histogram);
+    stats->histogram = NULL;
+}
+
+/// Fold every station of src into dest
+void stats_table_merge(StatsTable* dest, const StatsTable* src) {
+    for (size_t i = 0; i < src->capacity; ++i) {
+        const StationStats* entry = &src->entries[i];
+        if (entry->key == NULL) continue;
+        StationStats* merged = stats_table_find_or_insert(dest, entry->key, entry->length, entry->hash);
+        station_stats_merge(merged, entry);
+    }
+}
+
+/// Remove every station from a table, keeping its capacity
+void stats_table_clear(StatsTable* table) {
+    if (table==NULL) return;
+    for (size_t i = 0; i < table->capacity; ++i)
+        station_stats_destroy(&table->entries[i]);
+    memset(table->entries, 0x0, table->capacity * sizeof(StationStats));
+    while (table->keys != NULL) {
+        KeyBlock* next = table->keys->next;
+        free(table->keys);
+        table->keys = next;
+    }
+    table->size = 0;
+}
+
+/// Release the entries and keys of a table
+void stats_table_destroy(StatsTable* table) {
+    if (table==NULL) return;
+    for (size_t i = 0; table->entries != NULL && i < table->capacity; ++i)
+        station_stats_destroy(&table->entries[i]);
+    free(table->entries);
+    while (table->keys != NULL) {
+        KeyBlock* next = table->keys->next;
+        free(table->keys);
+        table->keys = next;
+    }
+    memset(table, 0x0, sizeof(StatsTable));
+}
@@ -0,0 +1,85 @@
+/* Open addressing table of per-station temperature statistics.
+
+                    GNU AFFERO GENERAL PUBLIC LICENSE
+                       Version 3, 19 November 2007
+
+    Copyright (C) 2024  Debajyoti Debnath
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published
+    by the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef _STATS_TABLE_H_
+#define _STATS_TABLE_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "run_stats.h"
+#include "histogram.h"
+
+// Initial capacity of a table, rounded up to a power of two
+#define STATS_TABLE_DEFAULT_CAPACITY 4096
+// Size of each block of the key arena
+#define KEY_ARENA_BLOCKSIZE (64 * 1024)
+
+// Aggregated temperatures of one station. Temperatures are kept in
+// hundredths of a degree so that aggregation is exact. The histogram is
+// only allocated when quantiles are requested.
+typedef struct {
+    uint64_t hash;
+    const char* key;
+    uint32_t length;
+    int32_t min;
+    int32_t max;
+    int64_t sum;
+    uint64_t count;
+    TemperatureHistogram* histogram;
+} StationStats;
+
+// Block of copied station names
+typedef struct KeyBlock {
+    struct KeyBlock* next;
+    size_t used;
+    size_t capacity;
+    char data[];
+} KeyBlock;
+
+// Linear probing table keyed by station_hash, owning copies of its keys.
+// Empty slots have a NULL key.
+typedef struct {
+    StationStats* entries;
+    size_t capacity;
+    size_t size;
+    KeyBlock* keys;
+    size_t num_allocations;
+#if ONEBRC_STATS
+    uint64_t probe_histogram[PROBE_HISTOGRAM_BUCKETS];
+#endif
+} StatsTable;
+
+void stats_table_init(StatsTable* table, size_t capacity);
+StationStats* stats_table_find_or_insert(StatsTable* table, const char* key, size_t length, uint64_t hash);
+StationStats* stats_table_find(const StatsTable* table, const char* key, size_t length, uint64_t hash);
+void station_stats_add(StationStats* stats, int32_t value);
+void station_stats_add_histogram(StationStats* stats, int32_t value);
+void station_stats_merge(StationStats* dest, const StationStats* src);
+void station_stats_destroy(StationStats* stats);
+void stats_table_merge(StatsTable* dest, const StatsTable* src);
+void stats_table_clear(StatsTable* table);
+void stats_table_destroy(StatsTable* table);
+
+#endif // _STATS_TABLE_H_
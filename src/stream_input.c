@@ -0,0 +1,310 @@
+/* Analysis of measurements read as a stream of blocks.
+
+                    GNU AFFERO GENERAL PUBLIC LICENSE
+                       Version 3, 19 November 2007
+
+    Copyright (C) 2024  Debajyoti Debnath
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published
+    by the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include "stream_input.h"
+#include "trace.h"
+#include <errno.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <yatpool.h>
+
+// Buffers passed between the reader and the workers of one stream
+typedef struct {
+    StreamRead read;
+    void* source;
+    char** blocks;
+    size_t* block_sizes;
+    size_t* block_capacities;
+    size_t num_blocks;
+    size_t* free_ring;
+    size_t free_head;
+    size_t free_count;
+    size_t* filled_ring;
+    size_t filled_head;
+    size_t filled_count;
+    bool done;
+    bool failed;
+    Aggregator* aggregators;
+    PerfReport* perf;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+} _StreamPipeline;
+
+typedef struct {
+    _StreamPipeline* pipeline;
+    size_t worker;
+} _StreamPipelineArg;
+
+void _streampipelinearg_init(_StreamPipelineArg** arg, _StreamPipeline* pipeline, size_t worker) {
+    if (arg==NULL || pipeline==NULL) return;
+    *arg = (_StreamPipelineArg*)malloc(sizeof(_StreamPipelineArg));
+    (*arg)->pipeline = pipeline;
+    (*arg)->worker = worker;
+}
+
+void _streampipelinearg_destroy(void* arg) {
+    if (arg==NULL) return;
+    _StreamPipelineArg* _arg = (_StreamPipelineArg*)arg;
+    free(_arg);
+}
+
+/// Take a free block, or a filled one if filled is set. Returns false once
+/// no filled block is left and the reader is done.
+static bool _pipeline_take(_StreamPipeline* pipeline, bool filled, size_t* block) {
+    pthread_mutex_lock(&pipeline->lock);
+    size_t* count = filled ? &pipeline->filled_count: &pipeline->free_count;
+    while (*count == 0 && !(filled && pipeline->done))
+        pthread_cond_wait(&pipeline->changed, &pipeline->lock);
+    bool taken = *count > 0;
+    if (taken) {
+        size_t* head = filled ? &pipeline->filled_head: &pipeline->free_head;
+        size_t* ring = filled ? pipeline->filled_ring: pipeline->free_ring;
+        *block = ring[*head];
+        *head = (*head + 1) % pipeline->num_blocks;
+        (*count)--;
+    }
+    pthread_mutex_unlock(&pipeline->lock);
+    return taken;
+}
+
+/// Hand a block to the workers if filled is set, or back to the reader
+static void _pipeline_put(_StreamPipeline* pipeline, bool filled, size_t block) {
+    pthread_mutex_lock(&pipeline->lock);
+    size_t* count = filled ? &pipeline->filled_count: &pipeline->free_count;
+    size_t head = filled ? pipeline->filled_head: pipeline->free_head;
+    size_t* ring = filled ? pipeline->filled_ring: pipeline->free_ring;
+    ring[(head + *count) % pipeline->num_blocks] = block;
+    (*count)++;
+    pthread_cond_broadcast(&pipeline->changed);
+    pthread_mutex_unlock(&pipeline->lock);
+}
+
+/// Function for threadpool to read the whole stream into blocks of complete
+/// lines, carrying each trailing partial line into the next block
+void* _read_stream(void* arg) {
+    _StreamPipelineArg* pipelinearg = (_StreamPipelineArg*)arg;
+    _StreamPipeline* pipeline = pipelinearg->pipeline;
+
+    char* carry = NULL;
+    size_t carried = 0;
+    bool done = false, failed = false;
+    while (!done) {
+        size_t block;
+        _pipeline_take(pipeline, false, &block);
+        if (pipeline->block_capacities[block] < 2 * carried) {
+            pipeline->block_capacities[block] = 2 * carried + STREAM_BLOCK_SIZE;
+            pipeline->blocks[block] = (char*)realloc(pipeline->blocks[block], pipeline->block_capacities[block]);
+        }
+        char* data = pipeline->blocks[block];
+        memcpy(data, carry, carried);
+        uint64_t trace_start = trace_begin();
+        size_t filled = carried + pipeline->read(pipeline->source, data + carried,
+                                                 pipeline->block_capacities[block] - carried, &done, &failed);
+        trace_end("read_block", trace_start);
+
+        char* last = done ? data + filled - 1: (char*)memrchr(data, '\n', filled);
+        if (last == NULL) {
+            carry = (char*)realloc(carry, filled);
+            memcpy(carry, data, filled);
+            carried = filled;
+            _pipeline_put(pipeline, false, block);
+            continue;
+        }
+        size_t size = filled == 0 ? 0: (size_t)(last + 1 - data);
+        carried = filled - size;
+        carry = carried > 0 ? (char*)realloc(carry, carried): carry;
+        memcpy(carry, last + 1, carried);
+        pipeline->block_sizes[block] = size;
+        _pipeline_put(pipeline, true, block);
+    }
+
+    pthread_mutex_lock(&pipeline->lock);
+    pipeline->failed = failed;
+    pipeline->done = true;
+    pthread_cond_broadcast(&pipeline->changed);
+    pthread_mutex_unlock(&pipeline->lock);
+    free(carry);
+    return NULL;
+}
+
+/// Function for threadpool to aggregate blocks until the stream is done
+void* _aggregate_blocks(void* arg) {
+    _StreamPipelineArg* pipelinearg = (_StreamPipelineArg*)arg;
+    _StreamPipeline* pipeline = pipelinearg->pipeline;
+    Aggregator* aggregator = &pipeline->aggregators[pipelinearg->worker];
+#if ONEBRC_STATS
+    double start = stats_now();
+#endif
+    PerfCounters counters;
+    bool count = perfreport_worker_start(pipeline->perf, pipelinearg->worker, &counters);
+    size_t block;
+    while (_pipeline_take(pipeline, true, &block)) {
+        const char* data = pipeline->blocks[block];
+        uint64_t trace_start = trace_begin();
+        aggregator_consume(aggregator, data, data + pipeline->block_sizes[block], true);
+        trace_end("parse_block", trace_start);
+        STATS(if (aggregator->stats != NULL) aggregator->stats->chunks++);
+        _pipeline_put(pipeline, false, block);
+    }
+    if (count)
+        perfreport_worker_stop(pipeline->perf, pipelinearg->worker, &counters, aggregator->rows);
+#if ONEBRC_STATS
+    if (aggregator->stats != NULL) {
+        aggregator->stats->seconds = stats_now() - start;
+        aggregator->stats->rows = aggregator->rows;
+        aggregator->stats->bytes = aggregator->bytes;
+    }
+#endif
+    return NULL;
+}
+
+/// Aggregate a stream that is read on one thread while config->num_threads
+/// workers aggregate the blocks it fills. Returns false if the stream could
+/// not be read to its end, in which case result still holds what was read.
+bool analyze_stream(StreamRead read, void* source, const AnalyzerConfig* config, Aggregator* result, RunStats* stats) {
+    if (config==NULL || result==NULL || read==NULL) {
+        perror("Error: Null pointer provided as argument.");
+        abort();
+    }
+    if (config->num_threads==0) {
+        perror("Error: num_threads cannot be zero.");
+        abort();
+    }
+#if ONEBRC_STATS
+    double start = stats_now();
+#else
+    (void)stats;
+#endif
+
+    size_t num_threads = config->num_threads;
+    _StreamPipeline pipeline;
+    memset(&pipeline, 0x0, sizeof(_StreamPipeline));
+    pipeline.read = read;
+    pipeline.source = source;
+    pipeline.num_blocks = STREAM_BLOCKS_PER_THREAD * num_threads + 1;
+    pipeline.blocks = (char**)calloc(pipeline.num_blocks, sizeof(char*));
+    pipeline.block_sizes = (size_t*)calloc(pipeline.num_blocks, sizeof(size_t));
+    pipeline.block_capacities = (size_t*)calloc(pipeline.num_blocks, sizeof(size_t));
+    pipeline.free_ring = (size_t*)calloc(pipeline.num_blocks, sizeof(size_t));
+    pipeline.filled_ring = (size_t*)calloc(pipeline.num_blocks, sizeof(size_t));
+    for (size_t i = 0; i < pipeline.num_blocks; ++i) {
+        pipeline.block_capacities[i] = STREAM_BLOCK_SIZE;
+        pipeline.blocks[i] = (char*)malloc(STREAM_BLOCK_SIZE);
+        pipeline.free_ring[i] = i;
+    }
+    pipeline.free_count = pipeline.num_blocks;
+    pipeline.perf = config->perf;
+    pipeline.aggregators = (Aggregator*)calloc(num_threads, sizeof(Aggregator));
+    for (size_t i = 0; i < num_threads; ++i) {
+        aggregator_init(&pipeline.aggregators[i], config->catalog);
+        pipeline.aggregators[i].histograms = config->histograms;
+        pipeline.aggregators[i].batch_width = config->batch_width;
+        STATS(pipeline.aggregators[i].stats = stats != NULL && i < stats->num_workers ? &stats->workers[i]: NULL);
+    }
+    pthread_mutex_init(&pipeline.lock, NULL);
+    pthread_cond_init(&pipeline.changed, NULL);
+
+    // The reader runs on its own thread next to the workers
+    YATPool* pool;
+    yatpool_init(&pool, num_threads + 1, num_threads + 1);
+    for (size_t i = 0; i <= num_threads; ++i) {
+        Task* task;
+        _StreamPipelineArg* arg;
+        _streampipelinearg_init(&arg, &pipeline, i);
+        trace_task_init(&task, i == num_threads ? "read_stream": "aggregate_blocks",
+                        i == num_threads ? &_read_stream: &_aggregate_blocks, arg, &_streampipelinearg_destroy);
+        yatpool_put(pool, task);
+    }
+    yatpool_wait(pool);
+    yatpool_destroy(pool);
+
+    PerfCounters counters;
+    bool count = config->perf != NULL && perf_counters_open(&counters, false);
+    if (count)
+        perf_counters_start(&counters);
+    aggregator_merge_parallel(pipeline.aggregators, num_threads, num_threads);
+    if (count) {
+        perf_counters_stop(&counters, perfreport_phase(config->perf, "merge"));
+        perf_counters_close(&counters);
+    }
+    *result = pipeline.aggregators[0];
+    STATS(result->stats = NULL);
+    if (config->perf != NULL)
+        config->perf->rows = result->rows;
+#if ONEBRC_STATS
+    if (stats != NULL) {
+        runstats_split_parse_aggregate(stats, stats_now() - start);
+        stats->table_size = result->table.size;
+        stats->table_capacity = result->table.capacity;
+    }
+#endif
+
+    pthread_mutex_destroy(&pipeline.lock);
+    pthread_cond_destroy(&pipeline.changed);
+    for (size_t i = 0; i < pipeline.num_blocks; ++i)
+        free(pipeline.blocks[i]);
+    free(pipeline.blocks);
+    free(pipeline.block_sizes);
+    free(pipeline.block_capacities);
+    free(pipeline.free_ring);
+    free(pipeline.filled_ring);
+    free(pipeline.aggregators);
+    return !pipeline.failed;
+}
+
+/// Read whatever one read() returns, so that a block is handed to the
+/// workers as soon as the writer of a pipe has produced it
+static size_t _read_fd(void* source, char* out, size_t capacity, bool* done, bool* failed) {
+    int fd = *(int*)source;
+    ssize_t n;
+    do {
+        n = read(fd, out, capacity);
+    } while (n == -1 && errno == EINTR);
+    if (n <= 0) {
+        *done = true;
+        *failed = n == -1;
+        return 0;
+    }
+    return (size_t)n;
+}
+
+/// Whether the input at path cannot be mapped and is streamed instead:
+/// stdin given as "-" or anything but a regular file
+bool stream_input_required(const char* path) {
+    struct stat st;
+    return strcmp(path, "-") == 0 || (stat(path, &st) == 0 && !S_ISREG(st.st_mode));
+}
+
+/// Aggregate everything read from fd, such as a pipe from the generator,
+/// until the end of the stream
+void analyze_fd(int fd, const AnalyzerConfig* config, Aggregator* result, RunStats* stats) {
+    if (!analyze_stream(&_read_fd, &fd, config, result, stats)) {
+        perror("Error: could not read input stream.");
+        exit(EXIT_FAILURE);
+    }
+}
@@ -0,0 +1,48 @@
+/* Analysis of measurements read as a stream of blocks.
+
+                    GNU AFFERO GENERAL PUBLIC LICENSE
+                       Version 3, 19 November 2007
+
+    Copyright (C) 2024  Debajyoti Debnath
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published
+    by the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+
+#ifndef _STREAM_INPUT_H_
+#define _STREAM_INPUT_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "analyzer.h"
+
+// Bytes per buffer handed from the reader of a stream to the workers
+#define STREAM_BLOCK_SIZE (4 << 20)
+// Buffers in flight per worker
+#define STREAM_BLOCKS_PER_THREAD 2
+
+// Source of a stream: writes up to capacity bytes to out and returns how
+// many it wrote, setting *done at the end of the stream and *failed as well
+// if the stream could not be read to its end
+typedef size_t (*StreamRead)(void* source, char* out, size_t capacity, bool* done, bool* failed);
+
+bool analyze_stream(StreamRead read, void* source, const AnalyzerConfig* config, Aggregator* result, RunStats* stats);
+bool stream_input_required(const char* path);
+void analyze_fd(int fd, const AnalyzerConfig* config, Aggregator* result, RunStats* stats);
+
+#endif // _STREAM_INPUT_H_
@@ -0,0 +1,174 @@
+/* Timeline of worker tasks in the Chrome trace format.
+
+                    GNU AFFERO GENERAL PUBLIC LICENSE
+                       Version 3, 19 November 2007
+
+    Copyright (C) 2024  Debajyoti Debnath
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published
+    by the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include "trace.h"
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+bool trace_active = false;
+
+// Every thread's buffer, pushed on first use and read at exit
+static TraceBuffer* _trace_buffers = NULL;
+static __thread TraceBuffer* _trace_buffer = NULL;
+static char _trace_path[1024];
+static char _trace_process[256];
+static uint64_t _trace_origin_ns = 0;
+
+// Task run through yatpool inside a span named after it
+typedef struct {
+    void* (*function)(void*);
+    void* arg;
+    void (*destroy)(void*);
+    const char* name;
+} _TracedTask;
+
+uint64_t trace_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+/// Record spans from now on and write them to path as Chrome trace JSON
+/// when the process exits
+void trace_start(const char* path, const char* process_name) {
+    if (path==NULL || process_name==NULL) {
+        perror("Error: Null pointer provided as argument.");
+        abort();
+    }
+    if (trace_active) return;
+    snprintf(_trace_path, sizeof(_trace_path), "%s", path);
+    snprintf(_trace_process, sizeof(_trace_process), "%s", process_name);
+    _trace_origin_ns = trace_now();
+    trace_active = true;
+    atexit(&trace_dump);
+}
+
+/// Buffer of the calling thread, created and pushed onto the list of
+/// buffers without a lock on its first span
+static TraceBuffer* _trace_thread_buffer(void) {
+    if (_trace_buffer != NULL) return _trace_buffer;
+    TraceBuffer* buffer = (TraceBuffer*)malloc(sizeof(TraceBuffer));
+    if (buffer == NULL) {
+        perror("Error: could not allocate trace buffer.");
+        abort();
+    }
+    buffer->tid = (int)syscall(SYS_gettid);
+    buffer->count = 0;
+    buffer->next = __atomic_load_n(&_trace_buffers, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&_trace_buffers, &buffer->next, buffer, true,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+        ;
+    _trace_buffer = buffer;
+    return buffer;
+}
+
+/// Append a span to the ring of the calling thread
+void trace_record(const char* name, uint64_t start_ns, uint64_t end_ns) {
+    TraceBuffer* buffer = _trace_thread_buffer();
+    TraceEvent* event = &buffer->events[buffer->count % TRACE_BUFFER_EVENTS];
+    event->name = name;
+    event->start_ns = start_ns;
+    event->end_ns = end_ns;
+    __atomic_store_n(&buffer->count, buffer->count + 1, __ATOMIC_RELEASE);
+}
+
+static void* _run_traced_task(void* arg) {
+    _TracedTask* traced = (_TracedTask*)arg;
+    uint64_t start = trace_now();
+    void* result = traced->function(traced->arg);
+    trace_record(traced->name, start, trace_now());
+    return result;
+}
+
+static void _destroy_traced_task(void* arg) {
+    _TracedTask* traced = (_TracedTask*)arg;
+    if (traced->destroy != NULL)
+        traced->destroy(traced->arg);
+    free(traced);
+}
+
+/// task_init that records a span named name around the task while
+/// tracing, and is task_init otherwise
+void trace_task_init(Task** task, const char* name, void* (*function)(void*), void* arg, void (*destroy)(void*)) {
+    if (!trace_active) {
+        task_init(task, function, arg, destroy);
+        return;
+    }
+    _TracedTask* traced = (_TracedTask*)malloc(sizeof(_TracedTask));
+    if (traced == NULL) {
+        perror("Error: could not allocate traced task.");
+        abort();
+    }
+    traced->function = function;
+    traced->arg = arg;
+    traced->destroy = destroy;
+    traced->name = name;
+    task_init(task, &_run_traced_task, traced, &_destroy_traced_task);
+}
+
+/// Write every recorded span as a complete event, in microseconds since
+/// trace_start, with one thread_name entry per thread. Called at exit;
+/// threads still running may lose their latest spans.
+void trace_dump(void) {
+    if (!trace_active) return;
+    trace_active = false;
+    FILE* out = fopen(_trace_path, "w");
+    if (out == NULL) {
+        fprintf(stderr, "Error: could not write trace %s: %s\n", _trace_path, strerror(errno));
+        return;
+    }
+    int pid = (int)getpid();
+    fprintf(out, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    fprintf(out, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+            pid, pid, _trace_process);
+    uint64_t dropped = 0;
+    for (TraceBuffer* buffer = __atomic_load_n(&_trace_buffers, __ATOMIC_ACQUIRE); buffer != NULL; buffer = buffer->next) {
+        uint64_t count = __atomic_load_n(&buffer->count, __ATOMIC_ACQUIRE);
+        uint64_t first = count > TRACE_BUFFER_EVENTS ? count - TRACE_BUFFER_EVENTS: 0;
+        dropped += first;
+        fprintf(out, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"%s %d\"}}",
+                pid, buffer->tid, buffer->tid == pid ? "main": "worker", buffer->tid);
+        for (uint64_t i = first; i < count; ++i) {
+            const TraceEvent* event = &buffer->events[i % TRACE_BUFFER_EVENTS];
+            uint64_t start = event->start_ns - _trace_origin_ns;
+            uint64_t duration = event->end_ns - event->start_ns;
+            fprintf(out, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%d,\"tid\":%d,\"ts\":%llu.%03llu,\"dur\":%llu.%03llu}",
+                    event->name, pid, buffer->tid,
+                    (unsigned long long)(start / 1000), (unsigned long long)(start % 1000),
+                    (unsigned long long)(duration / 1000), (unsigned long long)(duration % 1000));
+        }
+    }
+    fprintf(out, "\n]}\n");
+    if (fclose(out) != 0)
+        fprintf(stderr, "Error: could not write trace %s: %s\n", _trace_path, strerror(errno));
+    if (dropped > 0)
+        fprintf(stderr, "Trace %s lost the %llu oldest spans of threads that recorded more than %d.\n",
+                _trace_path, (unsigned long long)dropped, TRACE_BUFFER_EVENTS);
+}
@@ -0,0 +1,72 @@
+/* Timeline of worker tasks in the Chrome trace format.
+
+                    GNU AFFERO GENERAL PUBLIC LICENSE
+                       Version 3, 19 November 2007
+
+    Copyright (C) 2024  Debajyoti Debnath
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published
+    by the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+
+#ifndef _TRACE_H_
+#define _TRACE_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <yatpool.h>
+
+// Spans each thread keeps; older ones are overwritten once it is full
+#define TRACE_BUFFER_EVENTS (1 << 16)
+
+// One span of a thread. name must be a string literal.
+typedef struct {
+    const char* name;
+    uint64_t start_ns;
+    uint64_t end_ns;
+} TraceEvent;
+
+// Ring of the spans recorded by one thread, written by that thread only
+typedef struct TraceBuffer {
+    struct TraceBuffer* next;
+    int tid;
+    uint64_t count;
+    TraceEvent events[TRACE_BUFFER_EVENTS];
+} TraceBuffer;
+
+// Whether trace_start was called; checked before anything is recorded
+extern bool trace_active;
+
+void trace_start(const char* path, const char* process_name);
+uint64_t trace_now(void);
+void trace_record(const char* name, uint64_t start_ns, uint64_t end_ns);
+void trace_task_init(Task** task, const char* name, void* (*function)(void*), void* arg, void (*destroy)(void*));
+void trace_dump(void);
+
+/// Start of a span, or 0 if tracing is off
+static inline uint64_t trace_begin(void) {
+    return __builtin_expect(trace_active, 0) ? trace_now(): 0;
+}
+
+/// Record the span from start, as returned by trace_begin, until now
+static inline void trace_end(const char* name, uint64_t start) {
+    if (__builtin_expect(start != 0, 0))
+        trace_record(name, start, trace_now());
+}
+
+#endif // _TRACE_H_
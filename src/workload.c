@@ -0,0 +1,158 @@
+/* Shaping of generated workloads.
+
+                    GNU AFFERO GENERAL PUBLIC LICENSE
+                       Version 3, 19 November 2007
+
+    Copyright (C) 2024  Debajyoti Debnath
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published
+    by the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include "workload.h"
+
+/// Initialize a workload configuration to the defaults: uniform
+/// sampling from every station of the source catalog, two decimals
+void workloadconfig_init(WorkloadConfig* config) {
+    if (config==NULL) return;
+    config->zipf_exponent = 0.0;
+    config->num_stations = 0;
+    config->min_name_length = WORKLOAD_DEFAULT_MIN_NAME_LENGTH;
+    config->max_name_length = WORKLOAD_DEFAULT_MAX_NAME_LENGTH;
+    config->synthetic_names = false;
+    config->decimals = 2;
+}
+
+/// Number of synthetic names of the given length, capped just above
+/// WORKLOAD_MAX_STATIONS
+static size_t _name_capacity(size_t length) {
+    size_t capacity = 1;
+    for (size_t i = 0; i < length && capacity <= WORKLOAD_MAX_STATIONS; ++i)
+        capacity *= 36;
+    return capacity;
+}
+
+/// Write the i-th synthetic name of the given length into name and return
+/// its length, which is exactly length as long as i < _name_capacity(length).
+/// The name starts with i in base 36, in digits and lowercase letters, and
+/// is padded with random capital letters, so names of one length differ in
+/// their prefix.
+static size_t _synthetic_name(char* name, size_t i, size_t length, unsigned int* seed) {
+    const char digits[] = "0123456789abcdefghijklmnopqrstuvwxyz";
+    char prefix[16];
+    size_t prefix_length = 0;
+    do {
+        prefix[prefix_length++] = digits[i % 36];
+        i /= 36;
+    } while (i > 0);
+
+    size_t pos = 0;
+    while (prefix_length > 0)
+        name[pos++] = prefix[--prefix_length];
+    while (pos < length)
+        name[pos++] = 'A' + rand_r(seed) % 26;
+    return pos;
+}
+
+/// Build the catalog of stations to sample from. The first stations are
+/// taken from the source catalog; if more stations are requested than it
+/// has, or synthetic names are requested, synthetic stations are added
+/// with name lengths drawn uniformly from the configured range. A length
+/// whose names are used up passes its draws on to the next one.
+void workload_build_catalog(const StationCatalog* source, StationCatalog* dest, const WorkloadConfig* config, size_t seed) {
+    if (source==NULL || dest==NULL || config==NULL) {
+        perror("Error: Null pointer provided as argument.");
+        abort();
+    }
+    size_t num_stations = config->num_stations == 0 ? source->num_stations: config->num_stations;
+    if (num_stations > WORKLOAD_MAX_STATIONS) {
+        fprintf(stderr, "Number of stations must be at most %d.\n", WORKLOAD_MAX_STATIONS);
+        exit(1);
+    }
+    if (config->min_name_length == 0 || config->min_name_length > config->max_name_length
+        || config->max_name_length > WORKLOAD_MAX_NAME_LENGTH) {
+        fprintf(stderr, "Name lengths must satisfy 1 <= min <= max <= %d.\n", WORKLOAD_MAX_NAME_LENGTH);
+        exit(1);
+    }
+
+    catalog_init(dest);
+
+    size_t num_real = config->synthetic_names ? 0: source->num_stations;
+    num_real = num_real > num_stations ? num_stations: num_real;
+    for (uint32_t id = 0; id < num_real; ++id) {
+        String name = catalog_name(source, id);
+        catalog_intern(dest, name.data, name.length, source->mean_temperatures[id]);
+    }
+
+    size_t capacity = 0;
+    for (size_t length = config->min_name_length; length <= config->max_name_length; ++length)
+        capacity += _name_capacity(length);
+    if (num_stations - num_real > capacity) {
+        fprintf(stderr, "Names of %zu-%zu bytes cannot tell %zu stations apart.\n",
+                config->min_name_length, config->max_name_length, num_stations - num_real);
+        exit(1);
+    }
+
+    unsigned int rng = (unsigned int)seed;
+    char name[WORKLOAD_MAX_NAME_LENGTH + 1];
+    size_t used[WORKLOAD_MAX_NAME_LENGTH + 1] = {0};
+    size_t span = config->max_name_length - config->min_name_length + 1;
+    for (size_t generated = 0; dest->num_stations < num_stations; ++generated) {
+        // Synthetic names can only run out by clashing with source names
+        if (generated == capacity) {
+            fprintf(stderr, "Names of %zu-%zu bytes cannot tell %zu stations apart.\n",
+                    config->min_name_length, config->max_name_length, num_stations - num_real);
+            exit(1);
+        }
+        size_t length = config->min_name_length + rand_r(&rng) % span;
+        while (used[length] == _name_capacity(length))
+            length = length == config->max_name_length ? config->min_name_length: length + 1;
+        length = _synthetic_name(name, used[length]++, length, &rng);
+        double u = (double)rand_r(&rng) / (double)RAND_MAX;
+        double mean = WORKLOAD_MIN_MEAN_TEMPERATURE + u * (WORKLOAD_MAX_MEAN_TEMPERATURE - WORKLOAD_MIN_MEAN_TEMPERATURE);
+        catalog_intern(dest, name, length, mean);
+    }
+}
+
+/// Cumulative distribution of a Zipf law over num_stations stations:
+/// station k is drawn with probability proportional to 1/(k+1)^exponent
+double* workload_zipf_cdf(size_t num_stations, double exponent) {
+    if (num_stations == 0) {
+        perror("Error: num_stations cannot be zero.");
+        abort();
+    }
+    double* cdf = (double*)malloc(num_stations * sizeof(double));
+    double total = 0.0;
+    for (size_t k = 0; k < num_stations; ++k) {
+        total += pow((double)(k + 1), -exponent);
+        cdf[k] = total;
+    }
+    for (size_t k = 0; k < num_stations; ++k)
+        cdf[k] /= total;
+    cdf[num_stations - 1] = 1.0;
+    return cdf;
+}
+
+/// Station drawn by inverting the cumulative distribution at u in [0, 1]
+uint32_t workload_sample_station(const double* cdf, size_t num_stations, double u) {
+    size_t low = 0, high = num_stations - 1;
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+        if (cdf[mid] < u)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    return (uint32_t)low;
+}
@@ -0,0 +1,58 @@
+/* Shaping of generated workloads.
+
+                    GNU AFFERO GENERAL PUBLIC LICENSE
+                       Version 3, 19 November 2007
+
+    Copyright (C) 2024  Debajyoti Debnath
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published
+    by the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef _WORKLOAD_H_
+#define _WORKLOAD_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <math.h>
+#include "catalog.h"
+
+// Largest number of distinct stations a workload may have
+#define WORKLOAD_MAX_STATIONS 10000000
+// Largest length of a station name in bytes
+#define WORKLOAD_MAX_NAME_LENGTH 100
+// Default length range of synthetic station names
+#define WORKLOAD_DEFAULT_MIN_NAME_LENGTH 3
+#define WORKLOAD_DEFAULT_MAX_NAME_LENGTH 24
+// Range of the mean temperatures of synthetic stations
+#define WORKLOAD_MIN_MEAN_TEMPERATURE -30.0
+#define WORKLOAD_MAX_MEAN_TEMPERATURE 40.0
+
+// Shape of the generated measurements
+typedef struct {
+    double zipf_exponent;
+    size_t num_stations;
+    size_t min_name_length;
+    size_t max_name_length;
+    bool synthetic_names;
+    int decimals;
+} WorkloadConfig;
+
+void workloadconfig_init(WorkloadConfig* config);
+void workload_build_catalog(const StationCatalog* source, StationCatalog* dest, const WorkloadConfig* config, size_t seed);
+double* workload_zipf_cdf(size_t num_stations, double exponent);
+uint32_t workload_sample_station(const double* cdf, size_t num_stations, double u);
+
+#endif // _WORKLOAD_H_
@@ -0,0 +1,192 @@
+/* Buffered, bounded-memory file writer.
+
+                    GNU AFFERO GENERAL PUBLIC LICENSE
+                       Version 3, 19 November 2007
+
+    Copyright (C) 2024  Debajyoti Debnath
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published
+    by the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include "writer.h"
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/// Initialize a writer configuration to defaults
+void writerconfig_init(WriterConfig* config) {
+    if (config==NULL) return;
+    config->backend = WRITER_PWRITE;
+    config->direct = false;
+    config->nontemporal = false;
+    config->buf_size = WRITER_DEFAULT_BUFSIZE;
+    config->max_dirty = WRITER_DEFAULT_MAX_DIRTY;
+}
+
+/// Open a file for writing, with O_DIRECT if requested and supported
+/// by the underlying filesystem
+int writer_open(const char* path, bool direct) {
+    int flags = O_WRONLY | O_CREAT | O_TRUNC;
+    int fd = -1;
+    if (direct) {
+        fd = open(path, flags | O_DIRECT, S_IRUSR | S_IWUSR);
+        if (fd==-1 && errno==EINVAL)
+            fprintf(stderr, "O_DIRECT not supported for %s, using buffered I/O.\n", path);
+    }
+    if (fd==-1)
+        fd = open(path, flags, S_IRUSR | S_IWUSR);
+    return fd;
+}
+
+/// Copy len bytes using non-temporal stores where the destination is
+/// 16-byte aligned, so the copied data does not displace the cache
+void copy_nontemporal(char* dst, const char* src, size_t len) {
+#if defined(__SSE2__)
+    size_t head = (16 - ((uintptr_t)dst & 15)) & 15;
+    head = head > len ? len: head;
+    memcpy(dst, src, head);
+    dst += head;
+    src += head;
+    len -= head;
+    for (; len >= 16; len -= 16, dst += 16, src += 16)
+        _mm_stream_si128((__m128i*)dst, _mm_loadu_si128((const __m128i*)src));
+#endif
+    memcpy(dst, src, len);
+}
+
+/// Start writing back everything written since the last sync and drop
+/// it from the page cache once the dirty budget has been used up
+static void _writer_limit_dirty(BufferedWriter* writer, bool force) {
+    if (writer->direct) {
+        writer->synced_offset = writer->offset;
+        return;
+    }
+    off_t len = writer->offset - writer->synced_offset;
+    if (len <= 0) return;
+    if (!force && (size_t)len < writer->max_dirty) return;
+
+    sync_file_range(writer->fd, writer->synced_offset, len,
+                    SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+    posix_fadvise(writer->fd, writer->synced_offset, len, POSIX_FADV_DONTNEED);
+    writer->synced_offset = writer->offset;
+}
+
+/// Write the filled part of the buffer at the current file offset
+static void _writer_flush(BufferedWriter* writer, size_t len) {
+#if defined(__SSE2__)
+    if (writer->nontemporal)
+        _mm_sfence();
+#endif
+    const char* buf = writer->buf;
+    off_t offset = writer->offset;
+    size_t remaining = len;
+    while (remaining > 0) {
+        ssize_t written = pwrite(writer->fd, buf, remaining, offset);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            perror("Error: could not write to output file.");
+            abort();
+        }
+        buf += written;
+        offset += written;
+        remaining -= (size_t)written;
+    }
+    writer->offset += (off_t)writer->used;
+    writer->used = 0;
+    _writer_limit_dirty(writer, false);
+}
+
+/// Initialize a writer that appends to fd starting at offset. Up to
+/// max_dirty bytes written by this writer may be left dirty in the page cache.
+void writer_init(BufferedWriter* writer, int fd, off_t offset, const WriterConfig* config, size_t max_dirty) {
+    if (writer==NULL || config==NULL) {
+        perror("Error: Null pointer provided as argument.");
+        abort();
+    }
+    if (fd < 0) {
+        perror("Error: invalid file descriptor.");
+        abort();
+    }
+
+    size_t buf_size = config->buf_size < WRITER_ALIGNMENT ? WRITER_ALIGNMENT: config->buf_size;
+    buf_size = (buf_size + WRITER_ALIGNMENT - 1) / WRITER_ALIGNMENT * WRITER_ALIGNMENT;
+
+    writer->fd = fd;
+    writer->direct = (fcntl(fd, F_GETFL) & O_DIRECT) && offset % WRITER_ALIGNMENT == 0;
+    writer->nontemporal = config->nontemporal;
+    writer->buf = (char*)aligned_alloc(WRITER_ALIGNMENT, buf_size);
+    writer->buf_size = buf_size;
+    writer->used = 0;
+    writer->offset = offset;
+    writer->synced_offset = offset;
+    writer->max_dirty = max_dirty < buf_size ? buf_size: max_dirty;
+    writer->total_bytes = 0;
+
+    if (writer->buf == NULL) {
+        perror("Error: could not allocate writer buffer.");
+        abort();
+    }
+}
+
+/// Append len bytes to the output. Data is only written in whole buffers,
+/// so every write but the last is buf_size bytes long and aligned.
+void writer_append(BufferedWriter* writer, const char* data, size_t len) {
+    writer->total_bytes += len;
+    while (len > 0) {
+        size_t n = writer->buf_size - writer->used;
+        n = n > len ? len: n;
+        if (writer->nontemporal)
+            copy_nontemporal(writer->buf + writer->used, data, n);
+        else
+            memcpy(writer->buf + writer->used, data, n);
+        writer->used += n;
+        data += n;
+        len -= n;
+        if (writer->used == writer->buf_size)
+            _writer_flush(writer, writer->used);
+    }
+}
+
+/// Write out whatever is left in the buffer, push it to disk and free the
+/// buffer. With O_DIRECT the last block is padded and the file truncated
+/// back to its real size afterwards.
+void writer_finish(BufferedWriter* writer) {
+    if (writer==NULL || writer->buf==NULL) return;
+    if (writer->used > 0) {
+        off_t end = writer->offset + (off_t)writer->used;
+        if (writer->direct) {
+            size_t padded = (writer->used + WRITER_ALIGNMENT - 1) / WRITER_ALIGNMENT * WRITER_ALIGNMENT;
+            memset(writer->buf + writer->used, 0x0, padded - writer->used);
+            _writer_flush(writer, padded);
+            if (ftruncate(writer->fd, end)==-1) {
+                perror("Error: could not truncate file to specific length.");
+                abort();
+            }
+        } else {
+            _writer_flush(writer, writer->used);
+        }
+    }
+    _writer_limit_dirty(writer, true);
+    free(writer->buf);
+    writer->buf = NULL;
+}
@@ -0,0 +1,76 @@
+/* Buffered, bounded-memory file writer.
+
+                    GNU AFFERO GENERAL PUBLIC LICENSE
+                       Version 3, 19 November 2007
+
+    Copyright (C) 2024  Debajyoti Debnath
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published
+    by the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef _WRITER_H_
+#define _WRITER_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/types.h>
+
+// Alignment of writer buffers, file offsets and lengths for O_DIRECT
+#define WRITER_ALIGNMENT 4096
+// Default size of each writer's staging buffer
+#define WRITER_DEFAULT_BUFSIZE (1 << 20)
+// Default cap on the bytes all writers together may leave dirty in the page cache
+#define WRITER_DEFAULT_MAX_DIRTY (256UL << 20)
+
+// How generated lines are pushed to the output file
+typedef enum {
+    WRITER_MMAP,
+    WRITER_PWRITE
+} WriterBackend;
+
+// Configuration shared by all writers of one output
+typedef struct {
+    WriterBackend backend;
+    bool direct;
+    bool nontemporal;
+    size_t buf_size;
+    size_t max_dirty;
+} WriterConfig;
+
+// Appends data to a file region through one fixed-size aligned buffer
+typedef struct {
+    int fd;
+    bool direct;
+    bool nontemporal;
+    char* buf;
+    size_t buf_size;
+    size_t used;
+    off_t offset;
+    off_t synced_offset;
+    size_t max_dirty;
+    size_t total_bytes;
+} BufferedWriter;
+
+void writerconfig_init(WriterConfig* config);
+void writer_init(BufferedWriter* writer, int fd, off_t offset, const WriterConfig* config, size_t max_dirty);
+void writer_append(BufferedWriter* writer, const char* data, size_t len);
+void writer_finish(BufferedWriter* writer);
+int writer_open(const char* path, bool direct);
+void copy_nontemporal(char* dst, const char* src, size_t len);
+
+#endif // _WRITER_H_
@@ -0,0 +1,454 @@
+#include "../src/analyzer.h"
+#include "../src/gzip_input.h"
+#include <criterion/criterion.h>
+#include <zlib.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+static const char* measurements =
+    "Tokyo;12.34\n"
+    "Jakarta;-5.6\n"
+    "Tokyo;-1.00\n"
+    "no delimiter\n"
+    "Jakarta;30.1\n"
+    "Tokyo;7";
+
+static StationStats* find_station(const Aggregator* aggregator, const char* name) {
+    size_t length = strlen(name);
+    return stats_table_find(&aggregator->table, name, length, station_hash(name, length));
+}
+
+Test(analyzer_tests, parse_temperature) {
+    const char* values[] = {"12.34", "-5.6", "0.0", "7", "-99.99", "1.239"};
+    int32_t expected[] = {1234, -560, 0, 700, -9999, 123};
+    for (size_t i=0; i<sizeof(expected)/sizeof(expected[0]); ++i) {
+        cr_expect(parse_temperature(values[i], values[i] + strlen(values[i]))==expected[i],
+                "parse_temperature should parse %s into hundredths.", values[i]);
+    }
+}
+
+Test(analyzer_tests, aggregator_consume) {
+    Aggregator aggregator;
+    aggregator_init(&aggregator, NULL);
+    const char* end = measurements + strlen(measurements);
+
+    const char* rest = aggregator_consume(&aggregator, measurements, end, false);
+    cr_expect(strcmp(rest, "Tokyo;7")==0,
+            "aggregator_consume should leave a trailing partial line unless final is set.");
+    cr_expect(aggregator.rows==4,
+            "aggregator_consume should skip lines without a delimiter.");
+
+    aggregator_consume(&aggregator, rest, end, true);
+    StationStats* tokyo = find_station(&aggregator, "Tokyo");
+    cr_expect(tokyo!=NULL && tokyo->count==3 && tokyo->min==-100 && tokyo->max==1234 && tokyo->sum==1834,
+            "aggregator_consume should aggregate every row of a station.");
+    cr_expect(aggregator_num_stations(&aggregator)==2,
+            "aggregator_consume should create one entry per station.");
+    aggregator_destroy(&aggregator);
+}
+
+Test(analyzer_tests, analyze_buffer_threads) {
+    size_t size = strlen(measurements);
+    Aggregator serial, parallel;
+    AnalyzerConfig config;
+    analyzerconfig_init(&config);
+
+    config.num_threads = 1;
+    analyze_buffer(measurements, size, &config, &serial, NULL);
+    config.num_threads = 3;
+    config.num_chunks = 5;
+    analyze_buffer(measurements, size, &config, &parallel, NULL);
+
+    cr_expect(serial.rows==5 && parallel.rows==5,
+            "analyze_buffer should cover every row however the input is split.");
+    const char* names[] = {"Tokyo", "Jakarta"};
+    for (size_t i=0; i<2; ++i) {
+        StationStats* a = find_station(&serial, names[i]);
+        StationStats* b = find_station(&parallel, names[i]);
+        cr_expect(a!=NULL && b!=NULL && a->count==b->count && a->min==b->min
+                  && a->max==b->max && a->sum==b->sum,
+                "Merged worker results should match a single worker for %s.", names[i]);
+    }
+    aggregator_destroy(&serial);
+    aggregator_destroy(&parallel);
+}
+
+Test(analyzer_tests, aggregator_catalog) {
+    StationCatalog catalog;
+    catalog_init(&catalog);
+    catalog_intern(&catalog, "Jakarta", 7, -6.175);
+
+    Aggregator aggregator;
+    aggregator_init(&aggregator, &catalog);
+    aggregator_consume(&aggregator, measurements, measurements + strlen(measurements), true);
+    cr_expect(aggregator.catalog_stats[0].count==2 && aggregator.catalog_stats[0].sum==2450,
+            "Catalog stations should be aggregated by their ID.");
+    cr_expect(find_station(&aggregator, "Jakarta")==NULL && find_station(&aggregator, "Tokyo")!=NULL,
+            "Only stations missing from the catalog should go into the table.");
+    cr_expect(aggregator_num_stations(&aggregator)==2,
+            "aggregator_num_stations should count catalog and table stations.");
+    aggregator_destroy(&aggregator);
+    catalog_destroy(&catalog);
+}
+
+Test(analyzer_tests, batched_lookups) {
+    // Enough stations for the table to grow in the middle of a batch
+    size_t num_rows = 20000;
+    char* data = (char*)malloc(num_rows * 16);
+    size_t size = 0;
+    for (size_t i = 0; i < num_rows; ++i)
+        size += sprintf(data + size, "S%zu;%d.%d\n", i % 997, (int)(i % 50) - 25, (int)(i % 10));
+    size += sprintf(data + size, "no delimiter\nS7;4");
+
+    StationCatalog catalog;
+    catalog_init(&catalog);
+    catalog_intern(&catalog, "S7", 2, 0.0);
+
+    Aggregator single;
+    aggregator_init(&single, &catalog);
+    aggregator_consume(&single, data, data + size, true);
+    size_t widths[] = {2, ANALYZER_DEFAULT_BATCH_WIDTH, ANALYZER_MAX_BATCH_WIDTH};
+    for (size_t w = 0; w < sizeof(widths)/sizeof(widths[0]); ++w) {
+        Aggregator batched;
+        aggregator_init(&batched, &catalog);
+        batched.batch_width = widths[w];
+        const char* rest = aggregator_consume(&batched, data, data + size, false);
+        cr_expect(strcmp(rest, "S7;4")==0,
+                "Batches should leave a trailing partial line unless final is set.");
+        aggregator_consume(&batched, rest, data + size, true);
+        cr_expect(batched.rows==num_rows + 1 && batched.bytes==size && aggregator_num_stations(&batched)==997,
+                "Batches of %zu rows should aggregate every row once.", widths[w]);
+        cr_expect(batched.catalog_stats[0].count==single.catalog_stats[0].count
+                  && batched.catalog_stats[0].sum==single.catalog_stats[0].sum,
+                "Batches of %zu rows should aggregate catalog stations by their ID.", widths[w]);
+        char name[8];
+        for (size_t i = 0; i < 997; ++i) {
+            if (i == 7) continue;
+            size_t length = sprintf(name, "S%zu", i);
+            StationStats* a = stats_table_find(&single.table, name, length, station_hash(name, length));
+            StationStats* b = stats_table_find(&batched.table, name, length, station_hash(name, length));
+            cr_expect(a!=NULL && b!=NULL && a->count==b->count && a->min==b->min
+                      && a->max==b->max && a->sum==b->sum,
+                    "Batches of %zu rows should agree with single lookups for %s.", widths[w], name);
+        }
+        aggregator_destroy(&batched);
+    }
+    aggregator_destroy(&single);
+    catalog_destroy(&catalog);
+    free(data);
+}
+
+/// Aggregate stations first to first + num_stations - 1 into two aggregators
+static void consume_stations(Aggregator* a, Aggregator* b, size_t first, size_t num_stations) {
+    char* data = (char*)malloc(num_stations * 24);
+    size_t size = 0;
+    for (size_t i = first; i < first + num_stations; ++i)
+        size += sprintf(data + size, "S%zu;%d.%d\n", i, (int)(i % 50) - 25, (int)(i % 10));
+    aggregator_consume(a, data, data + size, true);
+    aggregator_consume(b, data, data + size, true);
+    free(data);
+}
+
+Test(analyzer_tests, parallel_merge) {
+    StationCatalog catalog;
+    catalog_init(&catalog);
+    catalog_intern(&catalog, "S7", 2, 0.0);
+    catalog_intern(&catalog, "S25000", 6, 0.0);
+
+    // Overlapping worker tables of different capacities, with enough
+    // stations in total for the merge to be partitioned
+    size_t num_workers = 5;
+    size_t firsts[] = {0, 10000, 20000, 30000, 5000};
+    size_t counts[] = {30000, 30000, 30000, 30000, 100};
+    Aggregator serial[5], parallel[5];
+    for (size_t i = 0; i < num_workers; ++i) {
+        aggregator_init(&serial[i], &catalog);
+        aggregator_init(&parallel[i], &catalog);
+        serial[i].histograms = parallel[i].histograms = true;
+        consume_stations(&serial[i], &parallel[i], firsts[i], counts[i]);
+    }
+    for (size_t i = 1; i < num_workers; ++i) {
+        aggregator_merge(&serial[0], &serial[i]);
+        aggregator_destroy(&serial[i]);
+    }
+    aggregator_merge_parallel(parallel, num_workers, 3);
+
+    cr_expect(parallel[0].rows==serial[0].rows && parallel[0].table.size==serial[0].table.size
+              && parallel[0].table.size==59998,
+            "A parallel merge should keep every station once.");
+    for (size_t id = 0; id < 2; ++id) {
+        cr_expect(parallel[0].catalog_stats[id].count==serial[0].catalog_stats[id].count
+                  && parallel[0].catalog_stats[id].histogram->count==serial[0].catalog_stats[id].count,
+                "A parallel merge should merge catalog station %zu.", id);
+    }
+    char name[8];
+    size_t mismatches = 0;
+    for (size_t i = 0; i < 60000; ++i) {
+        size_t length = sprintf(name, "S%zu", i);
+        StationStats* a = stats_table_find(&serial[0].table, name, length, station_hash(name, length));
+        StationStats* b = stats_table_find(&parallel[0].table, name, length, station_hash(name, length));
+        if (a == NULL && b == NULL) continue;
+        mismatches += a==NULL || b==NULL || a->count!=b->count || a->min!=b->min || a->max!=b->max
+                      || a->sum!=b->sum || b->histogram==NULL || b->histogram->count!=a->count;
+    }
+    cr_expect(mismatches==0,
+            "A parallel merge should agree with a serial one for every station, not for %zu.", mismatches);
+    aggregator_destroy(&serial[0]);
+    aggregator_destroy(&parallel[0]);
+    catalog_destroy(&catalog);
+}
+
+Test(analyzer_tests, shared_table) {
+    // Enough rows per station for workers to race on the same slots
+    size_t num_rows = 20000;
+    char* data = (char*)malloc(num_rows * 16);
+    size_t size = 0;
+    for (size_t i = 0; i < num_rows; ++i)
+        size += sprintf(data + size, "S%zu;%d.%d\n", i % 97, (int)(i % 50) - 25, (int)(i % 10));
+
+    Aggregator private_result, shared_result;
+    AnalyzerConfig config;
+    analyzerconfig_init(&config);
+    config.num_threads = 4;
+    config.num_chunks = 64;
+    analyze_buffer(data, size, &config, &private_result, NULL);
+    config.table_mode = ANALYZER_SHARED_TABLE;
+    config.shared_capacity = 256;
+    analyze_buffer(data, size, &config, &shared_result, NULL);
+
+    cr_expect(shared_result.rows==num_rows && aggregator_num_stations(&shared_result)==97,
+            "The shared table should hold every station once.");
+    char name[8];
+    for (size_t i = 0; i < 97; ++i) {
+        size_t length = sprintf(name, "S%zu", i);
+        StationStats* a = stats_table_find(&private_result.table, name, length, station_hash(name, length));
+        StationStats* b = stats_table_find(&shared_result.table, name, length, station_hash(name, length));
+        cr_expect(a!=NULL && b!=NULL && a->count==b->count && a->min==b->min
+                  && a->max==b->max && a->sum==b->sum,
+                "Shared and private tables should agree for %s.", name);
+    }
+    aggregator_destroy(&private_result);
+    aggregator_destroy(&shared_result);
+    free(data);
+}
+
+Test(analyzer_tests, partitioned) {
+    size_t num_rows = 20000;
+    char* data = (char*)malloc(num_rows * 16);
+    size_t size = 0;
+    for (size_t i = 0; i < num_rows; ++i)
+        size += sprintf(data + size, "S%zu;%d.%d\n", i % 997, (int)(i % 50) - 25, (int)(i % 10));
+
+    StationCatalog catalog;
+    catalog_init(&catalog);
+    catalog_intern(&catalog, "S7", 2, 0.0);
+
+    Aggregator private_result, partitioned_result;
+    AnalyzerConfig config;
+    analyzerconfig_init(&config);
+    config.num_threads = 3;
+    config.num_chunks = 16;
+    config.catalog = &catalog;
+    analyze_buffer(data, size, &config, &private_result, NULL);
+    config.table_mode = ANALYZER_PARTITIONED;
+    config.num_partitions = 5;
+    analyze_buffer(data, size, &config, &partitioned_result, NULL);
+
+    cr_expect(partitioned_result.rows==num_rows && aggregator_num_stations(&partitioned_result)==997,
+            "Partitions should hold every station once.");
+    cr_expect(partitioned_result.catalog_stats[0].count==private_result.catalog_stats[0].count,
+            "Catalog stations should be aggregated by their ID in partitioned mode.");
+    char name[8];
+    for (size_t i = 0; i < 997; ++i) {
+        if (i == 7) continue;
+        size_t length = sprintf(name, "S%zu", i);
+        StationStats* a = stats_table_find(&private_result.table, name, length, station_hash(name, length));
+        StationStats* b = stats_table_find(&partitioned_result.table, name, length, station_hash(name, length));
+        cr_expect(a!=NULL && b!=NULL && a->count==b->count && a->min==b->min
+                  && a->max==b->max && a->sum==b->sum,
+                "Partitioned and private tables should agree for %s.", name);
+    }
+    aggregator_destroy(&private_result);
+    aggregator_destroy(&partitioned_result);
+    catalog_destroy(&catalog);
+    free(data);
+}
+
+Test(analyzer_tests, histogram_quantiles) {
+    TemperatureHistogram a, b;
+    histogram_init(&a);
+    histogram_init(&b);
+    // Values 0.0 .. 99.9 split between a sparse and a dense histogram
+    for (int32_t tenths = 0; tenths < 1000; ++tenths) {
+        for (int i = 0; i < 5; ++i)
+            histogram_add(tenths % 2 == 0 ? &a: &b, tenths * 10);
+    }
+    histogram_add(&a, -1234);
+    cr_expect(a.dense!=NULL,
+            "A histogram should switch to dense bins once it holds many measurements.");
+    histogram_merge(&b, &a);
+    cr_expect(b.count==5001,
+            "Merging should keep every measurement.");
+    cr_expect(histogram_quantile(&b, 0.0)==-1240 && histogram_quantile(&b, 1.0)==9990,
+            "The extreme quantiles should be the smallest and largest bins.");
+    cr_expect(histogram_quantile(&b, 0.5)==4990 && histogram_quantile(&b, 0.99)==9890,
+            "Quantiles should be the nearest rank.");
+    histogram_destroy(&a);
+    histogram_destroy(&b);
+
+    TemperatureHistogram sparse;
+    histogram_init(&sparse);
+    int32_t values[] = {-560, 3010, 120, -560};
+    for (size_t i = 0; i < 4; ++i)
+        histogram_add(&sparse, values[i]);
+    cr_expect(sparse.dense==NULL && sparse.num_sparse==3,
+            "A rare station should keep sparse bins.");
+    cr_expect(histogram_quantile(&sparse, 0.5)==-560 && histogram_quantile(&sparse, 0.75)==120,
+            "Sparse quantiles should walk the bins in order.");
+    histogram_destroy(&sparse);
+}
+
+Test(analyzer_tests, quantiles_agree) {
+    size_t num_rows = 20000;
+    char* data = (char*)malloc(num_rows * 16);
+    size_t size = 0;
+    for (size_t i = 0; i < num_rows; ++i)
+        size += sprintf(data + size, "S%zu;%d.%d\n", i % 97, (int)(i % 50) - 25, (int)(i % 10));
+
+    Aggregator serial, parallel;
+    AnalyzerConfig config;
+    analyzerconfig_init(&config);
+    config.histograms = true;
+    config.num_threads = 1;
+    analyze_buffer(data, size, &config, &serial, NULL);
+    config.num_threads = 4;
+    config.num_chunks = 64;
+    config.table_mode = ANALYZER_PARTITIONED;
+    config.num_partitions = 4;
+    analyze_buffer(data, size, &config, &parallel, NULL);
+
+    double quantiles[] = {0.5, 0.95, 0.99};
+    char name[8];
+    for (size_t i = 0; i < 97; ++i) {
+        size_t length = sprintf(name, "S%zu", i);
+        StationStats* a = stats_table_find(&serial.table, name, length, station_hash(name, length));
+        StationStats* b = stats_table_find(&parallel.table, name, length, station_hash(name, length));
+        cr_assert(a!=NULL && b!=NULL && a->histogram!=NULL && b->histogram!=NULL,
+                "Every station should have a histogram for %s.", name);
+        cr_expect(a->histogram->count==a->count,
+                "A histogram should count every measurement of %s.", name);
+        for (size_t q = 0; q < 3; ++q) {
+            cr_expect(histogram_quantile(a->histogram, quantiles[q])==histogram_quantile(b->histogram, quantiles[q]),
+                    "Merged histograms should give the quantiles of a single worker for %s.", name);
+        }
+    }
+    aggregator_destroy(&serial);
+    aggregator_destroy(&parallel);
+    free(data);
+}
+
+Test(analyzer_tests, spill) {
+    size_t num_rows = 20000;
+    char* data = (char*)malloc(num_rows * 16);
+    size_t size = 0;
+    for (size_t i = 0; i < num_rows; ++i)
+        size += sprintf(data + size, "S%zu;%d.%d\n", i % 997, (int)(i % 50) - 25, (int)(i % 10));
+
+    Aggregator in_memory, spilled;
+    AnalyzerConfig config;
+    analyzerconfig_init(&config);
+    config.num_threads = 3;
+    config.num_chunks = 16;
+    analyze_buffer(data, size, &config, &in_memory, NULL);
+    // Small enough for every worker to spill many times
+    config.max_memory = 1;
+    analyze_buffer(data, size, &config, &spilled, NULL);
+
+    cr_assert(spilled.spill!=NULL && spilled.spill->num_spills>3,
+            "Workers should spill once their table is full.");
+    cr_expect(spilled.spill->max_fan_in==SPILL_MIN_FAN_IN,
+            "A tiny budget should merge the runs two at a time, in several passes.");
+    cr_expect(spilled.rows==num_rows && aggregator_num_stations(&spilled)==997,
+            "Merged spills should hold every station once.");
+    SpillCursor cursor;
+    StationStats b;
+    size_t num_stations = 0;
+    spillcursor_init(&cursor, spilled.spill);
+    while (spillcursor_next(&cursor, &b)) {
+        StationStats* a = stats_table_find(&in_memory.table, b.key, b.length, b.hash);
+        cr_expect(a!=NULL && a->count==b.count && a->min==b.min && a->max==b.max && a->sum==b.sum,
+                "Spilled and in-memory aggregates should agree for %.*s.", (int)b.length, b.key);
+        num_stations++;
+    }
+    spillcursor_destroy(&cursor);
+    cr_expect(num_stations==997,
+            "The cursor should read every merged station.");
+    aggregator_destroy(&in_memory);
+    aggregator_destroy(&spilled);
+    free(data);
+}
+
+// Compress data as num_members gzip members of about equal size
+static char* gzip_members(const char* data, size_t size, size_t num_members, size_t* compressed_size) {
+    size_t capacity = 2 * size + 1024 * num_members;
+    char* out = (char*)malloc(capacity);
+    *compressed_size = 0;
+    for (size_t k = 0; k < num_members; ++k) {
+        size_t begin = k * size / num_members;
+        size_t end = (k + 1) * size / num_members;
+        z_stream stream;
+        memset(&stream, 0x0, sizeof(z_stream));
+        deflateInit2(&stream, 1, Z_DEFLATED, 16 + MAX_WBITS, 8, Z_DEFAULT_STRATEGY);
+        stream.next_in = (Bytef*)(data + begin);
+        stream.avail_in = (uInt)(end - begin);
+        stream.next_out = (Bytef*)(out + *compressed_size);
+        stream.avail_out = (uInt)(capacity - *compressed_size);
+        deflate(&stream, Z_FINISH);
+        *compressed_size += stream.total_out;
+        deflateEnd(&stream);
+    }
+    return out;
+}
+
+Test(analyzer_tests, gzip_input) {
+    // Random names and values keep the members larger than a segment
+    size_t num_rows = 400000;
+    char* data = (char*)malloc(num_rows * 24);
+    size_t size = 0;
+    srand(7);
+    for (size_t i = 0; i < num_rows; ++i)
+        size += sprintf(data + size, "S%d;%d.%d\n", rand() % 50000, rand() % 100 - 50, rand() % 10);
+
+    Aggregator plain;
+    AnalyzerConfig config;
+    analyzerconfig_init(&config);
+    config.num_threads = 3;
+    analyze_buffer(data, size, &config, &plain, NULL);
+
+    for (size_t num_members = 1; num_members <= 7; num_members += 3) {
+        size_t compressed_size;
+        char* compressed = gzip_members(data, size, num_members, &compressed_size);
+        cr_assert(gzip_is_compressed(compressed, compressed_size) && !gzip_is_compressed(data, size),
+                "gzip input should be recognized by its header.");
+        size_t starts[3];
+        size_t num_starts = gzip_find_members(compressed, compressed_size, starts, 3);
+        cr_expect(num_members == 1 ? num_starts==1: num_starts>1,
+                "Members should be found only in a multi-member file.");
+
+        Aggregator result;
+        analyze_gzip_buffer(compressed, compressed_size, &config, &result, NULL);
+        cr_expect(result.rows==plain.rows && aggregator_num_stations(&result)==aggregator_num_stations(&plain),
+                "Decompressed input of %zu members should hold every row.", num_members);
+        for (size_t i = 0; i < plain.table.capacity; ++i) {
+            const StationStats* a = &plain.table.entries[i];
+            if (a->key == NULL) continue;
+            StationStats* b = stats_table_find(&result.table, a->key, a->length, a->hash);
+            cr_expect(b!=NULL && a->count==b->count && a->min==b->min && a->max==b->max && a->sum==b->sum,
+                    "Compressed and plain input should agree for %.*s.", (int)a->length, a->key);
+        }
+        aggregator_destroy(&result);
+        free(compressed);
+    }
+    aggregator_destroy(&plain);
+    free(data);
+}
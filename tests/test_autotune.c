@@ -0,0 +1,69 @@
+#include "../src/autotune.h"
+#include <criterion/criterion.h>
+#include <stdio.h>
+
+Test(autotune_tests, host) {
+    HostInfo host;
+    hostinfo_detect(&host);
+    cr_expect(host.cpus>=1 && host.cpus<=host.online_cpus && host.cpus<=host.affinity_cpus,
+            "Usable CPUs should be bounded by the online CPUs and the affinity mask.");
+    cr_expect(host.cpu_quota==0.0 || host.cpus<=(size_t)host.cpu_quota + 1,
+            "Usable CPUs should be bounded by the cgroup quota.");
+}
+
+Test(autotune_tests, profile_file) {
+    HostInfo host;
+    hostinfo_detect(&host);
+    TuneProfile saved, loaded;
+    tuneprofile_init(&saved, &host);
+    saved.num_threads = 3;
+    saved.chunk_size = 1 << 20;
+    saved.num_partitions = 64;
+    const char* path = "test_autotune.profile";
+    tuneprofile_save(&saved, &host, path);
+    cr_assert(tuneprofile_load(&loaded, path),
+            "A saved profile should load.");
+    cr_expect(loaded.num_threads==3 && loaded.chunk_size==(1 << 20) && loaded.num_partitions==64,
+            "A profile should keep its settings.");
+    cr_expect(tuneprofile_matches(&loaded, &host),
+            "A profile should match the host it was saved on.");
+    host.cpus++;
+    cr_expect(!tuneprofile_matches(&loaded, &host),
+            "A profile should not match a host with other CPUs.");
+    remove(path);
+    cr_expect(!tuneprofile_load(&loaded, path),
+            "A missing profile should not load.");
+}
+
+Test(autotune_tests, calibrate) {
+    size_t num_rows = 100000;
+    char* data = (char*)malloc(num_rows * 16);
+    size_t size = 0;
+    for (size_t i = 0; i < num_rows; ++i)
+        size += sprintf(data + size, "S%zu;%d.%d\n", i % 997, (int)(i % 50) - 25, (int)(i % 10));
+
+    HostInfo host;
+    hostinfo_detect(&host);
+    // A tiny L2 cache asks for many partitions
+    host.l2_size = 4096;
+    AnalyzerConfig config;
+    analyzerconfig_init(&config);
+    TuneProfile profile;
+    tuneprofile_init(&profile, &host);
+    autotune_calibrate(data, size, &config, &host, &profile);
+
+    cr_expect(profile.num_threads>=1 && profile.num_threads<=host.cpus,
+            "The tuned thread count should not exceed the usable CPUs.");
+    cr_expect(profile.num_partitions>AUTOTUNE_MIN_PARTITIONS && profile.num_partitions<=AUTOTUNE_MAX_PARTITIONS
+              && (profile.num_partitions & (profile.num_partitions - 1))==0,
+            "Partitions should be a power of two sized to the L2 cache.");
+
+    // Tuned settings aggregate like the defaults
+    Aggregator tuned;
+    tuneprofile_apply(&profile, &config);
+    analyze_buffer(data, size, &config, &tuned, NULL);
+    cr_expect(tuned.rows==num_rows && aggregator_num_stations(&tuned)==997,
+            "Tuned settings should aggregate every row.");
+    aggregator_destroy(&tuned);
+    free(data);
+}
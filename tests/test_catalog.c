@@ -0,0 +1,69 @@
+#include "../src/catalog.h"
+#include <criterion/criterion.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+StationCatalog catalog;
+
+void catalogsetup(void) {
+    catalog_init(&catalog);
+    catalog_intern(&catalog, "Tokyo", 5, 35.6897);
+    catalog_intern(&catalog, "Jakarta", 7, -6.175);
+    catalog_intern(&catalog, "Delhi", 5, 28.61);
+}
+
+void catalogteardown(void) {
+    catalog_destroy(&catalog);
+}
+
+TestSuite(catalog_tests, .init=catalogsetup, .fini=catalogteardown);
+
+Test(catalog_tests, catalog_intern) {
+    cr_expect(catalog.num_stations==3,
+            "catalog_intern should assign one ID per station.");
+    cr_expect(catalog_intern(&catalog, "Jakarta", 7, 0.0)==1,
+            "catalog_intern should return the existing ID of a repeated name.");
+    cr_expect(catalog.num_stations==3 && catalog.mean_temperatures[1]==-6.175,
+            "catalog_intern must not add or overwrite a repeated name.");
+}
+
+Test(catalog_tests, catalog_find) {
+    cr_expect(catalog_find(&catalog, "Delhi", 5, station_hash("Delhi", 5))==2,
+            "catalog_find should return the ID of an existing station.");
+    cr_expect(catalog_find(&catalog, "Del", 3, station_hash("Del", 3))==CATALOG_NOT_FOUND,
+            "catalog_find should return CATALOG_NOT_FOUND for a missing station.");
+}
+
+Test(catalog_tests, catalog_grow) {
+    char name[32];
+    for (int i=0; i<5000; ++i) {
+        int length = snprintf(name, sizeof(name), "Station %d", i);
+        catalog_intern(&catalog, name, length, (double)i);
+    }
+    cr_expect(catalog.num_stations==5003,
+            "catalog_intern should grow past the initial capacity.");
+    String tokyo = catalog_name(&catalog, 0);
+    cr_expect(tokyo.length==5 && strcmp(tokyo.data, "Tokyo")==0,
+            "catalog_name should return the interned name.");
+    cr_expect(catalog_find(&catalog, "Station 4321", 12, station_hash("Station 4321", 12))==4324,
+            "catalog_find should find stations after the index grows.");
+}
+
+Test(catalog_tests, catalog_save_map) {
+    const char* path = "test_catalog.bin";
+    catalog_save(&catalog, path);
+
+    StationCatalog mapped;
+    catalog_load(&mapped, path);
+    cr_expect(mapped.mapping!=NULL,
+            "catalog_load should map a binary catalog.");
+    cr_expect(mapped.num_stations==3,
+            "a mapped catalog should have the same stations.");
+    cr_expect(catalog_find(&mapped, "Jakarta", 7, station_hash("Jakarta", 7))==1,
+            "a mapped catalog should keep the same station IDs.");
+    cr_expect(mapped.mean_temperatures[0]==35.6897,
+            "a mapped catalog should keep the mean temperatures.");
+
+    catalog_destroy(&mapped);
+    remove(path);
+}
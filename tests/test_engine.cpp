@@ -0,0 +1,133 @@
+#include "../src/engine.hpp"
+#include "../src/pipeline.hpp"
+#include <criterion/criterion.h>
+#include <cstdio>
+#include <set>
+#include <string>
+extern "C" {
+#include "../src/analyzer.h"
+}
+
+static const char* measurements =
+    "Tokyo;12.34\n"
+    "Jakarta;-5.6\n"
+    "Tokyo;-1.00\n"
+    "no delimiter\n"
+    "A station with a long name;30.1\n"
+    "Aabenraa;63.25\n"
+    "Aabenraa;-1.25\n"
+    "Mean;1.0\n"
+    "Mean;1.5\n"
+    "Tokyo;7";
+
+// Values and means ending in 5 hundredths are rounded half up
+static const char* expected =
+    "A station with a long name=30.1/30.1/30.1\n"
+    "Aabenraa=-1.2/63.3/31.0\n"
+    "Jakarta=-5.6/-5.6/-5.6\n"
+    "Mean=1.0/1.5/1.3\n"
+    "Tokyo=-1.0/12.3/6.1\n";
+
+static std::string write_measurements(void) {
+    std::string path = "test_engine_measurements.txt";
+    FILE* file = fopen(path.c_str(), "w");
+    fputs(measurements, file);
+    fclose(file);
+    return path;
+}
+
+static std::string run_engine(const onebrc::EngineEntry& engine, const std::string& path, size_t num_threads) {
+    FILE* out = tmpfile();
+    engine.analyze({path}, num_threads, out);
+    std::string result(ftell(out), '\0');
+    rewind(out);
+    size_t length = fread(result.data(), 1, result.size(), out);
+    result.resize(length);
+    fclose(out);
+    return result;
+}
+
+// Output of the C analyzer for the same measurements, sorted by name
+static std::string run_analyzer(void) {
+    const char* end = measurements + strlen(measurements);
+    Aggregator aggregator;
+    aggregator_init(&aggregator, NULL);
+    aggregator_consume(&aggregator, measurements, end, true);
+
+    std::set<std::string> names;
+    const char* p = measurements;
+    onebrc::Row row;
+    while (onebrc::ScalarParser::next(p, end, row))
+        names.emplace(row.name, row.length);
+
+    FILE* out = tmpfile();
+    for (const std::string& name: names)
+        aggregator_print_station(&aggregator, name.data(), name.size(), out);
+    aggregator_destroy(&aggregator);
+    std::string result(ftell(out), '\0');
+    rewind(out);
+    size_t length = fread(result.data(), 1, result.size(), out);
+    result.resize(length);
+    fclose(out);
+    return result;
+}
+
+Test(engine_tests, parsers) {
+    const char* end = measurements + strlen(measurements);
+    const char* p = measurements;
+    const char* q = measurements;
+    onebrc::Row a, b;
+    size_t rows = 0;
+    while (onebrc::ScalarParser::next(p, end, a)) {
+        cr_expect(onebrc::SwarParser::next(q, end, b),
+                "SwarParser should find as many rows as ScalarParser.");
+        cr_expect(a.length==b.length && memcmp(a.name, b.name, a.length)==0 && a.value==b.value,
+                "SwarParser and ScalarParser should parse row %zu alike.", rows);
+        rows++;
+    }
+    cr_expect(rows==9,
+            "Parsers should skip lines without a delimiter.");
+}
+
+Test(engine_tests, registry) {
+    cr_expect(onebrc::engine_registry().size()==48,
+            "The registry should hold every combination of policies.");
+    cr_expect(onebrc::find_engine(onebrc::DEFAULT_ENGINE)!=nullptr,
+            "The default engine should be registered.");
+    cr_expect(onebrc::find_engine("mmap-swar-none-linear-int")==nullptr,
+            "find_engine should return nullptr for an unknown engine.");
+}
+
+Test(engine_tests, engines_agree) {
+    std::string path = write_measurements();
+    std::string reference = run_analyzer();
+    cr_expect(reference==expected,
+            "The C analyzer should round values ending in 5 hundredths half up.");
+    for (const onebrc::EngineEntry& engine: onebrc::engine_registry()) {
+        for (size_t num_threads: {1, 3}) {
+            cr_expect(run_engine(engine, path, num_threads)==reference,
+                    "Engine %s should print what the C analyzer prints with %zu threads.",
+                    engine.name.c_str(), num_threads);
+        }
+    }
+    remove(path.c_str());
+}
+
+Test(engine_tests, pipelines_agree) {
+    std::string path = write_measurements();
+    cr_expect(onebrc::pipeline_registry().size()==24,
+            "The pipeline registry should hold every combination of policies.");
+    for (const onebrc::EngineEntry& pipeline: onebrc::pipeline_registry()) {
+        cr_expect(run_engine(pipeline, path, 2)==run_analyzer(),
+                "Pipeline %s should print what the C analyzer prints.", pipeline.name.c_str());
+    }
+
+    // Lines never straddle two inputs
+    const onebrc::EngineEntry& pipeline = onebrc::pipeline_registry().front();
+    FILE* out = tmpfile();
+    size_t rows = pipeline.analyze({path, path}, 2, out);
+    fclose(out);
+    cr_expect(rows==18,
+            "A pipeline should aggregate every row of several inputs.");
+    remove(path.c_str());
+}
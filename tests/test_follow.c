@@ -0,0 +1,43 @@
+#include "../src/follow.h"
+#include <criterion/criterion.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <unistd.h>
+
+static const char* path = "test_follow_measurements.txt";
+
+static void append(const char* text, const char* mode) {
+    FILE* file = fopen(path, mode);
+    fputs(text, file);
+    fclose(file);
+}
+
+Test(follow_tests, appended_lines) {
+    append("Tokyo;12.3\nJakarta;-5", "w");
+    int fd = open(path, O_RDONLY);
+    AnalyzerConfig config;
+    analyzerconfig_init(&config);
+    FollowState state;
+    followstate_init(&state, fd, &config);
+
+    cr_expect(follow_read(&state, &config) && state.totals.rows==1 && state.carried==strlen("Jakarta;-5"),
+            "A trailing partial line should be held back.");
+    cr_expect(!follow_read(&state, &config),
+            "Nothing should change without appends.");
+
+    append(".6\nTokyo;1.7\n", "a");
+    cr_expect(follow_read(&state, &config) && state.totals.rows==3 && state.carried==0,
+            "Completed lines should be aggregated once.");
+    const char* name = "Jakarta";
+    StationStats* jakarta = stats_table_find(&state.totals.table, name, strlen(name), station_hash(name, strlen(name)));
+    cr_expect(jakarta!=NULL && jakarta->count==1 && jakarta->sum==-560,
+            "A line split across reads should be parsed whole.");
+
+    append("Lima;20.0\n", "w");
+    cr_expect(follow_read(&state, &config) && state.totals.rows==1 && aggregator_num_stations(&state.totals)==1,
+            "A truncated file should be aggregated from its start again.");
+
+    followstate_destroy(&state);
+    close(fd);
+    remove(path);
+}
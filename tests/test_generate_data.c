@@ -0,0 +1,70 @@
+#include "../src/generate_data.h"
+#include <criterion/criterion.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+
+static StationCatalog stations;
+
+static void generatesetup(void) {
+    catalog_init(&stations);
+    catalog_intern(&stations, "Tokyo", 5, 35.6897);
+    catalog_intern(&stations, "Jakarta", 7, -6.175);
+    catalog_intern(&stations, "Delhi", 5, 28.61);
+}
+
+static void generateteardown(void) {
+    catalog_destroy(&stations);
+}
+
+TestSuite(generate_tests, .init=generatesetup, .fini=generateteardown);
+
+static bool _same_rows(const String* a, const String* b, size_t n) {
+    for (size_t i = 0; i < n; ++i) {
+        if (a[i].length != b[i].length || memcmp(a[i].data, b[i].data, a[i].length) != 0)
+            return false;
+    }
+    return true;
+}
+
+static void _destroy_rows(String* rows, size_t n) {
+    for (size_t i = 0; i < n; ++i)
+        string_destroy(rows[i]);
+    free(rows);
+}
+
+Test(generate_tests, same_seed_same_rows) {
+    WorkloadConfig workload;
+    workloadconfig_init(&workload);
+    size_t n = 2 * GENERATE_TASK_ROWS + 7;
+
+    for (int zipf = 0; zipf < 2; ++zipf) {
+        workload.zipf_exponent = zipf ? 1.0: 0.0;
+        String* serial = generate_random_temperature_sample_threaded(&stations, n, 42, 1, &workload);
+        String* threaded = generate_random_temperature_sample_threaded(&stations, n, 42, 3, &workload);
+        String* reseeded = generate_random_temperature_sample_threaded(&stations, n, 43, 3, &workload);
+        cr_expect(_same_rows(serial, threaded, n),
+                "A seed should give the same rows with any number of threads.");
+        cr_expect(!_same_rows(serial, reseeded, n),
+                "Another seed should give other rows.");
+        _destroy_rows(serial, n);
+        _destroy_rows(threaded, n);
+        _destroy_rows(reseeded, n);
+    }
+}
+
+Test(generate_tests, ranges_match_whole_run) {
+    WorkloadConfig workload;
+    workloadconfig_init(&workload);
+    size_t n = 3 * GENERATE_TASK_ROWS + 5;
+
+    // Rows are generated a range at a time when streamed
+    String* whole = generate_random_temperature_sample_threaded(&stations, n, 42, 2, &workload);
+    String* head = generate_random_temperature_sample_range(&stations, 0, GENERATE_TASK_ROWS, 42, 2, &workload);
+    String* tail = generate_random_temperature_sample_range(&stations, GENERATE_TASK_ROWS, n - GENERATE_TASK_ROWS, 42, 2, &workload);
+    cr_expect(_same_rows(whole, head, GENERATE_TASK_ROWS) && _same_rows(whole + GENERATE_TASK_ROWS, tail, n - GENERATE_TASK_ROWS),
+            "Rows generated in ranges should be the rows of the whole run.");
+    _destroy_rows(whole, n);
+    _destroy_rows(head, GENERATE_TASK_ROWS);
+    _destroy_rows(tail, n - GENERATE_TASK_ROWS);
+}
@@ -0,0 +1,118 @@
+#include "../src/io_utils.h"
+#include <criterion/criterion.h>
+#include <stdio.h>
+#include <sys/stat.h>
+
+#define NUM_LINES 5000
+
+static String lines[NUM_LINES];
+static const char* outfile = "test_io_utils_measurements.txt";
+
+static void iosetup(void) {
+    char line[64];
+    for (size_t i = 0; i < NUM_LINES; ++i) {
+        int length = snprintf(line, sizeof(line), "Station %zu;%d.%zu\n", i % 37, (int)(i % 90) - 45, i % 10);
+        lines[i] = string_create(line, length);
+    }
+}
+
+static void ioteardown(void) {
+    for (size_t i = 0; i < NUM_LINES; ++i)
+        string_destroy(lines[i]);
+}
+
+TestSuite(io_utils_tests, .init=iosetup, .fini=ioteardown);
+
+// Read a whole file into a malloc'd buffer
+static char* read_file(const char* path, size_t* size) {
+    FILE* file = fopen(path, "rb");
+    cr_assert(file != NULL, "%s should exist.", path);
+    fseek(file, 0, SEEK_END);
+    *size = (size_t)ftell(file);
+    fseek(file, 0, SEEK_SET);
+    char* data = (char*)malloc(*size + 1);
+    cr_assert(fread(data, 1, *size, file) == *size);
+    fclose(file);
+    return data;
+}
+
+static size_t count_lines(const char* data, size_t size) {
+    size_t count = 0;
+    for (size_t i = 0; i < size; ++i)
+        count += data[i] == '\n';
+    return count;
+}
+
+Test(io_utils_tests, shard_manifest) {
+    WriterConfig config;
+    writerconfig_init(&config);
+    size_t expected_bytes = 0;
+    for (size_t i = 0; i < NUM_LINES; ++i)
+        expected_bytes += lines[i].length;
+
+    // Few shards are written in pwrite pieces, many one task per shard
+    for (size_t run = 0; run < 4; ++run) {
+        ShardBalance balance = run % 2 == 0 ? SHARD_BY_ROWS: SHARD_BY_BYTES;
+        size_t num_shards = run < 2 ? 3: 9;
+        ShardInfo* shards = write_datarowgroup_sharded(lines, outfile, NUM_LINES, num_shards, balance, 2, &config);
+        write_shard_manifest(shards, num_shards, outfile);
+
+        size_t total_rows = 0, total_bytes = 0;
+        for (size_t i = 0; i < num_shards; ++i) {
+            size_t size;
+            char* data = read_file(shards[i].path, &size);
+            cr_expect(size == shards[i].num_bytes && count_lines(data, size) == shards[i].end_lineno - shards[i].start_lineno,
+                    "Shard %zu should hold the rows and bytes it is described with.", i);
+            cr_expect(size == 0 || memcmp(data, lines[shards[i].start_lineno].data, lines[shards[i].start_lineno].length) == 0,
+                    "Shard %zu should start with its first row.", i);
+            total_rows += count_lines(data, size);
+            total_bytes += size;
+            free(data);
+        }
+        cr_expect(total_rows == NUM_LINES && total_bytes == expected_bytes,
+                "The shards together should hold every row once.");
+
+        char manifest_path[MAX_PATH_LEN];
+        snprintf(manifest_path, sizeof(manifest_path), "%s.manifest", outfile);
+        size_t size;
+        char* manifest = read_file(manifest_path, &size);
+        manifest[size] = '\0';
+        size_t manifest_rows = 0, manifest_bytes = 0;
+        const char* total = strstr(manifest, "# total\t");
+        cr_expect(total != NULL && sscanf(total, "# total\t%zu\t%zu", &manifest_rows, &manifest_bytes) == 2
+                  && manifest_rows == total_rows && manifest_bytes == total_bytes,
+                "The manifest totals should match the rows and bytes written.");
+        free(manifest);
+
+        for (size_t i = 0; i < num_shards; ++i)
+            remove(shards[i].path);
+        remove(manifest_path);
+        free(shards);
+    }
+}
+
+Test(io_utils_tests, pwrite_matches_mmap) {
+    WriterConfig config;
+    writerconfig_init(&config);
+    const char* mmap_path = "test_io_utils_mmap.txt";
+    config.backend = WRITER_MMAP;
+    write_datarowgroup_threaded(lines, mmap_path, NUM_LINES, 3, &config);
+    size_t mmap_size;
+    char* mmap_data = read_file(mmap_path, &mmap_size);
+
+    // A small buffer makes every pwrite task flush several times
+    config.backend = WRITER_PWRITE;
+    config.buf_size = WRITER_ALIGNMENT;
+    for (size_t num_threads = 1; num_threads <= 4; num_threads += 3) {
+        write_datarowgroup_threaded(lines, outfile, NUM_LINES, num_threads, &config);
+        size_t size;
+        char* data = read_file(outfile, &size);
+        cr_expect(size == mmap_size && memcmp(data, mmap_data, size) == 0,
+                "The pwrite backend should write the same bytes as the mmap backend with %zu threads.", num_threads);
+        free(data);
+        remove(outfile);
+    }
+
+    free(mmap_data);
+    remove(mmap_path);
+}
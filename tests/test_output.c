@@ -0,0 +1,213 @@
+#include "../src/output.h"
+#include "../src/format.h"
+#include <criterion/criterion.h>
+#include <stdio.h>
+
+static const char* measurements =
+    "Tokyo;12.34\n"
+    "Jakarta;-5.6\n"
+    "Tokyo;-1.05\n"
+    "Lima, Peru;20.0\n"
+    "\"Quoted\";1.25\n";
+
+// Write the stations of aggregator with config and return what was written
+static char* write_output(const Aggregator* aggregator, const OutputConfig* config, size_t* size) {
+    FILE* out = tmpfile();
+    cr_assert(output_write(aggregator, config, out),
+            "output_write should succeed on a temporary file.");
+    *size = (size_t)ftell(out);
+    char* text = (char*)malloc(*size + 1);
+    rewind(out);
+    *size = fread(text, 1, *size, out);
+    text[*size] = '\0';
+    fclose(out);
+    return text;
+}
+
+Test(output_tests, fixed_point) {
+    int64_t hundredths[] = {1234, 1235, -1235, -4, 5, 0, -99999};
+    const char* expected[] = {"12.3", "12.4", "-12.3", "0.0", "0.1", "0.0", "-1000.0"};
+    for (size_t i = 0; i < sizeof(hundredths)/sizeof(hundredths[0]); ++i) {
+        char text[FORMAT_TENTHS_MAX + 1];
+        *format_tenths(text, round_tenths(hundredths[i], 1)) = '\0';
+        cr_expect(strcmp(text, expected[i])==0,
+                "%lld hundredths should be written as %s, not %s.", (long long)hundredths[i], expected[i], text);
+    }
+    cr_expect(round_tenths(667, 2)==33 && round_tenths(-665, 2)==-33 && round_tenths(-675, 2)==-34,
+            "Means should be rounded half up.");
+}
+
+Test(output_tests, formats) {
+    Aggregator aggregator;
+    aggregator_init(&aggregator, NULL);
+    aggregator_consume(&aggregator, measurements, measurements + strlen(measurements), true);
+    OutputConfig config;
+    outputconfig_init(&config);
+    size_t size;
+
+    char* text = write_output(&aggregator, &config, &size);
+    cr_expect(strcmp(text, "Lines of input file covered: 5\nStations: 4\n"
+                           "\"Quoted\"=1.3/1.3/1.3\nJakarta=-5.6/-5.6/-5.6\n"
+                           "Lima, Peru=20.0/20.0/20.0\nTokyo=-1.0/12.3/5.6\n")==0,
+            "Lines should be sorted by name after the summary, not\n%s", text);
+    free(text);
+
+    config.format = OUTPUT_OFFICIAL;
+    text = write_output(&aggregator, &config, &size);
+    cr_expect(strcmp(text, "{\"Quoted\"=1.3/1.3/1.3, Jakarta=-5.6/-5.6/-5.6, "
+                           "Lima, Peru=20.0/20.0/20.0, Tokyo=-1.0/12.3/5.6}\n")==0,
+            "The official format should be one line in braces, not\n%s", text);
+    free(text);
+
+    config.format = OUTPUT_CSV;
+    text = write_output(&aggregator, &config, &size);
+    cr_expect(strcmp(text, "station,min,max,mean,count\n\"\"\"Quoted\"\"\",1.3,1.3,1.3,1\n"
+                           "Jakarta,-5.6,-5.6,-5.6,1\n\"Lima, Peru\",20.0,20.0,20.0,1\nTokyo,-1.0,12.3,5.6,2\n")==0,
+            "CSV should quote names with commas and quotes, not\n%s", text);
+    free(text);
+
+    config.format = OUTPUT_JSON;
+    text = write_output(&aggregator, &config, &size);
+    const char* head = "{\"rows\":5,\"stations\":[\n{\"name\":\"\\\"Quoted\\\"\",\"min\":1.3,";
+    cr_expect(strncmp(text, head, strlen(head))==0
+              && strstr(text, "{\"name\":\"Tokyo\",\"min\":-1.0,\"max\":12.3,\"mean\":5.6,\"count\":2}\n]}\n")!=NULL,
+            "JSON should escape names and close the array, not\n%s", text);
+    free(text);
+
+    config.format = OUTPUT_BINARY;
+    text = write_output(&aggregator, &config, &size);
+    uint64_t num_stations;
+    memcpy(&num_stations, text + 12, sizeof(num_stations));
+    cr_expect(memcmp(text, OUTPUT_BINARY_MAGIC, 4)==0 && num_stations==4,
+            "The binary format should start with its magic and the number of stations.");
+    const char* p = text + 20;
+    uint32_t length;
+    for (size_t i = 0; i < 3; ++i) {
+        memcpy(&length, p, sizeof(length));
+        p += sizeof(length) + length + 24;
+    }
+    memcpy(&length, p, sizeof(length));
+    int32_t min, max;
+    int64_t sum;
+    memcpy(&min, p + 4 + length, 4);
+    memcpy(&max, p + 8 + length, 4);
+    memcpy(&sum, p + 12 + length, 8);
+    cr_expect(length==5 && memcmp(p + 4, "Tokyo", 5)==0 && min==-105 && max==1234 && sum==1129
+              && (size_t)(p + 28 + length - text)==size,
+            "Binary records should hold the exact aggregates in name order.");
+    free(text);
+    aggregator_destroy(&aggregator);
+}
+
+Test(output_tests, parallel_sort) {
+    // Enough stations for several sort and merge tasks
+    size_t num_stations = 5 * OUTPUT_MIN_STATIONS_PER_TASK + 7;
+    char* data = (char*)malloc(num_stations * 24);
+    size_t size = 0;
+    for (size_t i = 0; i < num_stations; ++i)
+        size += sprintf(data + size, "S%zu;%d.0\n", (i * 7919) % num_stations, (int)(i % 50));
+
+    StationCatalog catalog;
+    catalog_init(&catalog);
+    catalog_intern(&catalog, "S5", 2, 0.0);
+    catalog_intern(&catalog, "S123456789", 10, 0.0);
+    Aggregator aggregator;
+    aggregator_init(&aggregator, &catalog);
+    aggregator_consume(&aggregator, data, data + size, true);
+
+    OutputConfig config;
+    outputconfig_init(&config);
+    config.summary = false;
+    char* sorted[2];
+    size_t sizes[2];
+    for (size_t i = 0; i < 2; ++i) {
+        config.num_threads = i == 0 ? 1: 3;
+        sorted[i] = write_output(&aggregator, &config, &sizes[i]);
+    }
+    cr_expect(sizes[0]==sizes[1] && memcmp(sorted[0], sorted[1], sizes[0])==0,
+            "Sorting in parallel should give the same output as one thread.");
+
+    size_t lines = 0;
+    const char* previous = NULL;
+    size_t previous_length = 0;
+    bool ordered = true;
+    for (const char* line = sorted[1]; *line != '\0'; line = strchr(line, '\n') + 1) {
+        size_t length = (size_t)(strchr(line, '=') - line);
+        if (previous != NULL) {
+            int c = memcmp(previous, line, previous_length < length ? previous_length: length);
+            ordered = ordered && (c < 0 || (c == 0 && previous_length < length));
+        }
+        previous = line;
+        previous_length = length;
+        lines++;
+    }
+    cr_expect(lines==num_stations && ordered,
+            "Catalog and table stations should be written once each in byte order.");
+
+    config.order = OUTPUT_SORT_NONE;
+    char* unsorted = write_output(&aggregator, &config, &sizes[0]);
+    cr_expect(sizes[0]==sizes[1] && memcmp(unsorted, sorted[1], sizes[0])!=0,
+            "Unsorted output should hold the same stations in table order.");
+    free(unsorted);
+    free(sorted[0]);
+    free(sorted[1]);
+    aggregator_destroy(&aggregator);
+    catalog_destroy(&catalog);
+    free(data);
+}
+
+Test(output_tests, spilled) {
+    size_t num_rows = 20000;
+    char* data = (char*)malloc(num_rows * 16);
+    size_t size = 0;
+    for (size_t i = 0; i < num_rows; ++i)
+        size += sprintf(data + size, "S%zu;%d.%d\n", i % 997, (int)(i % 50) - 25, (int)(i % 10));
+
+    StationCatalog catalog;
+    catalog_init(&catalog);
+    catalog_intern(&catalog, "S5", 2, 0.0);
+    Aggregator in_memory, spilled;
+    AnalyzerConfig analyzer;
+    analyzerconfig_init(&analyzer);
+    analyzer.catalog = &catalog;
+    analyzer.num_threads = 3;
+    analyze_buffer(data, size, &analyzer, &in_memory, NULL);
+    // Every station is a run of its own, merged in many passes
+    analyzer.max_memory = 1;
+    analyze_buffer(data, size, &analyzer, &spilled, NULL);
+    cr_assert(spilled.spill!=NULL, "A tiny budget should spill.");
+
+    OutputConfig config;
+    outputconfig_init(&config);
+    config.num_threads = 3;
+    size_t expected_size, spilled_size;
+    for (int format = OUTPUT_LINES; format <= OUTPUT_BINARY; ++format) {
+        config.format = (OutputFormat)format;
+        char* expected = write_output(&in_memory, &config, &expected_size);
+        char* text = write_output(&spilled, &config, &spilled_size);
+        cr_expect(spilled_size==expected_size && memcmp(text, expected, expected_size)==0,
+                "Spilled stations should be sorted on disk into the output of an in-memory result in format %d.", format);
+        free(expected);
+        free(text);
+    }
+
+    config.format = OUTPUT_LINES;
+    char* expected = write_output(&in_memory, &config, &expected_size);
+    config.order = OUTPUT_SORT_NONE;
+    char* text = write_output(&spilled, &config, &spilled_size);
+    bool found = spilled_size == expected_size;
+    for (char* line = strchr(text, '\n') + 1; found && *line != '\0'; line = strchr(line, '\n') + 1) {
+        char* end = strchr(line, '\n');
+        *end = '\0';
+        found = strstr(expected, line) != NULL;
+        *end = '\n';
+    }
+    cr_expect(found && strncmp(text, "Lines of input file covered: 20000\nStations: 997\nS5=", 52)==0,
+            "Unsorted spilled stations should be streamed after the catalog ones.");
+    free(expected);
+    free(text);
+    aggregator_destroy(&in_memory);
+    aggregator_destroy(&spilled);
+    catalog_destroy(&catalog);
+    free(data);
+}
@@ -0,0 +1,131 @@
+#include "../src/sample.h"
+#include "../src/output.h"
+#include <criterion/criterion.h>
+#include <math.h>
+#include <stdio.h>
+
+// Rows of num_stations stations in turn, with pseudo-random temperatures
+// between -20.00 and 39.99
+static char* make_rows(size_t num_rows, size_t num_stations, size_t* size) {
+    char* data = (char*)malloc(num_rows * 24);
+    uint32_t state = 12345;
+    *size = 0;
+    for (size_t i = 0; i < num_rows; ++i) {
+        state = state * 1103515245u + 12345u;
+        int value = (int)((state >> 8) % 6000) - 2000;
+        *size += sprintf(data + *size, "S%zu;%s%d.%02d\n", i % num_stations,
+                         value < 0 ? "-": "", abs(value) / 100, abs(value) % 100);
+    }
+    return data;
+}
+
+Test(sample_tests, whole_input) {
+    size_t size;
+    char* data = make_rows(50000, 200, &size);
+    AnalyzerConfig config;
+    analyzerconfig_init(&config);
+    config.num_threads = 2;
+
+    Aggregator exact, sampled;
+    SampleSummary summary;
+    analyze_buffer(data, size, &config, &exact, NULL);
+    sample_buffer(data, size, 1.0, SAMPLE_DEFAULT_SEED, &config, &sampled, &summary);
+
+    cr_expect(sampled.rows==50000 && sampled.bytes==size && summary.estimated_rows==50000,
+            "Sampling all of the input should read every row once.");
+    cr_expect(summary.num_stations==200 && summary.singletons==0 && summary.estimated_stations==200.0,
+            "Sampling all of the input should see every station.");
+    char name[8];
+    for (size_t i = 0; i < 200; ++i) {
+        size_t length = sprintf(name, "S%zu", i);
+        StationStats* a = stats_table_find(&exact.table, name, length, station_hash(name, length));
+        StationStats* b = stats_table_find(&sampled.table, name, length, station_hash(name, length));
+        cr_expect(a!=NULL && b!=NULL && a->count==b->count && a->sum==b->sum && a->min==b->min && a->max==b->max
+                  && b->histogram!=NULL && b->histogram->count==b->count,
+                "Sampling all of the input should aggregate %s exactly.", name);
+    }
+    aggregator_destroy(&exact);
+    aggregator_destroy(&sampled);
+    free(data);
+}
+
+Test(sample_tests, estimates) {
+    size_t num_rows = 400000;
+    size_t size;
+    char* data = make_rows(num_rows, 50, &size);
+    AnalyzerConfig config;
+    analyzerconfig_init(&config);
+    config.num_threads = 3;
+
+    Aggregator exact, sampled;
+    SampleSummary summary;
+    analyze_buffer(data, size, &config, &exact, NULL);
+    sample_buffer(data, size, 0.1, SAMPLE_DEFAULT_SEED, &config, &sampled, &summary);
+
+    cr_expect(summary.num_blocks==SAMPLE_MIN_BLOCKS && summary.bytes <= size / 10 + SAMPLE_MIN_BLOCKS * 24
+              && summary.bytes >= size / 10 - SAMPLE_MIN_BLOCKS * 24,
+            "A sample should read the requested fraction in whole lines, not %lu of %zu bytes.",
+            (unsigned long)summary.bytes, size);
+    cr_expect(summary.estimated_rows > num_rows * 95 / 100 && summary.estimated_rows < num_rows * 105 / 100,
+            "The rows of the input should be extrapolated from the sample, not %lu.",
+            (unsigned long)summary.estimated_rows);
+    cr_expect(summary.num_stations==50 && summary.estimated_stations==50.0,
+            "Frequent stations should all be sampled.");
+
+    // Sampled extremes are within the true ones, and at 95% confidence
+    // nearly every true mean is within the interval of its estimate
+    size_t covered = 0;
+    char name[8];
+    for (size_t i = 0; i < 50; ++i) {
+        size_t length = sprintf(name, "S%zu", i);
+        StationStats* a = stats_table_find(&exact.table, name, length, station_hash(name, length));
+        StationStats* b = stats_table_find(&sampled.table, name, length, station_hash(name, length));
+        cr_assert(a!=NULL && b!=NULL,
+                "%s should be sampled.", name);
+        cr_expect(b->min >= a->min && b->max <= a->max,
+                "Sampled extremes of %s should lie within the true ones.", name);
+        double error = (double)b->sum / (double)b->count - (double)a->sum / (double)a->count;
+        double interval = SAMPLE_Z95 * sqrt(histogram_variance(b->histogram) / (double)b->count);
+        covered += fabs(error) <= interval;
+    }
+    cr_expect(covered >= 45,
+            "95%% confidence intervals should cover most true means, not %zu of 50.", covered);
+    aggregator_destroy(&exact);
+    aggregator_destroy(&sampled);
+    free(data);
+}
+
+Test(sample_tests, intervals) {
+    TemperatureHistogram histogram;
+    histogram_init(&histogram);
+    cr_expect(histogram_variance(&histogram)==0.0,
+            "An empty histogram should have no variance.");
+    histogram_add(&histogram, 100);
+    histogram_add(&histogram, 200);
+    histogram_add(&histogram, 300);
+    cr_expect(fabs(histogram_variance(&histogram) - 10000.0) < 1e-6,
+            "The variance should be that of the sample, not %f.", histogram_variance(&histogram));
+    histogram_destroy(&histogram);
+
+    const char* rows = "A;1.0\nA;2.0\nA;3.0\nB;5.0\n";
+    Aggregator aggregator;
+    aggregator_init(&aggregator, NULL);
+    aggregator.histograms = true;
+    aggregator_consume(&aggregator, rows, rows + strlen(rows), true);
+    OutputConfig config;
+    outputconfig_init(&config);
+    config.summary = false;
+    config.interval_z = SAMPLE_Z95;
+
+    // t with 2 degrees of freedom is 4.30, and 4.30 / sqrt(3) rounds up to 2.5
+    FILE* out = tmpfile();
+    cr_assert(output_write(&aggregator, &config, out));
+    char text[128] = {0};
+    rewind(out);
+    size_t length = fread(text, 1, sizeof(text) - 1, out);
+    text[length] = '\0';
+    fclose(out);
+    cr_expect(strcmp(text, "A=1.0/3.0/2.0\xc2\xb1" "2.5\nB=5.0/5.0/5.0\xc2\xb1?\n")==0,
+            "Means should be followed by their interval, or ? for a single measurement, not:\n%s", text);
+    aggregator_destroy(&aggregator);
+}
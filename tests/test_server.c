@@ -0,0 +1,61 @@
+#include "../src/server.h"
+#include <criterion/criterion.h>
+#include <stdio.h>
+#include <string.h>
+
+static const char* path = "test_server_measurements.txt";
+
+static void append(const char* text) {
+    FILE* file = fopen(path, "a");
+    fputs(text, file);
+    fclose(file);
+}
+
+/// Answer of the server to one request
+static char* request(AnalyzerServer* server, const char* line, char* answer, size_t size) {
+    char buffer[256];
+    strncpy(buffer, line, sizeof(buffer) - 1);
+    buffer[sizeof(buffer) - 1] = '\0';
+    FILE* out = tmpfile();
+    server_handle_request(server, buffer, out);
+    rewind(out);
+    size_t length = fread(answer, 1, size - 1, out);
+    answer[length] = '\0';
+    fclose(out);
+    return answer;
+}
+
+Test(server_tests, incremental_queries) {
+    remove(path);
+    append("Tokyo;12.3\nJakarta;-5.6\nTokyo;1");
+
+    AnalyzerConfig config;
+    analyzerconfig_init(&config);
+    config.num_threads = 2;
+    AnalyzerServer server;
+    server_init(&server, &config);
+    char answer[1024];
+
+    cr_expect(strcmp(request(&server, "STATION test_server_measurements.txt Tokyo", answer, sizeof(answer)),
+                     "Tokyo=12.3/12.3/12.3\nOK 2 1\n")==0,
+            "A trailing partial line should wait for its newline, not %s", answer);
+
+    append(".7\nLima;20.0\n");
+    cr_expect(strcmp(request(&server, "STATIONS test_server_measurements.txt Tokyo;Lima;Oslo", answer, sizeof(answer)),
+                     "Tokyo=1.7/12.3/7.0\nLima=20.0/20.0/20.0\nOK 4 2\n")==0,
+            "Lines appended to a file should be aggregated before answering, not %s", answer);
+    ServedFile* file = server_register(&server, path);
+    cr_expect(server.num_files==1 && file->consumed==strlen("Tokyo;12.3\nJakarta;-5.6\nTokyo;1.7\nLima;20.0\n"),
+            "A file should be registered once and consumed up to its last newline.");
+
+    cr_expect(strcmp(request(&server, "STATION test_server_measurements.txt Oslo", answer, sizeof(answer)),
+                     "ERROR unknown station 'Oslo'\n")==0,
+            "Unknown stations should be reported.");
+    cr_expect(strncmp(request(&server, "ALL missing_file.txt", answer, sizeof(answer)), "ERROR", 5)==0,
+            "Missing files should be reported.");
+    cr_expect(strncmp(request(&server, "DROP", answer, sizeof(answer)), "ERROR", 5)==0,
+            "Unknown commands should be reported.");
+
+    server_destroy(&server);
+    remove(path);
+}
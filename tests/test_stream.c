@@ -0,0 +1,130 @@
+#include "../src/pipe_writer.h"
+#include "../src/stream_input.h"
+#include "../src/run_stats.h"
+#include <criterion/criterion.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <unistd.h>
+
+typedef struct {
+    int fd;
+    char* data;
+    size_t size;
+} Transfer;
+
+static size_t format_line(char* line, size_t i) {
+    return (size_t)sprintf(line, "S%zu;%d.%d\n", i % 101, (int)(i % 50) - 25, (int)(i % 10));
+}
+
+// Read a pipe to its end, as the analyzer would
+static void* drain(void* arg) {
+    Transfer* sink = (Transfer*)arg;
+    size_t capacity = 1 << 20;
+    sink->data = (char*)malloc(capacity);
+    ssize_t n;
+    while ((n = read(sink->fd, sink->data + sink->size, capacity - sink->size)) > 0) {
+        sink->size += (size_t)n;
+        if (sink->size == capacity) {
+            capacity *= 2;
+            sink->data = (char*)realloc(sink->data, capacity);
+        }
+    }
+    return NULL;
+}
+
+// Write a buffer into a pipe and close it, as the generator would
+static void* fill(void* arg) {
+    Transfer* source = (Transfer*)arg;
+    for (size_t offset = 0; offset < source->size;) {
+        ssize_t n = write(source->fd, source->data + offset, source->size - offset);
+        if (n <= 0) break;
+        offset += (size_t)n;
+    }
+    close(source->fd);
+    return NULL;
+}
+
+static void write_lines(size_t num_rows, size_t rows_per_second, Transfer* sink) {
+    int fds[2];
+    cr_assert(pipe(fds)==0);
+    sink->fd = fds[0];
+    sink->data = NULL;
+    sink->size = 0;
+    pthread_t reader;
+    pthread_create(&reader, NULL, &drain, sink);
+
+    PipeWriter writer;
+    pipe_writer_init(&writer, fds[1], rows_per_second);
+    char line[32];
+    for (size_t i = 0; i < num_rows; ++i)
+        pipe_writer_append(&writer, line, format_line(line, i));
+    pipe_writer_finish(&writer);
+    close(fds[1]);
+    pthread_join(reader, NULL);
+    close(fds[0]);
+}
+
+Test(stream_tests, pipe_writer) {
+    // Enough rows for every buffer to be handed to the pipe and refilled
+    size_t num_rows = 1000000;
+    Transfer sink;
+    write_lines(num_rows, 0, &sink);
+
+    char line[32];
+    size_t offset = 0;
+    bool intact = true;
+    for (size_t i = 0; i < num_rows && intact; ++i) {
+        size_t length = format_line(line, i);
+        intact = offset + length <= sink.size && memcmp(sink.data + offset, line, length)==0;
+        offset += length;
+    }
+    cr_expect(intact && offset==sink.size,
+            "The reader should receive every line in order.");
+    free(sink.data);
+}
+
+Test(stream_tests, rows_per_second) {
+    double start = stats_now();
+    Transfer sink;
+    write_lines(300, 1000, &sink);
+    cr_expect(stats_now() - start > 0.25,
+            "Rows should not be released faster than the configured rate.");
+    free(sink.data);
+}
+
+Test(stream_tests, analyze_fd) {
+    size_t num_rows = 200000;
+    char* data = (char*)malloc(num_rows * 16);
+    size_t size = 0;
+    for (size_t i = 0; i < num_rows; ++i)
+        size += format_line(data + size, i);
+
+    AnalyzerConfig config;
+    analyzerconfig_init(&config);
+    config.num_threads = 3;
+    Aggregator mapped, streamed;
+    analyze_buffer(data, size, &config, &mapped, NULL);
+
+    int fds[2];
+    cr_assert(pipe(fds)==0);
+    Transfer source = {fds[1], data, size};
+    pthread_t writer;
+    pthread_create(&writer, NULL, &fill, &source);
+    analyze_fd(fds[0], &config, &streamed, NULL);
+    pthread_join(writer, NULL);
+    close(fds[0]);
+
+    cr_expect(streamed.rows==num_rows && aggregator_num_stations(&streamed)==101,
+            "Every line read from a pipe should be aggregated.");
+    char name[8];
+    for (size_t i = 0; i < 101; ++i) {
+        size_t length = (size_t)sprintf(name, "S%zu", i);
+        StationStats* a = stats_table_find(&mapped.table, name, length, station_hash(name, length));
+        StationStats* b = stats_table_find(&streamed.table, name, length, station_hash(name, length));
+        cr_expect(a!=NULL && b!=NULL && a->count==b->count && a->min==b->min && a->max==b->max && a->sum==b->sum,
+                "Streamed and mapped input should agree for %s.", name);
+    }
+    aggregator_destroy(&mapped);
+    aggregator_destroy(&streamed);
+    free(data);
+}
@@ -0,0 +1,74 @@
+#include "../src/trace.h"
+#include <criterion/criterion.h>
+#include <stdio.h>
+
+static const char* path = "test_trace.json";
+
+static void* traced_work(void* arg) {
+    uint64_t start = trace_begin();
+    __atomic_fetch_add((int*)arg, 1, __ATOMIC_RELAXED);
+    trace_end("inner", start);
+    return NULL;
+}
+
+static int destroyed = 0;
+
+static void traced_destroy(void* arg) {
+    (void)arg;
+    __atomic_fetch_add(&destroyed, 1, __ATOMIC_RELAXED);
+}
+
+static size_t count_spans(const char* text, const char* name) {
+    char pattern[64];
+    snprintf(pattern, sizeof(pattern), "{\"name\":\"%s\",\"ph\":\"X\"", name);
+    size_t n = 0;
+    for (const char* p = strstr(text, pattern); p != NULL; p = strstr(p + 1, pattern))
+        n++;
+    return n;
+}
+
+Test(trace_tests, timeline) {
+    cr_expect(trace_begin()==0,
+            "Nothing should be timed before tracing starts.");
+    trace_start(path, "test");
+
+    int runs = 0;
+    YATPool* pool;
+    yatpool_init(&pool, 2, 3);
+    for (size_t i = 0; i < 3; ++i) {
+        Task* task;
+        trace_task_init(&task, "task", &traced_work, &runs, &traced_destroy);
+        yatpool_put(pool, task);
+    }
+    yatpool_wait(pool);
+    yatpool_destroy(pool);
+    cr_expect(runs==3 && destroyed==3,
+            "Traced tasks should run and release their arguments once.");
+
+    // One more span than the ring holds drops only the oldest
+    for (size_t i = 0; i < TRACE_BUFFER_EVENTS + 1; ++i)
+        trace_end("main", trace_begin());
+    trace_dump();
+
+    FILE* file = fopen(path, "r");
+    cr_assert(file!=NULL, "The trace should be written.");
+    fseek(file, 0, SEEK_END);
+    size_t size = (size_t)ftell(file);
+    rewind(file);
+    char* text = (char*)malloc(size + 1);
+    text[fread(text, 1, size, file)] = '\0';
+    fclose(file);
+
+    cr_expect(strncmp(text, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[", 39)==0 && strstr(text, "\n]}\n")!=NULL,
+            "The trace should be one Chrome trace JSON object.");
+    cr_expect(count_spans(text, "task")==3 && count_spans(text, "inner")==3,
+            "Every task should be a span with its own spans inside.");
+    cr_expect(count_spans(text, "main")==TRACE_BUFFER_EVENTS,
+            "A full ring should keep its latest spans.");
+    cr_expect(strstr(text, "\"args\":{\"name\":\"test\"}")!=NULL,
+            "The process should be named.");
+    cr_expect(trace_begin()==0,
+            "Tracing should stop once the trace is written.");
+    free(text);
+    remove(path);
+}
@@ -0,0 +1,107 @@
+#include "../src/workload.h"
+#include <criterion/criterion.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+static StationCatalog source;
+
+static void workloadsetup(void) {
+    catalog_init(&source);
+    catalog_intern(&source, "Tokyo", 5, 35.6897);
+    catalog_intern(&source, "Jakarta", 7, -6.175);
+    catalog_intern(&source, "Delhi", 5, 28.61);
+}
+
+static void workloadteardown(void) {
+    catalog_destroy(&source);
+}
+
+TestSuite(workload_tests, .init=workloadsetup, .fini=workloadteardown);
+
+// Whether every name of the catalog from the given ID on has a length in [min, max]
+static bool names_within(const StationCatalog* catalog, uint32_t first, size_t min, size_t max) {
+    for (uint32_t id = first; id < catalog->num_stations; ++id) {
+        String name = catalog_name(catalog, id);
+        if ((size_t)name.length < min || (size_t)name.length > max)
+            return false;
+    }
+    return true;
+}
+
+Test(workload_tests, synthetic_names) {
+    WorkloadConfig config;
+    workloadconfig_init(&config);
+    config.synthetic_names = true;
+    config.num_stations = 500;
+    config.min_name_length = 2;
+    config.max_name_length = 4;
+    StationCatalog catalog;
+    workload_build_catalog(&source, &catalog, &config, 7);
+    cr_expect(catalog.num_stations == 500,
+            "The catalog should have as many distinct stations as requested.");
+    cr_expect(names_within(&catalog, 0, 2, 4),
+            "Synthetic names should have lengths within the requested range.");
+    catalog_destroy(&catalog);
+}
+
+Test(workload_tests, exhausted_name_lengths) {
+    WorkloadConfig config;
+    workloadconfig_init(&config);
+    config.synthetic_names = true;
+    config.num_stations = 36;
+    config.min_name_length = 1;
+    config.max_name_length = 1;
+    StationCatalog catalog;
+    workload_build_catalog(&source, &catalog, &config, 7);
+    cr_expect(catalog.num_stations == 36 && names_within(&catalog, 0, 1, 1),
+            "Every one-byte name should be used before any longer one.");
+    catalog_destroy(&catalog);
+
+    // The one-byte names run out long before the two-byte ones
+    config.num_stations = 100;
+    config.max_name_length = 2;
+    workload_build_catalog(&source, &catalog, &config, 7);
+    cr_expect(catalog.num_stations == 100 && names_within(&catalog, 0, 1, 2),
+            "A length whose names are used up should pass its draws on within the range.");
+    catalog_destroy(&catalog);
+}
+
+Test(workload_tests, extra_stations) {
+    WorkloadConfig config;
+    workloadconfig_init(&config);
+    config.num_stations = 50;
+    config.min_name_length = 10;
+    config.max_name_length = 12;
+    StationCatalog catalog;
+    workload_build_catalog(&source, &catalog, &config, 7);
+    String first = catalog_name(&catalog, 0);
+    cr_expect(catalog.num_stations == 50 && first.length == 5 && memcmp(first.data, "Tokyo", 5) == 0,
+            "The source stations should come first, followed by synthetic ones.");
+    cr_expect(names_within(&catalog, (uint32_t)source.num_stations, 10, 12),
+            "Only the synthetic names should be bound to the length range.");
+    catalog_destroy(&catalog);
+}
+
+Test(workload_tests, zipf_skew) {
+    size_t num_stations = 100;
+    double* uniform = workload_zipf_cdf(num_stations, 0.0);
+    cr_expect(uniform[0] > 0.0099 && uniform[0] < 0.0101 && uniform[num_stations - 1] == 1.0,
+            "An exponent of 0 should give every station the same probability.");
+    free(uniform);
+
+    double* cdf = workload_zipf_cdf(num_stations, 1.0);
+    size_t counts[100] = {0};
+    size_t num_draws = 100000;
+    for (size_t i = 0; i < num_draws; ++i)
+        counts[workload_sample_station(cdf, num_stations, ((double)i + 0.5) / (double)num_draws)]++;
+    cr_expect(counts[0] > 10 * counts[num_stations - 1] && counts[0] > counts[1] && counts[1] > counts[9],
+            "Lower ranks should be drawn more often under a Zipf law.");
+
+    // With exponent 1 station k is drawn 1/(k+1) times as often as station 0
+    double ratio = (double)counts[0] / (double)counts[3];
+    cr_expect(ratio > 3.9 && ratio < 4.1,
+            "Station 3 should be drawn a quarter as often as station 0, not %f.", 1.0 / ratio);
+    cr_expect(workload_sample_station(cdf, num_stations, 0.0) == 0 && workload_sample_station(cdf, num_stations, 1.0) == num_stations - 1,
+            "The ends of the unit interval should map to the first and last stations.");
+    free(cdf);
+}